@@ -16,7 +16,11 @@ struct netstack {
 };
 
 
-void netstack_init(struct netstack *inst);
+/*!
+ * Initialises the internals of the netstack
+ * @return 0 on success, negative if the netstack can't run
+ */
+int netstack_init(struct netstack *inst);
 
 void netstack_cleanup(struct netstack *inst);
 
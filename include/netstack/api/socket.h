@@ -120,6 +120,13 @@ extern ssize_t (*sys_sendto)(int, const void *, size_t, int,
 
 extern ssize_t (*sys_sendmsg)(int, const struct msghdr *, int);
 
+#ifdef _GNU_SOURCE
+extern int (*sys_recvmmsg)(int, struct mmsghdr *, unsigned int, int,
+                           struct timespec *);
+
+extern int (*sys_sendmmsg)(int, struct mmsghdr *, unsigned int, int);
+#endif
+
 
 /*
  * Standard I/O functions
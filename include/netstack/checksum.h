@@ -7,7 +7,85 @@
 #if _WORDSIZE == 32
 uint16_t in_csum(const void *ptr, size_t len, uint32_t initial);
 #else
+/*!
+ * Calculates the Internet checksum (RFC 1071) of len octets at ptr, adding
+ * initial into the sum. Resolves to the fastest implementation supported by
+ * the CPU when the library is loaded
+ * @return the one's complement of the folded 16-bit sum
+ */
 uint16_t in_csum(const void *ptr, size_t len, uint64_t initial);
+
+/*!
+ * Copies len octets from src to dest, calculating in_csum(src, len, initial)
+ * in the same pass. src and dest must not overlap
+ * @return the one's complement of the folded 16-bit sum
+ */
+uint16_t in_csum_copy(void *dest, const void *src, size_t len,
+                      uint64_t initial);
+
+/*
+ * Individual in_csum() and in_csum_copy() implementations. The scalar
+ * in_csum_ref() and in_csum_copy_ref() are the reference that every other
+ * implementation must match exactly
+ */
+uint16_t in_csum_ref(const void *ptr, size_t len, uint64_t initial);
+uint16_t in_csum_copy_ref(void *dest, const void *src, size_t len,
+                          uint64_t initial);
+#if defined(__x86_64__)
+uint16_t in_csum_sse2(const void *ptr, size_t len, uint64_t initial);
+uint16_t in_csum_avx2(const void *ptr, size_t len, uint64_t initial);
+uint16_t in_csum_copy_sse2(void *dest, const void *src, size_t len,
+                           uint64_t initial);
+uint16_t in_csum_copy_avx2(void *dest, const void *src, size_t len,
+                           uint64_t initial);
+#elif defined(__aarch64__)
+uint16_t in_csum_neon(const void *ptr, size_t len, uint64_t initial);
+uint16_t in_csum_copy_neon(void *dest, const void *src, size_t len,
+                           uint64_t initial);
 #endif
+#endif
+
+/*!
+ * Adds two folded 16-bit one's complement sums
+ */
+static inline uint16_t in_csum_add(uint16_t a, uint16_t b) {
+    uint32_t sum = (uint32_t) a + b;
+    return (uint16_t) (sum + (sum >> 16));
+}
+
+/*!
+ * Updates an Internet checksum for a 16-bit field in the summed data changing
+ * from old to new, without summing the data again (RFC 1624, eqn. 3)
+ * Both values must be in the same byte order as the data
+ * @return the updated checksum
+ */
+static inline uint16_t in_csum_update16(uint16_t csum, uint16_t old,
+                                        uint16_t new) {
+    return (uint16_t) ~in_csum_add(in_csum_add((uint16_t) ~csum,
+                                               (uint16_t) ~old), new);
+}
+
+/*!
+ * Updates an Internet checksum for a 32-bit field, aligned to 16 bits, in the
+ * summed data changing from old to new
+ * @return the updated checksum
+ */
+static inline uint16_t in_csum_update32(uint16_t csum, uint32_t old,
+                                        uint32_t new) {
+    uint16_t sum = (uint16_t) ~csum;
+    sum = in_csum_add(sum, (uint16_t) ~(old >> 16));
+    sum = in_csum_add(sum, (uint16_t) ~old);
+    sum = in_csum_add(sum, (uint16_t) (new >> 16));
+    sum = in_csum_add(sum, (uint16_t) new);
+    return (uint16_t) ~sum;
+}
+
+/*!
+ * Byte-swaps a folded 16-bit sum. The sum of data that starts at an odd
+ * offset must be swapped before it is added to the sum of the whole
+ */
+static inline uint16_t in_csum_swap(uint16_t sum) {
+    return (uint16_t) ((sum << 8) | (sum >> 8));
+}
 
 #endif //NETSTACK_CHECKSUM_H
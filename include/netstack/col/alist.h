@@ -17,7 +17,9 @@
         /* Size of one array element */ \
         size_t type_sz; \
         /* List access lock */ \
-        pthread_mutex_t lock
+        pthread_mutex_t lock; \
+        /* Caller-provided storage used before the list first expands */ \
+        void *fixed
 
 typedef struct alist {
     _ARRAYLIST_COMMON;
@@ -58,6 +60,21 @@ typedef struct alist {
  */
 int _alist_init(void *list, size_t type_sz, size_t init_sz);
 
+#define alist_init_fixed(list, storage, size) \
+        _alist_init_fixed((list), sizeof(*(list)->arr), (storage), (size))
+
+/*!
+ * Initialises an arraylist using fixed storage provided by the caller, such
+ * as an array embedded in the same structure as the list. The storage is
+ * used until the list overflows it, after which the list is moved to the heap
+ * @param type_sz size of one array element
+ * @param storage space for init_sz elements, which must outlive the list
+ * @param init_sz number of elements storage holds
+ * @return 0 on success, negative on error
+ */
+int _alist_init_fixed(void *list, size_t type_sz, void *storage,
+                      size_t init_sz);
+
 /*!
  * Doubles the size of an arraylist. Does NOT lock the list- this must be
  * done by the user (although this function should never really be used)
@@ -81,4 +98,10 @@ void alist_free(void *lst);
  */
 ssize_t alist_add(void *lst, void **newelem);
 
+/*!
+ * Performs the same operation as alist_add() without locking the list, for
+ * lists that are only accessed by one thread at a time
+ */
+ssize_t alist_add_unlocked(void *lst, void **newelem);
+
 #endif //NETSTACK_ALIST_H
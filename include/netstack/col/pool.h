@@ -0,0 +1,95 @@
+#ifndef NETSTACK_POOL_H
+#define NETSTACK_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/*
+ * Fixed-size object pool
+ *
+ * All objects are carved out of a single contiguous allocation made when the
+ * pool is initialised. Free objects are kept on a lock-free shared stack,
+ * indexed by object number and tagged to avoid ABA, fronted by a small
+ * per-thread cache so that the common case of a thread allocating and freeing
+ * its own objects touches no shared state at all.
+ *
+ * Threads move objects between their cache and the shared stack in batches
+ * of half the cache size. Objects cached by a thread are returned to the
+ * shared stack when the thread exits.
+ *
+ * When the pool is exhausted, or the requested size doesn't fit in an object,
+ * pool_get() falls back to malloc(3) and counts a miss. pool_put() tells the
+ * two apart by address, so callers never need to track where memory came from.
+ */
+
+#define POOL_CACHE_SIZE 32          /* Objects cached per-thread */
+#define POOL_ALIGN      64          /* Object alignment, in octets */
+#define POOL_EMPTY      UINT32_MAX  /* End of the free list */
+
+struct pool_cache;
+
+struct pool {
+    uint8_t *mem;               /* Contiguous object storage */
+    size_t obj_sz;              /* Size of each object, rounded to POOL_ALIGN */
+    uint32_t count;             /* Number of objects in the pool */
+
+    _Atomic uint64_t head;      /* Free stack, (tag << 32) | index */
+    _Atomic uint32_t *next;     /* Per-object free list links */
+
+    pthread_key_t key;          /* Per-thread struct pool_cache */
+    pthread_mutex_t lock;       /* Protects caches */
+    struct pool_cache *caches;  /* All thread caches for this pool */
+
+    // Statistics
+    atomic_size_t used;         /* Objects currently handed out */
+    atomic_size_t high_water;   /* Maximum value of used */
+    atomic_size_t misses;       /* Allocations that fell back to malloc(3) */
+};
+
+struct pool_stats {
+    size_t count;
+    size_t used;
+    size_t high_water;
+    size_t misses;
+};
+
+/*!
+ * Initialises a pool of count objects of obj_sz octets each
+ * @return 0 on success, negative on error
+ */
+int pool_init(struct pool *pool, size_t obj_sz, uint32_t count);
+
+/*!
+ * Releases all pool memory and zeroes the pool. No objects may be in use
+ */
+void pool_free(struct pool *pool);
+
+/*!
+ * Allocates an object of at least size octets from the pool, falling back to
+ * malloc(3) if size is larger than the object size or the pool is exhausted
+ * @return allocated memory, or NULL if malloc(3) failed
+ */
+void *pool_get(struct pool *pool, size_t size);
+
+/*!
+ * Releases memory returned by pool_get()
+ */
+void pool_put(struct pool *pool, void *obj);
+
+/*!
+ * Checks whether obj points into pool object storage
+ */
+static inline bool pool_contains(struct pool *pool, void *obj) {
+    return (uint8_t *) obj >= pool->mem &&
+           (uint8_t *) obj < pool->mem + (size_t) pool->count * pool->obj_sz;
+}
+
+/*!
+ * Takes a snapshot of pool usage statistics
+ */
+void pool_get_stats(struct pool *pool, struct pool_stats *stats);
+
+#endif //NETSTACK_POOL_H
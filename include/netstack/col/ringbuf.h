@@ -0,0 +1,66 @@
+#ifndef NETSTACK_RINGBUF_H
+#define NETSTACK_RINGBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A fixed-size byte ring. Data is written at the end and read from the start,
+ * so any read or write is at most two memcpy() calls, one either side of the
+ * point the ring wraps at
+ */
+typedef struct ringbuf {
+    void *buf;
+    size_t size;            // Capacity of buf in bytes
+    size_t start;           // Offset of the first unread byte in buf
+    size_t count;           // Number of unread bytes, starting from start
+} ringbuf_t;
+
+/*!
+ * Allocates a ring of size bytes
+ * @return 0 on success, -ENOMEM if buf could not be allocated
+ */
+int ringbuf_init(ringbuf_t *rb, size_t size);
+
+void ringbuf_free(ringbuf_t *rb);
+
+/*!
+ * Appends up to len bytes of src to the ring, as many as there is space for
+ * @return the number of bytes written
+ */
+long ringbuf_write(ringbuf_t *rb, const void *src, size_t len);
+
+/*!
+ * Copies up to len bytes of src into the space after the end of the ring,
+ * summing them in the same pass, without adding them to the ring. They are
+ * only added by a following ringbuf_commit(). Any write or read before then
+ * may lose them
+ * @param sum set to the folded 16-bit one's complement sum of the bytes
+ *            copied, for use as part of an Internet checksum
+ * @return the number of bytes copied
+ */
+long ringbuf_stage_csum(ringbuf_t *rb, const void *src, size_t len,
+                        uint16_t *sum);
+
+/*!
+ * Adds len bytes copied by ringbuf_stage_csum() to the end of the ring
+ */
+static inline void ringbuf_commit(ringbuf_t *rb, size_t len) {
+    rb->count += len;
+}
+
+/*!
+ * Removes up to len bytes from the start of the ring into dest
+ * @return the number of bytes read
+ */
+long ringbuf_read(ringbuf_t *rb, void *dest, size_t len);
+
+/*!
+ * Returns the number of bytes that can be written before the ring is full
+ */
+static inline size_t ringbuf_space(const ringbuf_t *rb) {
+    return rb->size - rb->count;
+}
+
+
+#endif //NETSTACK_RINGBUF_H
@@ -1,22 +1,25 @@
 #ifndef NETSTACK_SEQBUF_H
 #define NETSTACK_SEQBUF_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 
+/*
+ * A sequence-numbered byte ring. The ring's pages are mapped twice, back to
+ * back, so that any run of bytes in it can be read with one memcpy(),
+ * wherever it wraps. It grows when a write doesn't fit
+ */
 typedef struct seqbuf {
-    struct seqbuf_block *head, *tail;
-    size_t start;           // Sequence number of first byte in buffers->head
-    size_t count;           // Number of bytes in all buffers, starting from
-                            // start at the first byte of buffers->head
+    void *buf;              // Two adjacent views of the same size bytes
+    size_t size;            // Size of one view, a multiple of the page size
+    size_t head;            // Offset in buf of the byte at start
+    size_t start;           // Sequence number of the byte at buf + head
+    size_t count;           // Number of bytes in the ring, starting from start
     size_t limit;           // Wrapping point in the buffer
 } seqbuf_t;
 
-struct seqbuf_block {
-    struct seqbuf_block *next;
-    size_t len;
-    // Access the block payload with `block + 1`
-};
+#define SEQBUF_MIN_SIZE (64 * 1024)
 
 int seqbuf_init(seqbuf_t *buf, size_t start, size_t limit);
 
@@ -24,6 +27,15 @@ void seqbuf_free(seqbuf_t *buf);
 
 long seqbuf_read(seqbuf_t *buf, size_t from, void *dest, size_t len);
 
+/*!
+ * Reads from the buffer exactly as seqbuf_read(), summing the data in the
+ * same pass as it is copied
+ * @param sum set to the folded 16-bit one's complement sum of the data read,
+ *            for use as part of an Internet checksum
+ */
+long seqbuf_read_csum(seqbuf_t *buf, size_t from, void *dest, size_t len,
+                      uint16_t *sum);
+
 long seqbuf_write(seqbuf_t *buf, const void *src, size_t len);
 
 int seqbuf_consume(seqbuf_t *buf, size_t from, size_t len);
@@ -26,9 +26,28 @@ struct frame_layer {
 };
 ARRAYLIST_DEFINE(frame_stack, struct frame_layer);
 
+// Number of protocol layers stored inline in a frame before using the heap
+#define FRAME_LAYERS_INLINE 6
+
+// Number of frames in the shared frame pool, see frame_pool_init()
+#define FRAME_POOL_SIZE     4096
+
 
 /*
  * A frame is ALWAYS stored in network byte order
+ *
+ * Frame ownership:
+ *    A frame has a single owner at any one time, which is the only thread
+ *    that may modify it. Ownership is handed off along with a reference, by
+ *    passing the frame down the stack or through a queue (neighbour and
+ *    retransmission queues, interface transmit batches). Any number of
+ *    threads holding a reference may read a frame that no thread is
+ *    modifying, which is why the buffer is never modified after sending.
+ *
+ *    frame_lock() and frame_unlock() mark where ownership is taken and
+ *    released. They compile to nothing unless NETSTACK_DEBUG_FRAME is
+ *    defined, in which case they assert that no other thread is writing the
+ *    frame. The reference count is the only shared state a frame needs.
  */
 
 struct frame {
@@ -40,6 +59,7 @@ struct frame {
 
     struct timespec time;   /* Send/recv time for frame */
     frame_stack_t layer;    /* Arraylist of protocol layers in frame, ordered */
+    struct frame_layer layers[FRAME_LAYERS_INLINE]; /* Storage for layer */
     size_t buf_sz;
     uint8_t *buffer,        /* These pointers are for 'current use' only.
                                refer to proto[] for list of protocol ptrs */
@@ -47,8 +67,13 @@ struct frame {
             *data,          /* are a contiguous region of memory */
             *tail;
 
-    pthread_rwlock_t lock;
     atomic_uint refcount;
+
+    // Kept last so both builds agree on the layout of the fields above
+#ifdef NETSTACK_DEBUG_FRAME
+    atomic_uintptr_t owner; /* Thread currently writing the frame, or 0 */
+    atomic_uint readers;    /* Threads currently reading the frame */
+#endif
 };
 
 
@@ -81,13 +106,26 @@ struct frame {
 
 
 /*!
- * Initialises a new frame, allocating it using calloc(3)
+ * Creates the shared pool that frames are allocated from. Frames are
+ * allocated with calloc(3) until this is called, or if the pool is exhausted
+ * @return 0 on success, negative on error
+ */
+int frame_pool_init(void);
+
+/*!
+ * Logs the frame pool usage statistics and releases the frame pool. No frames
+ * may be in use
+ */
+void frame_pool_free(void);
+
+/*!
+ * Initialises a new frame, allocating it from the frame pool
  * @param intf      interface for recv'd packets (required) or for packets to
  *                  be sent (sometimes required)
  * @param buffer    allocated space for frame contents. Can be re-initialised
  *                  later with frame_init_buf() (optional)
  * @param buf_size  size of allocated buffer in octets (required with buffer)
- * @return          a new calloc(3)'ed frame, initialised
+ * @return          a new zeroed frame, initialised
  */
 struct frame *frame_init(struct intf *intf, void *buffer, size_t buf_size);
 
@@ -103,7 +141,7 @@ void frame_init_buf(struct frame *frame, void *buffer, size_t buf_size);
 /*!
  * Increases the reference count for a frame, preventing it from being
  * deallocated prematurely. To release the reference, call frame_decref()
- * Note: There is no requirement to hold frame->lock as this operation is atomic
+ * Note: There is no requirement to own the frame as this operation is atomic
  */
 #define frame_incref(frame) atomic_fetch_add(&(frame)->refcount, 1)
 
@@ -114,22 +152,21 @@ void frame_init_buf(struct frame *frame, void *buffer, size_t buf_size);
  *    When a frame is passed to any internal code, it can be assumed that any
  *    required references will be added. Any dangling frames will cause
  *    memory leaks!
- * Only releases the frame->lock if the frame is to be deallocated
- * Note: The shared frame->lock should be held before calling this
+ * Only releases frame ownership if the frame is to be deallocated
  * @param frame frame to dereference
  */
 uint frame_decref(struct frame *frame);
 
 /*!
  * Performs the same action as frame_decref() but
- * ALWAYS releases the frame->lock
+ * ALWAYS releases frame ownership
  */
 uint frame_decref_unlock(struct frame *frame);
 
 /*!
  * Clones a frame
  * A clone has:
- *    Its own lock
+ *    Its own owner, the calling thread
  *    Its own refcount
  *    No buffer, so that it cannot be free'd
  *    A copied frame-stack (independent from original frame)
@@ -137,18 +174,27 @@ uint frame_decref_unlock(struct frame *frame);
  */
 struct frame *frame_clone(struct frame *orig, enum shared_mode mode);
 
+#ifdef NETSTACK_DEBUG_FRAME
 /*!
- * Obtains the frame mutex lock to prevent simultaneous access
- * @param type  lock for reading or reading/writing
- * @return see pthread_mutex_lock(3P)
+ * Takes ownership of a frame, aborting if another thread is writing it, or
+ * if another thread is reading it and type is SHARED_RW
+ * @param type  ownership for reading or reading/writing
  */
-#define frame_lock(frame, type) shared_lock(&(frame)->lock, (type))
+#define frame_lock(frame, type) _frame_lock((frame), (type), __FILE__, __LINE__)
 
 /*!
- * Releases the frame mutex lock
- * @return see pthread_mutex_lock(3P)
+ * Releases ownership of a frame, aborting if another thread is writing it
  */
-#define frame_unlock(frame) shared_unlock(&(frame)->lock)
+#define frame_unlock(frame) _frame_unlock((frame), __FILE__, __LINE__)
+
+void _frame_lock(struct frame *frame, enum shared_mode mode,
+                 const char *file, int line);
+
+void _frame_unlock(struct frame *frame, const char *file, int line);
+#else
+#define frame_lock(frame, type) ((void) (frame), (void) (type))
+#define frame_unlock(frame) ((void) (frame))
+#endif
 
 /*!
  * Pushes a protocol into the frame protocol stack
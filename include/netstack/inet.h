@@ -2,6 +2,8 @@
 #define NETSTACK_INET_H
 
 #include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <netinet/in.h>
 #include <netstack/addr.h>
 #include <netstack/inet/ipv4.h>
@@ -16,8 +18,64 @@ struct inet_sock {
     struct intf *intf;      /* Interface is fixed per-socket as the address/port
                               pairs define the socket, and thus the interface */
     uint16_t flags;         /* Socket-level options */
+
+    // Socket table membership. See struct inet_socktbl
+    struct inet_sock *_Atomic hnext;    /* Next socket in the same bucket */
+    uint32_t hash;              /* Hash of the key the socket is tabled by */
+    uint8_t hashed;             /* Table the socket is in, INET_HASH_* */
+};
+
+#define INET_HASH_NONE      0   /* Not in a socket table */
+#define INET_HASH_ESTAB     1   /* Keyed on the address/port quad */
+#define INET_HASH_LISTEN    2   /* Keyed on the local address/port */
+
+/*
+ * Socket demultiplexing table
+ *
+ * Sockets with a remote endpoint are hashed on their full address/port quad
+ * and matched exactly. Sockets without one (listening sockets) are kept in a
+ * second table hashed on their local address and port, which is only
+ * searched when no exact match is found, first for the local address and
+ * then for the wildcard address (0.0.0.0 or equiv).
+ *
+ * Lookups take no locks and are only required to be inside an epoch
+ * read-side section (see netstack/lock/epoch.h). Writers serialise on the
+ * table lock, publish changes with release stores and defer freeing old
+ * bucket arrays, and sockets, until no reader can still see them.
+ *
+ * A socket that is moved whilst a reader is passing over it takes the reader
+ * to its new chain, so every chain ends in a marker holding its bucket index
+ * and a lookup that ends on the wrong one starts again. A lookup that
+ * overlaps a table being resized, which doubles or halves a table as its load
+ * factor passes 1 or 1/8, also starts again.
+ */
+#define INET_SOCKTBL_MIN    64  /* Minimum number of buckets per table */
+
+// Chain end marker for bucket idx
+#define inet_sock_nulls(idx)    ((struct inet_sock *) (((uintptr_t) (idx) << 1) | 1))
+#define inet_sock_is_nulls(ptr) (((uintptr_t) (ptr)) & 1)
+#define inet_sock_nulls_idx(ptr) ((uintptr_t) (ptr) >> 1)
+
+struct inet_sock_buckets {
+    size_t size;                /* Number of buckets, a power of two */
+    struct inet_sock *_Atomic head[];
+};
+
+struct inet_sock_hashtbl {
+    struct inet_sock_buckets *_Atomic buckets;
+    size_t count;               /* Number of sockets in the table */
 };
 
+struct inet_socktbl {
+    pthread_mutex_t lock;       /* Serialises writers */
+    atomic_uint seq;            /* Odd whilst a table is being resized */
+    uint32_t seed;              /* Random hash seed, chosen on first use */
+    struct inet_sock_hashtbl estab;
+    struct inet_sock_hashtbl listen;
+};
+
+#define INET_SOCKTBL_INITIALISER { .lock = PTHREAD_MUTEX_INITIALIZER }
+
 /*
     Pseudo-header for calculating TCP/UDP checksum
 
@@ -45,22 +103,48 @@ uint16_t inet_ipv4_csum(struct ipv4_hdr *hdr);
 
 /*!
  * Finds a matching socket, including listening and closed sockets.
- * Will return wildcard address sockets for any match (0.0.0.0 or equiv
- * addrs) if any are found (e.g. TCP_LISTEN should be source: 0.0.0.0:0)
+ * A socket whose address/port quad matches exactly is preferred, then a
+ * socket without a remote endpoint bound to locaddr:locport, and lastly one
+ * bound to the wildcard address (e.g. TCP_LISTEN on 0.0.0.0:port)
  *
  * Note: Some socket objects should be treated as immutable, such as those
  * with TCP_LISTEN and a new one inserted specific to the connection.
  *
  * Courtesy of @Steamlined: https://i.giphy.com/media/czwo5mMtaknhC/200.gif
  *
+ * Must be called inside an epoch read-side section. The socket returned is
+ * only guaranteed to exist until the section ends
+ *
  * @param remaddr remote address
  * @param locaddr local address
  * @param remport remote port
  * @param locport local port
  * @return a matching inet_sock object, or NULL if no matches found
  */
-struct inet_sock *inet_sock_lookup(llist_t *socks,
+struct inet_sock *inet_sock_lookup(struct inet_socktbl *tbl,
                                    addr_t *remaddr, addr_t *locaddr,
                                    uint16_t remport, uint16_t locport);
 
+/*!
+ * Adds a socket to a socket table, keyed on its current addresses and ports.
+ * A socket that is already in the table is moved, so this must be called
+ * again whenever they change.
+ * @return 0 on success, -EADDRINUSE if another socket has the same key or
+ *         -ENOMEM if the table could not be allocated
+ */
+int inet_sock_hash(struct inet_socktbl *tbl, struct inet_sock *sock);
+
+/*!
+ * Removes a socket from a socket table, if it is in it. Readers may still
+ * find the socket until the current epoch read-side sections end, so its
+ * memory must be released with epoch_defer()
+ */
+void inet_sock_unhash(struct inet_socktbl *tbl, struct inet_sock *sock);
+
+/*!
+ * Releases the memory held by a socket table. Sockets still in the table are
+ * not freed. There must be no concurrent readers
+ */
+void inet_socktbl_free(struct inet_socktbl *tbl);
+
 #endif //NETSTACK_INET_H
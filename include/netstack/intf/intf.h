@@ -10,15 +10,25 @@
 #include <netstack/addr.h>
 #include <netstack/frame.h>
 #include <netstack/col/llist.h>
+#include <netstack/col/pool.h>
 
 // Fix circular include issue
 struct frame;
 
 // Interface types
 #define INTF_RAWSOCK    0x01
-#define INTF_TPACKET    0x01
+#define INTF_TPACKET    0x02
 #define INTF_TAP        0x03
 #define INTF_TUN        0x04
+#define INTF_XDP        0x05
+
+// Maximum frames read per wakeup of the receive thread
+#define INTF_RECV_BATCH 32
+// Maximum frames queued per-thread for send_frames() in a transmit batch
+#define INTF_SEND_BATCH 32
+
+// Number of buffers in an interface frame buffer pool
+#define INTF_POOL_SIZE  1024
 
 // Interface thread ids
 #define INTF_THR_RECV   0x00
@@ -46,6 +56,9 @@ struct intf {
     // Outbound queue for packets to neighbouring hosts (see neigh.c)
     llist_t neigh_outqueue;
 
+    // Frame buffer pool used by intf_pool_buffer(), see intf_pool_init()
+    struct pool pool;
+
     // Interface send/recv thread ids
     pthread_t threads[INTF_THR_MAX];
 
@@ -57,10 +70,33 @@ struct intf {
 
     long (*send_frame)(struct frame *);
 
+    // Optional batched variant of recv_frame(). Blocks until at least one
+    // frame is read, then reads as many as are available, up to count.
+    /* Frames are passed in from intf_frame_new(). Frames without a buffer
+     * should be given one from new_buffer(). Frames that were read are
+     * populated with frame_init_buf(), others are left untouched for reuse.
+     * On cancellation the caller releases the frames. Returns the number of
+     * frames read or -1 on error */
+    long (*recv_frames)(struct intf *, struct frame **frames, size_t count);
+
+    // Optional batched variant of send_frame(). Frames dispatched whilst a
+    // transmit batch is open are queued and sent together with this
+    /* Returns the number of frames sent, or negative on error */
+    long (*send_frames)(struct intf *, struct frame **frames, size_t count);
+
+    // Pushes frames queued by send_frame() out of the interface. Interfaces
+    // that transmit immediately from send_frame() leave this NULL
+    long (*flush)(struct intf *);
+
     void *(*new_buffer)(struct intf *intf, size_t size);
 
     void (*free_buffer)(struct intf *intf, void *buffer);
 
+    // Moves a frame out of a buffer that must be returned to the interface
+    // promptly, such as a transmit ring slot. Frames that will be held before
+    // being sent are detached first. NULL if buffers can be held indefinitely
+    int (*detach_buffer)(struct frame *);
+
     // Cleans up an allocated interface data, excluding the interface struct
     // itself (may not have been dynamically allocated)
     void (*free)(struct intf *);
@@ -74,6 +110,39 @@ struct intf {
  */
 int intf_dispatch(struct frame *frame);
 
+/*!
+ * Starts a transmit batch on the calling thread. Frames dispatched to an
+ * interface with a flush() function are not flushed until the outermost
+ * batch is ended with intf_batch_end(). Batches can be nested
+ */
+void intf_batch_begin(void);
+
+/*!
+ * Ends a transmit batch, flushing all interfaces sent to during the batch
+ * once the outermost batch ends
+ */
+void intf_batch_end(void);
+
+/*!
+ * Flushes all interfaces sent to in the current batch, without ending it.
+ * Must be called before blocking whilst a batch is open, otherwise the
+ * frames that are waited upon may never be sent
+ */
+void intf_batch_flush(void);
+
+/*!
+ * Pushes any queued frames out of the interface
+ * @return 0 on success, negative on error
+ */
+int intf_flush(struct intf *intf);
+
+/*!
+ * Ensures the frame buffer can be held for an unbounded time before the frame
+ * is sent, by calling intf->detach_buffer() if required
+ * @return 0 on success, negative on error
+ */
+int intf_frame_detach(struct frame *frame);
+
 /*!
  *
  * @param intf
@@ -104,6 +173,30 @@ void *intf_malloc_buffer(struct intf *intf, size_t size);
  */
 void intf_free_buffer(struct intf *intf, void *buffer);
 
+/*!
+ * Creates the interface frame buffer pool, with INTF_POOL_SIZE buffers large
+ * enough to hold any frame on the interface. Must be called after intf->mtu
+ * is set
+ * @return 0 on success, negative on error
+ */
+int intf_pool_init(struct intf *intf);
+
+/*!
+ * Logs the pool usage statistics, then releases the interface buffer pool
+ */
+void intf_pool_free(struct intf *intf);
+
+/*!
+ * new_buffer() implementation handing out buffers from the interface pool.
+ * Falls back to malloc(3) if the pool is exhausted or size is too large
+ */
+void *intf_pool_buffer(struct intf *intf, size_t size);
+
+/*!
+ * free_buffer() implementation for buffers from intf_pool_buffer()
+ */
+void intf_pool_free_buffer(struct intf *intf, void *buffer);
+
 /*!
  * Calculates the maximum frame size for an interface
  */
@@ -6,6 +6,9 @@
 
 #include <netstack/intf/intf.h>
 
+// Maximum frames passed to a single recvmmsg(2)/sendmmsg(2) call
+#define RAWSOCK_BATCH   64
+
 struct intf_rawsock {
     int sock;
     int if_index;
@@ -19,4 +22,21 @@ long rawsock_recv_frame(struct frame *);
 
 long rawsock_send_frame(struct frame *);
 
+#ifdef _GNU_SOURCE
+/*!
+ * Reads up to count frames with a single recvmmsg(2) call, blocking until at
+ * least one is available. Truncated frames are dropped
+ * @return number of frames read, or -1 on error
+ */
+long rawsock_recv_frames(struct intf *intf, struct frame **frames,
+                         size_t count);
+
+/*!
+ * Sends count frames with as few sendmmsg(2) calls as possible
+ * @return number of frames sent, or negative on error
+ */
+long rawsock_send_frames(struct intf *intf, struct frame **frames,
+                         size_t count);
+#endif
+
 #endif //NETSTACK_RAWSOCK_H
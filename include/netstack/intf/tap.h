@@ -17,4 +17,17 @@ long tap_recv_frame(struct frame *frame) ;
 
 long tap_send_frame(struct frame *frame) ;
 
+/*!
+ * Reads every frame queued on the tap device, up to count, blocking until at
+ * least one is available
+ * @return number of frames read, or -1 on error
+ */
+long tap_recv_frames(struct intf *intf, struct frame **frames, size_t count);
+
+/*!
+ * Writes count frames to the tap device, carrying on past any that fail
+ * @return number of frames sent, or negative errno of the last failure
+ */
+long tap_send_frames(struct intf *intf, struct frame **frames, size_t count);
+
 #endif //NETSTACK_TAP_H
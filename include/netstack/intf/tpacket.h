@@ -0,0 +1,119 @@
+#ifndef NETSTACK_TPACKET_H
+#define NETSTACK_TPACKET_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <linux/if_packet.h>
+
+#include <netstack/intf/intf.h>
+#include <netstack/intf/rawsock.h>
+
+/*
+ * TPACKET_V3 memory-mapped packet socket interface
+ *
+ * Received frames are never copied: frame->buffer points directly into a
+ * PACKET_RX_RING block. Each block holds a reference for every frame that
+ * points into it, plus one for the reader whilst it is walking the block.
+ * The block is handed back to the kernel when the last reference is dropped,
+ * which happens in free_buffer() once the last frame_decref() is called.
+ *
+ * Frames that are held for a long time (e.g. queued on a socket) pin their
+ * block. The kernel fills blocks in order so a pinned block will eventually
+ * stall reception until it is released.
+ *
+ * Outgoing frames are built in place in PACKET_TX_RING slots handed out by
+ * new_buffer(). send_frame() only marks the slot ready and flush() kicks the
+ * kernel to transmit every ready slot with a single send(2). The kernel walks
+ * the TX ring strictly in order, so slots are handed out in ring order and a
+ * slot that is released without being sent is marked ready with no data,
+ * which the kernel discards (PACKET_LOSS). Frames that will be held before
+ * sending are copied out of the ring with detach_buffer().
+ */
+
+#define TPACKET_BLOCK_SIZE  (1 << 16)   /* Size of a ring block, in octets */
+#define TPACKET_BLOCK_NR    128         /* Number of blocks in the ring */
+#define TPACKET_FRAME_SIZE  2048        /* Nominal frame slot size */
+#define TPACKET_RETIRE_TOV  1           /* Block retire timeout, in ms */
+
+#define TPACKET_TX_BLOCK_SIZE   (1 << 16)
+#define TPACKET_TX_BLOCK_NR     32
+#define TPACKET_TX_FRAME_SIZE   2048    /* Size of a TX slot, inc. header */
+
+// Offset of frame data in a TX slot
+#define TPACKET_TX_DATA     TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+// TX slot ownership, from the perspective of the stack
+enum tpacket_slot {
+    TPACKET_SLOT_FREE,      /* Not owned by a frame */
+    TPACKET_SLOT_OWNED,     /* Owned by a frame, not yet sent */
+    TPACKET_SLOT_QUEUED     /* Owned by a frame and marked for sending */
+};
+
+struct tpacket_blk {
+    atomic_uint refs;       /* Frames (and the reader) using this block */
+    atomic_bool busy;       /* Block is owned by userspace */
+};
+
+struct intf_tpacket {
+    struct intf_rawsock raw;    /* Must be first, tpacket is a rawsock */
+    uint8_t *ring;              /* mmap(2)'ed ring */
+    size_t ring_sz;
+    struct tpacket_req3 req;
+    struct tpacket_blk *blk;    /* Per-block reference state */
+
+    uint8_t *tx_ring;           /* Mapped directly after the RX ring */
+    struct tpacket_req3 tx_req;
+    atomic_uchar *tx_state;     /* Per-slot ownership, see tpacket_slot */
+    atomic_uint tx_head;        /* Next slot to hand out */
+    atomic_uint tx_pending;     /* Slots marked ready since the last flush */
+
+    // Reader position, only accessed from the receive thread
+    uint32_t block;             /* Index of current block */
+    uint32_t remaining;         /* Packets left to read in current block */
+    struct tpacket3_hdr *next;  /* Next packet header in current block */
+};
+
+/*!
+ * Creates a new TPACKET_V3 interface, bound to the first non-loopback
+ * interface that is up
+ * @param interface interface to initialise
+ * @return 0 on success, negative on error
+ */
+int tpacket_new(struct intf *interface);
+
+void tpacket_free(struct intf *interface);
+
+long tpacket_recv_frame(struct frame *);
+
+/*!
+ * Marks the frame TX slot ready for sending. Frames not built in the ring are
+ * copied into a slot, or sent directly if the ring is full
+ */
+long tpacket_send_frame(struct frame *);
+
+/*!
+ * Requests the kernel to transmit all ready TX slots
+ */
+long tpacket_flush(struct intf *intf);
+
+/*!
+ * Hands out the next TX ring slot, falling back to the interface buffer pool
+ * if the slot is still in use or size doesn't fit in a slot
+ */
+void *tpacket_new_buffer(struct intf *intf, size_t size);
+
+/*!
+ * Releases a frame buffer. Buffers pointing into the RX ring drop a
+ * reference on their block, TX slots are released back to the ring and
+ * anything else is returned to the interface buffer pool
+ */
+void tpacket_free_buffer(struct intf *intf, void *buffer);
+
+/*!
+ * Copies a frame out of its TX slot into a pool buffer, releasing
+ * the slot so that it doesn't hold up the ring
+ */
+int tpacket_detach_buffer(struct frame *frame);
+
+#endif //NETSTACK_TPACKET_H
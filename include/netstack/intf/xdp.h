@@ -0,0 +1,103 @@
+#ifndef NETSTACK_XDP_H
+#define NETSTACK_XDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <netstack/intf/intf.h>
+
+/*
+ * AF_XDP socket interface
+ *
+ * Frames live in a UMEM region shared with the kernel, split into fixed-size
+ * chunks. new_buffer()/free_buffer() hand out and release whole chunks, and
+ * received frames point straight into the chunk the kernel filled, so frames
+ * are never copied between the kernel and the stack.
+ *
+ * A small XDP program redirecting every packet on the queue to the socket is
+ * attached in generic (skb) mode and the socket is bound in copy mode, so any
+ * interface works without driver support, including veth pairs. Note that the
+ * kernel network stack no longer sees packets arriving on the interface.
+ *
+ * Each chunk is reference counted: one reference for the frame that owns it
+ * and one whilst the kernel is transmitting it. The chunk goes back to the
+ * free list when both are released.
+ */
+
+#define XDP_NUM_CHUNKS      4096        /* Number of chunks in the UMEM */
+#define XDP_CHUNK_SIZE      2048        /* Size of a UMEM chunk */
+#define XDP_RING_SIZE       2048        /* Size of each of the 4 rings */
+#define XDP_QUEUE_ID        0           /* Interface queue to bind to */
+
+struct xdp_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *desc;
+    uint32_t mask;
+    void *map;
+    size_t map_sz;
+};
+
+struct intf_xdp {
+    int sock;
+    int if_index;
+    int map_fd;                 /* XSKMAP the program redirects into */
+    int prog_fd;
+    int link_fd;                /* Attachment of the program to the intf */
+
+    uint8_t *umem;
+    size_t umem_sz;
+    atomic_uchar *refs;         /* Per-chunk reference counts */
+
+    // Free chunks available for the fill ring and for transmission
+    pthread_mutex_t free_lock;
+    uint64_t *free;
+    size_t free_count;
+
+    struct xdp_ring fill;       /* Only accessed from the receive thread */
+    struct xdp_ring rx;         /* Only accessed from the receive thread */
+    struct xdp_ring tx;
+    struct xdp_ring comp;
+    pthread_mutex_t tx_lock;    /* Protects the tx and completion rings */
+    atomic_uint tx_pending;     /* Descriptors queued since the last flush */
+};
+
+/*!
+ * Creates a new AF_XDP interface, bound to queue XDP_QUEUE_ID of the first
+ * non-loopback interface that is up
+ * @param interface interface to initialise
+ * @return 0 on success, negative on error
+ */
+int xdp_new(struct intf *interface);
+
+void xdp_free(struct intf *interface);
+
+long xdp_recv_frame(struct frame *);
+
+/*!
+ * Queues the frame chunk on the TX ring. Frames built outside of the UMEM are
+ * copied into a chunk first
+ */
+long xdp_send_frame(struct frame *);
+
+/*!
+ * Kicks the kernel to transmit queued descriptors and reclaims completed
+ * chunks
+ */
+long xdp_flush(struct intf *intf);
+
+/*!
+ * Hands out a free UMEM chunk, falling back to malloc(3) if size doesn't fit
+ * in a chunk or none are free
+ */
+void *xdp_new_buffer(struct intf *intf, size_t size);
+
+/*!
+ * Releases a frame buffer. Chunks are released back to the UMEM and anything
+ * else is free(3)'d
+ */
+void xdp_free_buffer(struct intf *intf, void *buffer);
+
+#endif //NETSTACK_XDP_H
@@ -0,0 +1,86 @@
+#ifndef NETSTACK_EPOCH_H
+#define NETSTACK_EPOCH_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Epoch-based reclamation
+ *
+ * Lets readers traverse shared structures without taking any locks. A reader
+ * brackets its accesses with epoch_enter() and epoch_exit(), which only
+ * publish the global epoch it observed in a per-thread record. Writers unlink
+ * objects as usual and hand them to epoch_defer() rather than freeing them.
+ *
+ * The global epoch only advances once every thread inside a read-side
+ * section has observed the current one, so an object retired in epoch e can
+ * no longer be reachable by any reader once the epoch reaches e + 2, and is
+ * then released. Deferred objects are reclaimed by later epoch_defer() calls,
+ * or all at once by epoch_barrier().
+ *
+ * Read-side sections may nest, but must not block for long: a reader that
+ * stays inside a section stops all reclamation until it leaves.
+ */
+
+#define EPOCH_INACTIVE  0   /* epoch_thread.local outside read-side sections */
+
+struct epoch_thread {
+    _Atomic uint64_t local;     /* (epoch << 1) | 1 whilst reading */
+    unsigned int nest;          /* Depth of nested read-side sections */
+    struct epoch_thread *next;
+};
+
+extern _Atomic uint64_t epoch_global;
+extern __thread struct epoch_thread *epoch_self;
+
+/*!
+ * Allocates and registers the calling thread's epoch record. Called on first
+ * use of epoch_enter() by each thread
+ * @return the record, or aborts if it cannot be allocated
+ */
+struct epoch_thread *epoch_register(void);
+
+/*!
+ * Enters a read-side section. Objects found until the matching epoch_exit()
+ * will not be released by epoch_defer()
+ */
+static inline void epoch_enter(void) {
+    struct epoch_thread *self = epoch_self;
+    if (self == NULL)
+        self = epoch_register();
+
+    if (self->nest++ == 0) {
+        uint64_t epoch = atomic_load_explicit(&epoch_global,
+                                              memory_order_relaxed);
+        atomic_store_explicit(&self->local, (epoch << 1) | 1,
+                              memory_order_relaxed);
+        // Publish the epoch before any shared pointer is read
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+/*!
+ * Leaves a read-side section. Objects found inside it must not be used after
+ * this unless a reference was taken
+ */
+static inline void epoch_exit(void) {
+    struct epoch_thread *self = epoch_self;
+    if (--self->nest == 0)
+        atomic_store_explicit(&self->local, EPOCH_INACTIVE,
+                              memory_order_release);
+}
+
+/*!
+ * Calls fn(arg) once no read-side section that may have found arg remains.
+ * arg must already be unreachable to new readers. May call deferred functions
+ * that have become safe to run before returning
+ */
+void epoch_defer(void (*fn)(void *), void *arg);
+
+/*!
+ * Waits until every function passed to epoch_defer() so far has been called.
+ * Must not be called inside a read-side section
+ */
+void epoch_barrier(void);
+
+#endif //NETSTACK_EPOCH_H
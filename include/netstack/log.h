@@ -6,12 +6,15 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <time.h>
+#include <stdatomic.h>
 
 #include <netstack/col/llist.h>
 
 #define LOG_TRANS_INIT_BUFFER   64      /* Initial log_trans buffer size */
 // TODO: Make LOG_MAX configurable
 #define LOG_MAX                 1024    /* Maximum log entry length */
+#define LOG_RING_SIZE           512     /* Entries buffered per thread when
+                                           logging asynchronously */
 
 #ifndef NETSTACK_LOG_UNIT
     #define LOG_UNIT ""
@@ -21,6 +24,8 @@
 
 typedef uint8_t loglvl_t;
 
+struct log_async;
+
 /* 2^n where n is size of loglvl_t, times 8 bits per byte */
 #define loglvl_max (1 << (sizeof(loglvl_t) * 8)) /* Max amount of log levels */
 
@@ -29,6 +34,10 @@ struct log_config {
     char *lvlstr[loglvl_max];   /* String representations of log levels */
     char *lvlcol[loglvl_max];   /* String representations of log levels */
     pthread_mutex_t lock;
+    /* Levels written by at least one stream, cached by log_update() */
+    _Atomic uint64_t enabled[loglvl_max / 64];
+    /* Asynchronous writer, or NULL to write entries synchronously */
+    struct log_async *_Atomic async;
 };
 
 struct log_stream {
@@ -55,6 +64,25 @@ struct pkt_log {
  */
 extern struct log_config logconf;
 
+/*!
+ * Checks if any stream in logconf accepts entries of level lvl
+ * Use this to avoid the cost of building log entries nobody will see
+ */
+static inline bool log_enabled(loglvl_t lvl) {
+    return (atomic_load_explicit(&logconf.enabled[lvl / 64],
+                                 memory_order_relaxed) >> (lvl % 64)) & 1;
+}
+
+/*!
+ * Checks if packet logs of level lvl should be produced. Always false when
+ * built with NETSTACK_NO_PKTLOG, so packet logging is compiled out entirely
+ */
+#ifdef NETSTACK_NO_PKTLOG
+#define pkt_log_enabled(lvl) ((void) (lvl), false)
+#else
+#define pkt_log_enabled(lvl) log_enabled(lvl)
+#endif
+
 
 /*
  * Default log levels
@@ -115,6 +143,39 @@ extern struct log_config logconf;
  */
 void log_default(struct log_config *conf);
 
+/*!
+ * Adds a stream accepting log levels from min to max (inclusive)
+ * @return 0 on success, -ENOMEM if the stream could not be allocated
+ */
+int log_add_stream(struct log_config *conf, FILE *file, loglvl_t min,
+                   loglvl_t max);
+
+/*!
+ * Recalculates the enabled log levels from conf->streams
+ * Must be called after modifying conf->streams directly
+ */
+void log_update(struct log_config *conf);
+
+/*!
+ * Starts writing log entries asynchronously
+ *
+ * Instead of writing to the streams directly, each thread formats entries
+ * into its own single-producer ring of LOG_RING_SIZE entries which is drained
+ * by a dedicated writer thread, merging entries from all rings in timestamp
+ * order. Logging never blocks on a slow stream: entries are dropped and
+ * counted when a thread's ring is full, and the writer reports how many were
+ * lost. LCRIT entries are always written synchronously as they usually
+ * precede abort(3)
+ * @return 0 on success, negative on error
+ */
+int log_async_start(struct log_config *conf);
+
+/*!
+ * Writes out all buffered entries and stops the writer thread. Subsequent
+ * entries are written synchronously. Other threads must not be logging
+ */
+void log_async_stop(struct log_config *conf);
+
 /*!
  * Generate log entry
  */
@@ -141,8 +202,9 @@ void VTLOG(loglvl_t level, struct timespec *t, const char *fmt, va_list args)
  *            func -> thread_start
  */
 #define LOG(lvl, fmt, ...) \
-    _LOG((lvl), "%s" fmt ": %s:%u<%s>", LOG_UNIT, ##__VA_ARGS__, \
-            __FILE__, __LINE__, __func__)
+    (log_enabled(lvl) ? \
+        _LOG((lvl), "%s" fmt ": %s:%u<%s>", LOG_UNIT, ##__VA_ARGS__, \
+            __FILE__, __LINE__, __func__) : (void) 0)
 
 /*!
  * Equivalent of perror(3)
@@ -1,9 +1,58 @@
 #ifndef NETSTACK_TCPOPT_H
 #define NETSTACK_TCPOPT_H
 
+#include <stdint.h>
+#include <stdbool.h>
 
+
+#define TCP_OPT_EOL         0x00
+#define TCP_OPT_NOP         0x01
 #define TCP_OPT_MSS         0x02
 #define TCP_OPT_MSS_LEN     0x04
+#define TCP_OPT_WSCALE      0x03    /* RFC 7323 */
+#define TCP_OPT_WSCALE_LEN  0x03
+#define TCP_OPT_SACK_PERM   0x04    /* RFC 2018 */
+#define TCP_OPT_SACK_PERM_LEN 0x02
+#define TCP_OPT_SACK        0x05
+#define TCP_OPT_SACK_LEN(n) (2 + 8 * (n))
+#define TCP_OPT_TS          0x08    /* RFC 7323 */
+#define TCP_OPT_TS_LEN      0x0A
+
+// Most SACK blocks that fit in the option space
+#define TCP_SACK_MAX_BLOCKS 4
+
+struct tcp_hdr;
+struct intf;
+
+// A block of sequence space received out-of-order, end is exclusive
+struct tcp_sack_block {
+    uint32_t start, end;
+};
+
+// Options parsed from an incoming segment
+struct tcp_opts {
+    uint16_t mss;               // 0 if the option wasn't present
+    bool wscale_ok;             // Window scale was sent, only valid in a SYN
+    uint8_t wscale;             // The shift it gives, at most 14
+    bool ts_ok;                 // Timestamps were sent
+    uint32_t tsval, tsecr;      // Only valid if ts_ok, in host byte order
+    bool sack_ok;               // SACK-permitted, only valid in a SYN
+    uint8_t sacks;              // Number of SACK blocks in sack
+    struct tcp_sack_block sack[TCP_SACK_MAX_BLOCKS];    // In host byte order
+};
+
+/*!
+ * Parses the options of a TCP header that has already been length-checked.
+ * Malformed options end the parse, leaving the options found before them
+ */
+void tcp_parse_opts(struct tcp_hdr *hdr, struct tcp_opts *opts);
+
+/*!
+ * Chooses the MSS for outgoing segments from the options of a SYN. Without
+ * an MSS option the RFC 879 default is used. Either is limited to what intf
+ * can carry, if intf is given
+ */
+uint16_t tcp_syn_mss(struct tcp_opts *opts, struct intf *intf);
 
 
 #endif //NETSTACK_TCPOPT_H
@@ -0,0 +1,91 @@
+#ifndef NETSTACK_TCP_REASSEMBLY_H
+#define NETSTACK_TCP_REASSEMBLY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <netstack/frame.h>
+#include <netstack/tcp/option.h>
+
+/*
+ * Out-of-order segment reassembly
+ *
+ * Segments that arrive ahead of RCV.NXT are held in runs: ranges of
+ * contiguous sequence space, each with the segments that cover it. Runs are
+ * kept in a skip list ordered by their first sequence number, so finding
+ * where a segment goes takes O(log n) in the number of runs, while handing
+ * the next run over once RCV.NXT reaches it is O(1).
+ *
+ * A segment is merged into any run it overlaps or adjoins, and runs it joins
+ * together are merged into one. Segments that bring no new octets, either on
+ * arrival or because a later segment covers them, are dropped.
+ */
+
+#define TCP_REASS_LEVELS    12  /* Skip list levels, enough for ~16M runs */
+
+struct tcp_reass_seg {
+    struct tcp_reass_seg *next;
+    struct frame *frame;
+    uint32_t seq;               // Sequence number of the first octet of text
+    uint16_t len;               // Octets of segment text in frame
+};
+
+/*
+ * Each segment starts at or before the end of those in front of it, so the
+ * segments can be read in order without gaps, skipping octets already read
+ */
+struct tcp_reass_run {
+    uint32_t seq, end;          // Sequence space covered, end is exclusive
+    size_t held;                // Octets of text in the segments, with overlap
+    struct tcp_reass_seg *head, *tail;
+    uint8_t height;
+    struct tcp_reass_run *next[];
+};
+
+struct tcp_reass {
+    struct tcp_reass_run *head[TCP_REASS_LEVELS];
+    uint8_t height;             // Highest level in use
+    uint32_t rand;              // xorshift32 state for run heights
+    size_t runs;
+    size_t held;                // Octets of text held in all runs
+};
+
+/*!
+ * Initialises an empty reassembly queue
+ */
+void tcp_reass_init(struct tcp_reass *q);
+
+/*!
+ * Queues the text of an out-of-order segment, taking over the caller's
+ * reference to frame. If the segment brings no new octets, the reference is
+ * dropped instead
+ * @param seq sequence number of the first octet of text
+ * @param len length of the text, which must be > 0
+ * @return 0 on success, -ENOMEM if the segment could not be queued, in which
+ *         case the caller keeps its reference
+ */
+int tcp_reass_insert(struct tcp_reass *q, struct frame *frame, uint32_t seq,
+                     uint16_t len);
+
+/*!
+ * Removes the first run if it starts at or before nxt
+ * @return the segments of the run, or NULL if there is no such run. The
+ *         caller owns the segments, their frames and must free() them
+ */
+struct tcp_reass_seg *tcp_reass_pop(struct tcp_reass *q, uint32_t nxt);
+
+/*!
+ * Describes the runs held as SACK blocks (RFC 2018), starting with the run
+ * that holds the sequence number 'recent', then the others in order
+ * @param recent first sequence number of the latest segment queued
+ * @return the number of blocks written, at most max
+ */
+size_t tcp_reass_sack(struct tcp_reass *q, uint32_t recent,
+                      struct tcp_sack_block *blocks, size_t max);
+
+/*!
+ * Drops every queued segment
+ */
+void tcp_reass_free(struct tcp_reass *q);
+
+#endif //NETSTACK_TCP_REASSEMBLY_H
@@ -10,24 +10,58 @@ struct tcp_seq_data {
     uint32_t seq;
     uint16_t len;
     uint8_t flags;
+    uint16_t csum;              // Folded one's complement sum of the payload
+    bool sacked;                // Held by the peer, but not yet acknowledged
+    bool rexmit;                // Retransmitted as a hole since the last RTO
+    bool retransmitted;         // Ever retransmitted, so not timed for the rtt
     struct timespec when;       // A CLOCK_MONOTONIC timestamp when when the
 };                              // segment was transmitted
 
-struct tcp_rto_data {
-    struct tcp_sock *sock;
-    uint32_t seq;
-    uint16_t len;
-    uint8_t flags;
-};
+/*!
+ * Arms the retransmission timer to expire in ns nanoseconds. An armed timer
+ * holds a reference to the socket, which is passed to the expiry callback
+ */
+void tcp_arm_rto(struct tcp_sock *sock, uint64_t ns);
+
+/*!
+ * Disarms the retransmission timer, dropping the reference it held
+ */
+void tcp_stop_rto(struct tcp_sock *sock);
 
-void tcp_syn_retransmission_timeout(void *arg);
+void tcp_rto_expire(void *arg);
+
+void tcp_syn_retransmission_timeout(struct tcp_sock *sock);
 
 void tcp_start_rto(struct tcp_sock *sock, uint16_t count, uint8_t flags);
 
-void tcp_retransmission_timeout(void *arg);
+void tcp_retransmission_timeout(struct tcp_sock *sock);
 
-void tcp_update_rtq(struct tcp_sock *sock);
+/*!
+ * Drops the segments SND.UNA has passed from the retransmission queue, and
+ * updates the RTO from the round-trip time of the latest of them
+ * @param has_ts true if the ACK carries a timestamp that tsecr holds
+ * @param tsecr  TSecr of the ACK. The round-trip time is taken from it when
+ *               no segment acknowledged can be timed without ambiguity, as
+ *               after a retransmission
+ */
+void tcp_update_rtq(struct tcp_sock *sock, bool has_ts, uint32_t tsecr);
 
 void tcp_update_rtt(struct tcp_sock *sock, struct tcp_seq_data *pData);
 
+/*!
+ * Updates the RTO from the timestamp echoed in an ACK (RFC 7323, section 4)
+ */
+void tcp_update_rtt_ts(struct tcp_sock *sock, uint32_t tsecr);
+
+/*!
+ * Marks the segments on the retransmission queue that the SACK blocks of an
+ * incoming ACK cover, once SND.UNA has been updated for it. Once a loss is
+ * seen, the holes the scoreboard shows below the highest SACKed segment are
+ * retransmitted, each once per recovery (RFC 6675). The socket lock must be
+ * held
+ * @param dupack the ACK is a duplicate as defined by RFC 5681
+ */
+void tcp_sack_update(struct tcp_sock *sock, struct tcp_sack_block *blocks,
+                     uint8_t count, bool dupack);
+
 #endif //NETSTACK_TCP_RETRANSMISSION_H
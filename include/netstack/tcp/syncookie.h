@@ -0,0 +1,54 @@
+#ifndef NETSTACK_TCP_SYNCOOKIE_H
+#define NETSTACK_TCP_SYNCOOKIE_H
+
+#include <stdint.h>
+
+#include <netstack/inet.h>
+
+/*
+ * SYN cookies (RFC 4987, section 3.6)
+ *
+ * Once a listener's SYN queue is full, SYNs are answered without keeping any
+ * state for them. Instead, the ISS of the SYN/ACK encodes what is needed to
+ * create the connection when the peer's ACK returns it:
+ *
+ *     31    27 26  24 23                                      0
+ *    +--------+------+-----------------------------------------+
+ *    | count  | mss  |   SipHash-2-4(quad, SEG.SEQ, count)     |
+ *    +--------+------+-----------------------------------------+
+ *
+ * count is a clock that ticks every TCP_COOKIE_PERIOD seconds, of which the
+ * cookie only carries the low bits, and mss indexes a table of common MSS
+ * values. The hash is keyed with a secret chosen on first use, and covers the
+ * address/port quad, the peer's ISN and the whole count, so cookies can
+ * neither be forged nor replayed once they have expired.
+ */
+
+#define TCP_SYNCOOKIES_OFF      0   /* Drop SYNs whilst the SYN queue is full */
+#define TCP_SYNCOOKIES_ON       1   /* Send cookies whilst the SYN queue is full */
+#define TCP_SYNCOOKIES_ALWAYS   2   /* Send cookies for every SYN */
+
+#define TCP_COOKIE_PERIOD       64  /* Seconds per tick of the cookie count */
+#define TCP_COOKIE_MAXAGE       2   /* Ticks for which a cookie is accepted */
+
+// When listeners answer SYNs with cookies, one of TCP_SYNCOOKIES_*
+extern int tcp_syncookies;
+
+/*!
+ * Creates the ISS for a SYN/ACK sent without a connection
+ * @param inet addresses and ports of the connection, from the listener's side
+ * @param seq SEG.SEQ of the SYN
+ * @param mss the peer's MSS, which is rounded down to one the cookie can hold
+ */
+uint32_t tcp_syncookie_make(struct inet_sock *inet, uint32_t seq, uint16_t mss);
+
+/*!
+ * Checks the cookie returned in the ACK of a handshake
+ * @param seq SEG.SEQ of the SYN, one less than that of the ACK
+ * @param cookie the ISS of the SYN/ACK, one less than SEG.ACK of the ACK
+ * @return the MSS encoded in the cookie, or -EINVAL if the cookie is invalid
+ *         or has expired
+ */
+int tcp_syncookie_check(struct inet_sock *inet, uint32_t seq, uint32_t cookie);
+
+#endif //NETSTACK_TCP_SYNCOOKIE_H
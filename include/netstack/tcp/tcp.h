@@ -11,12 +11,19 @@
 #include <netstack/intf/intf.h>
 #include <netstack/col/llist.h>
 #include <netstack/col/seqbuf.h>
-#include <netstack/time/timer.h>
-#include <netstack/time/contimer.h>
+#include <netstack/col/ringbuf.h>
+#include <netstack/tcp/reassembly.h>
+#include <netstack/time/util.h>
+#include <netstack/time/wheel.h>
 #include <netstack/lock/retlock.h>
+#include <netstack/lock/epoch.h>
 
 // Global TCP states list
 extern llist_t tcp_sockets;
+// Lookup table for incoming segments, keyed on each socket's address/port quad
+extern struct inet_socktbl tcp_socktbl;
+// Runs the retransmission and TIME-WAIT timers of every socket
+extern struct wheel tcp_wheel;
 
 /*
     Source: https://tools.ietf.org/html/rfc793#page-15
@@ -95,16 +102,18 @@ struct tcb {
     struct tcb_snd {
         uint32_t una;   // send unacknowledged
         uint32_t nxt;   // send next
-        uint16_t wnd;   // send window (what it is: https://tools.ietf.org/html/rfc793#page-20)
+        uint32_t wnd;   // send window (what it is: https://tools.ietf.org/html/rfc793#page-20)
         uint16_t up;    // send urgent pointer
+        uint8_t wscale; // shift of windows received, Snd.Wind.Shift (RFC 7323)
         uint32_t wl1;   // segment sequence number used for last window update
         uint32_t wl2;   // segment acknowledgment number used for last window update
     } snd;
     // Receive Sequence Variables
     struct tcb_rcv {
         uint32_t nxt;   // receive next
-        uint16_t wnd;   // receive window
+        uint32_t wnd;   // receive window
         uint16_t up;    // receive urgent pointer
+        uint8_t wscale; // shift of windows sent, Rcv.Wind.Shift (RFC 7323)
     } rcv;
 };
 
@@ -119,7 +128,7 @@ struct tcb {
 #define TCP_CLOSED          TCP_CLOSE
 
 
-static const char *tcp_strstate(tcp_state_t state) {
+static inline const char *tcp_strstate(tcp_state_t state) {
     switch (state) {
         case TCP_LISTEN:        return "LISTEN";
         case TCP_SYN_SENT:      return "SYN-SENT";
@@ -136,9 +145,37 @@ static const char *tcp_strstate(tcp_state_t state) {
     }
 }
 
+/*
+ * A FIFO of connections linked through their qnext fields, so that any
+ * connection can be removed from the queue it is in in O(1)
+ */
+struct tcp_queue {
+    struct tcp_sock *head, **tail;
+    size_t length;
+};
+
+#define TCP_QUEUE_INIT(q) { .head = NULL, .tail = &(q).head, .length = 0 }
+
+/*
+ * Incoming connections are half-open in synqueue until the handshake
+ * completes, then wait in acceptq to be accept'ed. Both are protected by the
+ * listening socket's lock
+ */
 struct tcp_passive {
-    size_t maxbacklog;          // Maximum amount of backlog clients acceptable
-    llist_t backlog;            // List of clients waiting to be accept'ed.
+    size_t maxbacklog;          // Most connections that may wait in acceptq
+    size_t maxsyn;              // Most connections that may be half-open
+    struct tcp_queue synqueue;  // SYN-RECEIVED connections
+    struct tcp_queue acceptq;   // ESTABLISHED connections, oldest first
+    uint64_t syn_drops;         // SYNs dropped as either queue was full
+    uint64_t accept_drops;      // Handshakes left incomplete as acceptq was full
+    uint64_t cookies_sent;      // SYNs answered with a SYN cookie
+    uint64_t cookies_failed;    // ACKs carrying an invalid or expired cookie
+};
+
+struct tcp_rto_data {
+    uint32_t seq;
+    uint16_t len;
+    uint8_t flags;
 };
 
 struct tcp_sock {
@@ -149,17 +186,34 @@ struct tcp_sock {
                                 // MSS for _outgoing_ send() calls only!
 
     struct tcp_passive *passive;// Non-NULL when the connection is PASSIVE (LISTEN)
-    struct tcp_sock *parent;
+    struct tcp_sock *parent;    // Listening socket, until accept'ed
+    struct tcp_queue *queue;    // Queue of parent->passive the socket is in
+    struct tcp_sock *qnext, **qpprev;
 
     // Data buffers
     seqbuf_t sndbuf;           // Sent data, stored in case of retransmissions
-    llist_t recvqueue;          // llist<struct frame> of recv'd tcp frames
-    uint32_t recvptr;           // Pointer to next byte to be recv'd
+    size_t sndbuf_max;          // SO_SNDBUF, the most sndbuf may hold
+    bool finpending;            // close()'d, the FIN follows the unsent text
+    ringbuf_t rcvbuf;           // In-order text not yet recv'd, up to RCV.NXT
+    size_t rcvbuf_max;          // SO_RCVBUF, the size rcvbuf is allocated at
+    bool wscale;                // Both ends sent window scale (RFC 7323)
+    bool ts;                    // Both ends sent timestamps (RFC 7323)
+    uint32_t ts_offset;         // Added to the timestamp clock for TSval
+    uint32_t ts_recent;         // TS.Recent, the TSval echoed in TSecr
+    uint32_t ts_recent_age;     // Our TSval when ts_recent was last updated
+    uint32_t ts_lastack;        // Last.ACK.sent, the last ACK sent
+    struct tcp_reass reass;     // Out-of-order segments beyond RCV.NXT
+    bool sack;                  // Both ends sent SACK-permitted (RFC 2018)
+    uint32_t sack_recent;       // SEQ of the latest segment put in reass
 
     // Retransmission
-    contimer_t rtimer;           // Retransmission timeout
-    contimer_event_t rto_event;  // Timer event corresponding to rto
+    struct wheel_timer rtimer;   // Retransmission timeout
+    struct tcp_rto_data rtd;     // Segment the rtimer retransmits on expiry
     llist_t unacked;             // Sequence numbers of unacknowledged segments
+                                 // and the SACK scoreboard
+    uint16_t dupacks;            // Duplicate ACKs since SND.UNA last moved
+    bool recovering;             // Retransmitting SACK holes, until SND.UNA
+    uint32_t recover;            // reaches recover
 
     struct timespec rto;         // Retransmit timeout value. Calculated from rtt
     struct timespec lasttime;    // Timestamp at which the last rto was started
@@ -167,7 +221,7 @@ struct tcp_sock {
     uint16_t backoff;
 
     // TCP timers
-    timeout_t timewait;
+    struct wheel_timer timewait;
 
     // Reference counting & shared-locking
     atomic_int refcount;
@@ -205,17 +259,41 @@ struct tcp_sock {
 #define TCP_DEF_MSS     536     // MSS conservative default as per RFC879
                                 // https://tools.ietf.org/html/rfc879
 #define TCP_MSL         60      // Maximum Segment Lifetime (in seconds)
+#define TCP_DEF_RCVBUF  262144  // Default SO_RCVBUF, the largest window
+                                // advertised
+#define TCP_MIN_RCVBUF  4096    // Smallest SO_RCVBUF that can be set
+#define TCP_MAX_WSCALE  14      // Largest window shift (RFC 7323, 2.3)
+#define TCP_MAX_RCVBUF  ((size_t) UINT16_MAX << TCP_MAX_WSCALE)
+#define TCP_DEF_SNDBUF  131072  // Default SO_SNDBUF, the most unacknowledged
+                                // and unsent text send() will buffer
+#define TCP_MIN_SNDBUF  4096    // Smallest SO_SNDBUF that can be set
+#define TCP_MAX_BACKLOG 4096    // listen() backlogs are capped at SOMAXCONN
+#define TCP_MIN_SYNQUEUE 128    // Half-open connections any listener allows
 
 // Initial connect timeout. Is doubled every retry
 #define TCP_SYN_RTO     mstons((uint64_t) 500U)
 // Amount of retries before giving up
 #define TCP_SYN_COUNT   6
 
+// Random outgoing ports to try before connect() fails with EADDRINUSE
+#define TCP_PORT_TRIES  8
+
 // Minimum RTO in nanoseconds. RFC 6298 (2.4) says: 'RTO _SHOULD_ be rounded up to 1 second'
 // https://tools.ietf.org/html/rfc6298#page-3
 // Linux uses a minimum RTO of 200 ms
 #define TCP_RTO_MIN     mstons((uint64_t) 100U)
 
+// Ticks per second of the timestamp clock, from 1 to 1000
+// https://tools.ietf.org/html/rfc7323#section-5.4
+#define TCP_TS_HZ       1000
+// Idle time after which TS.Recent is too old for PAWS to use (24 days)
+// https://tools.ietf.org/html/rfc7323#section-5.5
+#define TCP_PAWS_IDLE   ((uint32_t) 24 * 24 * 60 * 60 * TCP_TS_HZ)
+
+// Duplicate ACKs, or segments SACKed above SND.UNA, that signal a loss
+// https://tools.ietf.org/html/rfc6675#section-2
+#define TCP_DUPTHRESH   3
+
 
 /* Returns a string of characters/dots representing a set/unset TCP flag */
 static inline char *fmt_tcp_flags(uint8_t flags, char *buffer) {
@@ -256,8 +334,8 @@ static inline char *fmt_tcp_flags(uint8_t flags, char *buffer) {
 bool tcp_log(struct pkt_log *log, struct frame *frame, uint16_t net_csum,
              addr_t addr1, addr_t addr2);
 
-/* Logs all frames in the recvqueue of a socket with LVERB */
-void tcp_log_recvqueue(struct tcp_sock *sock);
+/* Logs the received text held by a socket with LVERB */
+void tcp_log_rcvbuf(struct tcp_sock *sock);
 
 /* Receives a tcp frame given an ipv4 parent */
 void tcp_ipv4_recv(struct frame *frame, struct ipv4_hdr *hdr);
@@ -281,27 +359,39 @@ void _tcp_setstate(struct tcp_sock *sock, tcp_state_t state);
  * Called on a newly established connection. It allocates required buffers
  * for data transmission
  * @param sock  socket to initialise
- * @param recvnext sequence number to expect the first byte at
  */
-void tcp_established(struct tcp_sock *sock, uint32_t recvnext);
+void tcp_established(struct tcp_sock *sock);
 
 /*!
  * Finds a matching tcp_sock with address/port quad, including matching
  * against wildcard addresses and ports.
+ * Must be called between epoch_enter() and epoch_exit(). Use
+ * tcp_sock_tryincref() to keep the socket after epoch_exit()
  * @see inet_sock_lookup
  * @return a tcp_sock instance, or NULL if no matches found
  */
 static inline struct tcp_sock *tcp_sock_lookup(addr_t *remaddr, addr_t *locaddr,
                                                uint16_t remport, uint16_t locport) {
     return (struct tcp_sock *)
-            inet_sock_lookup(&tcp_sockets, remaddr, locaddr, remport, locport);
+            inet_sock_lookup(&tcp_socktbl, remaddr, locaddr, remport, locport);
 }
 
 /*!
- * Removes a socket from the global socket list
+ * Makes a socket visible to tcp_sock_lookup() under its current address/port
+ * quad. Must be called again whenever they change
+ * @see inet_sock_hash
+ * @return 0 on success, or negative on error
+ */
+#define tcp_sock_hash(sock) inet_sock_hash(&tcp_socktbl, &(sock)->inet)
+
+/*!
+ * Removes a socket from the global socket list and lookup table
  * Should be called before tcp_free_sock() to avoid race conditions
  */
-#define tcp_sock_untrack(sock) llist_remove(&tcp_sockets, (sock))
+static inline void tcp_sock_untrack(struct tcp_sock *sock) {
+    inet_sock_unhash(&tcp_socktbl, &sock->inet);
+    llist_remove(&tcp_sockets, sock);
+}
 
 /*!
  * Initialises tcp_sock variables
@@ -338,6 +428,21 @@ void tcp_sock_abort(struct tcp_sock *sock);
 int _tcp_sock_incref(struct tcp_sock *sock, const char *file, int line, const char *func);
 #define tcp_sock_incref(sock) _tcp_sock_incref(sock, __FILE__, __LINE__, __func__)
 
+/*!
+ * Holds a reference to a socket found by tcp_sock_lookup(), unless the last
+ * reference has already been released and the socket is being free'd
+ * @return true if a reference was taken
+ */
+static inline bool tcp_sock_tryincref(struct tcp_sock *sock) {
+    int refcnt = atomic_load(&sock->refcount);
+    do {
+        if (refcnt <= 0)
+            return false;
+    } while (!atomic_compare_exchange_weak(&sock->refcount, &refcnt,
+                                           refcnt + 1));
+    return true;
+}
+
 /*!
  * Releases the socket reference. When the refcount hits 0, the socket is
  * free'd. This function does not release the mutex if it is held and assumes
@@ -386,25 +491,78 @@ uint16_t tcp_randomport();
  */
 uint32_t tcp_seqnum();
 
+/*!
+ * Returns the TSval for a segment sent now: a TCP_TS_HZ clock, offset by a
+ * random amount chosen for each connection
+ */
+uint32_t tcp_ts_now(struct tcp_sock *sock);
+
 
 /*
  * TCP Utility functions
  */
 
 /*!
- * Compares two TCP headers by the sequence numbers, used for sorting segements
- * into sequence order
+ * Appends sock to the tail of q
+ */
+void tcp_queue_append(struct tcp_queue *q, struct tcp_sock *sock);
+
+/*!
+ * Removes sock from the queue it is in, if any
+ */
+void tcp_queue_remove(struct tcp_sock *sock);
+
+/*!
+ * Removes and returns the connection at the head of q, or NULL if q is empty
+ */
+struct tcp_sock *tcp_queue_pop(struct tcp_queue *q);
+
+/*!
+ * Moves a passive connection that has completed the handshake from the
+ * listener's synqueue to its acceptq, waking one waiting accept() call.
+ * The connection's lock must be held, and it may take the listener's lock
+ * @return 0 on success, -ENOBUFS if the acceptq is full, in which case the
+ *         connection is left half-open
+ */
+int tcp_passive_ready(struct tcp_sock *sock);
+
+/*!
+ * Copies segment text starting at RCV.NXT into sock->rcvbuf, advancing
+ * RCV.NXT past it and shrinking RCV.WND to the space left
+ */
+void tcp_rcvbuf_append(struct tcp_sock *sock, const void *text, uint16_t len);
+
+/*!
+ * Adds len bytes of text that tcp_recv() already copied in after the end of
+ * sock->rcvbuf, advancing RCV.NXT and RCV.WND as tcp_rcvbuf_append() does
  */
-int tcp_seg_cmp(const struct frame *a, const struct frame *b);
+void tcp_rcvbuf_commit(struct tcp_sock *sock, uint16_t len);
 
 /*!
- * Gets the next sequence number after the longest contiguous sequence of bytes
- * stored in sock->recvqueue after the initial value given.
- * @param init initial sequence number to count from (next byte expected)
- * @return the next byte after the highest contiguous sequence number from
- *         init that is held in sock->recvqueue
+ * Copies the text of the out-of-order segments that RCV.NXT has reached from
+ * sock->reass into sock->rcvbuf, then drops the segments
  */
-uint32_t tcp_recvqueue_contigseq(struct tcp_sock *sock, uint32_t init);
+void tcp_rcvbuf_reassemble(struct tcp_sock *sock);
+
+/*!
+ * Returns the receive window to advertise: the free space in sock->rcvbuf, up
+ * to the largest window that Rcv.Wind.Shift can express
+ */
+static inline uint32_t tcp_rcvbuf_wnd(struct tcp_sock *sock) {
+    size_t space = ringbuf_space(&sock->rcvbuf);
+    size_t max = (size_t) UINT16_MAX << sock->tcb.rcv.wscale;
+    return (uint32_t) (space < max ? space : max);
+}
+
+/*!
+ * Returns the smallest window shift that can advertise a window of rcvbuf
+ */
+static inline uint8_t tcp_rcvbuf_wscale(size_t rcvbuf) {
+    uint8_t shift = 0;
+    while (shift < TCP_MAX_WSCALE && (rcvbuf >> shift) > UINT16_MAX)
+        shift++;
+    return shift;
+}
 
 
 /*
@@ -440,7 +598,21 @@ void tcp_recv_closed(struct frame *frame, struct tcp_hdr *seg);
 void tcp_recv_listen(struct frame *frame, struct tcp_sock *sock,
                      struct tcp_hdr *seg);
 
-int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock);
+/*!
+ * Processes a segment arriving for a connection that isn't CLOSED or LISTEN.
+ * The socket lock must be held, and is released before returning
+ * @param staged  length of the segment text tcp_recv() copied in after the
+ *                end of sock->rcvbuf as it checked the checksum, or 0
+ */
+int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock, size_t staged);
+
+/*!
+ * Returns the window of an incoming segment, scaled by Snd.Wind.Shift unless
+ * it is a SYN, whose window is never scaled
+ */
+static inline uint32_t tcp_seg_wnd(struct tcb *tcb, struct tcp_hdr *seg) {
+    return (uint32_t) ntohs(seg->wind) << (seg->flags.syn ? 0 : tcb->snd.wscale);
+}
 
 /*!
  * Updates the TCP send window from an incoming segment
@@ -462,6 +634,16 @@ void tcp_update_wnd(struct tcb *tcb, struct tcp_hdr *seg);
  */
 int tcp_send(struct inet_sock *sock, struct frame *frame, struct neigh_route *rt);
 
+/*!
+ * Sends a complete TCP frame as tcp_send() does, using a precalculated sum of
+ * the segment payload so that only the header is summed
+ * @param datasum folded 16-bit one's complement sum of the payload, such as
+ *                from seqbuf_read_csum()
+ * @return 0 on success, negative error otherwise
+ */
+int tcp_send_csum(struct inet_sock *sock, struct frame *frame,
+                  struct neigh_route *rt, uint16_t datasum);
+
 /*!
  * Constructs and sends a TCP packet with an empty payload
  * @param sock TCP socket to send a packet for
@@ -473,6 +655,15 @@ int tcp_send(struct inet_sock *sock, struct frame *frame, struct neigh_route *rt
 int tcp_send_empty(struct tcp_sock *sock, uint32_t seqn, uint32_t ackn,
                    uint8_t flags);
 
+/*!
+ * Sends a TCP packet with an empty payload that is never retransmitted, such
+ * as an RST or a SYN/ACK carrying a SYN cookie. Only sock->inet, mss and
+ * tcb.rcv.wnd are used, so sock needn't be a connection
+ * @return 0 on success, negative error otherwise
+ */
+int tcp_send_reply(struct tcp_sock *sock, uint32_t seqn, uint32_t ackn,
+                   uint8_t flags);
+
 /*!
  * Constructs and sends a TCP packet with the largest payload available to send,
  * or as much as can fit in a single packet, from the socket data send queue.
@@ -485,12 +676,38 @@ int tcp_send_empty(struct tcp_sock *sock, uint32_t seqn, uint32_t ackn,
  */
 int tcp_send_data(struct tcp_sock *sock, uint32_t seqn, size_t count, uint8_t flags);
 
+/*!
+ * Performs the same action as tcp_send_data(), for callers that already
+ * hold the socket lock
+ */
+int tcp_send_data_nolock(struct tcp_sock *sock, uint32_t seqn, size_t count,
+                         uint8_t flags);
+
+/*!
+ * Sends the text in the send buffer from SND.NXT onwards, as much as the
+ * remote RCV.WND has room for, followed by the FIN if close() queued one
+ * and no text is left unsent. The socket lock must be held
+ * @return >= 0: number of bytes sent, negative error otherwise
+ */
+int tcp_send_pending(struct tcp_sock *sock);
+
 /*!
  * Adds an outgoing segment to the unacked queue in case it is required for
  * later retransmission. This can be used for both data and control packets
+ * @param csum folded 16-bit one's complement sum of the segment payload,
+ *             cached so a retransmission doesn't have to sum it again
  */
 void tcp_queue_unacked(struct tcp_sock *sock, uint32_t seqn, uint16_t len,
-                       uint8_t flags);
+                       uint8_t flags, uint16_t csum);
+
+/*!
+ * Finds the segment in the unacked queue sent with sequence number seqn and
+ * payload length len, and marks it as retransmitted
+ * @param csum  set to the payload sum the segment was first sent with
+ * @return true if a segment matches, false otherwise
+ */
+bool tcp_unacked_resend(struct tcp_sock *sock, uint32_t seqn, uint16_t len,
+                        uint16_t *csum);
 
 /*!
  * Given an uninitialised frame, a TCP segment is formed, allocating space for
@@ -551,14 +768,14 @@ int tcp_send_syn(struct tcp_sock *sock);
  *    <SEQ={seqn}><CTL=RST>
  */
 #define tcp_send_rst(sock, seq) \
-    tcp_send_empty((sock), (seq), 0, TCP_FLAG_RST)
+    tcp_send_reply((sock), (seq), 0, TCP_FLAG_RST)
 
 /*!
  * Sends a TCP RST/ACK segment given a socket, in the form
  *    <SEQ={seqn}><ACK={ackn}><CTL=RST,ACK>
  */
 #define tcp_send_rstack(sock, seq, ack) \
-    tcp_send_empty((sock), (seq), (ack), TCP_FLAG_RST | TCP_FLAG_ACK)
+    tcp_send_reply((sock), (seq), (ack), TCP_FLAG_RST | TCP_FLAG_ACK)
 
 
 /*
@@ -580,12 +797,17 @@ int tcp_user_status();
  */
 void tcp_timewait_expire(struct tcp_sock *sock);
 
-#define tcp_timewait_start(sock) \
-    timeout_set(&(sock)->timewait, (void(*)(void *)) tcp_timewait_expire, \
-        (void *) (sock), TCP_MSL * 2, 0)
+/*
+ * Arms the 2 MSL TIME-WAIT timer. An armed timer holds a reference to the
+ * socket, which is passed to tcp_timewait_expire()
+ */
+void tcp_timewait_start(struct tcp_sock *sock);
 
-#define tcp_timewait_restart(sock) timeout_restart(&(sock)->timewait, -1, -1)
+#define tcp_timewait_restart(sock) tcp_timewait_start(sock)
 
-#define tcp_timewait_cancel(sock) timeout_clear(&(sock)->timewait)
+/*
+ * Disarms the TIME-WAIT timer, dropping the reference it held
+ */
+void tcp_timewait_cancel(struct tcp_sock *sock);
 
 #endif //NETSTACK_TCP_H
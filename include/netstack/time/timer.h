@@ -2,24 +2,39 @@
 #define NETSTACK_TIMER_H
 
 #include <time.h>
-#include <signal.h>
+#include <stddef.h>
 #include <pthread.h>
 
-#define TIMER_SIGNAL    SIGUSR1
+/*
+ * One-shot timeouts
+ *
+ * All timeouts are kept in a single min-heap ordered by expiry, and one
+ * timerfd is programmed with the earliest of them. A thread waits on the
+ * timerfd with epoll and calls the callbacks of expired timeouts, so they run
+ * as normal thread code rather than in a signal handler. Setting a timeout
+ * only makes a syscall when it becomes the earliest, and clearing one never
+ * does: the thread just wakes up to find nothing due.
+ */
+
+#define TIMER_HEAP_INIT 64      /* Initial capacity of the timeout heap */
 
 /*!
  * Represents the state of a timer and it's callback function
  */
 typedef struct timer_data {
-    timer_t timer;
+    size_t index;               // Position in the timeout heap + 1, 0 if idle
     void (*func)(void *);
     void *arg;
-    struct timespec timeout;
+    struct timespec timeout;    // Duration the timeout was last set for
+    struct timespec expires;    // CLOCK_MONOTONIC time the timeout is due at
 } timeout_t;
 
+#define TIMEOUT_INITIALISER { 0 }
+
 
 /*!
- * Creates and immediately starts a timeout with callback
+ * Creates and immediately starts a timeout with callback. The callback is
+ * called from the timer thread. Setting a pending timeout restarts it
  * @param t     timeout structure for storage. used for cancellation/restarting
  * @param fn    callback function
  * @param arg   argument to pass to callback function
@@ -31,8 +46,8 @@ int timeout_set(timeout_t *t, void (*fn)(void *), void *arg,
                 time_t sec, time_t nsec);
 
 /*!
- * Stops the timeout if it has not completed
- * free()'s allocated t->timer if it was started
+ * Stops the timeout if it has not completed. The callback may already be
+ * running if the timeout has just expired
  * @param t
  */
 void timeout_clear(timeout_t *t);
@@ -47,4 +62,10 @@ void timeout_clear(timeout_t *t);
  */
 int timeout_restart(timeout_t *t, time_t sec, time_t nsec);
 
+/*!
+ * Stops and joins the timer thread. Pending timeouts are dropped without
+ * their callbacks being called, and timeout_set() fails from then on
+ */
+void timer_stop(void);
+
 #endif //NETSTACK_TIMER_H
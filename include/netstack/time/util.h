@@ -45,7 +45,7 @@
 /*!
  * Adds seconds and nanoseconds into t1, accounting for nanosecond overflow
  */
-static void timespecaddp(struct timespec *t1, const time_t sec, const long nsec) {
+static inline void timespecaddp(struct timespec *t1, const time_t sec, const long nsec) {
     t1->tv_nsec += nsec;
     if (t1->tv_nsec >= NSPERSEC) {
         t1->tv_nsec -= NSPERSEC;
@@ -58,7 +58,7 @@ static void timespecaddp(struct timespec *t1, const time_t sec, const long nsec)
 /*!
  * Subtracts seconds and nanoseconds from t1, accounting for nanosecond overflow
  */
-static void timespecsubp(struct timespec *t1, const time_t sec, const long nsec) {
+static inline void timespecsubp(struct timespec *t1, const time_t sec, const long nsec) {
     t1->tv_nsec -= nsec;
     if (t1->tv_nsec < 0) {
         t1->tv_nsec += NSPERSEC;
@@ -71,21 +71,21 @@ static void timespecsubp(struct timespec *t1, const time_t sec, const long nsec)
 /*!
  * Adds t2 into t1, accounting for nanosecond overflow
  */
-static void timespecadd(struct timespec *t1, const struct timespec *t2) {
+static inline void timespecadd(struct timespec *t1, const struct timespec *t2) {
     timespecaddp(t1, t2->tv_sec, t2->tv_nsec);
 }
 
 /*!
  * Subtracts t2 from t1, accounting for nanosecond overflow
  */
-static void timespecsub(struct timespec *t1, const struct timespec *t2) {
+static inline void timespecsub(struct timespec *t1, const struct timespec *t2) {
     timespecsubp(t1, t2->tv_sec, t2->tv_nsec);
 }
 
 /*
  *
  */
-static void timespecns(struct timespec *t, uint64_t ns) {
+static inline void timespecns(struct timespec *t, uint64_t ns) {
     t->tv_sec = nstosec(ns);
     t->tv_nsec = ns % NSPERSEC;
 }
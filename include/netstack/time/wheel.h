@@ -0,0 +1,100 @@
+#ifndef NETSTACK_WHEEL_H
+#define NETSTACK_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Hierarchical timing wheel
+ *
+ * Runs any number of timers from a single thread. Timers are embedded in the
+ * structures they belong to, so arming, re-arming and cancelling never
+ * allocate and take constant time: a timer is linked into the slot for its
+ * expiry tick in the first level that spans it, and unlinked in place.
+ *
+ * Level 0 has one slot per tick. Each slot in level n spans a whole
+ * revolution of level n - 1, and its timers are cascaded down into the level
+ * below when the level below wraps around to it. Timers further away than the
+ * top level spans are parked in its last slot and cascaded until they are in
+ * range.
+ *
+ * Callbacks are called from the wheel thread without the wheel lock held, so
+ * they may arm and cancel timers, including their own. A timer may expire up
+ * to one tick later than requested, never earlier.
+ */
+
+#define WHEEL_TICK_NS   1000000     /* Tick length, 1ms */
+#define WHEEL_BITS      6
+#define WHEEL_SLOTS     (1U << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS    4           /* Spans 2^24 ticks, about 4.6 hours */
+
+struct wheel_timer {
+    struct wheel_timer *next;
+    struct wheel_timer **pprev; /* Link pointing to this timer, NULL if idle */
+    uint64_t expires;           /* Tick the timer is due at */
+    void (*fn)(void *);
+    void *arg;
+};
+
+struct wheel {
+    pthread_mutex_t lock;
+    pthread_cond_t wait;
+    pthread_t thread;
+    bool running;
+    struct timespec start;      /* CLOCK_MONOTONIC time of tick 0 */
+    uint64_t now;               /* Next tick to be run */
+    uint64_t wake;              /* Tick the thread is sleeping until */
+    size_t pending;             /* Number of armed timers */
+    struct wheel_timer *expired;    /* Timers due in the tick being run */
+    struct wheel_timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+/*!
+ * Initialises a timing wheel and starts the thread that runs its timers
+ * @return 0 on success, negative on error. On error the wheel can still be
+ *         stopped and have timers armed, but none of them will expire
+ */
+int wheel_init(struct wheel *wheel);
+
+/*!
+ * Stops the wheel thread and waits for it to exit. Timers still armed are
+ * disarmed without being called. Timers can still be armed and cancelled
+ * once stopped, but never expire. Stopping a stopped wheel does nothing
+ */
+void wheel_stop(struct wheel *wheel);
+
+/*!
+ * Initialises an idle timer that calls fn(arg) when it expires
+ */
+static inline void wheel_timer_init(struct wheel_timer *timer,
+                                    void (*fn)(void *), void *arg) {
+    *timer = (struct wheel_timer) { .fn = fn, .arg = arg };
+}
+
+/*!
+ * Arms a timer to expire ns nanoseconds from now, re-arming it if it is
+ * already armed
+ * @return true if the timer was already armed
+ */
+bool wheel_arm(struct wheel *wheel, struct wheel_timer *timer, uint64_t ns);
+
+/*!
+ * Disarms a timer. The callback may still be running, or about to run, if the
+ * timer has already expired
+ * @return true if the timer was armed and will now not be called
+ */
+bool wheel_cancel(struct wheel *wheel, struct wheel_timer *timer);
+
+/*!
+ * Checks whether a timer is armed. Only a snapshot unless the caller
+ * otherwise prevents the timer being armed, cancelled or expiring
+ */
+static inline bool wheel_pending(struct wheel_timer *timer) {
+    return timer->pprev != NULL;
+}
+
+#endif //NETSTACK_WHEEL_H
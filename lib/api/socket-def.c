@@ -55,6 +55,13 @@ ssize_t (*sys_sendto)(int, const void *, size_t, int, const struct sockaddr *,
 
 ssize_t (*sys_sendmsg)(int, const struct msghdr *, int) = NULL;
 
+#ifdef _GNU_SOURCE
+int (*sys_recvmmsg)(int, struct mmsghdr *, unsigned int, int,
+                    struct timespec *) = NULL;
+
+int (*sys_sendmmsg)(int, struct mmsghdr *, unsigned int, int) = NULL;
+#endif
+
 int (*sys_ioctl)(int __fd, unsigned long int __request, ...) = NULL;
 
 int (*sys_poll)(struct pollfd fds[], nfds_t nfds, int timeout) = NULL;
@@ -93,11 +100,17 @@ int ns_api_init() {
     sys_recv = dlsym(RTLD_NEXT, "recv");
     sys_recvfrom = dlsym(RTLD_NEXT, "recvfrom");
     sys_recvmsg = dlsym(RTLD_NEXT, "recvmsg");
+#ifdef _GNU_SOURCE
+    sys_recvmmsg = dlsym(RTLD_NEXT, "recvmmsg");
+#endif
     // send'ing
     sys_write = dlsym(RTLD_NEXT, "write");
     sys_send = dlsym(RTLD_NEXT, "send");
     sys_sendmsg = dlsym(RTLD_NEXT, "sendmsg");
     sys_sendto = dlsym(RTLD_NEXT, "sendto");
+#ifdef _GNU_SOURCE
+    sys_sendmmsg = dlsym(RTLD_NEXT, "sendmmsg");
+#endif
     // closing
     sys_close = dlsym(RTLD_NEXT, "close");
     sys_shutdown = dlsym(RTLD_NEXT, "shutdown");
@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <malloc.h>
 #include <sys/param.h>
 
@@ -74,11 +75,8 @@ int listen(int fd, int backlog) {
     }
 }
 
-int accept(int fd, struct sockaddr *restrict addr, socklen_t *restrict len) {
-    ns_check_sock(fd, sock, {
-        return sys_accept(fd, addr, len);
-    });
-
+// accept4() without the file descriptor checks, which accept() shares
+static int _accept4(struct inet_sock *sock, int flags) {
     switch (sock->type) {
         case SOCK_STREAM: {
             struct tcp_sock *client;
@@ -86,6 +84,12 @@ int accept(int fd, struct sockaddr *restrict addr, socklen_t *restrict len) {
             if (ret < 0)
                 returnerr(-ret);
 
+            // Optional flags for the new socket, as with socket()
+            if (flags & SOCK_NONBLOCK)
+                client->inet.flags |= O_NONBLOCK;
+            if (flags & SOCK_CLOEXEC)
+                client->inet.flags |= O_CLOEXEC;
+
             struct tcp_sock **elem = NULL;
             int fd = (int) alist_add(&ns_sockets, (void **) &elem);
             fd += NS_MIN_FD;
@@ -99,11 +103,22 @@ int accept(int fd, struct sockaddr *restrict addr, socklen_t *restrict len) {
     }
 }
 
+int accept(int fd, struct sockaddr *restrict addr, socklen_t *restrict len) {
+    ns_check_sock(fd, sock, {
+        return sys_accept(fd, addr, len);
+    });
+
+    return _accept4(sock, 0);
+}
+
 #ifdef _GNU_SOURCE
 int accept4(int fd, struct sockaddr *restrict addr, socklen_t *restrict len,
             int flags) {
-    LOG(LNTCE, "%s", __func__);
-    return sys_accept(fd, addr, len);
+    ns_check_sock(fd, sock, {
+        return sys_accept4(fd, addr, len, flags);
+    });
+
+    return _accept4(sock, flags);
 }
 #endif
 
@@ -221,6 +236,27 @@ int getsockopt_sock(struct inet_sock *sock, int level, int opt, void *val,
                 memcpy(val, &tcp_sock->error, size);
                 return 0;
             }
+            returnerr(ENOPROTOOPT);
+        case SO_SNDBUF:
+            if (sock->type == SOCK_STREAM) {
+                if (*len < sizeof(int))
+                    returnerr(EINVAL);
+                struct tcp_sock *tcp_sock = (struct tcp_sock *) sock;
+                *(int *) val = (int) MIN(tcp_sock->sndbuf_max, INT_MAX);
+                *len = sizeof(int);
+                return 0;
+            }
+            returnerr(ENOPROTOOPT);
+        case SO_RCVBUF:
+            if (sock->type == SOCK_STREAM) {
+                if (*len < sizeof(int))
+                    returnerr(EINVAL);
+                struct tcp_sock *tcp_sock = (struct tcp_sock *) sock;
+                *(int *) val = (int) MIN(tcp_sock->rcvbuf_max, INT_MAX);
+                *len = sizeof(int);
+                return 0;
+            }
+            returnerr(ENOPROTOOPT);
         default:
             returnerr(ENOPROTOOPT);
     }
@@ -249,7 +285,43 @@ int setsockopt(int fd, int level, int opt, const void *val, socklen_t len) {
 
 int setsockopt_sock(struct inet_sock *sock, int level, int opt, const void *val,
                     socklen_t len) {
-    returnerr(ENOPROTOOPT);
+
+    switch (opt) {
+        case SO_SNDBUF:
+            if (sock->type == SOCK_STREAM) {
+                if (len < sizeof(int))
+                    returnerr(EINVAL);
+                struct tcp_sock *tcp_sock = (struct tcp_sock *) sock;
+                int size = *(const int *) val;
+
+                tcp_sock_lock(tcp_sock);
+                tcp_sock->sndbuf_max = (size_t) MAX(size, TCP_MIN_SNDBUF);
+                // Blocked senders may fit in a larger buffer
+                pthread_cond_broadcast(&tcp_sock->waitack);
+                tcp_sock_unlock(tcp_sock);
+                return 0;
+            }
+            returnerr(ENOPROTOOPT);
+        case SO_RCVBUF:
+            if (sock->type == SOCK_STREAM) {
+                if (len < sizeof(int))
+                    returnerr(EINVAL);
+                struct tcp_sock *tcp_sock = (struct tcp_sock *) sock;
+                int size = *(const int *) val;
+
+                // The window scale is chosen from this in the SYN, so it
+                // must be set before connect() or listen() to take effect.
+                // Connections accept'ed from a listener inherit it
+                tcp_sock_lock(tcp_sock);
+                tcp_sock->rcvbuf_max = MIN((size_t) MAX(size, TCP_MIN_RCVBUF),
+                                           TCP_MAX_RCVBUF);
+                tcp_sock_unlock(tcp_sock);
+                return 0;
+            }
+            returnerr(ENOPROTOOPT);
+        default:
+            returnerr(ENOPROTOOPT);
+    }
 }
 
 int fcntl(int fd, int cmd, ...) {
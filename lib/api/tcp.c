@@ -71,8 +71,6 @@ int connect_tcp(struct inet_sock *inet, const struct sockaddr *addr,
     if (inet->locport == 0)
         inet->locport = tcp_randomport();
 
-    // TODO: Ensure chosen outgoing TCP port isn't in use already
-
     retns(tcp_user_open(sock));
 }
 
@@ -1,5 +1,13 @@
+#include <string.h>
+
 #include <netstack/checksum.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 /* Source: https://tools.ietf.org/html/rfc1071#section-4.1 */
 #if _WORDSIZE == 32
 uint16_t in_csum(const void *ptr, size_t len, uint32_t initial) {
@@ -25,7 +33,8 @@ uint16_t in_csum(const void *ptr, size_t len, uint32_t initial) {
     return (uint16_t) ~sum;
 }
 #else
-uint16_t in_csum(const void *ptr, size_t len, uint64_t initial) {
+static inline uint16_t _in_csum_ref(const void *ptr, size_t len,
+                                    uint64_t initial) {
 
     uint64_t sum = initial;
     const uint64_t *data = (const uint64_t *) ptr;
@@ -75,4 +84,249 @@ uint16_t in_csum(const void *ptr, size_t len, uint64_t initial) {
 
     return ~t3;
 }
+
+uint16_t in_csum_ref(const void *ptr, size_t len, uint64_t initial) {
+    return _in_csum_ref(ptr, len, initial);
+}
+
+static inline uint64_t csum_add(uint64_t sum, uint64_t s) {
+    sum += s;
+    return sum + (sum < s);
+}
+
+uint16_t in_csum_copy_ref(void *dest, const void *src, size_t len,
+                          uint64_t initial) {
+    uint8_t *to = dest;
+    const uint8_t *from = src;
+    uint64_t sum = initial;
+
+    // Sum each word as it is copied, 8 bytes at a time
+    for (; len >= 8; to += 8, from += 8, len -= 8) {
+        uint64_t s;
+        memcpy(&s, from, sizeof(s));
+        memcpy(to, &s, sizeof(s));
+        sum = csum_add(sum, s);
+    }
+
+    memcpy(to, from, len);
+    return _in_csum_ref(from, len, sum);
+}
+
+/*
+ * The vector implementations below sum 32-bit words into 64-bit lanes, which
+ * cannot overflow for any realistic length. Since 2^16 = 1 mod 0xFFFF, a sum
+ * of wider words folds to the same 16-bit one's complement sum, so the lanes
+ * are finally added together and passed with the remaining tail to the
+ * reference implementation as the initial value. The in_csum_copy() variants
+ * do the same with a store after each load
+ */
+
+#if defined(__x86_64__)
+static inline uint16_t _in_csum_sse2(const void *ptr, size_t len,
+                                     uint64_t initial) {
+    const uint8_t *data = ptr;
+    if (len < 32)
+        return _in_csum_ref(data, len, initial);
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+
+    // 32 bytes at a time, in two independent accumulators
+    for (; len >= 32; data += 32, len -= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *) data);
+        __m128i b = _mm_loadu_si128((const __m128i *) (data + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+    }
+
+    // Lanes are far from overflowing, so can be added without carry
+    acc0 = _mm_add_epi64(acc0, acc1);
+    acc0 = _mm_add_epi64(acc0, _mm_unpackhi_epi64(acc0, acc0));
+    uint64_t sum = csum_add(initial, (uint64_t) _mm_cvtsi128_si64(acc0));
+
+    return _in_csum_ref(data, len, sum);
+}
+
+uint16_t in_csum_sse2(const void *ptr, size_t len, uint64_t initial) {
+    return _in_csum_sse2(ptr, len, initial);
+}
+
+static inline uint16_t _in_csum_copy_sse2(void *dest, const void *src,
+                                          size_t len, uint64_t initial) {
+    uint8_t *to = dest;
+    const uint8_t *from = src;
+    if (len < 32)
+        return in_csum_copy_ref(to, from, len, initial);
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+
+    for (; len >= 32; to += 32, from += 32, len -= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *) from);
+        __m128i b = _mm_loadu_si128((const __m128i *) (from + 16));
+        _mm_storeu_si128((__m128i *) to, a);
+        _mm_storeu_si128((__m128i *) (to + 16), b);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+    }
+
+    acc0 = _mm_add_epi64(acc0, acc1);
+    acc0 = _mm_add_epi64(acc0, _mm_unpackhi_epi64(acc0, acc0));
+    uint64_t sum = csum_add(initial, (uint64_t) _mm_cvtsi128_si64(acc0));
+
+    return in_csum_copy_ref(to, from, len, sum);
+}
+
+uint16_t in_csum_copy_sse2(void *dest, const void *src, size_t len,
+                           uint64_t initial) {
+    return _in_csum_copy_sse2(dest, src, len, initial);
+}
+
+__attribute__((target("avx2")))
+uint16_t in_csum_avx2(const void *ptr, size_t len, uint64_t initial) {
+    const uint8_t *data = ptr;
+    if (len < 64)
+        return _in_csum_sse2(data, len, initial);
+
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+
+    // 64 bytes at a time, in two independent accumulators
+    for (; len >= 64; data += 64, len -= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) data);
+        __m256i b = _mm256_loadu_si256((const __m256i *) (data + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+    }
+
+    acc0 = _mm256_add_epi64(acc0, acc1);
+    __m128i acc = _mm_add_epi64(_mm256_castsi256_si128(acc0),
+                                _mm256_extracti128_si256(acc0, 1));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    uint64_t sum = csum_add(initial, (uint64_t) _mm_cvtsi128_si64(acc));
+
+    // Finish off anything shorter than 64 bytes with SSE2
+    return _in_csum_sse2(data, len, sum);
+}
+
+__attribute__((target("avx2")))
+uint16_t in_csum_copy_avx2(void *dest, const void *src, size_t len,
+                           uint64_t initial) {
+    uint8_t *to = dest;
+    const uint8_t *from = src;
+    if (len < 64)
+        return _in_csum_copy_sse2(to, from, len, initial);
+
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+
+    for (; len >= 64; to += 64, from += 64, len -= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) from);
+        __m256i b = _mm256_loadu_si256((const __m256i *) (from + 32));
+        _mm256_storeu_si256((__m256i *) to, a);
+        _mm256_storeu_si256((__m256i *) (to + 32), b);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+    }
+
+    acc0 = _mm256_add_epi64(acc0, acc1);
+    __m128i acc = _mm_add_epi64(_mm256_castsi256_si128(acc0),
+                                _mm256_extracti128_si256(acc0, 1));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    uint64_t sum = csum_add(initial, (uint64_t) _mm_cvtsi128_si64(acc));
+
+    return _in_csum_copy_sse2(to, from, len, sum);
+}
+
+/*
+ * Choose the in_csum() and in_csum_copy() implementations when the library
+ * is loaded
+ */
+static uint16_t (*in_csum_resolve(void))(const void *, size_t, uint64_t) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return in_csum_avx2;
+    return in_csum_sse2;
+}
+
+static uint16_t (*in_csum_copy_resolve(void))(void *, const void *, size_t,
+                                              uint64_t) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return in_csum_copy_avx2;
+    return in_csum_copy_sse2;
+}
+
+uint16_t in_csum(const void *ptr, size_t len, uint64_t initial)
+        __attribute__((ifunc("in_csum_resolve")));
+
+uint16_t in_csum_copy(void *dest, const void *src, size_t len,
+                      uint64_t initial)
+        __attribute__((ifunc("in_csum_copy_resolve")));
+
+#elif defined(__aarch64__)
+uint16_t in_csum_neon(const void *ptr, size_t len, uint64_t initial) {
+    const uint8_t *data = ptr;
+    uint64x2_t acc0 = vdupq_n_u64(0), acc1 = vdupq_n_u64(0);
+
+    // 32 bytes at a time, pairwise adding 32-bit words into 64-bit lanes
+    for (; len >= 32; data += 32, len -= 32) {
+        acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(vld1q_u8(data)));
+        acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(vld1q_u8(data + 16)));
+    }
+
+    // Lanes are far from overflowing, so can be added without carry
+    uint64_t sum = csum_add(initial, vaddvq_u64(vaddq_u64(acc0, acc1)));
+
+    return _in_csum_ref(data, len, sum);
+}
+
+uint16_t in_csum_copy_neon(void *dest, const void *src, size_t len,
+                           uint64_t initial) {
+    uint8_t *to = dest;
+    const uint8_t *from = src;
+    uint64x2_t acc0 = vdupq_n_u64(0), acc1 = vdupq_n_u64(0);
+
+    for (; len >= 32; to += 32, from += 32, len -= 32) {
+        uint8x16_t a = vld1q_u8(from);
+        uint8x16_t b = vld1q_u8(from + 16);
+        vst1q_u8(to, a);
+        vst1q_u8(to + 16, b);
+        acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(a));
+        acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(b));
+    }
+
+    uint64_t sum = csum_add(initial, vaddvq_u64(vaddq_u64(acc0, acc1)));
+
+    return in_csum_copy_ref(to, from, len, sum);
+}
+
+// Advanced SIMD is mandatory on AArch64, so no runtime check is needed
+uint16_t in_csum(const void *ptr, size_t len, uint64_t initial) {
+    return in_csum_neon(ptr, len, initial);
+}
+
+uint16_t in_csum_copy(void *dest, const void *src, size_t len,
+                      uint64_t initial) {
+    return in_csum_copy_neon(dest, src, len, initial);
+}
+
+#else
+uint16_t in_csum(const void *ptr, size_t len, uint64_t initial) {
+    return in_csum_ref(ptr, len, initial);
+}
+
+uint16_t in_csum_copy(void *dest, const void *src, size_t len,
+                      uint64_t initial) {
+    return in_csum_copy_ref(dest, src, len, initial);
+}
+#endif
 #endif
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #define NETSTACK_LOG_UNIT "ALIST"
@@ -20,44 +21,69 @@ int _alist_init(void *lst, size_t type_sz, size_t init_sz) {
     list->count = 0;
     list->type_sz = type_sz;
     list->len = init_sz;
+    list->fixed = NULL;
+
+    return 0;
+}
+
+int _alist_init_fixed(void *lst, size_t type_sz, void *storage,
+                      size_t init_sz) {
+    if (lst == NULL || storage == NULL || type_sz < 1 || init_sz < 1)
+        return -EINVAL;
+
+    alist_t *list = lst;
+    list->arr = list->fixed = storage;
+    list->count = 0;
+    list->type_sz = type_sz;
+    list->len = init_sz;
 
     return 0;
 }
 
 int alist_expand(struct alist *list) {
-    // Attempt to realloc twice the current allocated space
+    size_t size = (list->len * 2) * list->type_sz;
     void *inc;
-    if ((inc = realloc(list->arr, (list->len * 2) * list->type_sz))) {
+
+    if (list->arr == list->fixed) {
+        // Move out of fixed storage onto the heap
+        if ((inc = malloc(size)) == NULL)
+            return -ENOMEM;
+        memcpy(inc, list->arr, list->len * list->type_sz);
+    } else if ((inc = realloc(list->arr, size)) == NULL) {
+        // Attempt to realloc twice the current allocated space
         return -ENOMEM;
-    } else {
-        // Success! Update the list
-        list->len *= 2;
-        list->arr = inc;
     }
+
+    // Success! Update the list
+    list->len *= 2;
+    list->arr = inc;
     return 0;
 }
 
 void alist_free(void *lst) {
     alist_t *list = lst;
-    if (list->arr != NULL)
+    if (list->arr != NULL && list->arr != list->fixed)
         free(list->arr);
 }
 
 ssize_t alist_add(void *lst, void **newelem) {
     alist_t *list = lst;
-    int ret;
     alist_lock(list);
+    ssize_t ret = alist_add_unlocked(list, newelem);
+    alist_unlock(list);
+    return ret;
+}
+
+ssize_t alist_add_unlocked(void *lst, void **newelem) {
+    alist_t *list = lst;
+    int ret;
     // If the list is full, expand it
     if (list->len == list->count) {
-        if ((ret = alist_expand(list))) {
-            alist_unlock(list);
+        if ((ret = alist_expand(list)))
             return ret;
-        }
     }
 
     // Increment list count and get the elem at count
     *newelem = alist_elem(list, list->count++);
-    alist_unlock(list);
-    return (int) (list->count - 1);
+    return (ssize_t) (list->count - 1);
 }
-
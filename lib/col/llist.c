@@ -20,6 +20,7 @@ void llist_clear(llist_t *list) {
         free(tmp);
         tmp = next;
     }
+    list->head = list->tail = NULL;
     list->length = 0;
 
     pthread_mutex_unlock(&list->lock);
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define NETSTACK_LOG_UNIT "POOL"
+#include <netstack/log.h>
+#include <netstack/col/pool.h>
+
+struct pool_cache {
+    struct pool_cache *next, *prev;
+    struct pool *pool;
+    uint32_t count;
+    uint32_t obj[POOL_CACHE_SIZE];
+};
+
+#define pool_idx(head)  ((uint32_t) (head))
+#define pool_tag(head)  ((head) >> 32)
+#define pool_head(tag, idx) (((uint64_t) (tag) << 32) | (idx))
+
+static uint32_t pool_pop(struct pool *pool) {
+    uint64_t head = atomic_load(&pool->head), new;
+    uint32_t idx;
+    do {
+        if ((idx = pool_idx(head)) == POOL_EMPTY)
+            return POOL_EMPTY;
+        // next[idx] may be stale if idx was popped concurrently, in which
+        // case the tag will have changed and the CAS fails
+        new = pool_head(pool_tag(head) + 1, atomic_load(&pool->next[idx]));
+    } while (!atomic_compare_exchange_weak(&pool->head, &head, new));
+
+    return idx;
+}
+
+static void pool_push(struct pool *pool, uint32_t idx) {
+    uint64_t head = atomic_load(&pool->head), new;
+    do {
+        atomic_store(&pool->next[idx], pool_idx(head));
+        new = pool_head(pool_tag(head) + 1, idx);
+    } while (!atomic_compare_exchange_weak(&pool->head, &head, new));
+}
+
+/*
+ * Returns all objects in a cache to the shared stack and releases it. Called
+ * on thread exit
+ */
+static void pool_cache_free(struct pool_cache *cache) {
+    struct pool *pool = cache->pool;
+    while (cache->count > 0)
+        pool_push(pool, cache->obj[--cache->count]);
+
+    pthread_mutex_lock(&pool->lock);
+    if (cache->prev != NULL)
+        cache->prev->next = cache->next;
+    else
+        pool->caches = cache->next;
+    if (cache->next != NULL)
+        cache->next->prev = cache->prev;
+    pthread_mutex_unlock(&pool->lock);
+
+    free(cache);
+}
+
+static struct pool_cache *pool_cache_get(struct pool *pool) {
+    struct pool_cache *cache = pthread_getspecific(pool->key);
+    if (cache != NULL)
+        return cache;
+
+    if ((cache = calloc(1, sizeof(struct pool_cache))) == NULL)
+        return NULL;
+    cache->pool = pool;
+
+    pthread_mutex_lock(&pool->lock);
+    cache->next = pool->caches;
+    if (pool->caches != NULL)
+        pool->caches->prev = cache;
+    pool->caches = cache;
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_setspecific(pool->key, cache);
+    return cache;
+}
+
+int pool_init(struct pool *pool, size_t obj_sz, uint32_t count) {
+    if (pool == NULL || obj_sz == 0 || count == 0 || count == POOL_EMPTY)
+        return -EINVAL;
+
+    memset(pool, 0, sizeof(struct pool));
+    pool->obj_sz = (obj_sz + POOL_ALIGN - 1) & ~((size_t) POOL_ALIGN - 1);
+    pool->count = count;
+
+    pool->mem = aligned_alloc(POOL_ALIGN, (size_t) count * pool->obj_sz);
+    pool->next = malloc(count * sizeof(*pool->next));
+    if (pool->mem == NULL || pool->next == NULL) {
+        free(pool->mem);
+        free(pool->next);
+        return -ENOMEM;
+    }
+
+    int err;
+    if ((err = pthread_key_create(&pool->key,
+                                  (void (*)(void *)) pool_cache_free))) {
+        free(pool->mem);
+        free(pool->next);
+        return -err;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+
+    // Chain all objects together, lowest address first
+    for (uint32_t i = 0; i < count; i++)
+        atomic_init(&pool->next[i], i + 1 < count ? i + 1 : POOL_EMPTY);
+    atomic_init(&pool->head, pool_head(0, 0));
+
+    atomic_init(&pool->used, 0);
+    atomic_init(&pool->high_water, 0);
+    atomic_init(&pool->misses, 0);
+
+    return 0;
+}
+
+void pool_free(struct pool *pool) {
+    if (pool == NULL || pool->mem == NULL)
+        return;
+
+    // Deleting the key stops destructors running for remaining threads
+    pthread_key_delete(pool->key);
+    struct pool_cache *cache = pool->caches;
+    while (cache != NULL) {
+        struct pool_cache *next = cache->next;
+        free(cache);
+        cache = next;
+    }
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->mem);
+    free(pool->next);
+
+    // Leave the pool as if never initialised, so pool_get() falls back to
+    // malloc(3) and pool_free() may safely be called again
+    memset(pool, 0, sizeof(struct pool));
+}
+
+void *pool_get(struct pool *pool, size_t size) {
+    uint32_t idx = POOL_EMPTY;
+
+    if (size <= pool->obj_sz) {
+        struct pool_cache *cache = pool_cache_get(pool);
+        if (cache == NULL) {
+            idx = pool_pop(pool);
+        } else {
+            // Refill half of the cache at once to amortise shared accesses
+            while (cache->count < POOL_CACHE_SIZE / 2) {
+                uint32_t obj = pool_pop(pool);
+                if (obj == POOL_EMPTY)
+                    break;
+                cache->obj[cache->count++] = obj;
+            }
+            if (cache->count > 0)
+                idx = cache->obj[--cache->count];
+        }
+    }
+
+    if (idx == POOL_EMPTY) {
+        atomic_fetch_add_explicit(&pool->misses, 1, memory_order_relaxed);
+        return malloc(size);
+    }
+
+    size_t used = atomic_fetch_add_explicit(&pool->used, 1,
+                                            memory_order_relaxed) + 1;
+    size_t high = atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+    while (used > high && !atomic_compare_exchange_weak_explicit(
+            &pool->high_water, &high, used,
+            memory_order_relaxed, memory_order_relaxed));
+
+    return pool->mem + (size_t) idx * pool->obj_sz;
+}
+
+void pool_put(struct pool *pool, void *obj) {
+    if (obj == NULL)
+        return;
+
+    if (!pool_contains(pool, obj)) {
+        free(obj);
+        return;
+    }
+
+    uint32_t idx = (uint32_t) (((uint8_t *) obj - pool->mem) / pool->obj_sz);
+    atomic_fetch_sub_explicit(&pool->used, 1, memory_order_relaxed);
+
+    struct pool_cache *cache = pool_cache_get(pool);
+    if (cache == NULL) {
+        pool_push(pool, idx);
+        return;
+    }
+
+    // Spill half of a full cache so the next few puts don't spill again
+    if (cache->count == POOL_CACHE_SIZE)
+        while (cache->count > POOL_CACHE_SIZE / 2)
+            pool_push(pool, cache->obj[--cache->count]);
+
+    cache->obj[cache->count++] = idx;
+}
+
+void pool_get_stats(struct pool *pool, struct pool_stats *stats) {
+    stats->count = pool->count;
+    stats->used = atomic_load(&pool->used);
+    stats->high_water = atomic_load(&pool->high_water);
+    stats->misses = atomic_load(&pool->misses);
+}
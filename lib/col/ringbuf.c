@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/param.h>
+
+#include <netstack/checksum.h>
+#include <netstack/col/ringbuf.h>
+
+int ringbuf_init(ringbuf_t *rb, size_t size) {
+    if (rb == NULL)
+        return -EINVAL;
+
+    rb->start = 0;
+    rb->count = 0;
+    rb->buf = malloc(size);
+    rb->size = rb->buf != NULL ? size : 0;
+
+    return rb->buf != NULL ? 0 : -ENOMEM;
+}
+
+void ringbuf_free(ringbuf_t *rb) {
+    if (rb != NULL) {
+        free(rb->buf);
+        rb->buf = NULL;
+        rb->size = 0;
+        rb->start = 0;
+        rb->count = 0;
+    }
+}
+
+long ringbuf_write(ringbuf_t *rb, const void *src, size_t len) {
+    if (rb == NULL)
+        return -EINVAL;
+
+    len = MIN(len, ringbuf_space(rb));
+    if (len == 0)
+        return 0;
+
+    // Write from the end of the data up to the end of buf, then wrap around
+    size_t end = (rb->start + rb->count) % rb->size;
+    size_t first = MIN(len, rb->size - end);
+    memcpy(rb->buf + end, src, first);
+    memcpy(rb->buf, src + first, len - first);
+    rb->count += len;
+
+    return len;
+}
+
+long ringbuf_stage_csum(ringbuf_t *rb, const void *src, size_t len,
+                        uint16_t *sum) {
+    if (rb == NULL)
+        return -EINVAL;
+
+    len = MIN(len, ringbuf_space(rb));
+    *sum = 0;
+    if (len == 0)
+        return 0;
+
+    // The part after the wrap starts at an odd offset into src if the part
+    // before it is an odd length, so its sum is swapped to match
+    size_t end = (rb->start + rb->count) % rb->size;
+    size_t first = MIN(len, rb->size - end);
+    uint16_t head = ~in_csum_copy(rb->buf + end, src, first, 0);
+    uint16_t tail = ~in_csum_copy(rb->buf, src + first, len - first, 0);
+    *sum = in_csum_add(head, first & 1 ? in_csum_swap(tail) : tail);
+
+    return len;
+}
+
+long ringbuf_read(ringbuf_t *rb, void *dest, size_t len) {
+    if (rb == NULL)
+        return -EINVAL;
+
+    len = MIN(len, rb->count);
+    if (len == 0)
+        return 0;
+
+    size_t first = MIN(len, rb->size - rb->start);
+    memcpy(dest, rb->buf + rb->start, first);
+    memcpy(dest + first, rb->buf, len - first);
+    rb->start = (rb->start + len) % rb->size;
+    rb->count -= len;
+
+    // Reset an empty ring so that later reads and writes don't wrap as often
+    if (rb->count == 0)
+        rb->start = 0;
+
+    return len;
+}
@@ -1,19 +1,27 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
 
+#include <sys/mman.h>
 #include <sys/param.h>
 
 #define NETSTACK_LOG_UNIT "SEQBUF"
 #include <netstack/log.h>
+#include <netstack/checksum.h>
 #include <netstack/col/seqbuf.h>
 
 int seqbuf_init(seqbuf_t *buf, size_t start, size_t limit) {
     if (buf == NULL)
         return -EINVAL;
 
-    buf->head = NULL;
-    buf->tail = NULL;
+    // The ring is mapped by the first write
+    buf->buf = NULL;
+    buf->size = 0;
+    buf->head = 0;
     buf->start = start;
     buf->limit = limit;
     buf->count = 0;
@@ -23,20 +31,108 @@ int seqbuf_init(seqbuf_t *buf, size_t start, size_t limit) {
 
 void seqbuf_free(seqbuf_t *buf) {
     if (buf != NULL) {
+        if (buf->buf != NULL)
+            munmap(buf->buf, 2 * buf->size);
 
-        struct seqbuf_block *cur, *block = buf->head;
-        while (block != NULL) {
-            cur = block;
-            block = block->next;
-            free(cur);
-        }
-
+        buf->buf = NULL;
+        buf->size = 0;
+        buf->head = 0;
         buf->count = 0;
         buf->start = 0;
     }
 }
 
-long seqbuf_read(seqbuf_t *buf, size_t from, void *dest, size_t len) {
+// Opens an anonymous file to back a ring
+static int seqbuf_memfd(void) {
+#ifdef _GNU_SOURCE
+    int fd = memfd_create("seqbuf", MFD_CLOEXEC);
+    if (fd < 0)
+        LOGERR("memfd_create");
+    return fd;
+#else
+    // Without memfd_create(), use a shared memory object unlinked on creation
+    static atomic_uint seq = 0;
+    char name[32];
+    snprintf(name, sizeof(name), "/seqbuf-%d-%u", getpid(),
+             atomic_fetch_add(&seq, 1));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGERR("shm_open");
+        return fd;
+    }
+    shm_unlink(name);
+    return fd;
+#endif
+}
+
+/*
+ * Maps size bytes of a memfd twice into adjacent address space, so that
+ * writing past the end of the first view writes the start of the ring
+ */
+static void *seqbuf_map(size_t size) {
+    int fd = seqbuf_memfd();
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, (off_t) size)) {
+        LOGERR("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    // Reserve space for both views, then map the memfd over each half
+    void *addr = mmap(NULL, 2 * size, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        LOGERR("mmap");
+        close(fd);
+        return NULL;
+    }
+    if (mmap(addr, size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(addr + size, size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        LOGERR("mmap");
+        munmap(addr, 2 * size);
+        close(fd);
+        return NULL;
+    }
+
+    // The mappings keep the memory alive
+    close(fd);
+    return addr;
+}
+
+// Moves the contents of the buffer to a new ring that fits at least need bytes
+static int seqbuf_grow(seqbuf_t *buf, size_t need) {
+    size_t pagesz = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size = MAX(buf->size, SEQBUF_MIN_SIZE);
+    while (size < need)
+        size *= 2;
+    size = roundup(size, pagesz);
+
+    void *ring = seqbuf_map(size);
+    if (ring == NULL)
+        return -ENOMEM;
+
+    if (buf->buf != NULL) {
+        memcpy(ring, buf->buf + buf->head, buf->count);
+        munmap(buf->buf, 2 * buf->size);
+    }
+
+    LOG(LDBUG, "resized seqbuf from %zu to %zu bytes", buf->size, size);
+
+    buf->buf = ring;
+    buf->size = size;
+    buf->head = 0;
+    return 0;
+}
+
+/*
+ * Reads from the buffer, optionally summing the data as it is copied. sum is
+ * set to the folded 16-bit one's complement sum of all bytes read
+ */
+static long _seqbuf_read(seqbuf_t *buf, size_t from, void *dest, size_t len,
+                         uint16_t *sum) {
     if (buf == NULL)
         return -EINVAL;
 
@@ -44,80 +140,48 @@ long seqbuf_read(seqbuf_t *buf, size_t from, void *dest, size_t len) {
     if (avail <= 0)
         return avail;
 
-    // We can only read at most what is available, or what is requested
-    size_t toread = MIN(len, avail);
     // Offset by the initial byte
-    size_t blockofs = ((long) from - buf->start) % buf->limit;
-    // Cumulative sum of bytes read
-    size_t total_read = 0;
-    // Start at the first buffer and advance from there
-    struct seqbuf_block *block = buf->head;
-
-    // Advance blocks until the offset resides within the block
-    while (blockofs > block->len) {
-
-        blockofs -= block->len;
-        block = block->next;
-
-        // The next block doesn't exist (this shouldn't ever happen)
-        if (block == NULL) {
-            LOG(LERR, "buffer doesn't exist but it should.");
-            return -1;
-        }
+    size_t ofs = ((long) from - buf->start) % buf->limit;
+    if (ofs >= buf->count) {
+        LOG(LERR, "read from %zu is before the buffer start %zu",
+            from, buf->start);
+        return -ERANGE;
     }
 
-    // TODO: Try mmap() buffers into one contiguous region with one memcpy call
+    // We can only read at most what is available, or what is requested.
+    // However it wraps, the data is contiguous in the mapping
+    size_t toread = MIN(len, buf->count - ofs);
+    void *data = buf->buf + buf->head + ofs;
 
-    while (total_read < toread && block != NULL) {
-
-        void *data = block + 1;
-        size_t left_in_block = MIN(toread - total_read, block->len - blockofs);
-
-        // Read up to the end of the current buffer
-        memcpy(dest + total_read, data + blockofs, left_in_block);
+    if (sum != NULL)
+        *sum = ~in_csum_copy(dest, data, toread, 0);
+    else
+        memcpy(dest, data, toread);
 
-        // Advance counters and pointers
-        total_read += left_in_block;
-        // Offset within each buffer frame. mod bufsize prevents over-reading
-        blockofs = (blockofs + total_read) % block->len;
+    return toread;
+}
 
-        block = block->next;
-    }
+long seqbuf_read(seqbuf_t *buf, size_t from, void *dest, size_t len) {
+    return _seqbuf_read(buf, from, dest, len, NULL);
+}
 
-    return total_read;
+long seqbuf_read_csum(seqbuf_t *buf, size_t from, void *dest, size_t len,
+                      uint16_t *sum) {
+    return _seqbuf_read(buf, from, dest, len, sum);
 }
 
 long seqbuf_write(seqbuf_t *buf, const void *src, size_t len) {
     if (buf == NULL)
         return -EINVAL;
 
-    struct seqbuf_block *block;
-
-    // Allocate a new buffer to write the entire segment into
-    block = malloc(sizeof(struct seqbuf_block) + len);
-    if (block == NULL)
+    if (buf->count + len > buf->size && seqbuf_grow(buf, buf->count + len))
         return -ENOMEM;
 
-    // Copy the data into it
-    void *data = block + 1;
-    memcpy(data, src, len);
-
-    // Update the buffer size
+    // The second view takes any part of the write past the end of the first
+    memcpy(buf->buf + buf->head + buf->count, src, len);
     buf->count += len;
 
-    // There are no blocks in the buffer, this is the first
-    if (buf->head == NULL)
-        buf->head = block;
-    else
-        buf->tail->next = block;
-
-    block->len = len;
-    block->next = NULL;
-    // The tail of the buffer is always the newest block
-    buf->tail = block;
-
-    LOG(LINFO, "added new seqbuf block %p, %zu bytes, %zu total",
-        block, len, buf->count);
+    LOG(LTRCE, "wrote %zu bytes to seqbuf, %zu total", len, buf->count);
 
     return len;
 }
@@ -126,42 +190,19 @@ int seqbuf_consume(seqbuf_t *buf, size_t from, size_t len) {
     if (buf == NULL)
         return -EINVAL;
 
-    if (seqbuf_available(buf, from) < len) {
+    size_t ofs = ((long) from - buf->start) % buf->limit;
+    if (ofs > buf->count || buf->count - ofs < len) {
         LOG(LERR, "len (%zu) > buf->count (%zu), from %zu", len, buf->count, from);
         return -ERANGE;
     }
 
     LOG(LTRCE, "consuming %ld bytes from %zu (out of %ld)", len, from, buf->count);
 
-    size_t blocksize = buf->head->len - (from - buf->start);
-
-    while (len >= blocksize) {
-
-        // Update # of bytes left to remove
-        len -= blocksize;
-
-        // Move the start to the next unconsumed block
-        buf->start += blocksize;
-        buf->count -= blocksize;
-
-        // Store the old head so we can update the new one
-        void *tofree = buf->head;
-
-        // Update the head to the next block before free'ing the pointer
-        buf->head = buf->head->next;
-
-        free(tofree);
-
-        // We've free'd every block. We're done now
-        if (buf->head == NULL)
-            break;
-
-        // Update the blocksize for the next iteration if buf->head isn't NULL
-        blocksize = buf->head->len;
-    }
-
-    if (buf->head == NULL)
-        buf->tail = NULL;
+    // Everything before from goes too
+    size_t n = ofs + len;
+    buf->start += n;
+    buf->count -= n;
+    buf->head = buf->count > 0 ? (buf->head + n) % buf->size : 0;
 
     return 0;
 }
@@ -103,6 +103,9 @@ void arp_recv(struct frame *frame) {
 }
 
 void arp_log_tbl(struct intf *intf, loglvl_t level) {
+    if (!log_enabled(level))
+        return;
+
     struct log_trans trans = LOG_TRANS(level);
     LOGT(&trans, "Intf\tProtocol\tHW Address\t\tState");
     for_each_llist(&intf->arptbl) {
@@ -228,10 +231,12 @@ bool arp_cache_entry(struct intf *intf, addr_t *hwaddr, addr_t *protoaddr) {
 int arp_send_req(struct intf *intf, uint16_t hwtype,
                  addr_t *saddr, addr_t *daddr) {
 
-    struct log_trans trans = LOG_TRANS(LVERB);
-    LOGT(&trans, "arp_request(%s, %s", intf->name, straddr(saddr));
-    LOGT(&trans, ", %s);", straddr(daddr));
-    LOGT_COMMIT(&trans);
+    if (log_enabled(LVERB)) {
+        struct log_trans trans = LOG_TRANS(LVERB);
+        LOGT(&trans, "arp_request(%s, %s", intf->name, straddr(saddr));
+        LOGT(&trans, ", %s);", straddr(daddr));
+        LOGT_COMMIT(&trans);
+    }
 
     struct frame *frame = intf_frame_new(intf, intf_max_frame_size(intf));
     struct arp_ipv4 *req = frame_data_alloc(frame, sizeof(struct arp_ipv4));
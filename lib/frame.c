@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
 #include <errno.h>
@@ -5,18 +6,38 @@
 #define NETSTACK_LOG_UNIT "FRAME"
 #include <netstack/log.h>
 #include <netstack/frame.h>
+#include <netstack/col/pool.h>
+
+// Shared pool for struct frame allocations
+static struct pool frame_pool;
+
+int frame_pool_init(void) {
+    return pool_init(&frame_pool, sizeof(struct frame), FRAME_POOL_SIZE);
+}
+
+void frame_pool_free(void) {
+    if (frame_pool.mem == NULL)
+        return;
+
+    struct pool_stats stats;
+    pool_get_stats(&frame_pool, &stats);
+    LOG(LINFO, "frame pool: %zu/%zu in use, high-water %zu, %zu misses",
+        stats.used, stats.count, stats.high_water, stats.misses);
+
+    pool_free(&frame_pool);
+}
 
 struct frame *frame_init(struct intf *intf, void *buffer, size_t buf_size) {
-    struct frame *frame = calloc(1, sizeof(struct frame));
+    struct frame *frame = pool_get(&frame_pool, sizeof(struct frame));
+    memset(frame, 0, sizeof(struct frame));
     frame->intf = intf;
     if (buffer != NULL)
         frame_init_buf(frame, buffer, buf_size);
 
-    // Allocate space for 4 protocol layers by default
-    alist_init(&frame->layer, 4);
+    // Store protocol layers inline until there are too many
+    alist_init_fixed(&frame->layer, frame->layers, FRAME_LAYERS_INLINE);
     atomic_init(&frame->refcount, 1);
 
-    pthread_rwlock_init(&frame->lock, NULL);
     frame_lock(frame, SHARED_RW);
 
     return frame;
@@ -27,22 +48,29 @@ struct frame *frame_clone(struct frame *orig, enum shared_mode mode) {
         return NULL;
     }
 
-    struct frame *clone = calloc(1, sizeof(struct frame));
+    struct frame *clone = pool_get(&frame_pool, sizeof(struct frame));
     memcpy(clone, orig, sizeof(struct frame));
     // Clones don't have the buffer ptr, this prevents them free'ing it
     clone->buffer = NULL;
     clone->buf_sz = 0;
 
-    // Allocate and copy the protocol stack arraylist
-    alist_lock(&orig->layer);
-    clone->layer.arr = malloc(orig->layer.len);
-    memcpy(clone->layer.arr, orig->layer.arr, orig->layer.len);
-    alist_unlock(&orig->layer);
+    // Copy the protocol stack, inline unless the original has overflowed
+    clone->layer.lock = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER;
+    alist_init_fixed(&clone->layer, clone->layers, FRAME_LAYERS_INLINE);
+    if (orig->layer.count > FRAME_LAYERS_INLINE) {
+        clone->layer.arr = malloc(orig->layer.len * sizeof(struct frame_layer));
+        clone->layer.len = orig->layer.len;
+    }
+    memcpy(clone->layer.arr, orig->layer.arr,
+           orig->layer.count * sizeof(struct frame_layer));
+    clone->layer.count = orig->layer.count;
 
-    // Clones have their own refcount
+    // Clones have their own refcount and owner
     atomic_init(&clone->refcount, 1);
-
-    pthread_rwlock_init(&clone->lock, NULL);
+#ifdef NETSTACK_DEBUG_FRAME
+    atomic_init(&clone->owner, 0);
+    atomic_init(&clone->readers, 0);
+#endif
     frame_lock(clone, mode);
 
     return clone;
@@ -74,7 +102,7 @@ uint frame_decref(struct frame *frame) {
 
         // If another thread gains access here, after unlocking, it is a bug
         // That thread needs to be holding a reference to prevent deallocation
-        free(frame);
+        pool_put(&frame_pool, frame);
     }
 
     return val - 1;
@@ -97,7 +125,7 @@ uint frame_decref_unlock(struct frame *frame) {
 
         // If another thread gains access here, after unlocking, it is a bug
         // That thread needs to be holding a reference to prevent deallocation
-        free(frame);
+        pool_put(&frame_pool, frame);
     } else{
         // Just unlock
         frame_unlock(frame);
@@ -111,9 +139,10 @@ int frame_layer_push_ptr(struct frame *f, proto_t prot, void *hdr, void *data) {
     if (f == NULL || prot == 0 || hdr == NULL)
         return -EINVAL;
 
+    // The layer list is only modified by the frame owner, so it isn't locked
     struct frame_layer *elem;
     ssize_t ret;
-    if ((ret = alist_add(&f->layer, (void **) &elem)) < 0)
+    if ((ret = alist_add_unlocked(&f->layer, (void **) &elem)) < 0)
         return (int) ret;
 
     elem->proto = prot;
@@ -125,7 +154,7 @@ int frame_layer_push_ptr(struct frame *f, proto_t prot, void *hdr, void *data) {
 
 struct frame_layer *frame_layer_outer(struct frame *frame, uint8_t rel) {
     // Ensure relative position is within the bounds of the elements in the arr
-    if (((int8_t) frame->layer.count - rel) < 0)
+    if (((int8_t) frame->layer.count - rel) <= 0)
         return NULL;
 
     // Index the layer array for a relative frame from the end
@@ -133,3 +162,53 @@ struct frame_layer *frame_layer_outer(struct frame *frame, uint8_t rel) {
     struct frame_layer *layer = &frame->layer.arr[frame->layer.count - 1 - rel];
     return (layer->proto == 0) ? NULL : layer;
 }
+
+#ifdef NETSTACK_DEBUG_FRAME
+void _frame_lock(struct frame *frame, enum shared_mode mode,
+                 const char *file, int line) {
+    uintptr_t self = (uintptr_t) pthread_self(), owner = 0;
+
+    if (mode == SHARED_RD) {
+        // Any number of threads may read whilst nobody is writing. The owner
+        // reads under its ownership, so isn't counted as a reader; its
+        // frame_unlock() releases ownership rather than a read
+        owner = atomic_load(&frame->owner);
+        if (owner == self)
+            return;
+        if (owner == 0) {
+            atomic_fetch_add(&frame->readers, 1);
+            return;
+        }
+    } else if (atomic_compare_exchange_strong(&frame->owner, &owner, self) ||
+               owner == self) {
+        // Ownership may be taken again by the owning thread
+        if (owner == self || atomic_load(&frame->readers) == 0)
+            return;
+        LOG(LCRIT, "%s:%d: frame %p is being read by %u other threads",
+            file, line, frame, atomic_load(&frame->readers));
+        abort();
+    }
+
+    LOG(LCRIT, "%s:%d: frame %p is owned by another thread (%s)",
+        file, line, frame, mode == SHARED_RW ? "write" : "read");
+    abort();
+}
+
+void _frame_unlock(struct frame *frame, const char *file, int line) {
+    uintptr_t self = (uintptr_t) pthread_self(), owner = self;
+
+    if (atomic_compare_exchange_strong(&frame->owner, &owner, 0))
+        return;
+
+    // Releasing an unowned frame is harmless, releasing another's isn't
+    if (owner != 0) {
+        LOG(LCRIT, "%s:%d: frame %p released by a thread not owning it",
+            file, line, frame);
+        abort();
+    }
+
+    uint readers = atomic_load(&frame->readers);
+    while (readers > 0 &&
+           !atomic_compare_exchange_weak(&frame->readers, &readers, readers - 1));
+}
+#endif
@@ -1,9 +1,14 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/random.h>
 #include <netinet/in.h>
 
 #define NETSTACK_LOG_UNIT "INET"
 #include <netstack/inet/ipv4.h>
 #include <netstack/tcp/tcp.h>
 #include <netstack/checksum.h>
+#include <netstack/lock/epoch.h>
 
 uint16_t inet_ipv4_csum(struct ipv4_hdr *hdr) {
     struct inet_ipv4_phdr pseudo_hdr;
@@ -15,60 +20,295 @@ uint16_t inet_ipv4_csum(struct ipv4_hdr *hdr) {
     return ~in_csum(&pseudo_hdr, sizeof(pseudo_hdr), 0);
 }
 
-struct inet_sock *inet_sock_lookup(llist_t *socks,
-                                   addr_t *remaddr, addr_t *locaddr,
-                                   uint16_t remport, uint16_t locport) {
-    // TODO: Use hashtbl instead of list to lookup sockets
+/*
+ * Socket table hashing
+ */
+
+static inline uint32_t inet_hash_rotl(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
 
-    pthread_mutex_lock(&socks->lock);
+// One MurmurHash3 block. Mixes k into the running hash h
+static inline uint32_t inet_hash_mix(uint32_t h, uint32_t k) {
+    k *= 0xcc9e2d51;
+    k = inet_hash_rotl(k, 15);
+    k *= 0x1b873593;
+    h ^= k;
+    h = inet_hash_rotl(h, 13);
+    return h * 5 + 0xe6546b64;
+}
 
-    for_each_llist(socks) {
-        struct inet_sock *sock = llist_elem_data();
-        if (!sock) {
-            LOG(LWARN, "tcp_sockets contains a NULL element!");
-            continue;
+// Folds an address into one word. NULL and zero addresses fold to 0
+static inline uint32_t inet_hash_addr(addr_t *addr) {
+    if (addr == NULL)
+        return 0;
+    switch (addr->proto) {
+        case PROTO_IPV4:
+            return addr->ipv4;
+        case PROTO_IPV6: {
+            uint32_t w[4];
+            memcpy(w, addr->ipv6, sizeof(w));
+            return w[0] ^ w[1] ^ w[2] ^ w[3];
         }
+        default:
+            return 0;
+    }
+}
+
+static inline uint32_t inet_hash(uint32_t seed, addr_t *remaddr,
+                                 addr_t *locaddr, uint16_t remport,
+                                 uint16_t locport) {
+    uint32_t h = seed;
+    h = inet_hash_mix(h, inet_hash_addr(remaddr));
+    h = inet_hash_mix(h, inet_hash_addr(locaddr));
+    h = inet_hash_mix(h, ((uint32_t) remport << 16) | locport);
+
+    // MurmurHash3 finaliser
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline struct inet_sock_hashtbl *inet_socktbl_get(
+        struct inet_socktbl *tbl, uint8_t hashed) {
+    return hashed == INET_HASH_LISTEN ? &tbl->listen : &tbl->estab;
+}
+
+static struct inet_sock_buckets *inet_sock_buckets_new(size_t size) {
+    struct inet_sock_buckets *bk =
+            malloc(sizeof(*bk) + size * sizeof(bk->head[0]));
+    if (bk == NULL)
+        return NULL;
+
+    bk->size = size;
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&bk->head[i], inet_sock_nulls(i));
+    return bk;
+}
 
+/*
+ * Moves every socket in ht into a new array of size buckets and releases the
+ * old one once readers are done with it. The table lock must be held
+ */
+static int inet_socktbl_resize(struct inet_socktbl *tbl,
+                               struct inet_sock_hashtbl *ht, size_t size) {
+    struct inet_sock_buckets *new = inet_sock_buckets_new(size);
+    if (new == NULL)
+        return -ENOMEM;
 
-        // struct log_trans t = LOG_TRANS(LDBUG);
-        // LOGT(&t, "remote: %s:%hu ", straddr(remaddr), remport);
-        // LOGT(&t, "local: %s:%hu ", straddr(locaddr), locport);
-        // LOGT_COMMIT(&t);
+    struct inet_sock_buckets *old = atomic_load(&ht->buckets);
+    atomic_fetch_add(&tbl->seq, 1);
 
-        // Check matching saddr assuming it's non-zero
-        if (!addrzero(&sock->remaddr) && !addreq(remaddr, &sock->remaddr)) {
-            // LOG(LDBUG, "Remote address %s doesn't match", straddr(remaddr));
-            // LOG(LDBUG, "   compared to %s", straddr(&sock->remaddr));
-            continue;
+    for (size_t i = 0; old != NULL && i < old->size; i++) {
+        struct inet_sock *sock = atomic_load(&old->head[i]);
+        while (!inet_sock_is_nulls(sock)) {
+            struct inet_sock *next = atomic_load(&sock->hnext);
+            size_t idx = sock->hash & (size - 1);
+            atomic_store(&old->head[i], next);
+            atomic_store(&sock->hnext, atomic_load(&new->head[idx]));
+            atomic_store(&new->head[idx], sock);
+            sock = next;
         }
-        // Check matching remport assuming it's non-zero
-        if (sock->remport != 0 && sock->remport != remport) {
-            // LOG(LDBUG, "Remote port %hu doesn't match %hu", sock->remport, remport);
-            continue;
+    }
+
+    atomic_store(&ht->buckets, new);
+    atomic_fetch_add(&tbl->seq, 1);
+
+    if (old != NULL)
+        epoch_defer(free, old);
+    return 0;
+}
+
+/*
+ * Grows or shrinks ht if its load factor is out of range, or allocates it if
+ * it is empty. The table lock must be held
+ */
+static int inet_socktbl_balance(struct inet_socktbl *tbl,
+                                struct inet_sock_hashtbl *ht) {
+    if (tbl->seed == 0) {
+        // Keep remote hosts from choosing ports that collide
+        if (getrandom(&tbl->seed, sizeof(tbl->seed), 0) != sizeof(tbl->seed))
+            tbl->seed = (uint32_t) time(NULL) ^ (uint32_t) rand();
+        tbl->seed |= 1;
+    }
+
+    struct inet_sock_buckets *bk = atomic_load(&ht->buckets);
+    if (bk == NULL)
+        return inet_socktbl_resize(tbl, ht, INET_SOCKTBL_MIN);
+    else if (ht->count > bk->size)
+        return inet_socktbl_resize(tbl, ht, bk->size * 2);
+    else if (ht->count < bk->size / 8 && bk->size > INET_SOCKTBL_MIN)
+        return inet_socktbl_resize(tbl, ht, bk->size / 2);
+    return 0;
+}
+
+// Checks whether two sockets would be tabled under the same key
+static inline bool inet_sock_keyeq(struct inet_sock *a, struct inet_sock *b) {
+    return a->locport == b->locport && a->remport == b->remport &&
+           (addreq(&a->locaddr, &b->locaddr) ||
+            (addrzero(&a->locaddr) && addrzero(&b->locaddr))) &&
+           (addreq(&a->remaddr, &b->remaddr) ||
+            (addrzero(&a->remaddr) && addrzero(&b->remaddr)));
+}
+
+/*
+ * Unlinks sock from its bucket, leaving sock->hnext intact for any reader
+ * passing over it. The table lock must be held
+ */
+static void _inet_sock_unhash(struct inet_socktbl *tbl,
+                              struct inet_sock *sock) {
+    struct inet_sock_hashtbl *ht = inet_socktbl_get(tbl, sock->hashed);
+    struct inet_sock_buckets *bk = atomic_load(&ht->buckets);
+
+    // The table may have been freed already
+    if (bk != NULL) {
+        struct inet_sock *_Atomic *p = &bk->head[sock->hash & (bk->size - 1)];
+        struct inet_sock *cur;
+        while (!inet_sock_is_nulls(cur = atomic_load(p))) {
+            if (cur == sock) {
+                atomic_store(p, atomic_load(&sock->hnext));
+                ht->count--;
+                break;
+            }
+            p = &cur->hnext;
         }
+    }
+    sock->hashed = INET_HASH_NONE;
+}
+
+int inet_sock_hash(struct inet_socktbl *tbl, struct inet_sock *sock) {
+    uint8_t hashed = addrzero(&sock->remaddr) && sock->remport == 0 ?
+                     INET_HASH_LISTEN : INET_HASH_ESTAB;
+    struct inet_sock_hashtbl *ht = inet_socktbl_get(tbl, hashed);
+    int ret;
 
-        // Check matching daddr assuming it's non-zero
-        if (!addrzero(&sock->locaddr) && !addreq(locaddr, &sock->locaddr)) {
-            // LOG(LDBUG, "Local address %s doesn't match", straddr(remaddr));
-            // LOG(LDBUG, "  compared to %s", straddr(&sock->remaddr));
-            continue;
+    pthread_mutex_lock(&tbl->lock);
+    if (atomic_load(&ht->buckets) == NULL &&
+            (ret = inet_socktbl_balance(tbl, ht)) < 0) {
+        pthread_mutex_unlock(&tbl->lock);
+        return ret;
+    }
+
+    // Listening sockets are keyed without the (zero) remote endpoint
+    uint32_t hash = hashed == INET_HASH_LISTEN ?
+            inet_hash(tbl->seed, NULL, &sock->locaddr, 0, sock->locport) :
+            inet_hash(tbl->seed, &sock->remaddr, &sock->locaddr,
+                      sock->remport, sock->locport);
+    struct inet_sock_buckets *bk = atomic_load(&ht->buckets);
+    struct inet_sock *_Atomic *head = &bk->head[hash & (bk->size - 1)];
+
+    for (struct inet_sock *other = atomic_load(head);
+         !inet_sock_is_nulls(other); other = atomic_load(&other->hnext)) {
+        if (other != sock && inet_sock_keyeq(sock, other)) {
+            pthread_mutex_unlock(&tbl->lock);
+            return -EADDRINUSE;
         }
-        if (locport != sock->locport) {
-            // LOG(LDBUG, "Local port %hu doesn't match %hu", sock->locport, remport);
-            continue;
+    }
+
+    if (sock->hashed != INET_HASH_NONE)
+        _inet_sock_unhash(tbl, sock);
+
+    // Fill in the socket before it becomes visible to readers
+    sock->hash = hash;
+    sock->hashed = hashed;
+    atomic_store_explicit(&sock->hnext, atomic_load(head),
+                          memory_order_relaxed);
+    atomic_store_explicit(head, sock, memory_order_release);
+    ht->count++;
+
+    // Failing to grow only makes chains longer
+    inet_socktbl_balance(tbl, ht);
+    pthread_mutex_unlock(&tbl->lock);
+    return 0;
+}
+
+void inet_sock_unhash(struct inet_socktbl *tbl, struct inet_sock *sock) {
+    if (sock->hashed == INET_HASH_NONE)
+        return;
+
+    pthread_mutex_lock(&tbl->lock);
+    struct inet_sock_hashtbl *ht = inet_socktbl_get(tbl, sock->hashed);
+    _inet_sock_unhash(tbl, sock);
+    if (atomic_load(&ht->buckets) != NULL)
+        inet_socktbl_balance(tbl, ht);
+    pthread_mutex_unlock(&tbl->lock);
+}
+
+/*
+ * Searches one table for a socket matching the key. A listening socket
+ * matches on locaddr, or on the wildcard address if locaddr is NULL
+ */
+static struct inet_sock *inet_sock_find(struct inet_socktbl *tbl,
+                                        struct inet_sock_hashtbl *ht,
+                                        addr_t *remaddr, addr_t *locaddr,
+                                        uint16_t remport, uint16_t locport) {
+    bool listen = ht == &tbl->listen;
+    struct inet_sock_buckets *bk;
+    struct inet_sock *sock;
+    unsigned int seq;
+    uint32_t hash;
+    size_t idx;
+
+    do {
+        seq = atomic_load_explicit(&tbl->seq, memory_order_acquire);
+        if ((bk = atomic_load_explicit(&ht->buckets,
+                                       memory_order_acquire)) == NULL)
+            return NULL;
+
+        hash = listen ? inet_hash(tbl->seed, NULL, locaddr, 0, locport) :
+                        inet_hash(tbl->seed, remaddr, locaddr, remport, locport);
+        idx = hash & (bk->size - 1);
+
+        sock = atomic_load_explicit(&bk->head[idx], memory_order_acquire);
+        for (; !inet_sock_is_nulls(sock);
+               sock = atomic_load_explicit(&sock->hnext,
+                                           memory_order_acquire)) {
+            if (sock->hash != hash || sock->locport != locport)
+                continue;
+            if (listen ? (locaddr ? addreq(locaddr, &sock->locaddr)
+                                  : addrzero(&sock->locaddr))
+                       : (sock->remport == remport &&
+                          addreq(remaddr, &sock->remaddr) &&
+                          addreq(locaddr, &sock->locaddr)))
+                return sock;
         }
 
-        // t = (struct log_trans) LOG_TRANS(LDBUG);
-        // LOGT(&t, "Found matching tcp_sock\t");
-        // LOGT(&t, "\tsource: %s:%hu ", straddr(&sock->remaddr), sock->remport);
-        // LOGT(&t, "\tdest: %s:%hu ", straddr(&sock->locaddr), sock->locport);
-        // LOGT_COMMIT(&t);
+        // Retry if the search strayed onto another chain or raced a resize
+    } while (inet_sock_nulls_idx(sock) != idx || (seq & 1) ||
+             atomic_load_explicit(&tbl->seq, memory_order_acquire) != seq);
 
-        // Passed all matching checks
-        pthread_mutex_unlock(&socks->lock);
+    return NULL;
+}
+
+struct inet_sock *inet_sock_lookup(struct inet_socktbl *tbl,
+                                   addr_t *remaddr, addr_t *locaddr,
+                                   uint16_t remport, uint16_t locport) {
+    struct inet_sock *sock;
+
+    // Connected sockets match the address/port quad exactly
+    if ((sock = inet_sock_find(tbl, &tbl->estab, remaddr, locaddr,
+                               remport, locport)) != NULL)
         return sock;
-    }
 
-    pthread_mutex_unlock(&socks->lock);
-    return NULL;
+    // Otherwise fall back to listening sockets, on locaddr then the wildcard
+    if ((sock = inet_sock_find(tbl, &tbl->listen, NULL, locaddr,
+                               0, locport)) != NULL)
+        return sock;
+
+    return inet_sock_find(tbl, &tbl->listen, NULL, NULL, 0, locport);
+}
+
+void inet_socktbl_free(struct inet_socktbl *tbl) {
+    struct inet_sock_hashtbl *tables[] = { &tbl->estab, &tbl->listen };
+
+    pthread_mutex_lock(&tbl->lock);
+    for (size_t t = 0; t < sizeof(tables) / sizeof(*tables); t++) {
+        free(atomic_load(&tables[t]->buckets));
+        atomic_store(&tables[t]->buckets, NULL);
+        tables[t]->count = 0;
+    }
+    pthread_mutex_unlock(&tbl->lock);
 }
@@ -119,8 +119,12 @@ int send_icmp_reply(struct frame *ctrl) {
     echo->seq = ping->seq;
     hdr->type = ICMP_T_ECHORPLY;
     hdr->code = 0;
-    hdr->csum = 0;
-    hdr->csum = in_csum(hdr, frame_pkt_len(reply), 0);
+
+    // The reply only differs from the (already verified) request by type and
+    // code, so update the request checksum instead of summing the payload
+    struct icmp_hdr *req = frame_layer_outer(ctrl, 1)->hdr;
+    hdr->csum = in_csum_update16(req->csum, *(uint16_t *) req,
+                                 *(uint16_t *) hdr);
 
     frame_unlock(reply);
 
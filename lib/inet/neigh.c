@@ -24,11 +24,13 @@ int neigh_find_route(struct neigh_route *out) {
         return -EHOSTUNREACH;
     }
 
-    struct log_trans t = LOG_TRANS(LTRCE);
-    LOGT(&t, "Route found:  daddr %s", straddr(&rt->daddr));
-    LOGT(&t, " gwaddr %s", straddr(&rt->gwaddr));
-    LOGT(&t, " nmask %s", straddr(&rt->netmask));
-    LOGT_COMMIT(&t);
+    if (log_enabled(LTRCE)) {
+        struct log_trans t = LOG_TRANS(LTRCE);
+        LOGT(&t, "Route found:  daddr %s", straddr(&rt->daddr));
+        LOGT(&t, " gwaddr %s", straddr(&rt->gwaddr));
+        LOGT(&t, " nmask %s", straddr(&rt->netmask));
+        LOGT_COMMIT(&t);
+    }
 
     // TODO: Perform correct route/hardware address lookups when appropriate
     if (rt->intf == NULL) {
@@ -142,7 +144,13 @@ int neigh_send_to(struct neigh_route *rt, struct frame *frame, uint8_t proto,
             }
 
             // No existing ARP entry found. Request one
-            
+
+            // The frame may be held for a while, so it mustn't tie up
+            // interface resources such as transmit ring slots
+            int ret;
+            if ((ret = intf_frame_detach(frame)) < 0)
+                return ret;
+
             // Increase the refcount so other threads can use frame
             frame_incref(frame);
 
@@ -158,6 +166,7 @@ int neigh_send_to(struct neigh_route *rt, struct frame *frame, uint8_t proto,
             pending->proto = proto;
             pending->flags = flags;
             pending->sock_flags = sock_flags;
+            pending->timeout = (timeout_t) TIMEOUT_INITIALISER;
 
             // Lock retlock atomically with respect to 'pending'
             neigh_queued_lock(pending);
@@ -177,7 +186,7 @@ int neigh_send_to(struct neigh_route *rt, struct frame *frame, uint8_t proto,
 
             // TODO: Use inet_socket for passing options to neighbour
 
-            int ret = 0;
+            ret = 0;
             struct timespec to = {.tv_sec = ARP_WAIT_TIMEOUT};
 
             // If NONBLOCK flag is set, don't wait, just set the expiry timer
@@ -194,6 +203,9 @@ int neigh_send_to(struct neigh_route *rt, struct frame *frame, uint8_t proto,
                 LOG(LDBUG, "Requesting hwaddr for %s, (wait %lds)",
                       straddr(&rt->nexthop), to.tv_sec);
 
+                // Ensure the ARP request is sent before waiting on it
+                intf_batch_flush();
+
                 // Wait for packet to be sent, or timeout to occur
                 err = retlock_timedwait_bare(&pending->retwait, &to, &ret);
 
@@ -240,10 +252,13 @@ void neigh_update_hwaddr(struct intf *intf, addr_t *daddr, addr_t *hwaddr) {
                 timeout_clear(&tosend->timeout);
             }
 
-            struct log_trans trans = LOG_TRANS(LDBUG);
-            LOGT(&trans, "Sending queued packet to %s", straddr(&tosend->nexthop));
-            LOGT(&trans, " with hwaddr %s", straddr(hwaddr));
-            LOGT_COMMIT(&trans);
+            if (log_enabled(LDBUG)) {
+                struct log_trans trans = LOG_TRANS(LDBUG);
+                LOGT(&trans, "Sending queued packet to %s",
+                     straddr(&tosend->nexthop));
+                LOGT(&trans, " with hwaddr %s", straddr(hwaddr));
+                LOGT_COMMIT(&trans);
+            }
 
             // Remove queued packet from queue and unlock list
             llist_remove_nolock(&intf->neigh_outqueue, tosend);
@@ -13,6 +13,128 @@
 // Private functions
 void _intf_recv_thread(struct intf *intf);
 
+// Maximum distinct interfaces tracked per transmit batch
+#define INTF_BATCH_MAX  4
+
+/*
+ * Per-thread transmit batch state, see intf_batch_begin()
+ */
+static __thread struct {
+    uint depth;
+    uint count;
+    struct intf *intf[INTF_BATCH_MAX];  /* Interfaces to flush() */
+    uint queued;
+    struct frame *queue[INTF_SEND_BATCH];   /* Frames for send_frames() */
+} intf_batch = {0};
+
+/*
+ * Sends all frames queued in the batch with send_frames(), in order
+ */
+static void _intf_batch_send(void) {
+    uint i = 0;
+    while (i < intf_batch.queued) {
+        // Send runs of consecutive frames for the same interface together
+        struct intf *intf = intf_batch.queue[i]->intf;
+        uint n = 1;
+        while (i + n < intf_batch.queued &&
+               intf_batch.queue[i + n]->intf == intf)
+            n++;
+
+        long ret = intf->send_frames(intf, &intf_batch.queue[i], n);
+        if (ret < 0)
+            LOGSE(LINFO, "send_frames() returned %ld", ret, ret);
+
+        for (uint j = i; j < i + n; j++)
+            frame_decref(intf_batch.queue[j]);
+        i += n;
+    }
+    intf_batch.queued = 0;
+}
+
+
+/*
+ * Flushes the interface now, or when the current batch ends
+ */
+static void _intf_batch_add(struct intf *intf) {
+    if (intf_batch.depth == 0) {
+        intf_flush(intf);
+        return;
+    }
+    for (uint i = 0; i < intf_batch.count; i++)
+        if (intf_batch.intf[i] == intf)
+            return;
+
+    // Flush immediately if the interface can't be tracked
+    if (intf_batch.count < INTF_BATCH_MAX)
+        intf_batch.intf[intf_batch.count++] = intf;
+    else
+        intf_flush(intf);
+}
+
+void intf_batch_begin(void) {
+    intf_batch.depth++;
+}
+
+void intf_batch_end(void) {
+    if (intf_batch.depth == 0 || --intf_batch.depth > 0)
+        return;
+
+    intf_batch_flush();
+}
+
+void intf_batch_flush(void) {
+    _intf_batch_send();
+    for (uint i = 0; i < intf_batch.count; i++)
+        intf_flush(intf_batch.intf[i]);
+    intf_batch.count = 0;
+}
+
+int intf_flush(struct intf *intf) {
+    if (intf == NULL || intf->flush == NULL)
+        return 0;
+
+    long ret = intf->flush(intf);
+    if (ret < 0)
+        LOGSE(LINFO, "flush() returned %ld", ret, ret);
+
+    return (int) ((ret < 0) ? ret : 0);
+}
+
+int intf_frame_detach(struct frame *frame) {
+    if (frame == NULL || frame->intf == NULL || frame->buffer == NULL)
+        return 0;
+    if (frame->intf->detach_buffer == NULL)
+        return 0;
+
+    return frame->intf->detach_buffer(frame);
+}
+
+/*
+ * Writes a packet log entry for frame, parsing a clone so the frame itself
+ * is left untouched. Packet logs are costly so callers should check
+ * pkt_log_enabled() first
+ */
+static void _intf_log_frame(struct frame *frame, struct timespec *time) {
+    // Use transactional logging for packet logs
+    struct pkt_log log = PKT_TRANS(LFRAME);
+    if (time != NULL)
+        memcpy(&log.t.time, time, sizeof(struct timespec));
+
+    struct frame *logframe = frame_clone(frame, SHARED_RD);
+    switch (frame->intf->proto) {
+        case PROTO_ETHER:
+            LOGT_OPT_COMMIT(ether_log(&log, logframe), &log.t);
+            break;
+        case PROTO_IP:
+        case PROTO_IPV4:
+            LOGT_OPT_COMMIT(ipv4_log(&log, logframe), &log.t);
+            break;
+        default:
+            LOGT_DISPOSE(&log.t);
+            break;
+    }
+    frame_decref_unlock(logframe);
+}
 
 int intf_dispatch(struct frame *frame) {
 
@@ -23,29 +145,25 @@ int intf_dispatch(struct frame *frame) {
         frame_incref(frame);
         frame_lock(frame, SHARED_RD);
 
-        // Log outgoing packets
-        struct pkt_log log = PKT_TRANS(LFRAME);
-        struct frame *logframe = frame_clone(frame, SHARED_RD);
-
-        switch (frame->intf->proto) {
-            case PROTO_ETHER:
-                LOGT_OPT_COMMIT(ether_log(&log, logframe), &log.t);
-                break;
-            case PROTO_IP:
-            case PROTO_IPV4:
-                LOGT_OPT_COMMIT(ipv4_log(&log, logframe), &log.t);
-                break;
-            default:
-                break;
+        // Log outgoing packets, only if anything will be written
+        if (pkt_log_enabled(LFRAME))
+            _intf_log_frame(frame, NULL);
+
+        // Send the frame, or queue it until the batch is flushed
+        struct intf *intf = frame->intf;
+        if (intf_batch.depth > 0 && intf->send_frames != NULL) {
+            frame_incref(frame);
+            intf_batch.queue[intf_batch.queued++] = frame;
+            if (intf_batch.queued == INTF_SEND_BATCH)
+                _intf_batch_send();
+        } else {
+            ret = intf->send_frame(frame);
+            if (ret < 0)
+                LOGSE(LINFO, "send_frame() returned %ld", ret, ret);
+            else if (intf->flush != NULL)
+                _intf_batch_add(intf);
         }
 
-        frame_decref_unlock(logframe);
-
-        // Send the frame
-        ret = frame->intf->send_frame(frame);
-        if (ret < 0)
-            LOGSE(LINFO, "send_frame() returned %ld", ret, ret);
-
         frame_decref_unlock(frame);
     }
 
@@ -68,6 +186,84 @@ void intf_free_buffer(struct intf *intf, void *buffer) {
     free(buffer);
 }
 
+int intf_pool_init(struct intf *intf) {
+    if (intf == NULL)
+        return -EINVAL;
+
+    // Leave room for a VLAN tag and the FCS, as some drivers pass them up
+    size_t size = intf->mtu + sizeof(struct eth_hdr_vlan) + 4;
+    return pool_init(&intf->pool, size, INTF_POOL_SIZE);
+}
+
+void intf_pool_free(struct intf *intf) {
+    if (intf == NULL || intf->pool.mem == NULL)
+        return;
+
+    struct pool_stats stats;
+    pool_get_stats(&intf->pool, &stats);
+    LOG(LINFO, "%s buffer pool: %zu/%zu in use, high-water %zu, %zu misses",
+        intf->name, stats.used, stats.count, stats.high_water, stats.misses);
+
+    pool_free(&intf->pool);
+}
+
+void *intf_pool_buffer(struct intf *intf, size_t size) {
+    if (intf->pool.mem == NULL)
+        return malloc(size);
+
+    return pool_get(&intf->pool, size);
+}
+
+void intf_pool_free_buffer(struct intf *intf, void *buffer) {
+    pool_put(&intf->pool, buffer);
+}
+
+
+/*
+ * Pushes a received frame into the stack, then releases it
+ */
+static void _intf_recv_process(struct intf *intf, struct frame *rawframe) {
+    // TODO: Implement rx 'software' timestamping
+
+    if (rawframe->buffer == NULL || rawframe->buf_sz < 1) {
+        LOG(LERR, "recv'd frame has no data");
+        frame_decref_unlock(rawframe);
+        return;
+    }
+
+    // Release write lock: *_recv functions are read-only
+    frame_unlock(rawframe);
+    frame_lock(rawframe, SHARED_RD);
+
+    // Log received packets before the stack consumes them
+    if (pkt_log_enabled(LFRAME))
+        _intf_log_frame(rawframe, &rawframe->time);
+
+    // Push received data into the stack
+    switch (intf->proto) {
+        case PROTO_ETHER:
+            ether_recv(rawframe);
+            break;
+        case PROTO_IP:
+        case PROTO_IPV4:
+            ipv4_recv(rawframe);
+            break;
+        default:
+            LOG(LWARN, "Interface protocol %d unsupported\t", intf->proto);
+            break;
+    }
+
+    // Decrement frame refcount and unlock it regardless
+    frame_decref_unlock(rawframe);
+}
+
+/*
+ * Releases frames left in the receive vector when the thread is cancelled
+ */
+static void _intf_recv_cleanup(struct frame **frames) {
+    for (size_t i = 0; i < INTF_RECV_BATCH; i++)
+        frame_decref(frames[i]);
+}
 
 /*
  *  Receive thread used internally in the interface
@@ -80,60 +276,54 @@ void _intf_recv_thread(struct intf *intf) {
     pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-    rawframe = intf_frame_new(intf, 0);
-
-    while ((count = intf->recv_frame(rawframe)) != -1) {
-        // TODO: Implement rx 'software' timestamping
+    if (intf->recv_frames != NULL) {
+        // Read and process a whole vector of frames per wakeup
+        struct frame *frames[INTF_RECV_BATCH] = {0};
+        pthread_cleanup_push((void (*)(void *)) _intf_recv_cleanup, frames) ;
 
-        if (count < 1) {
-            LOG(LERR, "interface returned an empty frame");
-            continue;
-        }
-        if (rawframe->buffer == NULL || rawframe->buf_sz < 1) {
-            LOG(LERR, "recv'd frame has no data");
-            continue;
-        }
+        do {
+            for (size_t i = 0; i < INTF_RECV_BATCH; i++)
+                if (frames[i] == NULL)
+                    frames[i] = intf_frame_new(intf, 0);
 
-        // Use transactional logging for packet logs
-        struct frame *logframe = frame_clone(rawframe, SHARED_RD);
-        struct pkt_log log = PKT_TRANS(LFRAME);
-        memcpy(&log.t.time, &rawframe->time, sizeof(struct timespec));
-
-        // Release write lock: *_recv functions are read-only
-        frame_unlock(rawframe);
-        frame_lock(rawframe, SHARED_RD);
-
-        // TODO: Conditionally print debugging information
-        // Push received data into the stack
-        switch (intf->proto) {
-            case PROTO_ETHER:
-                LOGT_OPT_COMMIT(ether_log(&log, logframe), &log.t);
-                ether_recv(rawframe);
-                break;
-            case PROTO_IP:
-            case PROTO_IPV4:
-                LOGT_OPT_COMMIT(ipv4_log(&log, logframe), &log.t);
-                ipv4_recv(rawframe);
+            if ((count = intf->recv_frames(intf, frames, INTF_RECV_BATCH)) < 0)
                 break;
-            default:
-                LOG(LWARN, "Interface protocol %d unsupported\t", intf->proto);
-                break;
-        }
 
-        // Decref and unlock logframe
-        frame_decref_unlock(logframe);
+            // Replies to the whole vector are sent together
+            intf_batch_begin();
+            for (ssize_t i = 0; i < count; i++) {
+                _intf_recv_process(intf, frames[i]);
+                frames[i] = NULL;
+            }
+            intf_batch_end();
+
+            // Check if the thread should exit
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            pthread_testcancel();
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        } while (true);
+
+        pthread_cleanup_pop(true);
+    } else {
+        rawframe = intf_frame_new(intf, 0);
 
-        // Decrement frame refcount and unlock it regardless
-        frame_decref_unlock(rawframe);
-        rawframe = NULL;
+        while ((count = intf->recv_frame(rawframe)) != -1) {
+            if (count < 1) {
+                LOG(LERR, "interface returned an empty frame");
+                continue;
+            }
 
-        // Check if the thread should exit
-        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-        pthread_testcancel();
-        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            _intf_recv_process(intf, rawframe);
+            rawframe = NULL;
 
-        // Allocate a new frame
-        rawframe = intf_frame_new(intf, 0);
+            // Check if the thread should exit
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            pthread_testcancel();
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+            // Allocate a new frame
+            rawframe = intf_frame_new(intf, 0);
+        }
     }
 
     if (count == -1) {
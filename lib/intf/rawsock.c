@@ -2,12 +2,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sysexits.h>
 #include <errno.h>
 #include <pthread.h>
 
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 #include <netpacket/packet.h>
 #include <linux/if_ether.h>
@@ -105,20 +105,35 @@ int rawsock_new(struct intf *interface) {
 
     LOG(LINFO, "Using interface (#%d) %s, mtu %d", ifindex, ifname, mtu);
 
+    interface->mtu = (size_t) mtu;
+    if ((err = intf_pool_init(interface)) < 0) {
+        LOGSE(LERR, "intf_pool_init", -err);
+        free(hwaddr);
+        sys_close(sock);
+        return err;
+    }
+
     struct intf_rawsock *ll = malloc(sizeof(struct intf_rawsock));
     ll->sock = sock;
     ll->if_index = ifindex;
 
     interface->ll = ll;
     interface->ll_addr = hwaddr;
-    interface->mtu = (size_t) mtu;
     interface->type = INTF_RAWSOCK;
     interface->proto = PROTO_ETHER;
     interface->free = rawsock_free;
     interface->recv_frame = rawsock_recv_frame;
     interface->send_frame = rawsock_send_frame;
-    interface->new_buffer = intf_malloc_buffer;
-    interface->free_buffer = intf_free_buffer;
+#ifdef _GNU_SOURCE
+    interface->recv_frames = rawsock_recv_frames;
+    interface->send_frames = rawsock_send_frames;
+#else
+    // Without recvmmsg() and sendmmsg(), frames go one at a time
+    interface->recv_frames = NULL;
+    interface->send_frames = NULL;
+#endif
+    interface->new_buffer = intf_pool_buffer;
+    interface->free_buffer = intf_pool_free_buffer;
 
     return 0;
 }
@@ -129,6 +144,7 @@ void rawsock_free(struct intf *intf) {
     sys_close(sockptr->sock);
     free(sockptr);
     free(intf->ll_addr);
+    intf_pool_free(intf);
     llist_iter(&intf->arptbl, free);
     llist_clear(&intf->arptbl);
     llist_iter(&intf->inet, free);
@@ -156,8 +172,8 @@ long rawsock_recv_frame(struct frame *frame) {
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
     pthread_cleanup_pop(false);
 
-    // TODO: Allocate a buffer from the interface for frame storage
-    frame_init_buf(frame, malloc((size_t) lookahead), lookahead);
+    size_t size = (size_t) lookahead;
+    frame_init_buf(frame, interface->new_buffer(interface, size), size);
     frame->data = frame->buffer;
 
     // Allocate msghdr to receive packet & ancillary data into
@@ -192,15 +208,8 @@ long rawsock_recv_frame(struct frame *frame) {
     // Warn if the sizes don't match (should probably never happen)
     if (count != lookahead) {
         LOG(LWARN, "MSG_PEEK != recv(): %zi != %zi", lookahead, count);
-
-        // realloc a (larger?) new buffer if the size differs, just in case
-        void *newbuf;
-        if ((newbuf = realloc(frame->buffer, (size_t) count)) == NULL) {
-            LOG(LCRIT, "Failed to reallocate new buffer of %zi bytes", count);
-            exit(EX_OSERR);
-        }
-        frame->buffer = newbuf;
-        LOG(LNTCE, "realloc()'ed a new buffer of size %zi", count);
+        frame_init_buf(frame, frame->buffer, (size_t) count);
+        frame->data = frame->buffer;
     }
 
     return count;
@@ -219,3 +228,121 @@ long rawsock_send_frame(struct frame *frame) {
 
     return ret < 0 ? errno : ret;
 }
+
+#ifdef _GNU_SOURCE
+long rawsock_recv_frames(struct intf *intf, struct frame **frames,
+                         size_t count) {
+    struct intf_rawsock *ll = (struct intf_rawsock *) intf->ll;
+    size_t size = intf->mtu + sizeof(struct eth_hdr_vlan) + 4;
+
+    if (count > RAWSOCK_BATCH)
+        count = RAWSOCK_BATCH;
+
+    struct mmsghdr msgs[RAWSOCK_BATCH] = {0};
+    struct iovec iovs[RAWSOCK_BATCH];
+    uint8_t ctrl[RAWSOCK_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+
+    for (size_t i = 0; i < count; i++) {
+        struct frame *frame = frames[i];
+        // Reuse buffers left over from the last call
+        if (frame->buffer == NULL)
+            frame_init_buf(frame, intf->new_buffer(intf, size), size);
+
+        iovs[i].iov_base = frame->buffer;
+        iovs[i].iov_len = size;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = ctrl[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+    }
+
+    // Allow cancellation around recvmmsg() as this is the main blocking call
+    // Frames are released by the caller if the thread is cancelled
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    int ret = sys_recvmmsg(ll->sock, msgs, (unsigned int) count,
+                           MSG_WAITFORONE, NULL);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    if (ret < 0) {
+        LOGERR("recvmmsg");
+        return -1;
+    }
+
+    // Compact received frames to the front of the vector, leaving frames that
+    // weren't read (or were truncated) at the back for reuse
+    size_t read = 0;
+    for (size_t i = 0; i < (size_t) ret; i++) {
+        struct frame *frame = frames[i];
+        struct msghdr *msgh = &msgs[i].msg_hdr;
+
+        if (msgh->msg_flags & MSG_TRUNC) {
+            LOG(LWARN, "Dropped truncated frame of %u bytes", msgs[i].msg_len);
+            continue;
+        }
+
+        frame_init_buf(frame, frame->buffer, msgs[i].msg_len);
+        frame->data = frame->buffer;
+
+        struct cmsghdr *cmsg;
+        for (cmsg = CMSG_FIRSTHDR(msgh);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_SOCKET)
+                && (cmsg->cmsg_type == SO_TIMESTAMPNS))
+                memcpy(&frame->time, CMSG_DATA(cmsg), sizeof(frame->time));
+        }
+
+        frames[i] = frames[read];
+        frames[read++] = frame;
+    }
+
+    return (long) read;
+}
+
+long rawsock_send_frames(struct intf *intf, struct frame **frames,
+                         size_t count) {
+    struct intf_rawsock *ll = (struct intf_rawsock *) intf->ll;
+    struct mmsghdr msgs[RAWSOCK_BATCH] = {0};
+    struct iovec iovs[RAWSOCK_BATCH];
+    struct sockaddr_ll sas[RAWSOCK_BATCH];
+    size_t sent = 0;
+    long err = 0;
+
+    while (sent < count) {
+        size_t n = count - sent;
+        if (n > RAWSOCK_BATCH)
+            n = RAWSOCK_BATCH;
+
+        for (size_t i = 0; i < n; i++) {
+            struct frame *frame = frames[sent + i];
+            sas[i] = (struct sockaddr_ll) {
+                    .sll_family = AF_PACKET,
+                    .sll_ifindex = ll->if_index,
+                    .sll_halen = ETH_ADDR_LEN
+            };
+            memcpy(sas[i].sll_addr, eth_hdr(frame)->daddr, ETH_ADDR_LEN);
+
+            iovs[i].iov_base = frame->head;
+            iovs[i].iov_len = frame_pkt_len(frame);
+            msgs[i].msg_hdr = (struct msghdr) {
+                    .msg_name = &sas[i],
+                    .msg_namelen = sizeof(struct sockaddr_ll),
+                    .msg_iov = &iovs[i],
+                    .msg_iovlen = 1
+            };
+        }
+
+        // sendmmsg() may send fewer than requested; resend the remainder
+        int ret = sys_sendmmsg(ll->sock, msgs, (unsigned int) n, 0);
+        if (ret < 0) {
+            // Skip the frame that failed so the rest still get sent
+            LOGERR("sendmmsg");
+            err = -errno;
+            ret = 1;
+        }
+        sent += ret;
+    }
+
+    return err < 0 ? err : (long) sent;
+}
+#endif
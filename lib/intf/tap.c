@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
 
 #include <sys/ioctl.h>
 
@@ -21,7 +22,8 @@ int tap_new(struct intf *interface) {
         return EINVAL;
 
     int fd;
-    if ((fd = open("/dev/net/tun", O_RDWR)) < 0) {
+    // Non-blocking so tap_recv_frames() can drain the queue without blocking
+    if ((fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) < 0) {
         return fd;
     }
 
@@ -63,11 +65,19 @@ int tap_new(struct intf *interface) {
     for (int i = 0; i < ETH_ADDR_LEN; ++i)
         hwaddr[i] = (uint8_t) req.ifr_hwaddr.sa_data[i];
 
+    interface->mtu = (size_t) mtu;
+    int err;
+    if ((err = intf_pool_init(interface)) < 0) {
+        LOGSE(LERR, "intf_pool_init", -err);
+        free(hwaddr);
+        close(fd);
+        return err;
+    }
+
     int *ll = malloc(sizeof(int));
     *ll = fd;
     interface->ll = ll;
     interface->ll_addr = hwaddr;
-    interface->mtu = (size_t) mtu;
     // Zero then copy interface name
     memset(interface->name, 0, IFNAMSIZ);
     strncpy(interface->name, devname, IFNAMSIZ);
@@ -76,14 +86,25 @@ int tap_new(struct intf *interface) {
     interface->free = tap_free;
     interface->recv_frame = tap_recv_frame;
     interface->send_frame = tap_send_frame;
-    interface->new_buffer = intf_malloc_buffer;
-    interface->free_buffer = intf_free_buffer;
+    interface->recv_frames = tap_recv_frames;
+    interface->send_frames = tap_send_frames;
+    interface->new_buffer = intf_pool_buffer;
+    interface->free_buffer = intf_pool_free_buffer;
 
     return 0;
 }
 
 void tap_free(struct intf *intf) {
+    intf_pool_free(intf);
+}
 
+/*
+ * Blocks until the tap device is readable
+ */
+static void tap_wait(int fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (sys_poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        LOGERR("poll");
 }
 
 long tap_recv_frame(struct frame *frame) {
@@ -95,15 +116,23 @@ long tap_recv_frame(struct frame *frame) {
 
     // TODO: Check for IFF_PI and allocate space for it
     size_t size = interface->mtu + sizeof(struct eth_hdr_vlan) + 4;
-    frame_init_buf(frame, malloc(size), size);
+    void *buffer = interface->new_buffer(interface, size);
+    if (buffer == NULL) {
+        LOGERR("new_buffer");
+        return -1;
+    }
+    frame_init_buf(frame, buffer, size);
     frame->data = frame->buffer;
 
     // Allow cancellation around peek() as this is the main blocking call
     pthread_cleanup_push((void (*)(void *)) frame_decref, frame) ;
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 
-    if ((count = sys_read(sock, frame->buffer, frame->buf_sz)) == -1)
-        return (int) count;
+    while ((count = sys_read(sock, frame->buffer, frame->buf_sz)) == -1) {
+        if (errno != EAGAIN)
+            return (int) count;
+        tap_wait(sock);
+    }
 
     // Don't allow cancellation from here onwards
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
@@ -129,3 +158,54 @@ long tap_send_frame(struct frame *frame) {
 
     return 0;
 }
+
+long tap_recv_frames(struct intf *intf, struct frame **frames, size_t count) {
+    int sock = *((int *) intf->ll);
+    size_t size = intf->mtu + sizeof(struct eth_hdr_vlan) + 4;
+    size_t read = 0;
+
+    // A tap device returns one frame per read(2), so drain it until empty
+    while (read < count) {
+        struct frame *frame = frames[read];
+        if (frame->buffer == NULL) {
+            void *buffer = intf->new_buffer(intf, size);
+            if (buffer == NULL) {
+                // Pass up what was read, the caller retries the rest
+                LOGERR("new_buffer");
+                return read > 0 ? (long) read : -1;
+            }
+            frame_init_buf(frame, buffer, size);
+        }
+
+        ssize_t len = sys_read(sock, frame->buffer, size);
+        if (len > 0) {
+            frame_init_buf(frame, frame->buffer, (size_t) len);
+            frame->data = frame->buffer;
+            read++;
+        } else if (len == -1 && errno == EAGAIN) {
+            if (read > 0)
+                break;
+
+            // Allow cancellation whilst waiting for the first frame.
+            // Frames are released by the caller if the thread is cancelled
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            tap_wait(sock);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        } else if (len == -1 && errno != EINTR) {
+            LOGERR("read");
+            return -1;
+        }
+    }
+
+    return (long) read;
+}
+
+long tap_send_frames(struct intf *intf, struct frame **frames, size_t count) {
+    long err = 0, ret;
+    // Skip frames that fail so the rest still get sent
+    for (size_t i = 0; i < count; i++)
+        if ((ret = tap_send_frame(frames[i])) != 0)
+            err = -ret;
+
+    return err < 0 ? err : (long) count;
+}
@@ -0,0 +1,396 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+
+#define NETSTACK_LOG_UNIT "TPACKET"
+#include <netstack/log.h>
+#include <netstack/intf/tpacket.h>
+#include <netstack/api/socket.h>
+
+#define tpacket_block_desc(tp, i) \
+        ((struct tpacket_block_desc *) ((tp)->ring + \
+                                       (i) * (tp)->req.tp_block_size))
+
+#define tpacket_tx_slot(tp, i) \
+        ((struct tpacket3_hdr *) ((tp)->tx_ring + \
+                                  (i) * (tp)->tx_req.tp_frame_size))
+
+#define tpacket_tx_size(tp) \
+        ((size_t) (tp)->tx_req.tp_block_size * (tp)->tx_req.tp_block_nr)
+
+int tpacket_new(struct intf *interface) {
+    int err;
+    if ((err = rawsock_new(interface)) != 0)
+        return err;
+
+    struct intf_rawsock *raw = interface->ll;
+    int sock = raw->sock;
+
+    int ver = TPACKET_V3;
+    if (sys_setsockopt(sock, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver))) {
+        err = -errno;
+        LOGERR("setsockopt PACKET_VERSION");
+        goto error;
+    }
+
+    // Skip malformed TX slots, used to discard slots that are never sent
+    int opt = true;
+    if (sys_setsockopt(sock, SOL_PACKET, PACKET_LOSS, &opt, sizeof(opt))) {
+        err = -errno;
+        LOGERR("setsockopt PACKET_LOSS");
+        goto error;
+    }
+    // Take the frame offset from tp_mac so headers can be built backwards
+    if (sys_setsockopt(sock, SOL_PACKET, PACKET_TX_HAS_OFF, &opt, sizeof(opt))) {
+        err = -errno;
+        LOGERR("setsockopt PACKET_TX_HAS_OFF");
+        goto error;
+    }
+
+    struct tpacket_req3 req = {
+            .tp_block_size = TPACKET_BLOCK_SIZE,
+            .tp_block_nr = TPACKET_BLOCK_NR,
+            .tp_frame_size = TPACKET_FRAME_SIZE,
+            .tp_frame_nr = (TPACKET_BLOCK_SIZE / TPACKET_FRAME_SIZE) *
+                           TPACKET_BLOCK_NR,
+            .tp_retire_blk_tov = TPACKET_RETIRE_TOV
+    };
+    if (sys_setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+        err = -errno;
+        LOGERR("setsockopt PACKET_RX_RING");
+        goto error;
+    }
+
+    // Block transmit isn't supported, so the TX ring has no timeout
+    struct tpacket_req3 tx_req = {
+            .tp_block_size = TPACKET_TX_BLOCK_SIZE,
+            .tp_block_nr = TPACKET_TX_BLOCK_NR,
+            .tp_frame_size = TPACKET_TX_FRAME_SIZE,
+            .tp_frame_nr = (TPACKET_TX_BLOCK_SIZE / TPACKET_TX_FRAME_SIZE) *
+                           TPACKET_TX_BLOCK_NR
+    };
+    if (sys_setsockopt(sock, SOL_PACKET, PACKET_TX_RING, &tx_req,
+                       sizeof(tx_req))) {
+        err = -errno;
+        LOGERR("setsockopt PACKET_TX_RING");
+        goto error;
+    }
+
+    // Both rings are mapped together, RX first then TX
+    size_t ring_sz = (size_t) req.tp_block_size * req.tp_block_nr;
+    size_t tx_sz = (size_t) tx_req.tp_block_size * tx_req.tp_block_nr;
+    void *ring = mmap(NULL, ring_sz + tx_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, sock, 0);
+    if (ring == MAP_FAILED) {
+        err = -errno;
+        LOGERR("mmap");
+        goto error;
+    }
+
+    struct intf_tpacket *tp = calloc(1, sizeof(struct intf_tpacket));
+    memcpy(&tp->raw, raw, sizeof(struct intf_rawsock));
+    tp->ring = ring;
+    tp->ring_sz = ring_sz;
+    tp->req = req;
+    tp->blk = calloc(req.tp_block_nr, sizeof(struct tpacket_blk));
+    tp->tx_ring = tp->ring + ring_sz;
+    tp->tx_req = tx_req;
+    tp->tx_state = calloc(tx_req.tp_frame_nr, sizeof(atomic_uchar));
+    atomic_init(&tp->tx_head, 0);
+    atomic_init(&tp->tx_pending, 0);
+    free(raw);
+
+    LOG(LINFO, "Mapped %u x %u byte RX ring blocks, %u x %u byte TX slots",
+        req.tp_block_nr, req.tp_block_size,
+        tx_req.tp_frame_nr, tx_req.tp_frame_size);
+
+    interface->ll = tp;
+    interface->type = INTF_TPACKET;
+    interface->free = tpacket_free;
+    interface->recv_frame = tpacket_recv_frame;
+    interface->send_frame = tpacket_send_frame;
+    interface->recv_frames = NULL;
+    interface->send_frames = NULL;
+    interface->flush = tpacket_flush;
+    interface->new_buffer = tpacket_new_buffer;
+    interface->free_buffer = tpacket_free_buffer;
+    interface->detach_buffer = tpacket_detach_buffer;
+
+    return 0;
+
+error:
+    rawsock_free(interface);
+    return err;
+}
+
+void tpacket_free(struct intf *intf) {
+    struct intf_tpacket *tp = (struct intf_tpacket *) intf->ll;
+    munmap(tp->ring, tp->ring_sz + tpacket_tx_size(tp));
+    free(tp->blk);
+    free(tp->tx_state);
+    // intf->ll is free'd by rawsock_free()
+    rawsock_free(intf);
+}
+
+static void tpacket_block_put(struct intf_tpacket *tp, uint32_t i) {
+    struct tpacket_blk *blk = &tp->blk[i];
+    if (atomic_fetch_sub(&blk->refs, 1) == 1) {
+        // Last reference to the block, hand it back to the kernel
+        struct tpacket_block_desc *desc = tpacket_block_desc(tp, i);
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                         __ATOMIC_RELEASE);
+        atomic_store_explicit(&blk->busy, false, memory_order_release);
+    }
+}
+
+/*
+ * Finds the TX slot index for a buffer, or -1 if it isn't in the TX ring
+ */
+static long tpacket_tx_index(struct intf_tpacket *tp, void *buffer) {
+    uint8_t *buf = buffer;
+    if (buf < tp->tx_ring || buf >= tp->tx_ring + tpacket_tx_size(tp))
+        return -1;
+    return (buf - tp->tx_ring) / tp->tx_req.tp_frame_size;
+}
+
+/*
+ * Claims the next slot in the TX ring, in ring order
+ */
+static long tpacket_tx_claim(struct intf_tpacket *tp) {
+    uint32_t head = atomic_load(&tp->tx_head);
+    uint32_t slot;
+    do {
+        slot = head % tp->tx_req.tp_frame_nr;
+        uint32_t status = __atomic_load_n(&tpacket_tx_slot(tp, slot)->tp_status,
+                                          __ATOMIC_ACQUIRE);
+        // Slots can't be skipped, so the ring is full if the head is in use
+        if (atomic_load(&tp->tx_state[slot]) != TPACKET_SLOT_FREE ||
+                status != TP_STATUS_AVAILABLE)
+            return -1;
+    } while (!atomic_compare_exchange_weak(&tp->tx_head, &head, head + 1));
+
+    atomic_store(&tp->tx_state[slot], TPACKET_SLOT_OWNED);
+    return slot;
+}
+
+/*
+ * Hands a slot to the kernel. A zero length discards the slot
+ */
+static void tpacket_tx_ready(struct intf_tpacket *tp, long slot,
+                             uint32_t off, uint32_t len) {
+    struct tpacket3_hdr *hdr = tpacket_tx_slot(tp, slot);
+    hdr->tp_next_offset = 0;
+    hdr->tp_mac = off;
+    hdr->tp_len = len;
+    hdr->tp_snaplen = len;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+                     __ATOMIC_RELEASE);
+    atomic_fetch_add(&tp->tx_pending, 1);
+}
+
+void *tpacket_new_buffer(struct intf *intf, size_t size) {
+    struct intf_tpacket *tp = (struct intf_tpacket *) intf->ll;
+
+    long slot;
+    if (size <= tp->tx_req.tp_frame_size - TPACKET_TX_DATA &&
+            (slot = tpacket_tx_claim(tp)) >= 0)
+        return (uint8_t *) tpacket_tx_slot(tp, slot) + TPACKET_TX_DATA;
+
+    return intf_pool_buffer(intf, size);
+}
+
+void tpacket_free_buffer(struct intf *intf, void *buffer) {
+    struct intf_tpacket *tp = (struct intf_tpacket *) intf->ll;
+    uint8_t *buf = buffer;
+
+    if (buf >= tp->ring && buf < tp->ring + tp->ring_sz) {
+        tpacket_block_put(tp, (uint32_t) ((buf - tp->ring) /
+                                          tp->req.tp_block_size));
+        return;
+    }
+
+    long slot = tpacket_tx_index(tp, buffer);
+    if (slot < 0) {
+        intf_pool_free_buffer(intf, buffer);
+        return;
+    }
+
+    uint8_t state = TPACKET_SLOT_OWNED;
+    if (atomic_compare_exchange_strong(&tp->tx_state[slot], &state,
+                                       TPACKET_SLOT_FREE)) {
+        // The slot was never sent. The kernel stops at the first slot that
+        // isn't ready, so it must be marked ready to be skipped over
+        tpacket_tx_ready(tp, slot, TPACKET_TX_DATA, 0);
+    } else {
+        // The kernel releases the slot once it has been transmitted
+        atomic_store(&tp->tx_state[slot], TPACKET_SLOT_FREE);
+    }
+}
+
+int tpacket_detach_buffer(struct frame *frame) {
+    struct intf *intf = frame->intf;
+    struct intf_tpacket *tp = (struct intf_tpacket *) intf->ll;
+    uint8_t *old = frame->buffer;
+
+    if (tpacket_tx_index(tp, old) < 0)
+        return 0;
+
+    uint8_t *buf = intf_pool_buffer(intf, frame->buf_sz);
+    if (buf == NULL)
+        return -ENOMEM;
+    memcpy(buf, old, frame->buf_sz);
+
+    // Rebase all pointers into the old buffer
+    #define rebase(ptr) ((ptr) = buf + ((uint8_t *) (ptr) - old))
+    rebase(frame->head);
+    rebase(frame->data);
+    rebase(frame->tail);
+    for (size_t i = 0; i < frame->layer.count; i++) {
+        struct frame_layer *layer = &frame->layer.arr[i];
+        if ((uint8_t *) layer->hdr >= old &&
+                (uint8_t *) layer->hdr < old + frame->buf_sz)
+            rebase(layer->hdr);
+        if ((uint8_t *) layer->data >= old &&
+                (uint8_t *) layer->data <= old + frame->buf_sz)
+            rebase(layer->data);
+    }
+    #undef rebase
+    frame->buffer = buf;
+
+    tpacket_free_buffer(intf, old);
+    return 0;
+}
+
+long tpacket_send_frame(struct frame *frame) {
+    struct intf *intf = frame->intf;
+    struct intf_tpacket *tp = (struct intf_tpacket *) intf->ll;
+    size_t len = frame_pkt_len(frame);
+
+    long slot = tpacket_tx_index(tp, frame->buffer);
+    if (slot >= 0) {
+        // Built in place, the frame still owns the slot until it is free'd
+        struct tpacket3_hdr *hdr = tpacket_tx_slot(tp, slot);
+        atomic_store(&tp->tx_state[slot], TPACKET_SLOT_QUEUED);
+        tpacket_tx_ready(tp, slot, (uint32_t) (frame->head - (uint8_t *) hdr),
+                         (uint32_t) len);
+        return len;
+    }
+
+    // The frame was built elsewhere. Copy it into the ring if it fits
+    if (len > tp->tx_req.tp_frame_size - TPACKET_TX_DATA ||
+            (slot = tpacket_tx_claim(tp)) < 0)
+        return rawsock_send_frame(frame);
+
+    memcpy((uint8_t *) tpacket_tx_slot(tp, slot) + TPACKET_TX_DATA,
+           frame->head, len);
+    atomic_store(&tp->tx_state[slot], TPACKET_SLOT_FREE);
+    tpacket_tx_ready(tp, slot, TPACKET_TX_DATA, (uint32_t) len);
+
+    return len;
+}
+
+long tpacket_flush(struct intf *intf) {
+    struct intf_tpacket *tp = (struct intf_tpacket *) intf->ll;
+
+    uint pending = atomic_exchange(&tp->tx_pending, 0);
+    if (pending == 0)
+        return 0;
+
+    // A single send() transmits every ready slot from the ring head
+    ssize_t ret = sys_send(tp->raw.sock, NULL, 0, MSG_DONTWAIT);
+    if (ret < 0) {
+        ret = -errno;
+        // Slots are left ready, try again on the next flush
+        if (ret == -EAGAIN || ret == -ENOBUFS)
+            atomic_fetch_add(&tp->tx_pending, pending);
+    }
+
+    return ret;
+}
+
+long tpacket_recv_frame(struct frame *frame) {
+
+    struct intf *interface = frame->intf;
+    struct intf_tpacket *tp = (struct intf_tpacket *) interface->ll;
+    bool stalled = false;
+
+    while (tp->remaining == 0) {
+        // Finished walking the current block, drop the reader's reference
+        if (tp->next != NULL) {
+            tpacket_block_put(tp, tp->block);
+            tp->block = (tp->block + 1) % tp->req.tp_block_nr;
+            tp->next = NULL;
+        }
+
+        struct tpacket_blk *blk = &tp->blk[tp->block];
+        struct tpacket_block_desc *desc = tpacket_block_desc(tp, tp->block);
+
+        // A block still referenced from the last pass around the ring has not
+        // been refilled, even though its status is still TP_STATUS_USER
+        if (atomic_load_explicit(&blk->busy, memory_order_acquire)) {
+            if (!stalled) {
+                LOG(LWARN, "RX ring stalled on block %u (%u refs)",
+                    tp->block, atomic_load(&blk->refs));
+                stalled = true;
+            }
+            struct timespec wait = {.tv_sec = 0, .tv_nsec = 1000000};
+            pthread_cleanup_push((void (*)(void *)) frame_decref, frame) ;
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            nanosleep(&wait, NULL);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            pthread_cleanup_pop(false);
+            continue;
+        }
+
+        uint32_t status = __atomic_load_n(&desc->hdr.bh1.block_status,
+                                          __ATOMIC_ACQUIRE);
+        if (status & TP_STATUS_USER) {
+            // Take the block. The reader holds a reference whilst walking it
+            atomic_store(&blk->refs, 1);
+            atomic_store(&blk->busy, true);
+            tp->remaining = desc->hdr.bh1.num_pkts;
+            tp->next = (struct tpacket3_hdr *)
+                    ((uint8_t *) desc + desc->hdr.bh1.offset_to_first_pkt);
+            continue;
+        }
+
+        // Block the thread until the kernel retires the next block
+        struct pollfd pfd = {
+                .fd = tp->raw.sock,
+                .events = POLLIN | POLLERR
+        };
+        int ret;
+        pthread_cleanup_push((void (*)(void *)) frame_decref, frame) ;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        ret = sys_poll(&pfd, 1, -1);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        pthread_cleanup_pop(false);
+
+        if (ret == -1 && errno != EINTR)
+            return -1;
+    }
+
+    struct tpacket3_hdr *hdr = tp->next;
+    tp->remaining--;
+    if (hdr->tp_next_offset != 0)
+        tp->next = (struct tpacket3_hdr *)
+                ((uint8_t *) hdr + hdr->tp_next_offset);
+
+    // Each frame holds a reference to the block it points into
+    atomic_fetch_add(&tp->blk[tp->block].refs, 1);
+
+    frame_init_buf(frame, (uint8_t *) hdr + hdr->tp_mac, hdr->tp_snaplen);
+    frame->data = frame->buffer;
+    frame->time.tv_sec = hdr->tp_sec;
+    frame->time.tv_nsec = hdr->tp_nsec;
+
+    return hdr->tp_snaplen;
+}
@@ -0,0 +1,491 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#define NETSTACK_LOG_UNIT "XDP"
+#include <netstack/log.h>
+#include <netstack/intf/xdp.h>
+#include <netstack/intf/rawsock.h>
+#include <netstack/api/socket.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define xdp_in_umem(x, buf) \
+        ((uint8_t *) (buf) >= (x)->umem && \
+         (uint8_t *) (buf) < (x)->umem + (x)->umem_sz)
+
+static int sys_bpf(int cmd, union bpf_attr *attr) {
+    return (int) syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * Loads a program redirecting every packet to the AF_XDP socket in the
+ * XSKMAP for the queue it arrived on, or passing it on to the kernel if there
+ * isn't one:  return bpf_redirect_map(&map, ctx->rx_queue_index, XDP_PASS);
+ */
+static int xdp_load_prog(int map_fd) {
+    struct bpf_insn prog[] = {
+            // r2 = ctx->rx_queue_index
+            {.code = BPF_LDX | BPF_MEM | BPF_W, .dst_reg = BPF_REG_2,
+             .src_reg = BPF_REG_1,
+             .off = offsetof(struct xdp_md, rx_queue_index)},
+            // r1 = map (wide instruction, takes 2 slots)
+            {.code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1,
+             .src_reg = BPF_PSEUDO_MAP_FD, .imm = map_fd},
+            {0},
+            // r3 = XDP_PASS
+            {.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3,
+             .imm = XDP_PASS},
+            {.code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map},
+            {.code = BPF_JMP | BPF_EXIT}
+    };
+
+    union bpf_attr attr = {0};
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t) (uintptr_t) prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(struct bpf_insn);
+    attr.license = (uint64_t) (uintptr_t) "GPL";
+
+    return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int xdp_ring_map(struct intf_xdp *x, struct xdp_ring *ring,
+                        struct xdp_ring_offset *off, size_t desc_sz,
+                        off_t pgoff) {
+    ring->map_sz = off->desc + XDP_RING_SIZE * desc_sz;
+    ring->map = mmap(NULL, ring->map_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, x->sock, pgoff);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        return -errno;
+    }
+
+    ring->producer = (uint32_t *) ((uint8_t *) ring->map + off->producer);
+    ring->consumer = (uint32_t *) ((uint8_t *) ring->map + off->consumer);
+    ring->desc = (uint8_t *) ring->map + off->desc;
+    ring->mask = XDP_RING_SIZE - 1;
+    return 0;
+}
+
+static void xdp_destroy(struct intf_xdp *x) {
+    if (x->link_fd >= 0)
+        sys_close(x->link_fd);
+    if (x->prog_fd >= 0)
+        sys_close(x->prog_fd);
+    if (x->map_fd >= 0)
+        sys_close(x->map_fd);
+    if (x->sock >= 0)
+        sys_close(x->sock);
+
+    struct xdp_ring *rings[] = {&x->fill, &x->comp, &x->rx, &x->tx};
+    for (int i = 0; i < 4; i++)
+        if (rings[i]->map != NULL)
+            munmap(rings[i]->map, rings[i]->map_sz);
+    if (x->umem != NULL)
+        munmap(x->umem, x->umem_sz);
+
+    pthread_mutex_destroy(&x->free_lock);
+    pthread_mutex_destroy(&x->tx_lock);
+    free(x->free);
+    free(x->refs);
+    free(x);
+}
+
+static bool xdp_chunk_pop(struct intf_xdp *x, uint64_t *addr) {
+    bool found = false;
+    pthread_mutex_lock(&x->free_lock);
+    if (x->free_count > 0) {
+        *addr = x->free[--x->free_count];
+        found = true;
+    }
+    pthread_mutex_unlock(&x->free_lock);
+    return found;
+}
+
+/*
+ * Drops a reference to a chunk, returning it to the free list on the last
+ */
+static void xdp_chunk_put(struct intf_xdp *x, uint64_t addr) {
+    uint64_t idx = addr / XDP_CHUNK_SIZE;
+    if (atomic_fetch_sub(&x->refs[idx], 1) != 1)
+        return;
+
+    pthread_mutex_lock(&x->free_lock);
+    x->free[x->free_count++] = idx * XDP_CHUNK_SIZE;
+    pthread_mutex_unlock(&x->free_lock);
+}
+
+/*
+ * Gives free chunks to the kernel for reception
+ */
+static void xdp_refill(struct intf_xdp *x) {
+    struct xdp_ring *fill = &x->fill;
+    uint32_t prod = *fill->producer;
+    uint32_t cons = __atomic_load_n(fill->consumer, __ATOMIC_ACQUIRE);
+    uint32_t space = (fill->mask + 1) - (prod - cons);
+    if (space == 0)
+        return;
+
+    uint64_t *desc = fill->desc;
+    uint32_t n;
+    pthread_mutex_lock(&x->free_lock);
+    for (n = 0; n < space && x->free_count > 0; n++)
+        desc[(prod + n) & fill->mask] = x->free[--x->free_count];
+    pthread_mutex_unlock(&x->free_lock);
+
+    if (n > 0)
+        __atomic_store_n(fill->producer, prod + n, __ATOMIC_RELEASE);
+}
+
+/*
+ * Releases the kernel reference on chunks that have been transmitted
+ * Note: x->tx_lock must be held
+ */
+static void xdp_reclaim(struct intf_xdp *x) {
+    struct xdp_ring *comp = &x->comp;
+    uint32_t cons = *comp->consumer;
+    uint32_t prod = __atomic_load_n(comp->producer, __ATOMIC_ACQUIRE);
+    if (cons == prod)
+        return;
+
+    uint64_t *desc = comp->desc;
+    for (; cons != prod; cons++)
+        xdp_chunk_put(x, desc[cons & comp->mask]);
+
+    __atomic_store_n(comp->consumer, cons, __ATOMIC_RELEASE);
+}
+
+int xdp_new(struct intf *interface) {
+    int err;
+
+    // rawsock selects the interface and queries the link properties
+    if ((err = rawsock_new(interface)) != 0)
+        return err;
+
+    struct intf_rawsock *raw = interface->ll;
+    int ifindex = raw->if_index;
+    sys_close(raw->sock);
+    free(raw);
+    interface->ll = NULL;
+    // Frames live in the UMEM instead of the interface buffer pool
+    pool_free(&interface->pool);
+
+    struct intf_xdp *x = calloc(1, sizeof(struct intf_xdp));
+    x->if_index = ifindex;
+    x->map_fd = x->prog_fd = x->link_fd = -1;
+    pthread_mutex_init(&x->free_lock, NULL);
+    pthread_mutex_init(&x->tx_lock, NULL);
+    atomic_init(&x->tx_pending, 0);
+
+    if ((x->sock = sys_socket(AF_XDP, SOCK_RAW, 0)) < 0) {
+        err = -errno;
+        LOGERR("socket AF_XDP");
+        goto error;
+    }
+
+    // Register the UMEM with the socket
+    x->umem_sz = (size_t) XDP_NUM_CHUNKS * XDP_CHUNK_SIZE;
+    x->umem = mmap(NULL, x->umem_sz, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (x->umem == MAP_FAILED) {
+        x->umem = NULL;
+        err = -errno;
+        LOGERR("mmap umem");
+        goto error;
+    }
+    struct xdp_umem_reg reg = {
+            .addr = (uint64_t) (uintptr_t) x->umem,
+            .len = x->umem_sz,
+            .chunk_size = XDP_CHUNK_SIZE,
+            .headroom = 0
+    };
+    if (sys_setsockopt(x->sock, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg))) {
+        err = -errno;
+        LOGERR("setsockopt XDP_UMEM_REG");
+        goto error;
+    }
+
+    int size = XDP_RING_SIZE;
+    int ringopts[] = {XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING,
+                      XDP_RX_RING, XDP_TX_RING};
+    for (int i = 0; i < 4; i++) {
+        if (sys_setsockopt(x->sock, SOL_XDP, ringopts[i], &size, sizeof(size))) {
+            err = -errno;
+            LOGERR("setsockopt XDP ring size");
+            goto error;
+        }
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if (sys_getsockopt(x->sock, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) {
+        err = -errno;
+        LOGERR("getsockopt XDP_MMAP_OFFSETS");
+        goto error;
+    }
+
+    if ((err = xdp_ring_map(x, &x->fill, &off.fr, sizeof(uint64_t),
+                            XDP_UMEM_PGOFF_FILL_RING)) ||
+        (err = xdp_ring_map(x, &x->comp, &off.cr, sizeof(uint64_t),
+                            XDP_UMEM_PGOFF_COMPLETION_RING)) ||
+        (err = xdp_ring_map(x, &x->rx, &off.rx, sizeof(struct xdp_desc),
+                            XDP_PGOFF_RX_RING)) ||
+        (err = xdp_ring_map(x, &x->tx, &off.tx, sizeof(struct xdp_desc),
+                            XDP_PGOFF_TX_RING))) {
+        LOGSE(LERR, "mmap XDP rings", -err);
+        goto error;
+    }
+
+    // All chunks start out free, then the fill ring takes its share
+    x->refs = calloc(XDP_NUM_CHUNKS, sizeof(atomic_uchar));
+    x->free = malloc(XDP_NUM_CHUNKS * sizeof(uint64_t));
+    for (size_t i = 0; i < XDP_NUM_CHUNKS; i++)
+        x->free[i] = (XDP_NUM_CHUNKS - 1 - i) * XDP_CHUNK_SIZE;
+    x->free_count = XDP_NUM_CHUNKS;
+    xdp_refill(x);
+
+    struct sockaddr_xdp sxdp = {
+            .sxdp_family = AF_XDP,
+            .sxdp_ifindex = (uint32_t) ifindex,
+            .sxdp_queue_id = XDP_QUEUE_ID,
+            .sxdp_flags = XDP_COPY
+    };
+    if (sys_bind(x->sock, (struct sockaddr *) &sxdp, sizeof(sxdp))) {
+        err = -errno;
+        LOGERR("bind AF_XDP");
+        goto error;
+    }
+
+    // Create the XSKMAP and redirect the queue to the socket
+    union bpf_attr attr = {0};
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = XDP_QUEUE_ID + 1;
+    if ((x->map_fd = sys_bpf(BPF_MAP_CREATE, &attr)) < 0) {
+        err = -errno;
+        LOGERR("bpf BPF_MAP_CREATE");
+        goto error;
+    }
+
+    uint32_t key = XDP_QUEUE_ID;
+    uint32_t val = (uint32_t) x->sock;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t) x->map_fd;
+    attr.key = (uint64_t) (uintptr_t) &key;
+    attr.value = (uint64_t) (uintptr_t) &val;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+        err = -errno;
+        LOGERR("bpf BPF_MAP_UPDATE_ELEM");
+        goto error;
+    }
+
+    if ((x->prog_fd = xdp_load_prog(x->map_fd)) < 0) {
+        err = -errno;
+        LOGERR("bpf BPF_PROG_LOAD");
+        goto error;
+    }
+
+    // Attach in generic mode, which works for any driver
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = (uint32_t) x->prog_fd;
+    attr.link_create.target_ifindex = (uint32_t) ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    if ((x->link_fd = sys_bpf(BPF_LINK_CREATE, &attr)) < 0) {
+        err = -errno;
+        LOGERR("bpf BPF_LINK_CREATE");
+        goto error;
+    }
+
+    LOG(LINFO, "Attached AF_XDP socket to %s queue %d, %d x %d byte chunks",
+        interface->name, XDP_QUEUE_ID, XDP_NUM_CHUNKS, XDP_CHUNK_SIZE);
+
+    interface->ll = x;
+    interface->type = INTF_XDP;
+    interface->free = xdp_free;
+    interface->recv_frame = xdp_recv_frame;
+    interface->send_frame = xdp_send_frame;
+    interface->recv_frames = NULL;
+    interface->send_frames = NULL;
+    interface->flush = xdp_flush;
+    interface->new_buffer = xdp_new_buffer;
+    interface->free_buffer = xdp_free_buffer;
+    interface->detach_buffer = NULL;
+
+    return 0;
+
+error:
+    xdp_destroy(x);
+    free(interface->ll_addr);
+    interface->ll_addr = NULL;
+    return err;
+}
+
+void xdp_free(struct intf *intf) {
+    xdp_destroy((struct intf_xdp *) intf->ll);
+    free(intf->ll_addr);
+    llist_iter(&intf->arptbl, free);
+    llist_clear(&intf->arptbl);
+    llist_iter(&intf->inet, free);
+    llist_clear(&intf->inet);
+}
+
+void *xdp_new_buffer(struct intf *intf, size_t size) {
+    struct intf_xdp *x = (struct intf_xdp *) intf->ll;
+    uint64_t addr;
+
+    if (size > XDP_CHUNK_SIZE)
+        return malloc(size);
+
+    if (!xdp_chunk_pop(x, &addr)) {
+        // Try to recover chunks that have finished transmitting
+        pthread_mutex_lock(&x->tx_lock);
+        xdp_reclaim(x);
+        pthread_mutex_unlock(&x->tx_lock);
+
+        if (!xdp_chunk_pop(x, &addr))
+            return malloc(size);
+    }
+
+    atomic_store(&x->refs[addr / XDP_CHUNK_SIZE], 1);
+    return x->umem + addr;
+}
+
+void xdp_free_buffer(struct intf *intf, void *buffer) {
+    struct intf_xdp *x = (struct intf_xdp *) intf->ll;
+
+    if (xdp_in_umem(x, buffer))
+        xdp_chunk_put(x, (uint64_t) ((uint8_t *) buffer - x->umem));
+    else
+        free(buffer);
+}
+
+long xdp_recv_frame(struct frame *frame) {
+
+    struct intf *interface = frame->intf;
+    struct intf_xdp *x = (struct intf_xdp *) interface->ll;
+    struct xdp_ring *rx = &x->rx;
+
+    uint32_t cons = *rx->consumer;
+    while (__atomic_load_n(rx->producer, __ATOMIC_ACQUIRE) == cons) {
+        // Make sure the kernel has somewhere to put new packets
+        xdp_refill(x);
+
+        struct pollfd pfd = {
+                .fd = x->sock,
+                .events = POLLIN
+        };
+        int ret;
+        pthread_cleanup_push((void (*)(void *)) frame_decref, frame) ;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        ret = sys_poll(&pfd, 1, -1);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        pthread_cleanup_pop(false);
+
+        if (ret == -1 && errno != EINTR)
+            return -1;
+    }
+
+    struct xdp_desc *desc = &((struct xdp_desc *) rx->desc)[cons & rx->mask];
+    uint64_t addr = desc->addr;
+    uint32_t len = desc->len;
+    __atomic_store_n(rx->consumer, cons + 1, __ATOMIC_RELEASE);
+
+    // The frame now owns the chunk
+    atomic_store(&x->refs[addr / XDP_CHUNK_SIZE], 1);
+
+    frame_init_buf(frame, x->umem + addr, len);
+    frame->data = frame->buffer;
+    clock_gettime(CLOCK_REALTIME, &frame->time);
+
+    xdp_refill(x);
+
+    return len;
+}
+
+long xdp_send_frame(struct frame *frame) {
+    struct intf_xdp *x = (struct intf_xdp *) frame->intf->ll;
+    uint32_t len = frame_pkt_len(frame);
+    uint64_t addr;
+
+    if (xdp_in_umem(x, frame->buffer)) {
+        // The kernel holds its own reference until transmission completes
+        addr = (uint64_t) (frame->head - x->umem);
+        atomic_fetch_add(&x->refs[addr / XDP_CHUNK_SIZE], 1);
+    } else {
+        // Copy frames built elsewhere into a chunk owned only by the kernel
+        if (len > XDP_CHUNK_SIZE)
+            return -EMSGSIZE;
+        if (!xdp_chunk_pop(x, &addr))
+            return -ENOBUFS;
+        memcpy(x->umem + addr, frame->head, len);
+        atomic_store(&x->refs[addr / XDP_CHUNK_SIZE], 1);
+    }
+
+    struct xdp_ring *tx = &x->tx;
+    pthread_mutex_lock(&x->tx_lock);
+    uint32_t prod = *tx->producer;
+    if (prod - __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE) > tx->mask) {
+        // Ring is full. Kick the kernel to drain some and try once more
+        sys_sendto(x->sock, NULL, 0, MSG_DONTWAIT, NULL, 0);
+        xdp_reclaim(x);
+        if (prod - __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE) > tx->mask) {
+            pthread_mutex_unlock(&x->tx_lock);
+            xdp_chunk_put(x, addr);
+            return -ENOBUFS;
+        }
+    }
+
+    struct xdp_desc *desc = &((struct xdp_desc *) tx->desc)[prod & tx->mask];
+    desc->addr = addr;
+    desc->len = len;
+    desc->options = 0;
+    __atomic_store_n(tx->producer, prod + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&x->tx_lock);
+
+    atomic_fetch_add(&x->tx_pending, 1);
+
+    return len;
+}
+
+long xdp_flush(struct intf *intf) {
+    struct intf_xdp *x = (struct intf_xdp *) intf->ll;
+    long ret = 0;
+
+    pthread_mutex_lock(&x->tx_lock);
+    if (atomic_exchange(&x->tx_pending, 0) > 0) {
+        // Copy mode always requires a syscall to start transmission, and
+        // each call only transmits a small batch. -EAGAIN means there is more
+        struct xdp_ring *tx = &x->tx;
+        while (sys_sendto(x->sock, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0) {
+            ret = -errno;
+            if (ret != -EAGAIN || *tx->producer ==
+                    __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE))
+                break;
+        }
+        // Transient errors, the descriptors remain queued
+        if (ret == -EAGAIN || ret == -EBUSY || ret == -ENOBUFS)
+            ret = 0;
+    }
+    xdp_reclaim(x);
+    pthread_mutex_unlock(&x->tx_lock);
+
+    return ret;
+}
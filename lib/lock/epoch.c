@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define NETSTACK_LOG_UNIT "EPOCH"
+#include <netstack/log.h>
+#include <netstack/lock/epoch.h>
+
+struct epoch_entry {
+    struct epoch_entry *next;
+    void (*fn)(void *);
+    void *arg;
+    uint64_t epoch;             /* Global epoch when the entry was deferred */
+};
+
+_Atomic uint64_t epoch_global = 1;
+__thread struct epoch_thread *epoch_self = NULL;
+
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key;
+
+// epoch_lock protects the thread list, the limbo list and advancing the epoch
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct epoch_thread *epoch_threads = NULL;
+static struct epoch_entry *epoch_limbo = NULL;  /* Oldest entry first */
+static struct epoch_entry **epoch_limbo_tail = &epoch_limbo;
+
+// Removes the record of an exiting thread
+static void epoch_unregister(struct epoch_thread *self) {
+    pthread_mutex_lock(&epoch_lock);
+    for (struct epoch_thread **t = &epoch_threads; *t != NULL; t = &(*t)->next) {
+        if (*t == self) {
+            *t = self->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&epoch_lock);
+
+    epoch_self = NULL;
+    free(self);
+}
+
+static void epoch_key_create(void) {
+    pthread_key_create(&epoch_key, (void (*)(void *)) epoch_unregister);
+}
+
+struct epoch_thread *epoch_register(void) {
+    pthread_once(&epoch_once, epoch_key_create);
+
+    struct epoch_thread *self = calloc(1, sizeof(struct epoch_thread));
+    if (self == NULL) {
+        LOG(LCRIT, "Failed to allocate the thread epoch record");
+        abort();
+    }
+    atomic_init(&self->local, EPOCH_INACTIVE);
+
+    pthread_mutex_lock(&epoch_lock);
+    self->next = epoch_threads;
+    epoch_threads = self;
+    pthread_mutex_unlock(&epoch_lock);
+
+    pthread_setspecific(epoch_key, self);
+    epoch_self = self;
+    return self;
+}
+
+/*
+ * Advances the global epoch if every reader has observed the current one.
+ * epoch_lock must be held
+ */
+static bool epoch_advance(void) {
+    uint64_t epoch = atomic_load(&epoch_global);
+
+    // Order the caller's unlinking before reading any reader's epoch
+    atomic_thread_fence(memory_order_seq_cst);
+    for (struct epoch_thread *t = epoch_threads; t != NULL; t = t->next) {
+        uint64_t local = atomic_load(&t->local);
+        if (local != EPOCH_INACTIVE && (local >> 1) != epoch)
+            return false;
+    }
+
+    atomic_store(&epoch_global, epoch + 1);
+    return true;
+}
+
+/*
+ * Detaches the entries that no reader can still reach from the limbo list.
+ * epoch_lock must be held
+ */
+static struct epoch_entry *epoch_collect(void) {
+    uint64_t epoch = atomic_load(&epoch_global);
+    struct epoch_entry *expired = epoch_limbo, **tail = &epoch_limbo;
+
+    while (*tail != NULL && (*tail)->epoch + 2 <= epoch)
+        tail = &(*tail)->next;
+
+    if (tail == &epoch_limbo)
+        return NULL;
+
+    epoch_limbo = *tail;
+    if (epoch_limbo == NULL)
+        epoch_limbo_tail = &epoch_limbo;
+    *tail = NULL;
+    return expired;
+}
+
+// Calls and frees a list of entries returned by epoch_collect()
+static void epoch_run(struct epoch_entry *entry) {
+    while (entry != NULL) {
+        struct epoch_entry *next = entry->next;
+        entry->fn(entry->arg);
+        free(entry);
+        entry = next;
+    }
+}
+
+void epoch_defer(void (*fn)(void *), void *arg) {
+    struct epoch_entry *entry = malloc(sizeof(struct epoch_entry));
+    if (entry == NULL) {
+        // Without memory to queue the call, wait for the readers instead
+        pthread_mutex_lock(&epoch_lock);
+        uint64_t safe = atomic_load(&epoch_global) + 2;
+        while (atomic_load(&epoch_global) < safe) {
+            if (!epoch_advance()) {
+                pthread_mutex_unlock(&epoch_lock);
+                sched_yield();
+                pthread_mutex_lock(&epoch_lock);
+            }
+        }
+        pthread_mutex_unlock(&epoch_lock);
+        fn(arg);
+        return;
+    }
+
+    entry->next = NULL;
+    entry->fn = fn;
+    entry->arg = arg;
+
+    pthread_mutex_lock(&epoch_lock);
+    entry->epoch = atomic_load(&epoch_global);
+    *epoch_limbo_tail = entry;
+    epoch_limbo_tail = &entry->next;
+
+    // With no readers in the way, this makes the entry safe to run right away
+    for (int i = 0; i < 2 && epoch_advance(); i++);
+    struct epoch_entry *expired = epoch_collect();
+    pthread_mutex_unlock(&epoch_lock);
+
+    epoch_run(expired);
+}
+
+void epoch_barrier(void) {
+    bool empty;
+    do {
+        pthread_mutex_lock(&epoch_lock);
+        epoch_advance();
+        struct epoch_entry *expired = epoch_collect();
+        pthread_mutex_unlock(&epoch_lock);
+
+        epoch_run(expired);
+
+        pthread_mutex_lock(&epoch_lock);
+        empty = epoch_limbo == NULL;
+        pthread_mutex_unlock(&epoch_lock);
+
+        if (!empty)
+            sched_yield();
+    } while (!empty);
+}
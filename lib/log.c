@@ -4,6 +4,7 @@
 #include <sysexits.h>
 #include <errno.h>
 #include <unistd.h>
+#include <semaphore.h>
 
 #ifdef _GNU_SOURCE
 #include <pthread.h>
@@ -12,6 +13,38 @@
 #include <sys/param.h>
 #include <netstack/log.h>
 
+#define LOG_THREAD_NAME 16      /* Thread name length, including the NULL */
+
+struct log_record {
+    struct timespec time;
+    loglvl_t level;
+    char thread[LOG_THREAD_NAME];
+    char str[LOG_MAX];
+};
+
+/*
+ * Single-producer, single-consumer ring owned by one logging thread and
+ * drained by the writer thread
+ */
+struct log_ring {
+    struct log_ring *next;
+    atomic_size_t head;     /* Next record to write, owner thread only */
+    atomic_size_t tail;     /* Next record to read, writer thread only */
+    atomic_bool closed;     /* Owner thread has exited */
+    struct log_record rec[LOG_RING_SIZE];
+};
+
+struct log_async {
+    struct log_config *conf;
+    pthread_t thread;
+    atomic_bool running;
+    atomic_bool idle;       /* Writer is (about to be) waiting on wake */
+    sem_t wake;
+    pthread_key_t key;      /* Per-thread struct log_ring */
+    struct log_ring *_Atomic rings;
+    atomic_size_t dropped;  /* Entries lost to full rings */
+};
+
 struct log_config logconf = {
         .streams = LLIST_INITIALISER,
         .lvlstr  = {
@@ -39,16 +72,36 @@ struct log_config logconf = {
 
 void log_default(struct log_config *conf) {
     // Add stdout/stderr streams
-    struct log_stream *out = malloc(sizeof(struct log_stream));
-    out->stream = stdout;
-    out->min = LTRCE;
-    out->max = LNTCE - 1;
-    llist_append(&logconf.streams, out);
-    struct log_stream *err = malloc(sizeof(struct log_stream));
-    err->stream = stderr;
-    err->min = LNTCE;
-    err->max = loglvl_max - 1;
-    llist_append(&logconf.streams, err);
+    log_add_stream(conf, stdout, LTRCE, LNTCE - 1);
+    log_add_stream(conf, stderr, LNTCE, loglvl_max - 1);
+}
+
+int log_add_stream(struct log_config *conf, FILE *file, loglvl_t min,
+                   loglvl_t max) {
+    struct log_stream *stream = malloc(sizeof(struct log_stream));
+    if (stream == NULL)
+        return -ENOMEM;
+
+    stream->stream = file;
+    stream->min = min;
+    stream->max = max;
+    llist_append(&conf->streams, stream);
+    log_update(conf);
+    return 0;
+}
+
+void log_update(struct log_config *conf) {
+    uint64_t enabled[loglvl_max / 64] = {0};
+
+    for_each_llist(&conf->streams) {
+        struct log_stream *stream = llist_elem_data();
+        for (unsigned int lvl = stream->min; lvl <= stream->max; lvl++)
+            enabled[lvl / 64] |= (uint64_t) 1 << (lvl % 64);
+    }
+
+    for (size_t i = 0; i < loglvl_max / 64; i++)
+        atomic_store_explicit(&conf->enabled[i], enabled[i],
+                              memory_order_relaxed);
 }
 
 
@@ -103,33 +156,27 @@ inline void VLOGF(FILE *file, loglvl_t level, const char *fmt, va_list args) {
     VTLOGF(file, level, NULL, fmt, args);
 }
 
-void VTLOG(loglvl_t level, struct timespec *t, const char *fmt,
-           va_list args) {
-    for_each_llist(&logconf.streams) {
-        struct log_stream *stream = llist_elem_data();
-        if (level >= stream->min && level <= stream->max) {
-            VTLOGF(stream->stream, level, t, fmt, args);
-        }
-    }
+/*
+ * Gets the name of the calling thread, or an empty string if unavailable
+ */
+static void log_thread_name(char *name) {
+    name[0] = '\0';
+#ifdef _GNU_SOURCE
+    pthread_getname_np(pthread_self(), name, LOG_THREAD_NAME);
+#endif
 }
 
-void VTLOGF(FILE *file, loglvl_t level, struct timespec *t, const char *fmt,
-           va_list args) {
-    va_list args2;
-    va_copy(args2, args);
-
+/*
+ * Writes a formatted entry to file, prefixed by the time, thread name and
+ * level on every line. Modifies str
+ */
+static void log_write(FILE *file, loglvl_t level, struct timespec *t,
+                      const char *thread, char *str) {
     // Calculate string length
     int prelen = 0;
     size_t maxlen = 128;
     char pre[maxlen];
 
-    // Capture time now if one isn't specified
-    struct timespec ts = {0};
-    if (t == NULL) {
-        timespec_get(&ts, TIME_UTC);
-        t = &ts;
-    }
-
     // Format and print time the same as tcpdump for comparison
     prelen += strftime(pre, maxlen, "%T", gmtime(&t->tv_sec));
     prelen += snprintf(pre + 8, 12, ".%09ld ", t->tv_nsec);
@@ -137,9 +184,9 @@ void VTLOGF(FILE *file, loglvl_t level, struct timespec *t, const char *fmt,
     // Append thread name to pre
 #ifdef _GNU_SOURCE
     pre[prelen++] = '[';
-    char name[32];
-    pthread_getname_np(pthread_self(), name, 32);
-    size_t name_end = MIN(strlen(name), 10);
+    char name[LOG_THREAD_NAME + 1];
+    size_t name_end = MIN(strlen(thread), 10);
+    memcpy(name, thread, name_end);
     name[name_end] = ']';
     name[name_end + 1] = '\0';
     prelen += snprintf(pre + prelen, maxlen, "%-12s", name);
@@ -156,11 +203,6 @@ void VTLOGF(FILE *file, loglvl_t level, struct timespec *t, const char *fmt,
     else
         prelen += snprintf(pre + prelen, maxlen, "[%s] ", logconf.lvlstr[level]);
 
-    // Produce formatted string
-    size_t len = LOG_MAX;
-    char str[len];
-    vsnprintf(str, len, fmt, args2);
-
     pthread_mutex_lock(&logconf.lock);
 
     // Print to output file
@@ -172,11 +214,95 @@ void VTLOGF(FILE *file, loglvl_t level, struct timespec *t, const char *fmt,
         else
             fprintf(file, "%s%s\n", pre, line);
     }
-    fflush(file);
 
     pthread_mutex_unlock(&logconf.lock);
 }
 
+/*
+ * Formats an entry into the calling thread's ring, dropping it if the ring
+ * is full. Never blocks
+ */
+static void log_async_push(struct log_async *async, loglvl_t level,
+                           struct timespec *t, const char *fmt,
+                           va_list args) {
+    struct log_ring *ring = pthread_getspecific(async->key);
+    if (ring == NULL) {
+        if ((ring = calloc(1, sizeof(struct log_ring))) == NULL) {
+            atomic_fetch_add(&async->dropped, 1);
+            return;
+        }
+        ring->next = atomic_load(&async->rings);
+        while (!atomic_compare_exchange_weak(&async->rings, &ring->next, ring));
+        pthread_setspecific(async->key, ring);
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire)
+            >= LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&async->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct log_record *rec = &ring->rec[head % LOG_RING_SIZE];
+    if (t != NULL)
+        rec->time = *t;
+    else
+        timespec_get(&rec->time, TIME_UTC);
+    rec->level = level;
+    log_thread_name(rec->thread);
+    vsnprintf(rec->str, LOG_MAX, fmt, args);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    // Only wake the writer if it is waiting, avoiding a syscall per entry
+    if (atomic_exchange(&async->idle, false))
+        sem_post(&async->wake);
+}
+
+void VTLOG(loglvl_t level, struct timespec *t, const char *fmt,
+           va_list args) {
+    if (!log_enabled(level))
+        return;
+
+    struct log_async *async = atomic_load(&logconf.async);
+    if (async != NULL && level < LCRIT) {
+        log_async_push(async, level, t, fmt, args);
+        return;
+    }
+
+    for_each_llist(&logconf.streams) {
+        struct log_stream *stream = llist_elem_data();
+        if (level >= stream->min && level <= stream->max) {
+            VTLOGF(stream->stream, level, t, fmt, args);
+        }
+    }
+}
+
+void VTLOGF(FILE *file, loglvl_t level, struct timespec *t, const char *fmt,
+           va_list args) {
+    va_list args2;
+    va_copy(args2, args);
+
+    // Capture time now if one isn't specified
+    struct timespec ts = {0};
+    if (t == NULL) {
+        timespec_get(&ts, TIME_UTC);
+        t = &ts;
+    }
+
+    char name[LOG_THREAD_NAME];
+    log_thread_name(name);
+
+    // Produce formatted string
+    size_t len = LOG_MAX;
+    char str[len];
+    vsnprintf(str, len, fmt, args2);
+    va_end(args2);
+
+    log_write(file, level, t, name, str);
+    fflush(file);
+}
+
 void VLOGT(struct log_trans *trans, const char *fmt, va_list args) {
     if (trans == NULL || fmt == NULL)
         return;
@@ -221,3 +347,209 @@ void LOGT_DISPOSE(struct log_trans *trans) {
     if (trans != NULL && trans->str)
         free(trans->str);
 }
+
+
+/*
+ * Asynchronous logging
+ */
+
+static void log_async_record(struct log_config *conf, struct log_record *rec) {
+    for_each_llist(&conf->streams) {
+        struct log_stream *stream = llist_elem_data();
+        if (rec->level >= stream->min && rec->level <= stream->max)
+            log_write(stream->stream, rec->level, &rec->time, rec->thread,
+                      rec->str);
+    }
+}
+
+static void log_async_flush(struct log_config *conf) {
+    for_each_llist(&conf->streams) {
+        struct log_stream *stream = llist_elem_data();
+        fflush(stream->stream);
+    }
+}
+
+static bool log_async_before(struct timespec *a, struct timespec *b) {
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * Removes a ring from the list. Only the writer removes rings, but threads
+ * may concurrently push new rings onto the front of the list
+ */
+static void log_async_unlink(struct log_async *async, struct log_ring *ring) {
+    struct log_ring *first = ring;
+    if (atomic_compare_exchange_strong(&async->rings, &first, ring->next))
+        return;
+
+    struct log_ring *prev = atomic_load(&async->rings);
+    while (prev->next != ring)
+        prev = prev->next;
+    prev->next = ring->next;
+}
+
+/*
+ * Writes all buffered entries, oldest first across all rings, and frees the
+ * rings of exited threads
+ * @return the number of entries written
+ */
+static size_t log_async_drain(struct log_async *async) {
+    size_t count = 0;
+
+    while (true) {
+        // Find the oldest entry at the front of a ring
+        struct log_ring *oldest = NULL;
+        struct log_record *rec = NULL;
+        for (struct log_ring *ring = atomic_load(&async->rings), *next;
+             ring != NULL; ring = next) {
+            next = ring->next;
+
+            size_t tail = atomic_load_explicit(&ring->tail,
+                                               memory_order_relaxed);
+            if (atomic_load(&ring->head) == tail) {
+                // Check again after reading closed, the owner may have
+                // logged just before it exited
+                if (atomic_load(&ring->closed) &&
+                        atomic_load(&ring->head) == tail) {
+                    log_async_unlink(async, ring);
+                    free(ring);
+                }
+                continue;
+            }
+
+            struct log_record *front = &ring->rec[tail % LOG_RING_SIZE];
+            if (rec == NULL || log_async_before(&front->time, &rec->time)) {
+                oldest = ring;
+                rec = front;
+            }
+        }
+        if (oldest == NULL)
+            break;
+
+        log_async_record(async->conf, rec);
+        atomic_fetch_add_explicit(&oldest->tail, 1, memory_order_release);
+        count++;
+    }
+
+    if (count > 0)
+        log_async_flush(async->conf);
+
+    size_t dropped = atomic_exchange(&async->dropped, 0);
+    if (dropped > 0) {
+        struct log_record rec = { .level = LWARN, .thread = "log" };
+        timespec_get(&rec.time, TIME_UTC);
+        snprintf(rec.str, LOG_MAX, "%zu log entries were dropped", dropped);
+        log_async_record(async->conf, &rec);
+        log_async_flush(async->conf);
+    }
+
+    return count;
+}
+
+static bool log_async_pending(struct log_async *async) {
+    for (struct log_ring *ring = atomic_load(&async->rings); ring != NULL;
+         ring = ring->next)
+        if (atomic_load(&ring->head) != atomic_load(&ring->tail))
+            return true;
+    return false;
+}
+
+static void *log_async_run(struct log_async *async) {
+#ifdef _GNU_SOURCE
+    pthread_setname_np(pthread_self(), "log");
+#endif
+
+    while (atomic_load(&async->running)) {
+        if (log_async_drain(async) > 0)
+            continue;
+
+        // Announce that we are going to sleep, then check nothing was
+        // logged in the meantime without waking us
+        atomic_store(&async->idle, true);
+        if (!log_async_pending(async)) {
+            // Wake at least once a second to free exited threads' rings
+            struct timespec wake;
+            clock_gettime(CLOCK_REALTIME, &wake);
+            wake.tv_sec += 1;
+            while (sem_timedwait(&async->wake, &wake) == -1 && errno == EINTR);
+        }
+        atomic_store(&async->idle, false);
+    }
+
+    log_async_drain(async);
+    return NULL;
+}
+
+static void log_ring_close(struct log_ring *ring) {
+    atomic_store(&ring->closed, true);
+}
+
+/*
+ * The writer thread doesn't survive fork(2), so children log synchronously
+ */
+static void log_async_atfork_child(void) {
+    atomic_store(&logconf.async, NULL);
+}
+
+static void log_async_atfork(void) {
+    pthread_atfork(NULL, NULL, log_async_atfork_child);
+}
+
+int log_async_start(struct log_config *conf) {
+    if (atomic_load(&conf->async) != NULL)
+        return -EALREADY;
+
+    struct log_async *async = calloc(1, sizeof(struct log_async));
+    if (async == NULL)
+        return -ENOMEM;
+
+    async->conf = conf;
+    atomic_init(&async->running, true);
+    atomic_init(&async->idle, false);
+    atomic_init(&async->rings, NULL);
+    atomic_init(&async->dropped, 0);
+
+    int err;
+    if ((err = pthread_key_create(&async->key,
+                                  (void (*)(void *)) log_ring_close))) {
+        free(async);
+        return -err;
+    }
+    sem_init(&async->wake, 0, 0);
+
+    if ((err = pthread_create(&async->thread, NULL,
+                              (void *(*)(void *)) log_async_run, async))) {
+        sem_destroy(&async->wake);
+        pthread_key_delete(async->key);
+        free(async);
+        return -err;
+    }
+
+    static pthread_once_t atfork = PTHREAD_ONCE_INIT;
+    pthread_once(&atfork, log_async_atfork);
+
+    atomic_store(&conf->async, async);
+    return 0;
+}
+
+void log_async_stop(struct log_config *conf) {
+    struct log_async *async = atomic_exchange(&conf->async, NULL);
+    if (async == NULL)
+        return;
+
+    atomic_store(&async->running, false);
+    sem_post(&async->wake);
+    pthread_join(async->thread, NULL);
+
+    // Deleting the key stops destructors running for remaining threads
+    pthread_key_delete(async->key);
+    struct log_ring *ring = atomic_load(&async->rings);
+    while (ring != NULL) {
+        struct log_ring *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    sem_destroy(&async->wake);
+    free(async);
+}
@@ -5,12 +5,15 @@
 #define NETSTACK_LOG_UNIT "NETSTACK"
 #include <netstack.h>
 #include <netstack/log.h>
+#include <netstack/frame.h>
+#include <netstack/time/timer.h>
 #include <netstack/intf/intf.h>
 #include <netstack/inet/route.h>
 #include <netstack/api/socket.h>
+#include <netstack/tcp/tcp.h>
 
 
-void netstack_init(struct netstack *inst) {
+int netstack_init(struct netstack *inst) {
 
     // Populate all function pointers for sys_* calls
     ns_api_init();
@@ -18,17 +21,36 @@ void netstack_init(struct netstack *inst) {
     // Initialise default logging with stdout & stderr
     log_default(&logconf);
     logconf.lvlstr[LFRAME] = "FRAME";
-    struct log_stream *fr = malloc(sizeof(struct log_stream));
-    fr->stream = stdout;
-    fr->min = LFRAME;
-    fr->max = LFRAME;
-    llist_append(&logconf.streams, fr);
+#ifndef NETSTACK_NO_PKTLOG
+    log_add_stream(&logconf, stdout, LFRAME, LFRAME);
+#endif
+
+    // Keep slow log streams off the packet processing threads
+    int err;
+    if ((err = log_async_start(&logconf)) < 0)
+        LOGSE(LWARN, "Failed to start the log writer", -err);
+
+    // Allocate frames from a pool rather than the heap
+    if (frame_pool_init() < 0)
+        LOG(LWARN, "Failed to create the frame pool, using the heap");
+
+    // Start the thread running every TCP timer. TCP can't work without it
+    if ((err = wheel_init(&tcp_wheel)) < 0) {
+        LOGSE(LCRIT, "Failed to start the TCP timer wheel", -err);
+        return err;
+    }
+
+    return 0;
 }
 
 void netstack_cleanup(struct netstack *inst) {
 
     // TODO: Wait for all connections to be closed/reset
 
+    // No timer may fire into the interfaces as they are torn down
+    wheel_stop(&tcp_wheel);
+    timer_stop();
+
     for_each_llist(&inst->interfaces) {
         struct intf *intf = llist_elem_data();
         LOG(LINFO, "Cleaning up interface %s", intf->name);
@@ -37,18 +59,26 @@ void netstack_cleanup(struct netstack *inst) {
     }
     llist_clear(&inst->interfaces);
 
+    // All frames have been released with the interfaces
+    frame_pool_free();
+
     // Cleanup route table
     llist_iter(&route_tbl, free);
     llist_clear(&route_tbl);
 
     // Deallocate the global socket list
     alist_free(&ns_sockets);
+    inet_socktbl_free(&tcp_socktbl);
+    // Release sockets and tables waiting for lookups to finish
+    epoch_barrier();
 
     LOG(LINFO, "Exiting!");
 
     // Clean-up logging configuration
+    log_async_stop(&logconf);
     llist_iter(&logconf.streams, free);
     llist_clear(&logconf.streams);
+    log_update(&logconf);
 }
 
 int netstack_checkcap(const char *name) {
@@ -8,6 +8,8 @@
 #define NETSTACK_LOG_UNIT "TCP"
 #include <netstack/tcp/tcp.h>
 #include <netstack/tcp/retransmission.h>
+#include <netstack/tcp/option.h>
+#include <netstack/tcp/syncookie.h>
 
 
 void expand_escapes(char *dest, const char *src, size_t len) {
@@ -44,11 +46,13 @@ void expand_escapes(char *dest, const char *src, size_t len) {
 void tcp_recv_closed(struct frame *frame, struct tcp_hdr *seg) {
 
     // If the state is CLOSED (i.e., TCB does not exist) then
-    struct log_trans t = LOG_TRANS(LDBUG);
-    LOGT(&t, "Reached TCP_CLOSED on ");
-    LOGT(&t, "%s:%hu -> ", straddr(&frame->remaddr), frame->remport);
-    LOGT(&t, "%s:%hu", straddr(&frame->locaddr), frame->locport);
-    LOGT_COMMIT(&t);
+    if (log_enabled(LDBUG)) {
+        struct log_trans t = LOG_TRANS(LDBUG);
+        LOGT(&t, "Reached TCP_CLOSED on ");
+        LOGT(&t, "%s:%hu -> ", straddr(&frame->remaddr), frame->remport);
+        LOGT(&t, "%s:%hu", straddr(&frame->locaddr), frame->locport);
+        LOGT_COMMIT(&t);
+    }
 
     // all data in the incoming segment is discarded.  An incoming
     // segment containing a RST is discarded.  An incoming segment not
@@ -83,6 +87,107 @@ void tcp_recv_closed(struct frame *frame, struct tcp_hdr *seg) {
     }
 }
 
+/*
+ * Creates a SYN-RECEIVED connection for a SYN to a listening socket and adds
+ * it to the SYN queue. The listener's lock must be held
+ */
+static struct tcp_sock *tcp_listen_child(struct frame *frame,
+                                         struct tcp_sock *parent, uint32_t irs,
+                                         uint32_t iss, uint16_t wnd,
+                                         uint16_t mss) {
+
+    struct tcp_sock *client = tcp_sock_init(calloc(1, sizeof(struct tcp_sock)));
+    client->inet.locport = frame->locport;
+    client->inet.locaddr = frame->locaddr;
+    client->inet.remport = frame->remport;
+    client->inet.remaddr = frame->remaddr;
+    // Un-accepted connections should be non-blocking
+    // as to not cause deadlocks
+    client->inet.flags = O_NONBLOCK;
+    client->inet.type = SOCK_STREAM;
+    client->inet.intf = frame->intf;
+    client->mss = mss;
+    client->rcvbuf_max = parent->rcvbuf_max;
+    client->tcb = (struct tcb) {
+            .irs = irs,
+            .iss = iss,
+            .snd = {
+                    .una = iss,
+                    .nxt = iss + 1,
+                    .wnd = wnd
+            },
+            .rcv = {
+                    .nxt = irs + 1,
+                    .wnd = UINT16_MAX
+            }
+    };
+    tcp_setstate(client, TCP_SYN_RECEIVED);
+    if (tcp_sock_hash(client) < 0) {
+        LOG(LWARN, "Failed to track incoming connection");
+        tcp_sock_destroy(client);
+        return NULL;
+    }
+    client->parent = parent;
+    tcp_queue_append(&parent->passive->synqueue, client);
+
+    return client;
+}
+
+/*
+ * Creates the connection for an ACK that returns a SYN cookie, then processes
+ * the ACK on it as if the connection had been SYN-RECEIVED all along
+ * @return 0 if the segment was taken, negative if it holds no valid cookie
+ */
+static int tcp_recv_cookie(struct frame *frame, struct tcp_sock *parent,
+                           struct tcp_hdr *seg, struct inet_sock *inet) {
+
+    uint32_t seg_seq = ntohl(seg->seqn);
+    uint32_t seg_ack = ntohl(seg->ackn);
+
+    tcp_sock_lock(parent);
+    struct tcp_passive *passive = parent->passive;
+    // Only listeners that have sent cookies can have them returned
+    if (parent->state != TCP_LISTEN || passive == NULL ||
+            passive->cookies_sent == 0) {
+        tcp_sock_unlock(parent);
+        return -ENOENT;
+    }
+
+    int mss = tcp_syncookie_check(inet, seg_seq - 1, seg_ack - 1);
+    if (mss < 0) {
+        passive->cookies_failed++;
+        tcp_sock_unlock(parent);
+        return mss;
+    }
+
+    // As for SYN-RECEIVED connections, the handshake can't complete whilst
+    // acceptq is full. Without a SYN/ACK to retransmit, it is left to the
+    // peer's next segment
+    if (passive->acceptq.length >= passive->maxbacklog) {
+        passive->accept_drops++;
+        tcp_sock_unlock(parent);
+        return 0;
+    }
+
+    uint16_t intf_mss = tcp_mss_ipv4(frame->intf);
+    struct tcp_sock *client = tcp_listen_child(frame, parent, seg_seq - 1,
+                                               seg_ack - 1, ntohs(seg->wind),
+                                               MIN((uint16_t) mss, intf_mss));
+    if (client != NULL)
+        tcp_sock_incref(client);
+    tcp_sock_unlock(parent);
+    if (client == NULL)
+        return 0;
+
+    LOG(LDBUG, "Accepted SYN cookie from %s:%hu",
+        straddr(&frame->remaddr), frame->remport);
+    tcp_sock_lock(client);
+    tcp_seg_arr(frame, client, 0);
+    tcp_sock_decref(client);
+
+    return 0;
+}
+
 void tcp_recv_listen(struct frame *frame, struct tcp_sock *parent,
                      struct tcp_hdr *seg) {
 
@@ -121,6 +226,11 @@ void tcp_recv_listen(struct frame *frame, struct tcp_sock *parent,
         Return.
     */
     if (seg->flags.ack == 1) {
+        // Unless it completes a handshake that was answered with a SYN cookie
+        if (seg->flags.syn == 0 &&
+                tcp_recv_cookie(frame, parent, seg, &sock.inet) == 0)
+            return;
+
         LOG(LDBUG, "Sending RST");
         tcp_send_rst(&sock, ntohl(seg->ackn));
         return;
@@ -168,37 +278,70 @@ void tcp_recv_listen(struct frame *frame, struct tcp_sock *parent,
         unspecified fields should be filled in now.
     */
 
-    uint32_t iss = ntohl(tcp_seqnum());
+    // Drop the SYN while the listener can't take another connection. The
+    // peer will retransmit it
+    tcp_sock_lock(parent);
+    struct tcp_passive *passive = parent->passive;
+    if (parent->state != TCP_LISTEN || passive == NULL) {
+        tcp_sock_unlock(parent);
+        return;
+    }
+    if (passive->acceptq.length >= passive->maxbacklog) {
+        passive->syn_drops++;
+        LOG(LNTCE, "accept queue is full (%zu to accept)",
+            passive->acceptq.length);
+        tcp_sock_unlock(parent);
+        return;
+    }
+
     uint32_t seg_seq = ntohl(seg->seqn);
+    struct tcp_opts opts;
+    tcp_parse_opts(seg, &opts);
+    uint16_t mss = tcp_syn_mss(&opts, frame->intf);
+
+    // Once the SYN queue is full, SYNs are answered without a connection.
+    // The cookie has no room for SACK-permitted, the window scale or
+    // timestamps, so none of them are offered
+    bool synfull = passive->synqueue.length >= passive->maxsyn;
+    if (tcp_syncookies == TCP_SYNCOOKIES_ALWAYS ||
+            (synfull && tcp_syncookies == TCP_SYNCOOKIES_ON)) {
+        passive->cookies_sent++;
+        tcp_sock_unlock(parent);
+
+        LOG(LDBUG, "Sending SYN/ACK with a SYN cookie");
+        sock.tcb.rcv.wnd = UINT16_MAX;
+        tcp_send_reply(&sock, tcp_syncookie_make(&sock.inet, seg_seq, mss),
+                       seg_seq + 1, TCP_FLAG_SYN | TCP_FLAG_ACK);
+        return;
+    }
+    if (synfull) {
+        passive->syn_drops++;
+        LOG(LNTCE, "SYN queue is full (%zu half-open)",
+            passive->synqueue.length);
+        tcp_sock_unlock(parent);
+        return;
+    }
 
-    struct tcp_sock *client = tcp_sock_init(calloc(1, sizeof(struct tcp_sock)));
-    client->inet.locport = frame->locport;
-    client->inet.locaddr = frame->locaddr;
-    client->inet.remport = frame->remport;
-    client->inet.remaddr = frame->remaddr;
-    // Un-accepted connections should be non-blocking
-    // as to not cause deadlocks
-    client->inet.flags = O_NONBLOCK;
-    client->inet.type = SOCK_STREAM;
-    client->inet.intf = frame->intf;
-    client->mss = 1460;
-    client->tcb = (struct tcb) {
-            .irs = seg_seq,
-            .iss = iss,
-            .snd = {
-                    .una = iss,
-                    .nxt = iss + 1,
-                    .wnd = ntohs(seg->wind)
-            },
-            .rcv = {
-                    .nxt = seg_seq + 1,
-                    .wnd = UINT16_MAX
-            }
-    };
-    tcp_setstate(client, TCP_SYN_RECEIVED);
-    client->parent = parent;
-    llist_push(&tcp_sockets, client);
-    llist_append(&parent->passive->backlog, client);
+    uint32_t iss = ntohl(tcp_seqnum());
+    struct tcp_sock *client = tcp_listen_child(frame, parent, seg_seq, iss,
+                                               ntohs(seg->wind), mss);
+    if (client != NULL) {
+        client->sack = opts.sack_ok;
+        client->ts = opts.ts_ok;
+        if (client->ts) {
+            client->ts_recent = opts.tsval;
+            client->ts_recent_age = tcp_ts_now(client);
+        }
+        // Windows are only scaled if both ends send the option
+        client->wscale = opts.wscale_ok;
+        if (client->wscale) {
+            client->tcb.snd.wscale = opts.wscale;
+            client->tcb.rcv.wscale = tcp_rcvbuf_wscale(client->rcvbuf_max);
+        }
+    }
+    tcp_sock_unlock(parent);
+    if (client == NULL)
+        return;
 
     // Send SYN/ACK and drop incoming segment
     LOG(LDBUG, "Sending SYN/ACK");
@@ -225,7 +368,7 @@ void tcp_recv_listen(struct frame *frame, struct tcp_sock *parent,
  *
  * See RFC793, bottom of page 52: https://tools.ietf.org/html/rfc793#page-52
  */
-int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
+int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock, size_t staged) {
     int ret = -1;
 
     // Don't allow NULL sockets because it provides no address to send RST to
@@ -234,7 +377,6 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
 
     // Ensure we always hold the frame as long as we need it
     frame_incref(frame);
-    tcp_sock_lock(sock);
     tcp_sock_incref(sock);
 
     struct tcb *tcb = &sock->tcb;
@@ -244,6 +386,8 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
     uint32_t seg_ack = ntohl(seg->ackn);
     uint16_t seg_len = frame_data_len(frame);
     uint32_t seg_end = seg_seq + MAX(seg_len - 1, 0);
+    struct tcp_opts opts;
+    tcp_parse_opts(seg, &opts);
 
     if (sock->inet.intf == NULL)
         // Use incoming interface as known intf for socket
@@ -355,7 +499,7 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
             if (ack_acceptable)
                 tcb->snd.una = seg_ack;
 
-            tcp_update_rtq(sock);
+            tcp_update_rtq(sock, false, 0);
 
             /*
                 If SND.UNA > ISS (our SYN has been ACKed), change the connection
@@ -370,8 +514,20 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
             */
             if (tcb->snd.una > tcb->iss) {
 
-                // TODO: Parse incoming TCP options for MSS value
-                sock->mss = 1460;
+                sock->mss = tcp_syn_mss(&opts, sock->inet.intf);
+                // SACK-permitted, window scale and timestamps are always
+                // offered in our SYN, so are in use if the SYN/ACK has them
+                sock->sack = opts.sack_ok;
+                sock->ts = opts.ts_ok;
+                if (sock->ts) {
+                    sock->ts_recent = opts.tsval;
+                    sock->ts_recent_age = tcp_ts_now(sock);
+                }
+                sock->wscale = opts.wscale_ok;
+                if (sock->wscale)
+                    tcb->snd.wscale = opts.wscale;
+                else
+                    tcb->rcv.wscale = 0;
 
                 // RFC 1122: Section 4.2.2.20 (c)
                 // TCP event processing corrections
@@ -379,11 +535,11 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
                 tcp_update_wnd(tcb, seg);
 
                 // Initialise established connection
-                tcp_established(sock, seg_seq + 1);
+                tcp_established(sock);
 
                 LOG(LDBUG, "Sending ACK");
                 if (seqbuf_available(&sock->sndbuf, seg_ack))
-                    ret = tcp_send_data(sock, seg_seq + 1, 0, 0);
+                    ret = tcp_send_data_nolock(sock, seg_seq + 1, 0, 0);
                 else
                     ret = tcp_send_ack(sock);
 
@@ -457,21 +613,39 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
         special allowance should be made to accept valid ACKs, URGs and
         RSTs.
     */
+    // Once both ends have agreed on timestamps, every segment but a RST
+    // carries one. Those without are dropped silently
+    // https://tools.ietf.org/html/rfc7323#section-3.2
+    if (sock->ts && !opts.ts_ok && seg->flags.rst == 0) {
+        LOG(LINFO, "Dropping segment SEQ %u without a timestamp", seg_seq);
+        goto drop_pkt;
+    }
+
     bool valid = true;
-    if (seg_len > 0 && tcb->rcv.wnd == 0) {
+    if (sock->ts && opts.ts_ok && seg->flags.rst == 0 &&
+            tcp_seq_lt(opts.tsval, sock->ts_recent) &&
+            tcp_ts_now(sock) - sock->ts_recent_age < TCP_PAWS_IDLE) {
+        // PAWS: a timestamp older than one already seen marks an old
+        // duplicate, perhaps from before the sequence space wrapped around.
+        // Once idle for long enough, TS.Recent may itself have wrapped
+        // https://tools.ietf.org/html/rfc7323#section-5.3
         valid = false;
-        LOG(LINFO, "data sent but RCV.WND is 0");
-    }
-    if (!tcp_seq_inwnd(seg_seq, tcb->rcv.nxt, tcb->rcv.wnd) ||
-            !tcp_seq_inwnd(seg_end, tcb->rcv.nxt, tcb->rcv.wnd)) {
+        LOG(LINFO, "PAWS rejected segment SEQ %u: TSval %u < TS.Recent %u",
+            seg_seq, opts.tsval, sock->ts_recent);
+    } else if (tcb->rcv.wnd == 0) {
+        // Only a zero length segment at RCV.NXT fits in a zero window
+        valid = seg_len == 0 && seg_seq == tcb->rcv.nxt;
+        if (!valid)
+            LOG(LINFO, "segment SEQ %u, LEN %hu sent but RCV.WND is 0",
+                seg_seq, seg_len);
+    } else if (!tcp_seq_inwnd(seg_seq, tcb->rcv.nxt, tcb->rcv.wnd)) {
         valid = false;
         LOG(LINFO, "Recv'd out-of-sequence segment: SEQ %u < RCV.NXT %u",
             seg_seq, tcb->rcv.nxt);
-    }
-    if (!tcp_seq_inwnd(seg_end, tcb->rcv.nxt, tcb->rcv.wnd)) {
+    } else if (!tcp_seq_inwnd(seg_end, tcb->rcv.nxt, tcb->rcv.wnd)) {
         valid = false;
         LOG(LINFO, "more data was sent than can fit in RCV.WND: "
-                    "SEQ %u, END %u, LEN %hu, RCV.NXT %u, RCV.WND %hu",
+                    "SEQ %u, END %u, LEN %hu, RCV.NXT %u, RCV.WND %u",
             seg_seq, seg_end, seg_len, tcb->rcv.nxt, tcb->rcv.wnd);
     }
     /*
@@ -492,6 +666,15 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
         }
         goto drop_pkt;
     }
+
+    // Keep the TSval to echo: that of the earliest segment the next ACK
+    // acknowledges, so the peer measures the RTT including any delay in it
+    // https://tools.ietf.org/html/rfc7323#section-4.3
+    if (sock->ts && opts.ts_ok && tcp_seq_geq(opts.tsval, sock->ts_recent) &&
+            tcp_seq_leq(seg_seq, sock->ts_lastack)) {
+        sock->ts_recent = opts.tsval;
+        sock->ts_recent_age = tcp_ts_now(sock);
+    }
     /*
         In the following it is assumed that the segment is the idealized
         segment that begins at RCV.NXT and does not exceed the window.
@@ -501,7 +684,8 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
         begins at RCV.NXT.  Segments with higher beginning sequence
         numbers may be held for later processing.
 
-    // TODO: Store out-of-order segments that are >RCV.NXT for later processing
+    Out-of-order segments that are >RCV.NXT are held in sock->reass when
+    their text is processed below.
 
     second check the RST bit,
 
@@ -524,12 +708,14 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
     */
         case TCP_SYN_RECEIVED:
             if (seg->flags.rst == 1) {
-                // If backlog list is NULL, socket is ACTIVE open
-                if (sock->passive == NULL) {
+                // If there is no listener, socket is ACTIVE open
+                if (sock->parent == NULL) {
                     tcp_wake_error(sock, -ECONNREFUSED);
-                    contimer_stop(&sock->rtimer);
+                    tcp_stop_rto(sock);
                     ret = -ECONNREFUSED;
                 }
+                // Marks the queue's reference as gone to a closing listener
+                tcp_setstate(sock, TCP_CLOSED);
                 tcp_sock_decref(sock);
                 goto drop_pkt;
             }
@@ -641,7 +827,8 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
                 tcp_wake_error(sock, -ECONNRESET);
                 LOG(LDBUG, "Sending RST");
                 ret = tcp_send_rst(sock, seg_ack);
-                contimer_stop(&sock->rtimer);
+                tcp_stop_rto(sock);
+                tcp_setstate(sock, TCP_CLOSED);
                 tcp_sock_decref(sock);
                 // TODO: Implement RFC 5961 Section 4: Blind Reset Attack on SYN
                 // https://tools.ietf.org/html/rfc5961#page-9
@@ -681,7 +868,11 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
     */
         case TCP_SYN_RECEIVED:
             if (ack_acceptable) {
-                tcp_established(sock, seg_seq);
+                // Stay half-open whilst the listener's accept queue is full,
+                // dropping the ACK. The SYN/ACK is retransmitted later
+                if (sock->parent != NULL && tcp_passive_ready(sock) < 0)
+                    goto drop_pkt;
+                tcp_established(sock);
             } else {
                 LOG(LDBUG, "Sending RST");
                 ret = tcp_send_rst(sock, seg_ack);
@@ -725,11 +916,19 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
             // https://tools.ietf.org/html/rfc1122#page-94
             if (ack_acceptable) {
 
+                // RFC 5681: an ACK that acknowledges nothing new and carries
+                // nothing else, whilst data is outstanding, is a duplicate
+                bool dupack = seg_ack == tcb->snd.una && seg_len == 0 &&
+                        !seg->flags.syn && !seg->flags.fin &&
+                        tcb->snd.nxt != tcb->snd.una &&
+                        tcp_seg_wnd(tcb, seg) == tcb->snd.wnd;
+
                 // Update send buffer
                 tcb->snd.una = seg_ack;
 
-                // Remove any segments from the rtq that are ack'd
-                tcp_update_rtq(sock);
+                // Remove any segments from the rtq that are ack'd, timing the
+                // round-trip from the echoed timestamp if they were resent
+                tcp_update_rtq(sock, sock->ts && opts.ts_ok, opts.tsecr);
 
                 // Exponential backoff should be reset upon receiving a valid ACK
                 // It should happen _AFTER_ updating the rtt/rtq so that segments
@@ -737,6 +936,11 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
                 // updated RTO. See: https://tools.ietf.org/html/rfc6298#page-4
                 sock->backoff = 0;
 
+                // Update the scoreboard and retransmit any holes it shows
+                if (sock->sack) {
+                    tcp_sack_update(sock, opts.sack, opts.sacks, dupack);
+                }
+
                 // Wakeup tcp_user_send() now as there might be space in the snd.wnd
                 pthread_cond_broadcast(&sock->waitack);
 
@@ -756,9 +960,15 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
                 tcp_update_wnd(tcb, seg);
             } else {
                 // Just update send window
-                tcb->snd.wnd = ntohs(seg->wind);
+                tcb->snd.wnd = tcp_seg_wnd(tcb, seg);
             }
 
+            // The ACK may have made room in SND.WND for buffered text, and
+            // the FIN close() left to follow it
+            if (sock->state == TCP_ESTABLISHED ||
+                    sock->state == TCP_CLOSE_WAIT || sock->finpending)
+                tcp_send_pending(sock);
+
         default:
             break;
     }
@@ -891,42 +1101,39 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
             if (seg_len < 1)
                 break;
 
-            // We keep segment text for any segments that have arrived,
-            // regardless of whether they are out-of-order, to reduce
-            // future retransmissions
-
-            // Reorder segments
-            frame_incref(frame);
-            pthread_mutex_lock(&sock->recvqueue.lock);
-
-            // Insert the segment into the queue, ordered
-            llist_insert_sorted_nolock(&sock->recvqueue, frame,
-                                (int (*)(void *, void *)) &tcp_seg_cmp);
-
-            // Regardless of whether the segment was in-order, it takes up
-            // space in the recvqueue so adjust the window accordingly
-            tcb->rcv.wnd -= seg_len;
-            uint32_t irs = tcb->irs;
-
-            // For debug purposes, print queued segments in recvqueue
-            //tcp_log_recvqueue(sock);
-
-            // Before unlocking the recvqueue, count the amount of contiguous
-            // bytes available locally in the queue from RCV.NXT
-            tcb->rcv.nxt = tcp_recvqueue_contigseq(sock, tcb->rcv.nxt);
+            // In-order text is copied straight into the receive buffer. We
+            // keep out-of-order segments that have arrived to reduce future
+            // retransmissions. They take no space from RCV.WND, as they are
+            // within it and will take their place in the buffer once the
+            // text before them arrives
+            uint32_t rcv_nxt = tcb->rcv.nxt;
+            if (in_order && staged == seg_len) {
+                // tcp_recv() already copied the text in as it was summed
+                tcp_rcvbuf_commit(sock, seg_len);
+            } else if (in_order) {
+                tcp_rcvbuf_append(sock, frame->data, seg_len);
+            } else {
+                frame_incref(frame);
+                if (tcp_reass_insert(&sock->reass, frame, seg_seq, seg_len)) {
+                    LOG(LWARN, "Failed to queue out-of-order segment");
+                    frame_decref(frame);
+                }
+                // Reported first in the SACK option of the ACK below
+                sock->sack_recent = seg_seq;
+            }
 
-            pthread_mutex_unlock(&sock->recvqueue.lock);
+            // The segment may have filled the gap before queued segments
+            tcp_rcvbuf_reassemble(sock);
 
-            if (tcp_seq_gt(sock->recvptr, sock->tcb.rcv.nxt))
-                LOG(LERR, "You dun goofed: recvptr (%u) > RCV.NXT (%u)",
-                      sock->recvptr - irs, sock->tcb.rcv.nxt - irs);
+            // For debug purposes, print the received text held
+            //tcp_log_rcvbuf(sock);
 
             // Always send an ACK for the largest contiguous segment we've queued.
             LOG(LDBUG, "Sending ACK");
             ret = tcp_send_ack(sock);
 
             // Signal pending recv() calls with a >0 value to indicate data
-            if (in_order)
+            if (tcb->rcv.nxt != rcv_nxt)
                 tcp_wake_waiters(sock);
 
             break;
@@ -999,7 +1206,7 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
 
                     // Stop retransmission timer
                     // TODO: stop other TCP timers in FIN-WAIT-2
-                    contimer_stop(&sock->rtimer);
+                    tcp_stop_rto(sock);
                 } else {
                     // Just enter CLOSING and wait for ACK
                     tcp_setstate(sock, TCP_CLOSING);
@@ -1017,7 +1224,7 @@ int tcp_seg_arr(struct frame *frame, struct tcp_sock *sock) {
 
                  // TODO: stop other TCP timers in FIN-WAIT-2
                 // Stop retransmission timer
-                contimer_stop(&sock->rtimer);
+                tcp_stop_rto(sock);
                 break;
     /*
         TIME-WAIT STATE
@@ -1060,7 +1267,7 @@ drop_pkt:
 }
 
 void tcp_update_wnd(struct tcb *tcb, struct tcp_hdr *seg) {
-    tcb->snd.wnd = ntohs(seg->wind);
+    tcb->snd.wnd = tcp_seg_wnd(tcb, seg);
     tcb->snd.wl1 = ntohl(seg->seqn);
     tcb->snd.wl2 = ntohl(seg->ackn);
 }
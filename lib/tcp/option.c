@@ -0,0 +1,86 @@
+#include <string.h>
+#include <sys/param.h>
+#include <arpa/inet.h>
+
+#define NETSTACK_LOG_UNIT "TCP"
+#include <netstack/log.h>
+#include <netstack/tcp/tcp.h>
+#include <netstack/tcp/option.h>
+
+void tcp_parse_opts(struct tcp_hdr *hdr, struct tcp_opts *opts) {
+    *opts = (struct tcp_opts) {0};
+
+    uint8_t *opt = (uint8_t *) hdr + sizeof(struct tcp_hdr);
+    uint8_t *end = (uint8_t *) hdr + tcp_hdr_len(hdr);
+
+    while (opt < end) {
+        uint8_t kind = opt[0];
+        if (kind == TCP_OPT_EOL)
+            break;
+        if (kind == TCP_OPT_NOP) {
+            opt++;
+            continue;
+        }
+
+        // Every other option has a length octet covering the whole option
+        if (end - opt < 2 || opt[1] < 2 || opt[1] > end - opt) {
+            LOG(LDBUG, "malformed option %hhu", kind);
+            break;
+        }
+
+        switch (kind) {
+            case TCP_OPT_MSS:
+                if (opt[1] == TCP_OPT_MSS_LEN) {
+                    uint16_t mss;
+                    memcpy(&mss, opt + 2, sizeof(mss));
+                    opts->mss = ntohs(mss);
+                }
+                break;
+            case TCP_OPT_WSCALE:
+                // Larger shifts are taken as the largest allowed
+                // https://tools.ietf.org/html/rfc7323#section-2.3
+                if (opt[1] == TCP_OPT_WSCALE_LEN) {
+                    opts->wscale_ok = true;
+                    opts->wscale = MIN(opt[2], TCP_MAX_WSCALE);
+                }
+                break;
+            case TCP_OPT_TS:
+                if (opt[1] == TCP_OPT_TS_LEN) {
+                    uint32_t ts[2];
+                    memcpy(ts, opt + 2, sizeof(ts));
+                    opts->ts_ok = true;
+                    opts->tsval = ntohl(ts[0]);
+                    opts->tsecr = ntohl(ts[1]);
+                }
+                break;
+            case TCP_OPT_SACK_PERM:
+                if (opt[1] == TCP_OPT_SACK_PERM_LEN)
+                    opts->sack_ok = true;
+                break;
+            case TCP_OPT_SACK: {
+                uint8_t count = (uint8_t) ((opt[1] - 2) / 8);
+                if (opt[1] != TCP_OPT_SACK_LEN(count) ||
+                        count > TCP_SACK_MAX_BLOCKS)
+                    break;
+                for (uint8_t i = 0; i < count; i++) {
+                    uint32_t edge[2];
+                    memcpy(edge, opt + 2 + 8 * i, sizeof(edge));
+                    opts->sack[i].start = ntohl(edge[0]);
+                    opts->sack[i].end = ntohl(edge[1]);
+                }
+                opts->sacks = count;
+                break;
+            }
+            default:
+                break;
+        }
+        opt += opt[1];
+    }
+}
+
+uint16_t tcp_syn_mss(struct tcp_opts *opts, struct intf *intf) {
+    uint16_t mss = opts->mss ? opts->mss : (uint16_t) TCP_DEF_MSS;
+    if (intf != NULL)
+        mss = MIN(mss, tcp_mss_ipv4(intf));
+    return mss;
+}
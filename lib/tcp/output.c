@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include <sys/param.h>
 #include <netinet/in.h>
@@ -9,15 +10,24 @@
 #include <netstack/tcp/tcp.h>
 #include <netstack/tcp/option.h>
 #include <netstack/tcp/retransmission.h>
-#include <netstack/time/contimer.h>
 #include <netstack/time/util.h>
 
 
 int tcp_send(struct inet_sock *inet, struct frame *frame, struct neigh_route *rt) {
+    frame_lock(frame, SHARED_RD);
+    uint16_t datasum = ~in_csum(frame->data, frame_data_len(frame), 0);
+    frame_unlock(frame);
+
+    return tcp_send_csum(inet, frame, rt, datasum);
+}
+
+int tcp_send_csum(struct inet_sock *inet, struct frame *frame,
+                  struct neigh_route *rt, uint16_t datasum) {
     struct tcp_hdr *hdr = tcp_hdr(frame);
 
     frame_lock(frame, SHARED_RD);
     uint16_t pktlen = frame_pkt_len(frame);
+    size_t hdrlen = frame->data - frame->head;
     frame_unlock(frame);
 
     // TODO: Don't assume IPv4 L3, choose based on sock->saddr
@@ -29,10 +39,12 @@ int tcp_send(struct inet_sock *inet, struct frame *frame, struct neigh_route *rt
             .rsvd = 0
     };
 
-    // Calculate TCP checksum, including IP layer
+    // Calculate TCP checksum, including IP layer. The payload is already
+    // summed so only the header needs to be. The header is a multiple of 4
+    // octets long so the payload sum never needs byte-swapping
     // TODO: Don't assume IPv4 pseudo-header for checksumming
-    uint16_t ph_csum = in_csum(&phdr, sizeof(phdr), 0);
-    hdr->csum = in_csum(hdr, pktlen, ~ph_csum);
+    uint16_t ph_csum = ~in_csum(&phdr, sizeof(phdr), 0);
+    hdr->csum = in_csum(hdr, hdrlen, in_csum_add(ph_csum, datasum));
 
     frame_incref(frame);
 
@@ -72,19 +84,12 @@ int tcp_send_syn(struct tcp_sock *sock) {
         LOG(LTRCE, "starting SYN rto for sock %p", sock);
         
         // Use the SYN connect timeout for ACTIVE open SYN packets
-        struct timespec timeout;
-        timespecns(&timeout, TCP_SYN_RTO);
-        LOG(LVERB, "setting sock connect timeout %.3fs", tstosec(&timeout, float));
-
-        struct tcp_rto_data rtd = { .sock = sock, .seq = sock->tcb.iss,
-                                    .len = 0, .flags = TCP_FLAG_SYN };
-
-        // Hold another reference to the socket to prevent it being free'd
-        tcp_sock_incref(sock);
+        LOG(LVERB, "setting sock connect timeout %.3fs",
+            nstosec((float) TCP_SYN_RTO));
 
-        sock->rto_event = contimer_queue_rel(&sock->rtimer, &timeout,
-                                             tcp_syn_retransmission_timeout,
-                                             &rtd, sizeof(rtd));
+        sock->rtd = (struct tcp_rto_data) { .seq = sock->tcb.iss, .len = 0,
+                                            .flags = TCP_FLAG_SYN };
+        tcp_arm_rto(sock, TCP_SYN_RTO);
     }
 
     // Unlock and send the segment
@@ -97,8 +102,13 @@ int tcp_send_syn(struct tcp_sock *sock) {
     return ret;
 }
 
-int tcp_send_empty(struct tcp_sock *sock, uint32_t seqn, uint32_t ackn,
-                   uint8_t flags) {
+/*
+ * Sends a segment without text. Segments that aren't queued are never
+ * retransmitted and leave the socket untouched, so sock can be a stand-in
+ * with only inet set
+ */
+static int _tcp_send_empty(struct tcp_sock *sock, uint32_t seqn, uint32_t ackn,
+                           uint8_t flags, bool queue) {
 
     // Find route to next-hop
     int err;
@@ -120,7 +130,8 @@ int tcp_send_empty(struct tcp_sock *sock, uint32_t seqn, uint32_t ackn,
         return (int) count;
 
     // Queue control segments in case they expire and start the rto
-    tcp_queue_unacked(sock, seqn, 0, tcp_hdr(seg)->flagval);
+    if (queue)
+        tcp_queue_unacked(sock, seqn, 0, tcp_hdr(seg)->flagval, 0);
 
     // Unlock and send the segment
     frame_unlock(seg);
@@ -132,8 +143,22 @@ int tcp_send_empty(struct tcp_sock *sock, uint32_t seqn, uint32_t ackn,
     return ret;
 }
 
-int tcp_send_data(struct tcp_sock *sock, uint32_t seqn, size_t len,
-                  uint8_t flags) {
+int tcp_send_empty(struct tcp_sock *sock, uint32_t seqn, uint32_t ackn,
+                   uint8_t flags) {
+    return _tcp_send_empty(sock, seqn, ackn, flags, true);
+}
+
+int tcp_send_reply(struct tcp_sock *sock, uint32_t seqn, uint32_t ackn,
+                   uint8_t flags) {
+    return _tcp_send_empty(sock, seqn, ackn, flags, false);
+}
+
+/*
+ * Sends a data segment. If the caller doesn't already hold the socket lock,
+ * it is only taken around reading the send buffer
+ */
+static int _tcp_send_data(struct tcp_sock *sock, uint32_t seqn, size_t len,
+                          uint8_t flags, bool locked) {
 
     int err;
     uint16_t count;
@@ -155,7 +180,8 @@ int tcp_send_data(struct tcp_sock *sock, uint32_t seqn, size_t len,
     // Initialise a new frame to carry outgoing segment
     struct frame *seg = intf_frame_new(intf, intf_max_frame_size(intf));
 
-    tcp_sock_lock(sock);
+    if (!locked)
+        tcp_sock_lock(sock);
 
     // Get the maximum available bytes to send
     long tosend = seqbuf_available(&sock->sndbuf, seqn);
@@ -163,12 +189,13 @@ int tcp_send_data(struct tcp_sock *sock, uint32_t seqn, size_t len,
     // There is no data to send from seqn. Return ENODATA
     // This is performed after the expensive intf_frame_new() because it is
     // unlikely to happen in most cases
-    if (tosend < 0) {
-        LOGSE(LERR, "sendbuf_available", -tosend);
+    if (tosend <= 0) {
+        if (tosend < 0)
+            LOGSE(LERR, "sendbuf_available", -tosend);
+        if (!locked)
+            tcp_sock_unlock(sock);
         frame_decref_unlock(seg);
-        return (int) tosend;
-    } else if (tosend == 0) {
-        return -ENODATA;
+        return tosend < 0 ? (int) tosend : -ENODATA;
     }
 
     // Bound payload size by requested length
@@ -177,6 +204,8 @@ int tcp_send_data(struct tcp_sock *sock, uint32_t seqn, size_t len,
 
     err = tcp_init_header(seg, sock, htonl(seqn), ackn, flags, (size_t) tosend);
     if (err < 0) {
+        if (!locked)
+            tcp_sock_unlock(sock);
         frame_decref_unlock(seg);
         // < 0 indicates error
         return err;
@@ -187,37 +216,114 @@ int tcp_send_data(struct tcp_sock *sock, uint32_t seqn, size_t len,
     if (count >= tosend)
         tcp_hdr(seg)->flags.psh = 1;
 
-    // Queue the segment in case of later retransmission and start the rto
-    tcp_queue_unacked(sock, seqn, count, tcp_hdr(seg)->flagval);
-
-    // Read data from the send buffer into the segment payload
-    long readerr = seqbuf_read(&sock->sndbuf, seqn, seg->data, (size_t) count);
+    // Read data from the send buffer into the segment payload. Retransmitted
+    // segments reuse the payload sum from when they were first sent,
+    // otherwise the payload is summed as it is copied. Only text before
+    // SND.NXT can have been sent before
+    uint16_t datasum;
+    long readerr;
+    if (tcp_seq_lt(seqn, sock->tcb.snd.nxt) &&
+            tcp_unacked_resend(sock, seqn, count, &datasum)) {
+        readerr = seqbuf_read(&sock->sndbuf, seqn, seg->data, count);
+    } else {
+        readerr = seqbuf_read_csum(&sock->sndbuf, seqn, seg->data, count,
+                                   &datasum);
+    }
     if (readerr < 0) {
         LOGSE(LERR, "seqbuf_read (%li)", -readerr, readerr);
-        tcp_sock_unlock(sock);
+        if (!locked)
+            tcp_sock_unlock(sock);
         frame_decref_unlock(seg);
         return (int) readerr;
     } else if (readerr == 0) {
         // This is unlikely/impossible because there is a data check above
         LOG(LWARN, "No data to send");
-        tcp_sock_unlock(sock);
+        if (!locked)
+            tcp_sock_unlock(sock);
         frame_decref_unlock(seg);
         return -ENODATA;
     }
 
-    tcp_sock_unlock(sock);
+    // Queue the segment in case of later retransmission and start the rto
+    tcp_queue_unacked(sock, seqn, count, tcp_hdr(seg)->flagval, datasum);
+
+    if (!locked)
+        tcp_sock_unlock(sock);
     frame_unlock(seg);
 
     // Send to neigh, passing IP options
-    int ret = tcp_send(&sock->inet, seg, &route);
+    int ret = tcp_send_csum(&sock->inet, seg, &route, datasum);
 
     frame_decref(seg);
 
     return (ret < 0 ? ret : count);
 }
 
+int tcp_send_data(struct tcp_sock *sock, uint32_t seqn, size_t len,
+                  uint8_t flags) {
+    return _tcp_send_data(sock, seqn, len, flags, false);
+}
+
+int tcp_send_data_nolock(struct tcp_sock *sock, uint32_t seqn, size_t len,
+                         uint8_t flags) {
+    return _tcp_send_data(sock, seqn, len, flags, true);
+}
+
+int tcp_send_pending(struct tcp_sock *sock) {
+    struct tcb *tcb = &sock->tcb;
+    int sent = 0;
+
+    while (seqbuf_available(&sock->sndbuf, tcb->snd.nxt) > 0) {
+        // Only send what the remote RCV.WND has room for beyond the
+        // segments already in flight
+        uint32_t inflight = tcb->snd.nxt - tcb->snd.una;
+        if (inflight >= tcb->snd.wnd)
+            break;
+
+        int ret = tcp_send_data_nolock(sock, tcb->snd.nxt,
+                                       tcb->snd.wnd - inflight, 0);
+        if (ret <= 0)
+            return sent > 0 ? sent : ret;
+        sent += ret;
+    }
+
+    // A FIN queued by close() can go once all the text before it has
+    if (sock->finpending &&
+            seqbuf_available(&sock->sndbuf, tcb->snd.nxt) == 0) {
+        sock->finpending = false;
+        int ret = tcp_send_finack(sock);
+        if (ret < 0 && sent == 0)
+            return ret;
+    }
+
+    return sent;
+}
+
+bool tcp_unacked_resend(struct tcp_sock *sock, uint32_t seqn, uint16_t len,
+                        uint16_t *csum) {
+    bool found = false;
+
+    pthread_mutex_lock(&sock->unacked.lock);
+    for_each_llist(&sock->unacked) {
+        struct tcp_seq_data *data = llist_elem_data();
+        // The queue is in sequence order, as segments are only queued at
+        // SND.NXT, so there's no match past seqn
+        if (tcp_seq_gt(data->seq, seqn))
+            break;
+        if (data->seq == seqn && data->len == len) {
+            *csum = data->csum;
+            data->retransmitted = true;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sock->unacked.lock);
+
+    return found;
+}
+
 void tcp_queue_unacked(struct tcp_sock *sock, uint32_t seqn, uint16_t len,
-                       uint8_t flags) {
+                       uint8_t flags, uint16_t csum) {
 
     // Start the retransmission timeout
     if (sock->unacked.length == 0)
@@ -243,6 +349,8 @@ void tcp_queue_unacked(struct tcp_sock *sock, uint32_t seqn, uint16_t len,
     seg_data->seq = seqn;
     seg_data->len = len;
     seg_data->flags = flags;
+    seg_data->csum = csum;
+    seg_data->sacked = seg_data->rexmit = seg_data->retransmitted = false;
     clock_gettime(CLOCK_MONOTONIC, &seg_data->when);
 
     // Log unsent/unacked segment data for potential later retransmission
@@ -292,12 +400,20 @@ int tcp_init_header(struct frame *seg, struct tcp_sock *sock, uint32_t seqn,
     hdr->csum = 0;
     hdr->urg_ptr = 0;
     hdr->hlen = (uint8_t) (hdrlen >> 2);     // hdrlen / 4
-    hdr->wind = htons(sock->tcb.rcv.wnd);
+    // The window in a SYN is never scaled
+    // https://tools.ietf.org/html/rfc7323#section-2.2
+    uint8_t wscale = (flags & TCP_FLAG_SYN) ? 0 : sock->tcb.rcv.wscale;
+    hdr->wind = htons((uint16_t) MIN(sock->tcb.rcv.wnd >> wscale, UINT16_MAX));
+
+    // TS.Recent is only taken from segments up to the last ACK sent
+    if (sock->ts && (flags & TCP_FLAG_ACK))
+        sock->ts_lastack = ntohl(ackn);
 
     // Copy options
     uint8_t *optptr = (seg->head + sizeof(struct tcp_hdr));
     // Zero last 4 bytes for padding
-    *((uint32_t *) (optptr - 4)) = 0;
+    if (tcp_optlen > 0)
+        *((uint32_t *) (optptr + tcp_optlen - 4)) = 0;
     memcpy(optptr, tcp_optdat, tcp_optsum);
 
     return (int) count;
@@ -320,6 +436,65 @@ size_t tcp_options(struct tcp_sock *sock, uint8_t tcp_flags, uint8_t *opt) {
         opt += 2;
     }
 
+    // Window scale is offered in every SYN, and only returned in a SYN/ACK if
+    // the SYN had it
+    // https://tools.ietf.org/html/rfc7323#section-2.2
+    if ((tcp_flags & TCP_FLAG_SYN) &&
+            (!(tcp_flags & TCP_FLAG_ACK) || sock->wscale)) {
+        *opt++ = TCP_OPT_NOP;
+        *opt++ = TCP_OPT_WSCALE;
+        *opt++ = TCP_OPT_WSCALE_LEN;
+        *opt++ = sock->tcb.rcv.wscale;
+    }
+
+    // SACK-permitted is offered in every SYN, and accepted in a SYN/ACK
+    // https://tools.ietf.org/html/rfc2018#section-2
+    if ((tcp_flags & TCP_FLAG_SYN) &&
+            (!(tcp_flags & TCP_FLAG_ACK) || sock->sack)) {
+        *opt++ = TCP_OPT_NOP;
+        *opt++ = TCP_OPT_NOP;
+        *opt++ = TCP_OPT_SACK_PERM;
+        *opt++ = TCP_OPT_SACK_PERM_LEN;
+    }
+
+    // Timestamps are offered in every SYN, and once both ends have sent them
+    // are carried by every segment other than an RST. TSecr is only valid
+    // with ACK set
+    // https://tools.ietf.org/html/rfc7323#section-3.2
+    if (!(tcp_flags & TCP_FLAG_RST) &&
+            (tcp_flags == TCP_FLAG_SYN || sock->ts)) {
+        uint32_t ts[2] = {
+                htonl(tcp_ts_now(sock)),
+                htonl((tcp_flags & TCP_FLAG_ACK) ? sock->ts_recent : 0)
+        };
+        *opt++ = TCP_OPT_NOP;
+        *opt++ = TCP_OPT_NOP;
+        *opt++ = TCP_OPT_TS;
+        *opt++ = TCP_OPT_TS_LEN;
+        memcpy(opt, ts, sizeof(ts));
+        opt += sizeof(ts);
+    }
+
+    // Report the out-of-order runs held in ACKs, as many as there is room for
+    // https://tools.ietf.org/html/rfc2018#section-4
+    if (sock->sack && sock->reass.runs > 0 &&
+            !(tcp_flags & (TCP_FLAG_SYN | TCP_FLAG_RST))) {
+        struct tcp_sack_block blocks[TCP_SACK_MAX_BLOCKS];
+        size_t room = (40 - (opt - optstart) - 4) / 8;
+        size_t count = tcp_reass_sack(&sock->reass, sock->sack_recent, blocks,
+                                      MIN(room, TCP_SACK_MAX_BLOCKS));
+
+        *opt++ = TCP_OPT_NOP;
+        *opt++ = TCP_OPT_NOP;
+        *opt++ = TCP_OPT_SACK;
+        *opt++ = (uint8_t) TCP_OPT_SACK_LEN(count);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t edge[2] = { htonl(blocks[i].start), htonl(blocks[i].end) };
+            memcpy(opt, edge, sizeof(edge));
+            opt += sizeof(edge);
+        }
+    }
+
     // Length of options is delta
     uint64_t len = opt - optstart;
     LOG(LVERB, "options length %lu", len);
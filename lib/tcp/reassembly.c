@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <errno.h>
+
+#define NETSTACK_LOG_UNIT "TCP/RA"
+#include <netstack/log.h>
+#include <netstack/tcp/tcp.h>
+#include <netstack/tcp/reassembly.h>
+
+void tcp_reass_init(struct tcp_reass *q) {
+    *q = (struct tcp_reass) {
+            .height = 1,
+            .rand = (uint32_t) rand() | 1
+    };
+}
+
+// Picks a height for a new run, each level having a quarter of the runs below
+static uint8_t tcp_reass_height(struct tcp_reass *q) {
+    uint32_t x = q->rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    q->rand = x;
+
+    uint8_t height = 1;
+    while (height < TCP_REASS_LEVELS && (x & 3) == 0) {
+        height++;
+        x >>= 2;
+    }
+    return height;
+}
+
+// Lowers the skip list height past any levels left empty
+static void tcp_reass_shrink(struct tcp_reass *q) {
+    while (q->height > 1 && q->head[q->height - 1] == NULL)
+        q->height--;
+}
+
+// Drops segments from the front of a list that end at or before 'end'
+static struct tcp_reass_seg *tcp_reass_trim(struct tcp_reass *q,
+                                            struct tcp_reass_seg *seg,
+                                            uint32_t end, size_t *dropped) {
+    while (seg != NULL && tcp_seq_leq(seg->seq + seg->len, end)) {
+        struct tcp_reass_seg *next = seg->next;
+        *dropped += seg->len;
+        q->held -= seg->len;
+        frame_decref(seg->frame);
+        free(seg);
+        seg = next;
+    }
+    return seg;
+}
+
+int tcp_reass_insert(struct tcp_reass *q, struct frame *frame, uint32_t seq,
+                     uint16_t len) {
+
+    struct tcp_reass_run **link[TCP_REASS_LEVELS];
+    struct tcp_reass_run **cur = q->head, *prev = NULL;
+    uint32_t end = seq + len;
+
+    // Find the last run starting before seq at each level
+    for (int l = q->height - 1; l >= 0; l--) {
+        while (cur[l] != NULL && tcp_seq_lt(cur[l]->seq, seq)) {
+            prev = cur[l];
+            cur = prev->next;
+        }
+        link[l] = &cur[l];
+    }
+    for (int l = q->height; l < TCP_REASS_LEVELS; l++)
+        link[l] = &q->head[l];
+
+    // Drop segments that are entirely duplicates
+    struct tcp_reass_run *next = *link[0];
+    if ((prev != NULL && tcp_seq_geq(prev->end, end)) || (next != NULL &&
+            next->seq == seq && tcp_seq_geq(next->end, end))) {
+        LOG(LTRCE, "dropping duplicate segment %u-%u", seq, end - 1);
+        frame_decref(frame);
+        return 0;
+    }
+
+    struct tcp_reass_seg *seg = malloc(sizeof(struct tcp_reass_seg));
+    if (seg == NULL)
+        return -ENOMEM;
+    *seg = (struct tcp_reass_seg) {
+            .frame = frame,
+            .seq = seq,
+            .len = len
+    };
+
+    // Extend the run before the segment if it reaches it, otherwise start one
+    struct tcp_reass_run *run;
+    if (prev != NULL && tcp_seq_geq(prev->end, seq)) {
+        run = prev;
+        run->tail->next = seg;
+        run->tail = seg;
+        run->end = end;
+    } else {
+        uint8_t height = tcp_reass_height(q);
+        run = malloc(sizeof(struct tcp_reass_run) +
+                     height * sizeof(struct tcp_reass_run *));
+        if (run == NULL) {
+            free(seg);
+            return -ENOMEM;
+        }
+        run->seq = seq;
+        run->end = end;
+        run->held = 0;
+        run->head = run->tail = seg;
+        run->height = height;
+
+        for (int l = 0; l < height; l++) {
+            run->next[l] = *link[l];
+            *link[l] = run;
+        }
+        if (height > q->height)
+            q->height = height;
+        q->runs++;
+    }
+    run->held += len;
+    q->held += len;
+
+    // Absorb the runs that the segment now reaches
+    struct tcp_reass_run *absorb;
+    while ((absorb = run->next[0]) != NULL &&
+            tcp_seq_leq(absorb->seq, run->end)) {
+
+        // Anything between run and absorb at a level has already been absorbed
+        for (int l = 0; l < absorb->height; l++) {
+            if (l < run->height)
+                run->next[l] = absorb->next[l];
+            else
+                *link[l] = absorb->next[l];
+        }
+
+        size_t dropped = 0;
+        struct tcp_reass_seg *rest = tcp_reass_trim(q, absorb->head, run->end,
+                                                    &dropped);
+        if (rest != NULL) {
+            run->tail->next = rest;
+            run->tail = absorb->tail;
+            run->end = absorb->end;
+            run->held += absorb->held - dropped;
+        }
+
+        q->runs--;
+        free(absorb);
+    }
+    tcp_reass_shrink(q);
+
+    return 0;
+}
+
+struct tcp_reass_seg *tcp_reass_pop(struct tcp_reass *q, uint32_t nxt) {
+    struct tcp_reass_run *run = q->head[0];
+    if (run == NULL || tcp_seq_gt(run->seq, nxt))
+        return NULL;
+
+    // The first run is first at every level it is in
+    for (int l = 0; l < run->height; l++)
+        q->head[l] = run->next[l];
+    tcp_reass_shrink(q);
+
+    q->held -= run->held;
+    q->runs--;
+
+    struct tcp_reass_seg *seg = run->head;
+    free(run);
+    return seg;
+}
+
+size_t tcp_reass_sack(struct tcp_reass *q, uint32_t recent,
+                      struct tcp_sack_block *blocks, size_t max) {
+    if (max == 0)
+        return 0;
+
+    // Find the last run starting at or before recent
+    struct tcp_reass_run **cur = q->head, *first = NULL;
+    for (int l = q->height - 1; l >= 0; l--) {
+        while (cur[l] != NULL && tcp_seq_leq(cur[l]->seq, recent)) {
+            first = cur[l];
+            cur = first->next;
+        }
+    }
+
+    size_t count = 0;
+    if (first != NULL && tcp_seq_lt(recent, first->end))
+        blocks[count++] = (struct tcp_sack_block) {first->seq, first->end};
+    else
+        first = NULL;
+
+    for (struct tcp_reass_run *run = q->head[0]; run != NULL && count < max;
+            run = run->next[0]) {
+        if (run != first)
+            blocks[count++] = (struct tcp_sack_block) {run->seq, run->end};
+    }
+    return count;
+}
+
+void tcp_reass_free(struct tcp_reass *q) {
+    struct tcp_reass_run *run = q->head[0];
+    while (run != NULL) {
+        struct tcp_reass_run *next = run->next[0];
+        size_t dropped = 0;
+        tcp_reass_trim(q, run->head, run->end, &dropped);
+        free(run);
+        run = next;
+    }
+
+    for (int l = 0; l < TCP_REASS_LEVELS; l++)
+        q->head[l] = NULL;
+    q->height = 1;
+    q->runs = 0;
+}
@@ -6,22 +6,50 @@
 #include <netstack/time/util.h>
 #include <netstack/tcp/retransmission.h>
 
+// Holes taken from the SACK scoreboard per pass over it
+#define TCP_SACK_HOLES  16
 
-void tcp_syn_retransmission_timeout(void *arg) {
-    struct tcp_rto_data *data = arg;
-    struct tcp_sock *sock = data->sock;
+
+void tcp_arm_rto(struct tcp_sock *sock, uint64_t ns) {
+    // Hold another reference to the socket to prevent it being free'd
+    tcp_sock_incref(sock);
+
+    // Re-arming an armed timer keeps the reference it already holds
+    if (wheel_arm(&tcp_wheel, &sock->rtimer, ns))
+        tcp_sock_decref(sock);
+}
+
+void tcp_stop_rto(struct tcp_sock *sock) {
+    // Ensure we don't decref the socket if the timer has already expired
+    if (wheel_cancel(&tcp_wheel, &sock->rtimer))
+        tcp_sock_decref(sock);
+}
+
+void tcp_rto_expire(void *arg) {
+    struct tcp_sock *sock = arg;
+
+    // Until the SYN is answered, the timer paces connection attempts instead
+    if (sock->state == TCP_SYN_SENT)
+        tcp_syn_retransmission_timeout(sock);
+    else
+        tcp_retransmission_timeout(sock);
+}
+
+void tcp_syn_retransmission_timeout(struct tcp_sock *sock) {
 
     tcp_sock_lock(sock);
 
     // Sanity check
-    if (sock->state != TCP_SYN_SENT)
+    if (sock->state != TCP_SYN_SENT) {
+        tcp_sock_decref_unlock(sock);
         return;
+    }
 
     // If the backoff has hit the retry count, give up and claim ETIMEDOUT
     if (sock->backoff >= TCP_SYN_COUNT - 1) {
         tcp_setstate(sock, TCP_CLOSED);
         tcp_wake_error(sock, -ETIMEDOUT);
-        tcp_sock_unlock(sock);
+        tcp_sock_decref_unlock(sock);
         return;
     }
 
@@ -32,42 +60,30 @@ void tcp_syn_retransmission_timeout(void *arg) {
     tcp_send_syn(sock);
 
     // Re-arm the connect timeout with double timeout
-    struct timespec timeout;
-    timespecns(&timeout, TCP_SYN_RTO << sock->backoff);
-    LOG(LVERB, "setting sock connect timeout %.3fs", tstosec(&timeout, float));
+    uint64_t timeout = TCP_SYN_RTO << sock->backoff;
+    LOG(LVERB, "setting sock connect timeout %.3fs", nstosec((float) timeout));
+    tcp_arm_rto(sock, timeout);
 
-    void *cb = tcp_syn_retransmission_timeout;
-    sock->rto_event = contimer_queue_rel(&sock->rtimer, &timeout, cb,
-                                         data, sizeof(struct tcp_rto_data));
-
-    tcp_sock_unlock(sock);
+    // Release the reference held for this timeout
+    tcp_sock_decref_unlock(sock);
 }
 
 void tcp_start_rto(struct tcp_sock *sock, uint16_t count, uint8_t flags) {
 
-    struct tcp_rto_data rtd = {
-            .sock = sock,
+    sock->rtd = (struct tcp_rto_data) {
             .seq = sock->tcb.snd.nxt,
             .len = count,
             .flags = flags
     };
 
-    // Hold another reference to the socket to prevent it being free'd
-    tcp_sock_incref(sock);
-
-    // Use the sock->lasttime storage as contimer_queue_rel() will fill it
-    // with the absolute start time of the timeout upon return
-    sock->lasttime.tv_sec  = nstosec(sock->rtt);
-    sock->lasttime.tv_nsec = sock->rtt % NSPERSEC;
+    clock_gettime(CLOCK_MONOTONIC, &sock->lasttime);
 
-    LOG(LVERB, "starting rtimer for sock %p (%u, %i)", sock, rtd.seq, count);
-    sock->rto_event = contimer_queue_rel(&sock->rtimer, &sock->lasttime,
-                                         NULL, &rtd, sizeof(rtd));
+    LOG(LVERB, "starting rtimer for sock %p (%u, %i)", sock, sock->rtd.seq, count);
+    tcp_arm_rto(sock, tstons(&sock->rto, uint64_t));
 }
 
-void tcp_retransmission_timeout(void *arg) {
-    struct tcp_rto_data *data = arg;
-    struct tcp_sock *sock = data->sock;
+void tcp_retransmission_timeout(struct tcp_sock *sock) {
+    struct tcp_rto_data *data = &sock->rtd;
     struct tcb *tcb = &sock->tcb;
 
     tcp_sock_lock(sock);
@@ -91,22 +107,38 @@ void tcp_retransmission_timeout(void *arg) {
         // Always exponentially backoff every time a segment has to be
         // retransmitted. This is reset to 0 every time a valid ACK arrives
         sock->backoff++;
-        
-        tcp_sock_unlock(sock);
 
-        // Retransmit the first bytes in the retransmission queue
-        // TODO: Optionally only send the missing bytes instead of just a full segment worth
+        // The peer may have discarded what it SACKed, so the scoreboard is
+        // rebuilt from the SACKs that follow (RFC 2018, section 8). Until
+        // SND.NXT is acknowledged, the holes they show are retransmitted
+        pthread_mutex_lock(&sock->unacked.lock);
+        bool first = true;
+        for_each_llist(&sock->unacked) {
+            struct tcp_seq_data *unacked = llist_elem_data();
+            unacked->sacked = false;
+            unacked->rexmit = first;
+            unacked->retransmitted |= first;
+            first = false;
+        }
+        pthread_mutex_unlock(&sock->unacked.lock);
+        if (sock->sack) {
+            sock->recovering = true;
+            sock->recover = tcb->snd.nxt;
+        }
+
+        // Retransmit the first bytes in the retransmission queue. Control
+        // segments are sent with the lock held as their options may be built
+        // from the socket state
         int ret;
         if (data->len > 0) {
+            tcp_sock_unlock(sock);
             if ((ret = tcp_send_data(sock, una, data->len, data->flags)) <= 0)
                 LOGSE(LWARN, "retransmitting with tcp_send_data(%u)", -ret, una - tcb->iss);
+            tcp_sock_lock(sock);
         } else {
             if ((ret = tcp_send_empty(sock, una, data->len, data->flags)) <= 0)
                 LOGSE(LWARN, "retransmitting with tcp_send_empty(%u)", -ret, una - tcb->iss);
         }
-
-        // Relock the socket
-        tcp_sock_lock(sock);
     }
 
     pthread_mutex_lock(&sock->unacked.lock);
@@ -137,19 +169,16 @@ void tcp_retransmission_timeout(void *arg) {
         // good from my testing. -frebib ~2018
 
         // Restart the rto
-        sock->rto_event = contimer_queue_rel(&sock->rtimer, &timeout, NULL,
-                                             data, sizeof(struct tcp_rto_data));
-
-        // Unlock but continue to hold reference for next timeout
-        tcp_sock_unlock(sock);
+        tcp_arm_rto(sock, tstons(&timeout, uint64_t));
     } else {
         pthread_mutex_unlock(&sock->unacked.lock);
-        // Decrement held reference from when rto was started
-        tcp_sock_decref_unlock(sock);
     }
+
+    // Decrement held reference from when rto was started
+    tcp_sock_decref_unlock(sock);
 }
 
-void tcp_update_rtq(struct tcp_sock *sock) {
+void tcp_update_rtq(struct tcp_sock *sock, bool has_ts, uint32_t tsecr) {
 
     pthread_mutex_lock(&sock->unacked.lock);
 
@@ -168,6 +197,7 @@ void tcp_update_rtq(struct tcp_sock *sock) {
     }
 
     struct tcp_seq_data latest = {0};
+    bool acked = false;
     LOG(LVERB, "checking %zu unacked segments", sock->unacked.length);
     for_each_llist(&sock->unacked) {
         struct tcp_seq_data *data = llist_elem_data();
@@ -181,8 +211,9 @@ void tcp_update_rtq(struct tcp_sock *sock) {
 
             // Store the latest ACKed segment for updating the rtt
             // Retransmitted segments should NOT be used for rtt calculation
-            if (sock->backoff < 1)
+            if (sock->backoff < 1 && !data->retransmitted)
                 latest = *data;
+            acked = true;
 
             llist_remove_nolock(&sock->unacked, data);
             free(data);
@@ -197,27 +228,50 @@ void tcp_update_rtq(struct tcp_sock *sock) {
             latest.seq - iss, end - iss);
 
         tcp_update_rtt(sock, &latest);
+    } else if (acked && has_ts) {
+        // The echoed timestamp is that of the segment which was acknowledged,
+        // whichever transmission of it that was
+        tcp_update_rtt_ts(sock, tsecr);
     }
 
-    // Cancel the rto if there are no unacked segments left
-    if (sock->unacked.length < 1) {
+    bool outstanding = sock->unacked.length > 0;
+    pthread_mutex_unlock(&sock->unacked.lock);
 
+    // Cancel the rto if there are no unacked segments left
+    if (!outstanding) {
         LOG(LINFO, "No unacked segments outstanding. Cancelling the rto");
+        tcp_stop_rto(sock);
+    }
+}
 
-        // Ensure we don't decref the socket if no event was cancelled
-        if (contimer_cancel(&sock->rtimer, sock->rto_event) == 0) {
-            // Unlock then decrement held reference
-            pthread_mutex_unlock(&sock->unacked.lock);
-            tcp_sock_decref(sock);
-        }
-
-        // Just unlock. No event was cancelled
-        pthread_mutex_unlock(&sock->unacked.lock);
+/*
+ * Updates SRTT, RTTVAR and the RTO with a round-trip time sample of r ns
+ */
+static void tcp_rtt_sample(struct tcp_sock *sock, uint64_t r) {
+    // RFC 6298: Computing TCP's Retransmission Timer
+    // https://tools.ietf.org/html/rfc6298
 
+    // If SRTT is 0, make the initial measurement
+    if (sock->srtt == 0) {
+        sock->srtt = r;
+        sock->rttvar = r >> 1U;  // r / 2
     } else {
-        // Just release lock. The timer is still running
-        pthread_mutex_unlock(&sock->unacked.lock);
+        // RTTVAR <- (1 - beta) * RTTVAR + beta * |SRTT - R'|
+        // SRTT <- (1 - alpha) * SRTT + alpha * R'
+        const double beta = 0.25;
+        const double alpha = 0.125;
+        sock->rttvar = (uint64_t) ((1 - beta) * sock->rttvar + beta *
+                                        labs((int64_t) (sock->srtt - r)));
+        sock->srtt = (uint64_t) ((1 - alpha) * sock->srtt + alpha * r);
     }
+
+    // K <- 4
+    // RTO <- SRTT + (K*RTTVAR)
+    uint64_t rto = sock->srtt + (sock->rttvar << 2U);
+    rto = MAX(rto, TCP_RTO_MIN);
+    timespecns(&sock->rto, rto);
+
+    LOG(LVERB, "sock %p RTO <- %.3fms", sock, nstoms((float) rto));
 }
 
 void tcp_update_rtt(struct tcp_sock *sock, struct tcp_seq_data *acked) {
@@ -241,29 +295,119 @@ void tcp_update_rtt(struct tcp_sock *sock, struct tcp_seq_data *acked) {
     uint64_t r = tstons(&now, uint64_t);
 
     LOG(LTRCE, "segment response time %.3fms (%ldns)", nstoms((float) r), r);
+    tcp_rtt_sample(sock, r);
+}
 
-    // RFC 6298: Computing TCP's Retransmission Timer
-    // https://tools.ietf.org/html/rfc6298
+void tcp_update_rtt_ts(struct tcp_sock *sock, uint32_t tsecr) {
+    int32_t ticks = (int32_t) (tcp_ts_now(sock) - tsecr);
+    if (ticks < 0) {
+        LOG(LWARN, "TSecr %u was sent in the future?", tsecr);
+        return;
+    }
 
-    // If SRTT is 0, make the initial measurement
-    if (sock->srtt == 0) {
-        sock->srtt = r;
-        sock->rttvar = r >> 1U;  // r / 2
-    } else {
-        // RTTVAR <- (1 - beta) * RTTVAR + beta * |SRTT - R'|
-        // SRTT <- (1 - alpha) * SRTT + alpha * R'
-        const double beta = 0.25;
-        const double alpha = 0.125;
-        sock->rttvar = (uint64_t) ((1 - beta) * sock->rttvar + beta *
-                                        labs((int64_t) (sock->srtt - r)));
-        sock->srtt = (uint64_t) ((1 - alpha) * sock->srtt + alpha * r);
+    // A round-trip within one tick can't be told apart from one tick
+    uint64_t r = (uint64_t) MAX(ticks, 1) * (sectons(1) / TCP_TS_HZ);
+
+    LOG(LTRCE, "timestamp response time %.3fms (%ldns)", nstoms((float) r), r);
+    tcp_rtt_sample(sock, r);
+}
+
+/*
+ * Takes up to max holes from the scoreboard: segments neither SACKed nor
+ * already retransmitted, that are considered lost as TCP_DUPTHRESH segments
+ * after them have been SACKed (RFC 6675, IsLost)
+ */
+static size_t tcp_sack_holes(struct tcp_sock *sock, struct tcp_seq_data *holes,
+                             size_t max) {
+    pthread_mutex_lock(&sock->unacked.lock);
+
+    size_t above = 0;
+    for_each_llist(&sock->unacked) {
+        struct tcp_seq_data *data = llist_elem_data();
+        above += data->sacked;
     }
 
-    // K <- 4
-    // RTO <- SRTT + (K*RTTVAR)
-    uint64_t rto = sock->srtt + (sock->rttvar << 2U);
-    rto = MAX(rto, TCP_RTO_MIN);
-    timespecns(&sock->rto, rto);
+    // Duplicate ACKs without SACK blocks only show the first segment missing
+    bool first = sock->dupacks >= TCP_DUPTHRESH;
 
-    LOG(LVERB, "sock %p RTO <- %.3fms", sock, nstoms((float) rto));
+    size_t count = 0;
+    for_each_llist(&sock->unacked) {
+        struct tcp_seq_data *data = llist_elem_data();
+        if (count == max || (above < TCP_DUPTHRESH && !first))
+            break;
+        if (data->sacked) {
+            above--;
+        } else if (!data->rexmit && data->len > 0) {
+            data->rexmit = data->retransmitted = true;
+            holes[count++] = *data;
+        }
+        first = false;
+    }
+
+    pthread_mutex_unlock(&sock->unacked.lock);
+
+    return count;
+}
+
+void tcp_sack_update(struct tcp_sock *sock, struct tcp_sack_block *blocks,
+                     uint8_t count, bool dupack) {
+    struct tcb *tcb = &sock->tcb;
+    uint32_t iss = tcb->iss;
+
+    sock->dupacks = dupack ? sock->dupacks + 1 : 0;
+
+    // Blocks only ever cover whole segments, as they are made of them
+    size_t sacked = 0;
+    pthread_mutex_lock(&sock->unacked.lock);
+    for_each_llist(&sock->unacked) {
+        struct tcp_seq_data *data = llist_elem_data();
+        uint32_t end = data->seq + data->len;
+        for (uint8_t i = 0; i < count && !data->sacked && data->len > 0; i++) {
+            if (tcp_seq_leq(blocks[i].start, data->seq) &&
+                    tcp_seq_leq(end, blocks[i].end))
+                data->sacked = true;
+        }
+        if (data->sacked)
+            sacked++;
+    }
+    pthread_mutex_unlock(&sock->unacked.lock);
+
+    if (sock->recovering && tcp_seq_geq(tcb->snd.una, sock->recover)) {
+        LOG(LDBUG, "loss recovery complete at %u", sock->recover - iss);
+        sock->recovering = false;
+    }
+    if (!sock->recovering) {
+        if (sock->dupacks < TCP_DUPTHRESH && sacked < TCP_DUPTHRESH)
+            return;
+
+        sock->recovering = true;
+        sock->recover = tcb->snd.nxt;
+        LOG(LDBUG, "loss detected, recovering until %u (%u dupacks, "
+            "%zu sacked)", sock->recover - iss, sock->dupacks, sacked);
+    }
+
+    struct tcp_seq_data holes[TCP_SACK_HOLES];
+    size_t found;
+    do {
+        found = tcp_sack_holes(sock, holes, TCP_SACK_HOLES);
+        for (size_t i = 0; i < found; i++) {
+            uint32_t seq = holes[i].seq;
+            uint32_t end = seq + holes[i].len;
+            // Only send what the ACK hasn't covered since
+            if (tcp_seq_lt(seq, tcb->snd.una))
+                seq = tcb->snd.una;
+
+            LOG(LCRIT, "RETRANSMITTING HOLE %u-%u", seq - iss, end - 1 - iss);
+            while (tcp_seq_lt(seq, end)) {
+                int ret = tcp_send_data_nolock(sock, seq, end - seq,
+                                               holes[i].flags);
+                if (ret <= 0) {
+                    LOGSE(LWARN, "retransmitting with tcp_send_data(%u)", -ret,
+                          seq - iss);
+                    return;
+                }
+                seq += ret;
+            }
+        }
+    } while (found == TCP_SACK_HOLES);
 }
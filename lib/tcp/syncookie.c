@@ -0,0 +1,150 @@
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <endian.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#define NETSTACK_LOG_UNIT "TCP"
+#include <netstack/log.h>
+#include <netstack/tcp/syncookie.h>
+
+int tcp_syncookies = TCP_SYNCOOKIES_ON;
+
+// Common MSS values, the largest not above the peer's is put in a cookie
+static const uint16_t tcp_cookie_mss[] = {
+        216, 536, 1024, 1220, 1300, 1380, 1440, 1460
+};
+#define TCP_COOKIE_MSS_COUNT \
+        (sizeof(tcp_cookie_mss) / sizeof(tcp_cookie_mss[0]))
+
+static pthread_once_t tcp_cookie_once = PTHREAD_ONCE_INIT;
+static uint64_t tcp_cookie_key[2];
+
+static void tcp_cookie_init(void) {
+    if (getrandom(tcp_cookie_key, sizeof(tcp_cookie_key), 0) !=
+            sizeof(tcp_cookie_key)) {
+        LOGERR("getrandom");
+        tcp_cookie_key[0] = (uint64_t) time(NULL) << 32 | (uint32_t) rand();
+        tcp_cookie_key[1] = (uint64_t) rand() << 32 | (uint32_t) rand();
+    }
+}
+
+/*
+ * SipHash-2-4, from https://131002.net/siphash/siphash.pdf
+ */
+
+static inline uint64_t sip_rotl(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+static inline void sip_round(uint64_t v[4]) {
+    v[0] += v[1]; v[1] = sip_rotl(v[1], 13); v[1] ^= v[0];
+    v[0] = sip_rotl(v[0], 32);
+    v[2] += v[3]; v[3] = sip_rotl(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = sip_rotl(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = sip_rotl(v[1], 17); v[1] ^= v[2];
+    v[2] = sip_rotl(v[2], 32);
+}
+
+static uint64_t siphash24(const uint64_t key[2], const void *in, size_t len) {
+    uint64_t v[4] = {
+            key[0] ^ 0x736f6d6570736575ULL,
+            key[1] ^ 0x646f72616e646f6dULL,
+            key[0] ^ 0x6c7967656e657261ULL,
+            key[1] ^ 0x7465646279746573ULL
+    };
+    const uint8_t *p = in, *end = p + (len & ~(size_t) 7);
+    uint64_t m;
+
+    for (; p < end; p += 8) {
+        memcpy(&m, p, sizeof(m));
+        m = le64toh(m);
+        v[3] ^= m;
+        sip_round(v);
+        sip_round(v);
+        v[0] ^= m;
+    }
+
+    // The final block holds the remaining octets and the length
+    m = (uint64_t) len << 56;
+    for (size_t i = 0; i < (len & 7); i++)
+        m |= (uint64_t) p[i] << (8 * i);
+    v[3] ^= m;
+    sip_round(v);
+    sip_round(v);
+    v[0] ^= m;
+
+    v[2] ^= 0xff;
+    for (int i = 0; i < 4; i++)
+        sip_round(v);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+static inline uint32_t tcp_cookie_count(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec / TCP_COOKIE_PERIOD);
+}
+
+static void tcp_cookie_addr(uint8_t out[16], addr_t *addr) {
+    switch (addr->proto) {
+        case PROTO_IPV4:
+            memcpy(out, &addr->ipv4, sizeof(addr->ipv4));
+            break;
+        case PROTO_IPV6:
+            memcpy(out, addr->ipv6, sizeof(addr->ipv6));
+            break;
+        default:
+            break;
+    }
+}
+
+// The 24 bits of a cookie that authenticate the rest of it
+static uint32_t tcp_cookie_hash(struct inet_sock *inet, uint32_t seq,
+                                uint32_t count, uint32_t mss) {
+    struct {
+        uint8_t remaddr[16], locaddr[16];
+        uint16_t remport, locport;
+        uint32_t seq, count, mss;
+    } msg;
+    memset(&msg, 0, sizeof(msg));
+    tcp_cookie_addr(msg.remaddr, &inet->remaddr);
+    tcp_cookie_addr(msg.locaddr, &inet->locaddr);
+    msg.remport = inet->remport;
+    msg.locport = inet->locport;
+    msg.seq = seq;
+    msg.count = count;
+    msg.mss = mss;
+
+    pthread_once(&tcp_cookie_once, tcp_cookie_init);
+    return (uint32_t) siphash24(tcp_cookie_key, &msg, sizeof(msg)) & 0xFFFFFF;
+}
+
+uint32_t tcp_syncookie_make(struct inet_sock *inet, uint32_t seq,
+                            uint16_t mss) {
+    uint32_t count = tcp_cookie_count();
+
+    uint32_t idx = TCP_COOKIE_MSS_COUNT - 1;
+    while (idx > 0 && tcp_cookie_mss[idx] > mss)
+        idx--;
+
+    return (count & 0x1F) << 27 | idx << 24 |
+           tcp_cookie_hash(inet, seq, count, idx);
+}
+
+int tcp_syncookie_check(struct inet_sock *inet, uint32_t seq,
+                        uint32_t cookie) {
+    // Recover the full count from the low bits the cookie carries
+    uint32_t now = tcp_cookie_count();
+    uint32_t age = (now - (cookie >> 27)) & 0x1F;
+    if (age >= TCP_COOKIE_MAXAGE)
+        return -EINVAL;
+
+    uint32_t idx = (cookie >> 24) & 0x7;
+    if (tcp_cookie_hash(inet, seq, now - age, idx) != (cookie & 0xFFFFFF))
+        return -EINVAL;
+
+    return tcp_cookie_mss[idx];
+}
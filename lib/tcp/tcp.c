@@ -13,6 +13,8 @@
 #include <netstack/time/util.h>
 
 llist_t tcp_sockets = LLIST_INITIALISER;
+struct inet_socktbl tcp_socktbl = INET_SOCKTBL_INITIALISER;
+struct wheel tcp_wheel;
 
 
 bool tcp_log(struct pkt_log *log, struct frame *frame, uint16_t net_csum,
@@ -27,6 +29,8 @@ bool tcp_log(struct pkt_log *log, struct frame *frame, uint16_t net_csum,
     uint32_t irs = 0, iss = 0;
     struct tcp_sock *sock = NULL;
 
+    // The socket is only read, so it only needs to outlive this function
+    epoch_enter();
     if ((sock = tcp_sock_lookup(&saddr, &daddr, sport, dport)) != NULL) {
         if (!hdr->flags.syn && !hdr->flags.rst) {
             irs = sock->tcb.irs;
@@ -46,6 +50,7 @@ bool tcp_log(struct pkt_log *log, struct frame *frame, uint16_t net_csum,
         LOGT(trans, "%s, ", tcp_strstate(sock->state));
     else
         LOGT(trans, "(unrecognised), ");
+    epoch_exit();
 
     // Print and check checksum
     uint16_t pkt_csum = hdr->csum;
@@ -77,25 +82,23 @@ bool tcp_log(struct pkt_log *log, struct frame *frame, uint16_t net_csum,
     return true;
 }
 
-void tcp_log_recvqueue(struct tcp_sock *sock) {
-    if (sock->recvqueue.length > 0) {
+void tcp_log_rcvbuf(struct tcp_sock *sock) {
+    if (!log_enabled(LVERB))
+        return;
+
+    uint32_t irs = sock->tcb.irs;
+    uint32_t end = sock->tcb.rcv.nxt - irs;
+    LOG(LVERB, "rcvbuf seq %u-%u, %zu bytes, %zu free", end -
+        (uint32_t) sock->rcvbuf.count, end - 1, sock->rcvbuf.count,
+        ringbuf_space(&sock->rcvbuf));
+
+    if (sock->reass.runs > 0) {
         struct log_trans t = LOG_TRANS(LVERB);
-        uint i = 0;
-        uint32_t ctr = sock->tcb.rcv.nxt;
-        for_each_llist(&sock->recvqueue) {
-            struct frame *qframe = llist_elem_data();
-            struct tcp_hdr *hdr = tcp_hdr(qframe);
-            uint32_t seqn = ntohl(hdr->seqn);
-            uint32_t relseq = seqn - sock->tcb.irs;
-            if (tcp_seq_gt(seqn, ctr))
-                LOGT(&t, "recvqueue    < GAP OF %u bytes>\n", seqn - ctr);
-            LOGT(&t, "recvqueue[%u] seq %u-%u\n",
-                 i++, relseq, relseq + frame_data_len(qframe) - 1);
-            ctr = seqn + frame_data_len(qframe);
-        }
+        for (struct tcp_reass_run *run = sock->reass.head[0]; run != NULL;
+             run = run->next[0])
+            LOGT(&t, "out-of-order seq %u-%u\n", run->seq - irs,
+                 run->end - irs - 1);
         LOGT_COMMIT(&t);
-    } else {
-        LOG(LVERB, "recvqueue is empty");
     }
 }
 
@@ -104,18 +107,21 @@ void tcp_ipv4_recv(struct frame *frame, struct ipv4_hdr *hdr) {
     struct tcp_hdr *tcp_hdr = tcp_hdr(frame);
     frame->remport = htons(tcp_hdr->sport);
     frame->locport = htons(tcp_hdr->dport);
+
+    epoch_enter();
     struct tcp_sock *sock =
             tcp_sock_lookup(&frame->remaddr, &frame->locaddr,
                              frame->remport,  frame->locport);
+    // Ignore sockets that are already being free'd
+    if (sock != NULL && !tcp_sock_tryincref(sock))
+        sock = NULL;
+    epoch_exit();
 
     // https://blog.cloudflare.com/syn-packet-handling-in-the-wild
 
     // No (part/complete) established connection was found
-    if (sock == NULL) {
+    if (sock == NULL)
         LOG(LWARN, "Unrecognised incoming TCP connection");
-    } else {
-        tcp_sock_incref(sock);
-    }
     /* Pass initial network csum as TCP packet csum seed */
     tcp_recv(frame, sock, inet_ipv4_csum(hdr));
 
@@ -125,6 +131,32 @@ void tcp_ipv4_recv(struct frame *frame, struct ipv4_hdr *hdr) {
 }
 
 
+/*
+ * Copies the text of a segment that is next in order for a synchronised
+ * connection in after the end of its receive buffer, summing it in the same
+ * pass. The socket lock must be held
+ * @return the length of the text copied, or 0 if it was not
+ */
+static size_t tcp_rcvbuf_stage(struct tcp_sock *sock, tcp_state_t state,
+                               struct frame *frame, uint16_t *sum) {
+    switch (state) {
+        case TCP_ESTABLISHED:
+        case TCP_FIN_WAIT_1:
+        case TCP_FIN_WAIT_2:
+            break;
+        default:
+            return 0;
+    }
+
+    uint16_t len = frame_data_len(frame);
+    if (len == 0 || ntohl(tcp_hdr(frame)->seqn) != sock->tcb.rcv.nxt ||
+            len > ringbuf_space(&sock->rcvbuf))
+        return 0;
+
+    return ringbuf_stage_csum(&sock->rcvbuf, frame->data, len, sum) == len ?
+           len : 0;
+}
+
 void tcp_recv(struct frame *frame, struct tcp_sock *sock, uint16_t net_csum) {
 
     /* Don't parse yet, we need to check the checksum first */
@@ -142,9 +174,27 @@ void tcp_recv(struct frame *frame, struct tcp_sock *sock, uint16_t net_csum) {
     //   - https://lwn.net/Articles/358910/
     //   - https://www.kernel.org/doc/Documentation/networking/segmentation-offloads.txt
 
+    // Obtain socket state within the mutex lock. It is held through to
+    // tcp_seg_arr() for text to be copied into the receive buffer
+    tcp_state_t state = TCP_CLOSED;
+    if (sock != NULL) {
+        tcp_sock_lock(sock);
+        state = sock->state;
+    }
+
+    // In-order text is summed as it is copied in after the receive buffer,
+    // and only added to it once the whole checksum verifies. Any other text
+    // is summed where it is
+    uint16_t datasum;
+    size_t staged = tcp_rcvbuf_stage(sock, state, frame, &datasum);
+    if (staged == 0)
+        datasum = ~in_csum(frame->data, frame_data_len(frame), 0);
+
     // TODO: Check for TSO and GRO and account for it, somehow..
-    if (in_csum(frame->head, frame_pkt_len(frame), net_csum) != 0) {
+    if (in_csum(hdr, tcp_hdr_len(hdr), in_csum_add(net_csum, datasum)) != 0) {
         LOG(LTRCE, "Dropping TCP packet with invalid checksum!");
+        if (sock != NULL)
+            tcp_sock_unlock(sock);
         goto drop_pkt;
     }
 
@@ -156,21 +206,17 @@ void tcp_recv(struct frame *frame, struct tcp_sock *sock, uint16_t net_csum) {
     // Parse segment TCP options
     // TODO: Parse incoming TCP segment options
 
-    // Obtain socket state within the mutex lock
-    tcp_state_t state = TCP_CLOSED;
-    if (sock != NULL) {
-        tcp_sock_lock(sock);
-        state = sock->state;
-        tcp_sock_unlock(sock);
+    if (sock == NULL || state == TCP_CLOSED || state == TCP_LISTEN) {
+        if (sock != NULL)
+            tcp_sock_unlock(sock);
+        if (state == TCP_LISTEN)
+            tcp_recv_listen(frame, sock, hdr);
+        else
+            tcp_recv_closed(frame, hdr);
+    } else {
+        tcp_seg_arr(frame, sock, staged);
     }
 
-    if (sock == NULL || state == TCP_CLOSED)
-        tcp_recv_closed(frame, hdr);
-    else if (state == TCP_LISTEN)
-        tcp_recv_listen(frame, sock, hdr);
-    else
-        tcp_seg_arr(frame, sock);
-
     drop_pkt:
     return;
 }
@@ -189,33 +235,30 @@ void _tcp_setstate(struct tcp_sock *sock, tcp_state_t state) {
         case TCP_CLOSED:
             // Clear this timeout
             tcp_timewait_cancel(sock);
-            contimer_stop(&sock->rtimer);
+            tcp_stop_rto(sock);
         default:
             break;
     }
 }
 
-void tcp_established(struct tcp_sock *sock, uint32_t recvnext) {
+void tcp_established(struct tcp_sock *sock) {
 
     tcp_setstate(sock, TCP_ESTABLISHED);
 
     // Cancel the pending retransmit timeout
-    contimer_stop(&sock->rtimer);
-
-    // Set the initial recv value to the first byte in stream
-    sock->recvptr = recvnext;
-    LOG(LTRCE, "set recvptr to %u", sock->recvptr);
+    tcp_stop_rto(sock);
 
     // Allocate send/receive buffers
     seqbuf_init(&sock->sndbuf, (size_t) sock->tcb.iss + 1, ((size_t) 1) << 32U);
+    if (ringbuf_init(&sock->rcvbuf, sock->rcvbuf_max))
+        LOG(LERR, "Failed to allocate a receive buffer");
 
-    LOG(LDBUG, "Allocated SND.WND %hu, RCV.WND %hu",
-        sock->tcb.snd.wnd, sock->tcb.rcv.wnd);
+    // Only what fits in the receive buffer can be accepted from now on
+    sock->tcb.rcv.wnd = tcp_rcvbuf_wnd(sock);
 
-    // If socket was PASSIVE open, notify the parent socket if waiting on accept()
-    if (sock->parent != NULL) {
-        tcp_wake_waiters(sock->parent);
-    }
+    LOG(LDBUG, "Allocated SND.WND %u, RCV.WND %u (shifts %hhu/%hhu)",
+        sock->tcb.snd.wnd, sock->tcb.rcv.wnd, sock->tcb.snd.wscale,
+        sock->tcb.rcv.wscale);
 }
 
 struct tcp_sock *tcp_sock_init(struct tcp_sock *sock) {
@@ -227,6 +270,13 @@ struct tcp_sock *tcp_sock_init(struct tcp_sock *sock) {
     sock->mss = TCP_DEF_MSS;
     sock->passive = NULL;
     sock->parent = NULL;
+    sock->queue = NULL;
+    sock->sndbuf_max = TCP_DEF_SNDBUF;
+    sock->finpending = false;
+    sock->rcvbuf_max = TCP_DEF_RCVBUF;
+    sock->wscale = false;
+    sock->ts = false;
+    sock->ts_offset = tcp_seqnum();
 
     // Locking & concurrency
     atomic_init(&sock->refcount, 1);
@@ -235,11 +285,16 @@ struct tcp_sock *tcp_sock_init(struct tcp_sock *sock) {
     pthread_cond_init(&sock->waitack, NULL);
     sock->error = 0;
 
-    sock->timewait = (timeout_t) {0};
+    wheel_timer_init(&sock->timewait,
+                     (void (*)(void *)) tcp_timewait_expire, sock);
 
     // Retransmission
-    contimer_init(&sock->rtimer, tcp_retransmission_timeout);
+    wheel_timer_init(&sock->rtimer, tcp_rto_expire, sock);
     sock->unacked = (llist_t) LLIST_INITIALISER;
+    sock->dupacks = 0;
+    sock->recovering = false;
+    tcp_reass_init(&sock->reass);
+    sock->sack = false;
 
     // https://tools.ietf.org/html/rfc6298#page-7 (section 7)
     // Default RTO is 1 second, unless SYN or following ACK is lost, then 3 secs
@@ -252,28 +307,83 @@ struct tcp_sock *tcp_sock_init(struct tcp_sock *sock) {
     return sock;
 }
 
+/*
+ * Resets the connections that were never accept'ed and frees the listener's
+ * queues. Each child holds its own lock and reference, which the RX thread
+ * may be using, so only the reference the queue held is dropped here
+ */
+static void tcp_passive_free(struct tcp_sock *sock) {
+    // Children looking for their listener find it gone from here on
+    tcp_sock_lock(sock);
+    struct tcp_passive *passive = sock->passive;
+    sock->passive = NULL;
+    tcp_sock_unlock(sock);
+
+    for (;;) {
+        // Children being free'd remove themselves under the listener's lock
+        tcp_sock_lock(sock);
+        struct tcp_sock *child = tcp_queue_pop(&passive->synqueue);
+        if (child == NULL)
+            child = tcp_queue_pop(&passive->acceptq);
+        bool held = child != NULL && tcp_sock_tryincref(child);
+        tcp_sock_unlock(sock);
+
+        if (child == NULL)
+            break;
+        // The last reference to it is already gone
+        if (!held)
+            continue;
+
+        tcp_sock_lock(child);
+        child->parent = NULL;
+        // A closed connection has already given up the queue's reference
+        if (child->state != TCP_CLOSED) {
+            tcp_sock_abort(child);
+            tcp_setstate(child, TCP_CLOSED);
+            tcp_sock_decref(child);
+        }
+        tcp_sock_decref_unlock(child);
+    }
+
+    LOG(LDBUG, "listener dropped %lu SYNs and %lu handshakes, "
+        "sent %lu SYN cookies (%lu returned invalid)",
+        passive->syn_drops, passive->accept_drops,
+        passive->cookies_sent, passive->cookies_failed);
+    free(passive);
+}
+
 inline void tcp_sock_free(struct tcp_sock *sock) {
 
-    // Cancel all running timers
-    tcp_timewait_cancel(sock);
-    contimer_stop(&sock->rtimer);
+    // Cancel all running timers. The socket is going regardless of the
+    // references they hold
+    wheel_cancel(&tcp_wheel, &sock->timewait);
+    wheel_cancel(&tcp_wheel, &sock->rtimer);
 
     // Deallocate dynamically allocated data buffers
     seqbuf_free(&sock->sndbuf);
+    ringbuf_free(&sock->rcvbuf);
+
+    // A connection waiting to be accept'ed leaves the listener's queues
+    struct tcp_sock *parent = sock->parent;
+    if (parent != NULL) {
+        tcp_sock_lock(parent);
+        tcp_queue_remove(sock);
+        tcp_sock_unlock(parent);
+    }
 
     if (sock->passive) {
-        llist_iter(&sock->passive->backlog, tcp_sock_free);
-        llist_clear(&sock->passive->backlog);
-        free(sock->passive);
+        tcp_passive_free(sock);
     }
 
     llist_iter(&sock->unacked, free);
     llist_clear(&sock->unacked);
+    tcp_reass_free(&sock->reass);
 
     // This shouldn't do anything as we currently hold the lock
     tcp_wake_waiters(sock);
 
-    free(sock);
+    // Lookups may still be reading the socket
+    epoch_defer(free, sock);
 }
 
 inline void tcp_sock_destroy(struct tcp_sock *sock) {
@@ -354,29 +464,106 @@ uint32_t tcp_seqnum() {
     return (uint32_t) (rand() * time(NULL));
 }
 
-int tcp_seg_cmp(const struct frame *fa, const struct frame *fb) {
-    return tcp_seq_gt(ntohl(tcp_hdr(fb)->seqn), ntohl(tcp_hdr(fa)->seqn));
+uint32_t tcp_ts_now(struct tcp_sock *sock) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ticks = (uint64_t) now.tv_sec * TCP_TS_HZ +
+                     (uint64_t) now.tv_nsec / (1000000000 / TCP_TS_HZ);
+    return (uint32_t) ticks + sock->ts_offset;
 }
 
-uint32_t tcp_recvqueue_contigseq(struct tcp_sock *sock, uint32_t init) {
-
-    for_each_llist(&sock->recvqueue) {
-        struct frame *frame = llist_elem_data();
-        struct tcp_hdr *hdr = tcp_hdr(frame);
-
-        uint32_t seg_seq = ntohl(hdr->seqn);
-        uint16_t seg_len = frame_data_len(frame);
-        uint32_t seg_end = seg_seq + seg_len - 1;
-        // If initial byte resides within the segment
-        if (tcp_seq_geq(init, seg_seq) && tcp_seq_leq(init, seg_end))
-            // jump to the next byte after the segment
-            init = seg_end + 1;
-        else if (tcp_seq_gt(init, seg_end))
-            // account for duplicate segments
-            continue;
-        else
-            break;
+void tcp_queue_append(struct tcp_queue *q, struct tcp_sock *sock) {
+    sock->queue = q;
+    sock->qnext = NULL;
+    sock->qpprev = q->tail;
+    *q->tail = sock;
+    q->tail = &sock->qnext;
+    q->length++;
+}
+
+void tcp_queue_remove(struct tcp_sock *sock) {
+    struct tcp_queue *q = sock->queue;
+    if (q == NULL)
+        return;
+
+    *sock->qpprev = sock->qnext;
+    if (sock->qnext != NULL)
+        sock->qnext->qpprev = sock->qpprev;
+    else
+        q->tail = sock->qpprev;
+    q->length--;
+    sock->queue = NULL;
+}
+
+struct tcp_sock *tcp_queue_pop(struct tcp_queue *q) {
+    struct tcp_sock *sock = q->head;
+    if (sock != NULL)
+        tcp_queue_remove(sock);
+    return sock;
+}
+
+int tcp_passive_ready(struct tcp_sock *sock) {
+    struct tcp_sock *parent = sock->parent;
+    int ret = 0;
+
+    tcp_sock_lock(parent);
+    struct tcp_passive *passive = parent->passive;
+    if (passive == NULL) {
+        // The listener has been closed and will take the connection with it
+        ret = -ENOTCONN;
+    } else if (passive->acceptq.length >= passive->maxbacklog) {
+        passive->accept_drops++;
+        LOG(LNTCE, "accept queue is full (%zu). dropping handshake ACK",
+            passive->acceptq.length);
+        ret = -ENOBUFS;
+    } else {
+        tcp_queue_remove(sock);
+        tcp_queue_append(&passive->acceptq, sock);
+
+        // Only one accept() call can take the connection
+        pthread_cond_signal(&parent->wait);
     }
+    tcp_sock_unlock(parent);
+
+    return ret;
+}
+
+void tcp_rcvbuf_append(struct tcp_sock *sock, const void *text, uint16_t len) {
+    struct tcb *tcb = &sock->tcb;
 
-    return init;
+    // The window only admits text that fits, so this should never fall short
+    long written = ringbuf_write(&sock->rcvbuf, text, len);
+    if (written != len)
+        LOG(LERR, "rcvbuf overflow: wrote %ld of %hu bytes", written, len);
+
+    tcb->rcv.nxt += written;
+    tcb->rcv.wnd = tcp_rcvbuf_wnd(sock);
+}
+
+void tcp_rcvbuf_commit(struct tcp_sock *sock, uint16_t len) {
+    ringbuf_commit(&sock->rcvbuf, len);
+    sock->tcb.rcv.nxt += len;
+    sock->tcb.rcv.wnd = tcp_rcvbuf_wnd(sock);
+}
+
+void tcp_rcvbuf_reassemble(struct tcp_sock *sock) {
+    struct tcb *tcb = &sock->tcb;
+    struct tcp_reass_seg *seg;
+
+    while ((seg = tcp_reass_pop(&sock->reass, tcb->rcv.nxt)) != NULL) {
+        while (seg != NULL) {
+            struct tcp_reass_seg *next = seg->next;
+            uint32_t skip = tcb->rcv.nxt - seg->seq;
+
+            // Skip text covered by segments that have arrived since
+            frame_lock(seg->frame, SHARED_RD);
+            if (skip < seg->len)
+                tcp_rcvbuf_append(sock, seg->frame->data + skip,
+                                  (uint16_t) (seg->len - skip));
+            frame_decref_unlock(seg->frame);
+
+            free(seg);
+            seg = next;
+        }
+    }
 }
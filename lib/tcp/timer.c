@@ -1,9 +1,34 @@
 #define NETSTACK_LOG_UNIT "TCP"
 #include <netstack/tcp/tcp.h>
+#include <netstack/time/util.h>
 #include <netstack/time/timer.h>
 
+void tcp_timewait_start(struct tcp_sock *sock) {
+    // Hold another reference to the socket until the timer expires
+    tcp_sock_incref(sock);
+
+    // Restarting an armed timer keeps the reference it already holds
+    uint64_t timeout = sectons((uint64_t) TCP_MSL * 2);
+    if (wheel_arm(&tcp_wheel, &sock->timewait, timeout))
+        tcp_sock_decref(sock);
+}
+
+void tcp_timewait_cancel(struct tcp_sock *sock) {
+    // Ensure we don't decref the socket if the timer has already expired
+    if (wheel_cancel(&tcp_wheel, &sock->timewait))
+        tcp_sock_decref(sock);
+}
+
 void tcp_timewait_expire(struct tcp_sock *sock) {
-    LOG(LINFO, "TIME-WAIT expired. Closing connection");
-    tcp_setstate(sock, TCP_CLOSED);
-    tcp_sock_destroy(sock);
+    tcp_sock_lock(sock);
+
+    // The connection may have been reset whilst the timer was firing
+    if (sock->state == TCP_TIME_WAIT) {
+        LOG(LINFO, "TIME-WAIT expired. Closing connection");
+        tcp_setstate(sock, TCP_CLOSED);
+        tcp_sock_decref(sock);
+    }
+
+    // Release the reference held for this timeout
+    tcp_sock_decref_unlock(sock);
 }
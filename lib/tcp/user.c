@@ -63,7 +63,17 @@ int tcp_user_open(struct tcp_sock *sock) {
             break;
     }
 
-    sock->inet.locport = tcp_randomport();
+    // Choose an outgoing port that no other connection to the peer is using
+    int ret = -EADDRINUSE;
+    for (int tries = 0; ret == -EADDRINUSE && tries < TCP_PORT_TRIES; tries++) {
+        sock->inet.locport = tcp_randomport();
+        ret = tcp_sock_hash(sock);
+    }
+    if (ret < 0) {
+        tcp_sock_decref_unlock(sock);
+        return ret;
+    }
+
     // TODO: Fill out 'user timeout' information
 
     uint32_t iss = tcp_seqnum();
@@ -71,12 +81,12 @@ int tcp_user_open(struct tcp_sock *sock) {
     sock->tcb.snd.una = iss;
     sock->tcb.snd.nxt = iss + 1;
     sock->tcb.rcv.wnd = UINT16_MAX;
+    sock->tcb.rcv.wscale = tcp_rcvbuf_wscale(sock->rcvbuf_max);
 
     // Ensure the state is SYN-SENT _before_ calling tcp_send_syn() so that
     // the correct retransmit timeout function is used
     tcp_setstate(sock, TCP_SYN_SENT);
 
-    int ret;
     if ((ret = tcp_send_syn(sock)) < 0) {
         if (ret != -EINPROGRESS)
             LOGSE(LNTCE, "tcp_send_syn", -ret);
@@ -97,71 +107,61 @@ int tcp_user_open(struct tcp_sock *sock) {
     return ret;
 }
 
-#define tcp_user_send_state_check(sock) \
-    switch ((sock)->state) { \
-        case TCP_CLOSED: \
-        case TCP_LISTEN: \
-        case TCP_SYN_SENT: \
-        case TCP_SYN_RECEIVED: \
-            tcp_sock_decref_unlock(sock); \
-            return -ENOTCONN; \
-        case TCP_FIN_WAIT_1: \
-        case TCP_FIN_WAIT_2: \
-        case TCP_CLOSING: \
-        case TCP_LAST_ACK: \
-        case TCP_TIME_WAIT: \
-            tcp_sock_decref_unlock(sock); \
-            return -ESHUTDOWN; \
-        default: \
-            /* ESTABLISHED or CLOSE-WAIT */ \
-            break; \
-    } \
+// Checks the socket is in a state that data can be sent in
+static int tcp_user_send_state(struct tcp_sock *sock) {
+    switch (sock->state) {
+        case TCP_CLOSED:
+        case TCP_LISTEN:
+        case TCP_SYN_SENT:
+        case TCP_SYN_RECEIVED:
+            return -ENOTCONN;
+        case TCP_FIN_WAIT_1:
+        case TCP_FIN_WAIT_2:
+        case TCP_CLOSING:
+        case TCP_LAST_ACK:
+        case TCP_TIME_WAIT:
+            return -ESHUTDOWN;
+        default:
+            /* ESTABLISHED or CLOSE-WAIT */
+            return sock->error < 0 ? sock->error : 0;
+    }
+}
 
-int tcp_user_send(struct tcp_sock *sock, const void *data, size_t len, int flags) {
-    if (sock == NULL)
-        return -ENOTSOCK;
+static int _tcp_user_send(struct tcp_sock *sock, const void *data, size_t len,
+                          int flags) {
 
     // Ensure socket cannot be free'd until this lock is released
     tcp_sock_incref(sock);
     tcp_sock_lock(sock);
 
-    int sent = 0;
-
-    // Ensure the socket is in a valid sending state and return if not
-    tcp_user_send_state_check(sock);
-
-    // TODO: Write to sndbuf and output directly at the same time
-    // TODO: Limit the size of the send buffer. Block if the buffer is full
-    seqbuf_write(&sock->sndbuf, data, len);
+    size_t written = 0;
+    int ret = 0;
 
-    // TODO: Signal sending thread and offload segmentation/transmission
     // TODO: Check for MSG_MORE flag and don't trigger for a short while
-    while (sent < len) {
-
-        // Check every send iteration too, just to make
-        // sure the state hasn't changed in between
-        tcp_user_send_state_check(sock);
-
-        // Ensure there is enough space in the remote rcv.wnd
-        // Take into account those unacknowledged segments that are in-flight
-        size_t inflight_sum = 0;
-        for_each_llist(&sock->unacked) {
-            struct tcp_seq_data *unacked = llist_elem_data();
-            inflight_sum += unacked->len;
-        }
+    while (written < len) {
 
-        size_t space = MAX(0, ((int32_t) sock->tcb.snd.wnd) - inflight_sum);
-        if (space <= 0) {
+        // Check every iteration too, as the state can change whilst waiting
+        if ((ret = tcp_user_send_state(sock)) < 0)
+            break;
+
+        // Only buffer as much as SO_SNDBUF allows, counting the text
+        // that has been sent but not yet acknowledged
+        size_t count = sock->sndbuf.count;
+        size_t space = sock->sndbuf_max > count ? sock->sndbuf_max - count : 0;
+        if (space == 0) {
 
             // Don't wait if socket is non-blocking
-            if (sock->inet.flags & O_NONBLOCK) {
-                tcp_sock_decref_unlock(sock);
-                return -EWOULDBLOCK;
+            if ((sock->inet.flags & O_NONBLOCK) || (flags & MSG_DONTWAIT)) {
+                ret = -EWOULDBLOCK;
+                break;
             }
 
-            LOG(LINFO, "no space in SND.WND. waiting for an incoming ACK");
+            LOG(LINFO, "send buffer is full. waiting for an incoming ACK");
+
+            // Get the segments sent so far out before waiting on their ACK
+            intf_batch_flush();
 
-            // We assume the remote send window is full so wait for an ACK
+            // Acknowledged text is removed from the send buffer
             pthread_cond_wait(&sock->waitack, &sock->lock);
 
             // Woken up; we should re-check our state before sending
@@ -169,36 +169,39 @@ int tcp_user_send(struct tcp_sock *sock, const void *data, size_t len, int flags
             continue;
         }
 
-        uint32_t seqn = sock->tcb.snd.nxt;
-
-        // There is space in the send window- unlock and get the data out!
-        tcp_sock_unlock(sock);
-
-        // Send at most the space left in the SND.WND
-        int ret = tcp_send_data(sock, seqn, space, 0);
-        if (ret <= 0) {
-            LOGSE(LINFO, "tcp_send_data returned", -ret);
-            sent = ret;
+        long n = seqbuf_write(&sock->sndbuf, data + written,
+                              MIN(space, len - written));
+        if (n < 0) {
+            ret = (int) n;
             break;
         }
-        sent += ret;
-        LOG(LVERB, "Sent %i bytes (%i/%zu)", ret, sent, len);
+        written += n;
 
-        // Lock as we return to the start of the loop again
-        tcp_sock_lock(sock);
+        // Send what the SND.WND allows now. Incoming ACKs send the rest
+        if ((ret = tcp_send_pending(sock)) < 0)
+            LOGSE(LINFO, "tcp_send_pending returned", -ret);
+        else
+            LOG(LVERB, "Sent %i bytes (%zu/%zu buffered)", ret, written, len);
     }
-    if (sent > 0)
-        LOG(LDBUG, "Sent in total %i bytes", sent);
-
-    if (sent != len)
-        LOG(LCRIT, "Didn't send everything in the buffer :( %d != %zu", sent, len);
 
     tcp_sock_decref_unlock(sock);
 
-    // Notify that we sent it all, even though the segments never actually got
-    // sent. Retransmissions will pick up the pieces
-    // TODO: Rewind the send buffer to the amount of data we actually sent
-    return (int) len;
+    // Report the text that was buffered, even if the remainder couldn't be
+    if (written > 0)
+        return (int) written;
+    return ret;
+}
+
+int tcp_user_send(struct tcp_sock *sock, const void *data, size_t len, int flags) {
+    if (sock == NULL)
+        return -ENOTSOCK;
+
+    // Batch the segments so that a burst of them is flushed out together
+    intf_batch_begin();
+    int ret = _tcp_user_send(sock, data, len, flags);
+    intf_batch_end();
+
+    return ret;
 }
 
 int tcp_user_recv(struct tcp_sock *sock, void* out, size_t len, int flags) {
@@ -209,167 +212,61 @@ int tcp_user_recv(struct tcp_sock *sock, void* out, size_t len, int flags) {
     tcp_sock_incref(sock);
 
     int ret = 0;
-    unsigned count = 0;     /* # of bytes already copied to out buffer */
 
     // TODO: Don't return EOF until recv'd up to FIN seqn
-    while (count < len) {
-        // Assume frames in sock->recvqueue are ordered, but NOT
-        // necessarily contiguous. Segments may be missing!
-
-        // IMPORTANT LOCKING NOTE:
-        // Take the socket lock and hold it UNTIL all operations to
-        // sock->recvptr, sock->recvqueue and tcb->rcv.wnd have completed
-        // to ensure atomicity.
-        // Reading, unlocking, locking then writing is VERY VERY BAD
-        tcp_sock_lock(sock);
-
-        // First check if there is something to recv
-        struct frame *seg = llist_peek(&sock->recvqueue);
-        uint32_t irs = sock->tcb.irs;
-
-        // If there is a segment, ensure it is the next in sequence
-        if (seg != NULL) {
-            uint32_t seg_seq = ntohl(tcp_hdr(seg)->seqn);
-            uint32_t seg_len = frame_data_len(seg);
-            uint32_t seg_end = seg_seq + seg_len - 1;
-
-            LOG(LTRCE, "sock->recvptr %u, seg_seq %u, seg_end %u",
-                sock->recvptr - irs, seg_seq - irs, seg_end - irs);
-
-            // Check if the queued segment has already been passed
-            if (tcp_seq_gt(sock->recvptr, seg_end)) {
-                LOG(LWARN, "sock->recvptr is past seg_end. Skipping segment");
-
-                // Release and remove segment from the queue
-                sock->tcb.rcv.wnd += seg_len;
-                tcp_sock_unlock(sock);
-                frame_unlock(seg);
-                llist_remove(&sock->recvqueue, seg);
-
-                // Loop back around to try again
-                continue;
-            }
-        }
-
-        if (tcp_seq_gt(sock->recvptr, sock->tcb.rcv.nxt))
-            LOG(LERR, "recvptr > rcv.nxt. This should never happen!");
+    // Hold the socket lock from checking sock->rcvbuf until it and
+    // RCV.WND have been updated, as input writes to both
+    tcp_sock_lock(sock);
+    while (sock->rcvbuf.count == 0) {
+        switch (sock->state) {
+            case TCP_CLOSE_WAIT:
+            case TCP_LAST_ACK:
+            case TCP_TIME_WAIT:
+                LOG(LTRCE, "sock->state hit %s. Returning EOF",
+                    tcp_strstate(sock->state));
 
-        // If the next segment isn't in the recvqueue, wait for it
-        if (seg == NULL || tcp_seq_geq(sock->recvptr, sock->tcb.rcv.nxt)) {
-            if (count > 0) {
                 tcp_sock_unlock(sock);
 
-                LOG(LDBUG, "recvqueue empty, read %d bytes", count);
-
-                // We have already read some data and the queue is now empty
-                // Return back the data to the user
-                ret = count;
-                goto decref_and_return;
-            }
-
-            switch (sock->state) {
-                case TCP_CLOSE_WAIT:
-                case TCP_LAST_ACK:
-                case TCP_TIME_WAIT:
-                    LOG(LTRCE, "sock->state hit %s. Returning EOF",
-                        tcp_strstate(sock->state));
-
-                    tcp_sock_unlock(sock);
-
-                    // We have hit EOF. No more data to recv()
-                    // Zero signifies EOF
-                    ret = 0;
-                    goto decref_and_return;
-                default:
-                    break;
-            }
-
-            // Wait for some data then continue when some arrives
-            LOG(LDBUG, "recvqueue has nothing ready. waiting to be woken up");
-            if ((ret = tcp_wait_change(sock)))
-                LOGE(LERR, "tcp_wait_change %s: ", strerror((int) ret));
-
-            LOG(LDBUG, "tcp_user_recv woken with %d", sock->error);
-            tcp_sock_unlock(sock);
-
-            // Don't return EOF if 0 here, check properly above
-
-            // err is <0 for error
-            if (sock->error < 0) {
-                ret = sock->error;
+                // We have hit EOF. No more data to recv()
+                // Zero signifies EOF
+                ret = 0;
                 goto decref_and_return;
-            }
-
-            // Return to start of loop to obtain next segment to recv
-            continue;
+            default:
+                break;
         }
 
-        pthread_mutex_lock(&sock->recvqueue.lock);
-        LOG(LDBUG, "recvqueue->length = %lu", sock->recvqueue.length);
-        pthread_mutex_unlock(&sock->recvqueue.lock);
+        // Wait for some data then continue when some arrives
+        LOG(LDBUG, "rcvbuf has nothing ready. waiting to be woken up");
+        if ((ret = tcp_wait_change(sock)))
+            LOGE(LERR, "tcp_wait_change %s: ", strerror((int) ret));
 
-        size_t space_left = len - count;
-        frame_lock(seg, SHARED_RD);
-        uint32_t seg_seq = ntohl(tcp_hdr(seg)->seqn);
-        uint16_t seg_len = frame_data_len(seg);
+        LOG(LDBUG, "tcp_user_recv woken with %d", sock->error);
 
-        // seg_ofs is the offset within the segment data to start at
-        size_t seg_ofs = sock->recvptr - seg_seq;
-        // seg_left is the amount of data left in the current seg to read
-        size_t seg_left = seg_len - seg_ofs;
+        // Don't return EOF if 0 here, check properly above
 
-        // This shouldn't happen, but just to be sure
-        if (!tcp_seq_inwnd(sock->recvptr, seg_seq, seg_len)) {
-            LOG(LERR, "sock->recvptr is outside seg_seq");
+        // err is <0 for error
+        if (sock->error < 0) {
+            ret = sock->error;
             tcp_sock_unlock(sock);
-            continue;
+            goto decref_and_return;
         }
+    }
 
-        LOG(LDBUG, "seg len %hu, ptr %lu, space %lu, seg left %lu",
-            seg_len, seg_ofs, space_left, seg_left);
-
-        // If there is more data in the segment than space in the buffer
-        // then only copy as much as will fit in the buffer
-        if (seg_left > space_left) {
-
-            // Update last recv position in sock
-            sock->recvptr += space_left;
-
-            // Maintain the lock around reading and writing to recvptr
-            tcp_sock_unlock(sock);
-
-            // Copy partial frame and return
-            memcpy(out + count, seg->data + seg_ofs, space_left);
-            count += space_left;
-
-            // Break from loop and return
-            frame_unlock(seg);
-            break;
-        } else {
-
-            // Update last recv position in sock
-            sock->recvptr += seg_left;
-
-            // Update RCV.WND size after removing consumed segment
-            sock->tcb.rcv.wnd += seg_len;
-
-            // Remove completely consumed frame from the queue
-            // If seg isn't sock->recvqueue head, locking isn't working
-            // Note: This operation holds it's own lock so a socket RW
-            // lock isn't required here
-            llist_remove(&sock->recvqueue, seg);
-
-            tcp_sock_unlock(sock);
-
-            // Copy remainder of frame then dispose of it
-            memcpy(out + count, seg->data + seg_ofs, seg_left);
-            count += seg_left;
-
-            // TODO: Check for MSG_PEEK and conditionally don't do this
-            frame_decref(seg);
-        }
+    // TODO: Check for MSG_PEEK and conditionally don't consume the data
+    ret = (int) ringbuf_read(&sock->rcvbuf, out, len);
+    LOG(LDBUG, "read %d bytes, %zu left in rcvbuf", ret, sock->rcvbuf.count);
+
+    // Reading frees space in the buffer, which opens the window. A sender
+    // held up by a window smaller than a segment won't know it has opened
+    // unless we say so
+    uint32_t wnd = sock->tcb.rcv.wnd;
+    sock->tcb.rcv.wnd = tcp_rcvbuf_wnd(sock);
+    if (wnd < sock->mss && sock->tcb.rcv.wnd >= sock->mss) {
+        LOG(LDBUG, "Sending window update, RCV.WND %u", sock->tcb.rcv.wnd);
+        tcp_send_ack(sock);
     }
-    ret = count;
+
+    tcp_sock_unlock(sock);
 
 decref_and_return:
     tcp_sock_decref(sock);
@@ -387,10 +284,14 @@ int tcp_user_close(struct tcp_sock *sock) {
     tcp_sock_lock(sock);
     tcp_sock_incref(sock);
 
-    // TODO: tcp_close() request until all send() calls have completed
+    bool finpending;
+    bool block = !(sock->inet.flags & O_NONBLOCK);
+
     switch (sock->state) {
         case TCP_LISTEN:
             tcp_setstate(sock, TCP_CLOSED);
+            // Waiting accept() calls have nothing left to wait for
+            tcp_wake_waiters(sock);
             tcp_sock_decref(sock);
             break;
         case TCP_SYN_SENT:
@@ -404,21 +305,39 @@ int tcp_user_close(struct tcp_sock *sock) {
             // TODO: Check for pending send() calls
             // Fall through to TCP_ESTABLISHED
         case TCP_ESTABLISHED:
+            // The FIN follows the text in the send buffer. Text that hasn't
+            // been sent yet is left for tcp_send_pending() to send the FIN
+            // after. The buffer only exists once ESTABLISHED is reached
+            finpending = sock->state == TCP_ESTABLISHED &&
+                    seqbuf_available(&sock->sndbuf, sock->tcb.snd.nxt) > 0;
             tcp_setstate(sock, TCP_FIN_WAIT_1);
+            if (finpending) {
+                sock->finpending = true;
+                break;
+            }
             tcp_send_finack(sock);
-            tcp_wait_change(sock);
-            ret = sock->error;
+            if (block) {
+                tcp_wait_change(sock);
+                ret = sock->error;
+            }
             break;
         case TCP_CLOSE_WAIT:
             // TODO: If unsent data, queue sending FIN/ACK on CLOSING
             // RFC 1122: Section 4.2.2.20 (a)
             // TCP event processing corrections
             // https://tools.ietf.org/html/rfc1122#page-93
+            finpending =
+                    seqbuf_available(&sock->sndbuf, sock->tcb.snd.nxt) > 0;
             tcp_setstate(sock, TCP_LAST_ACK);
+            if (finpending) {
+                sock->finpending = true;
+                break;
+            }
             tcp_send_finack(sock);
 
             // Wait for the connection to be closed before returning
-            while (!(sock->state == TCP_TIME_WAIT || sock->state == TCP_CLOSED)
+            while (block &&
+                   !(sock->state == TCP_TIME_WAIT || sock->state == TCP_CLOSED)
                    && sock->error != 0)
                 tcp_wait_change(sock);
 
@@ -445,90 +364,83 @@ int tcp_user_listen(struct tcp_sock *sock, size_t backlog) {
     if (sock == NULL)
         return -ENOTSOCK;
 
-    // Move socket to end of socket list
-    // Listening sockets should be the last thing to looked-up
-    pthread_mutex_lock(&tcp_sockets.lock);
-    llist_remove_nolock(&tcp_sockets, sock);
-    llist_append_nolock(&tcp_sockets, sock);
-    pthread_mutex_unlock(&tcp_sockets.lock);
-
     tcp_sock_lock(sock);
 
-    tcp_setstate(sock, TCP_LISTEN);
-    sock->passive = malloc(sizeof(struct tcp_passive));
-    *sock->passive = (struct tcp_passive) {
+    // Like Linux, a backlog of 0 still allows a connection to wait
+    backlog = MIN(MAX(backlog, 1), TCP_MAX_BACKLOG);
+
+    // Calling listen() again only changes the backlog
+    if (sock->passive != NULL) {
+        sock->passive->maxbacklog = backlog;
+        sock->passive->maxsyn = MAX(backlog, TCP_MIN_SYNQUEUE);
+        tcp_sock_unlock(sock);
+        return 0;
+    }
+
+    struct tcp_passive *passive = malloc(sizeof(struct tcp_passive));
+    if (passive == NULL) {
+        tcp_sock_unlock(sock);
+        return -ENOMEM;
+    }
+    *passive = (struct tcp_passive) {
         .maxbacklog = backlog,
-        .backlog = LLIST_INITIALISER,
+        .maxsyn = MAX(backlog, TCP_MIN_SYNQUEUE),
+        .synqueue = TCP_QUEUE_INIT(passive->synqueue),
+        .acceptq = TCP_QUEUE_INIT(passive->acceptq),
     };
+    sock->passive = passive;
+    tcp_setstate(sock, TCP_LISTEN);
+
+    // Only start matching incoming segments once the backlog exists
+    int ret = tcp_sock_hash(sock);
 
     tcp_sock_unlock(sock);
 
-    return 0;
+    return ret;
 }
 
 int tcp_user_accept(struct tcp_sock *sock, struct tcp_sock **client) {
     if (sock == NULL)
         return -ENOTSOCK;
 
+    // Ensure the listener cannot be free'd whilst waiting, if it is closed
     tcp_sock_lock(sock);
+    tcp_sock_incref(sock);
     // EINVAL: Socket is not listening for connections
-    if (client == NULL || sock->passive == NULL)
+    if (client == NULL || sock->passive == NULL) {
+        tcp_sock_decref_unlock(sock);
         return -EINVAL;
+    }
 
-    // Initialise value to NULL to prevent unitialised errors
-    // We can't/shouldn't assume the user will initialise the memory
-    *client = NULL;
-
-    while (*client == NULL) {
-
-        // Check to see if there is an established socket ready to accept
-        if ((*client = llist_pop(&sock->passive->backlog)) != NULL) {
-            tcp_sock_lock(*client);
-            switch ((*client)->state) {
-                case TCP_LISTEN:
-                case TCP_SYN_SENT:
-                case TCP_SYN_RECEIVED:
-                    // Connection is not established yet. Re-queue it for now
-                    LOG(LWARN, "tcp_user_accept client not yet established"
-                            " %p. re-queuing..", *client);
-                    llist_append(&sock->passive->backlog, *client);
-
-                    // Attempt to get another client
-                    tcp_sock_unlock(*client);
-                    *client = NULL;
-                    continue;
-
-                case TCP_FIN_WAIT_1:
-                case TCP_FIN_WAIT_2:
-                case TCP_CLOSING:
-                case TCP_CLOSED:
-                case TCP_LAST_ACK:
-                case TCP_TIME_WAIT:
-                    LOG(LWARN, "tcp_user_accept client in invalid state: %s",
-                            tcp_strstate((*client)->state));
-                    tcp_sock_unlock(*client);
-                    *client = NULL;
-                    continue;
-
-                case TCP_ESTABLISHED:
-                case TCP_CLOSE_WAIT:
-                    // Client is in valid state and ready to communicate
-                    LOG(LNTCE, "Accepting client %p from backlog", *client);
-                    // Remove non-blocking flag now that the user has control
-                    (*client)->inet.flags &= ~O_NONBLOCK;
-                    tcp_sock_unlock(*client);
-                    break;
-            }
-            break;
-        }
+    // Only connections that have completed the handshake are queued, so the
+    // first one can be taken straight away
+    struct tcp_sock *child;
+    while ((child = tcp_queue_pop(&sock->passive->acceptq)) == NULL) {
 
-        // TODO: Check for O_NONBLOCK and return EWOULDBLOCK in tcp_user_accept
+        if (sock->inet.flags & O_NONBLOCK) {
+            tcp_sock_decref_unlock(sock);
+            return -EWOULDBLOCK;
+        }
 
         LOG(LNTCE, "No connections ready to be accepted. Waiting..");
-
         tcp_wait_change(sock);
+
+        // The listener may have been closed whilst waiting
+        if (sock->state != TCP_LISTEN) {
+            tcp_sock_decref_unlock(sock);
+            return -EINVAL;
+        }
     }
+    tcp_sock_decref_unlock(sock);
 
-    tcp_sock_unlock(sock);
+    LOG(LNTCE, "Accepting client %p from backlog", child);
+
+    // The user has control of the connection now
+    tcp_sock_lock(child);
+    child->parent = NULL;
+    child->inet.flags &= ~O_NONBLOCK;
+    tcp_sock_unlock(child);
+
+    *client = child;
     return 0;
 }
@@ -1,80 +1,279 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 #define NETSTACK_LOG_UNIT "TIMER"
 #include <netstack/log.h>
 #include <netstack/time/timer.h>
+#include <netstack/time/util.h>
 
-// Private timer signal handler function
-static void netstack_timer_handler(int sig, siginfo_t *si, void *uc);
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static int timer_fd = -1;
+static int timer_epfd = -1;
+static pthread_t timer_thread;
 
-int timeout_set(timeout_t *t, void (*fn)(void *), void *arg,
-                time_t sec, time_t nsec) {
+// timer_lock protects the heap and the deadline timer_fd is programmed with
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static timeout_t **timer_heap = NULL;
+static size_t timer_len = 0, timer_cap = 0;
+static struct timespec timer_armed = {0};   /* Zero when timer_fd is idle */
+static bool timer_stopping = false;
+
+static inline bool timer_before(const struct timespec *a,
+                                const struct timespec *b) {
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
 
-    // Source: https://stackoverflow.com/questions/18847883/multiple-timers-in-c
+static inline bool timer_idle(const struct timespec *ts) {
+    return ts->tv_sec == 0 && ts->tv_nsec == 0;
+}
 
-    struct sigaction sa = {0};
-    sa.sa_flags = SA_SIGINFO;
-    sa.sa_sigaction = netstack_timer_handler;
-    sigemptyset(&sa.sa_mask);
+/*
+ * Checks that t is in the heap. The index alone can't be trusted, as callers
+ * may clear timeouts that were never set
+ */
+static inline bool timer_pending(timeout_t *t) {
+    return t->index > 0 && t->index <= timer_len &&
+           timer_heap[t->index - 1] == t;
+}
 
-    if (sigaction(TIMER_SIGNAL, &sa, NULL)) {
-        LOGERR("sigaction");
-        return -1;
+static inline void timer_heap_put(size_t i, timeout_t *t) {
+    timer_heap[i] = t;
+    t->index = i + 1;
+}
+
+static void timer_sift_up(size_t i) {
+    timeout_t *t = timer_heap[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!timer_before(&t->expires, &timer_heap[parent]->expires))
+            break;
+        timer_heap_put(i, timer_heap[parent]);
+        i = parent;
     }
+    timer_heap_put(i, t);
+}
 
-    *t = (timeout_t) {NULL, fn, arg, {sec, nsec}};
+static void timer_sift_down(size_t i) {
+    timeout_t *t = timer_heap[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= timer_len)
+            break;
+        if (child + 1 < timer_len && timer_before(&timer_heap[child + 1]->expires,
+                                                  &timer_heap[child]->expires))
+            child++;
+        if (!timer_before(&timer_heap[child]->expires, &t->expires))
+            break;
+        timer_heap_put(i, timer_heap[child]);
+        i = child;
+    }
+    timer_heap_put(i, t);
+}
 
-    struct sigevent te = {0};
-    te.sigev_notify = SIGEV_SIGNAL;
-    te.sigev_signo = TIMER_SIGNAL;
-    te.sigev_value.sival_ptr = t;
-    if (timer_create(CLOCK_MONOTONIC, &te, &t->timer)) {
-        LOGERR("timer_create");
-        free(t);
-        return -1;
+static void timer_remove(timeout_t *t) {
+    size_t i = t->index - 1;
+    timeout_t *last = timer_heap[--timer_len];
+
+    t->index = 0;
+    if (i < timer_len) {
+        timer_heap_put(i, last);
+        timer_sift_up(i);
+        timer_sift_down(last->index - 1);
+    }
+}
+
+// Sets timer_fd to fire at the absolute CLOCK_MONOTONIC time 'at'
+static void timer_program(const struct timespec *at) {
+    struct itimerspec its = { .it_value = *at };
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL))
+        LOGERR("timerfd_settime");
+    timer_armed = its.it_value;
+}
+
+static void *timer_run(void *arg) {
+#ifdef _GNU_SOURCE
+    pthread_setname_np(pthread_self(), "timer");
+#endif
+
+    for (;;) {
+        struct epoll_event event;
+        if (epoll_wait(timer_epfd, &event, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGERR("epoll_wait");
+            break;
+        }
+
+        pthread_mutex_lock(&timer_lock);
+        timer_armed = (struct timespec) {0};
+        if (timer_stopping) {
+            pthread_mutex_unlock(&timer_lock);
+            break;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        while (timer_len > 0 && !timer_before(&now, &timer_heap[0]->expires)) {
+            timeout_t *t = timer_heap[0];
+            void (*func)(void *) = t->func;
+            void *targ = t->arg;
+            timer_remove(t);
+
+            // The callback is free to set, clear or free the timeout
+            pthread_mutex_unlock(&timer_lock);
+            LOG(LDBUG, "Timer expired. Calling handler");
+            func(targ);
+            pthread_mutex_lock(&timer_lock);
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        }
+
+        if (timer_len > 0 && (timer_idle(&timer_armed) ||
+                timer_before(&timer_heap[0]->expires, &timer_armed)))
+            timer_program(&timer_heap[0]->expires);
+        pthread_mutex_unlock(&timer_lock);
     }
 
-    struct itimerspec timerspec = {0};
-    timerspec.it_value.tv_sec = sec;
-    timerspec.it_value.tv_nsec = nsec;
-    if (timer_settime(t->timer, 0, &timerspec, NULL)) {
-        LOGERR("timer_settime");
-        timeout_clear(t);
+    return NULL;
+}
+
+static void timer_start(void) {
+    // Held throughout so timer_stop() sees either no thread or a whole one
+    pthread_mutex_lock(&timer_lock);
+    if (timer_stopping)
+        goto unlock;
+
+    if ((timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                   TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        LOGERR("timerfd_create");
+        goto unlock;
+    }
+    if ((timer_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        LOGERR("epoll_create1");
+        goto close_timer;
+    }
+
+    // Edge-triggered, as every expiry is a new event. This saves reading the
+    // expiry count, which would go through the read() the api intercepts
+    struct epoll_event event = { .events = EPOLLIN | EPOLLET,
+                                 .data.fd = timer_fd };
+    if (epoll_ctl(timer_epfd, EPOLL_CTL_ADD, timer_fd, &event)) {
+        LOGERR("epoll_ctl");
+        goto close_epoll;
+    }
+
+    int err;
+    if ((err = pthread_create(&timer_thread, NULL, timer_run, NULL))) {
+        LOGSE(LERR, "pthread_create", err);
+        goto close_epoll;
+    }
+    goto unlock;
+
+close_epoll:
+    close(timer_epfd);
+    timer_epfd = -1;
+close_timer:
+    close(timer_fd);
+    timer_fd = -1;
+unlock:
+    pthread_mutex_unlock(&timer_lock);
+}
+
+void timer_stop(void) {
+    // Expire timer_fd straight away to wake the thread up to see the flag
+    pthread_mutex_lock(&timer_lock);
+    timer_stopping = true;
+    if (timer_fd < 0) {
+        // The thread was never started, and now never will be
+        pthread_mutex_unlock(&timer_lock);
+        return;
+    }
+    timer_program(&(struct timespec) {0, 1});
+    pthread_mutex_unlock(&timer_lock);
+
+    pthread_join(timer_thread, NULL);
+
+    // Timeouts still pending will never fire now
+    pthread_mutex_lock(&timer_lock);
+    while (timer_len > 0)
+        timer_remove(timer_heap[0]);
+    free(timer_heap);
+    timer_heap = NULL;
+    timer_cap = 0;
+    close(timer_epfd);
+    close(timer_fd);
+    timer_epfd = timer_fd = -1;
+    pthread_mutex_unlock(&timer_lock);
+}
+
+int timeout_set(timeout_t *t, void (*fn)(void *), void *arg,
+                time_t sec, time_t nsec) {
+
+    // The timer thread is started by the first timeout
+    pthread_once(&timer_once, timer_start);
+
+    pthread_mutex_lock(&timer_lock);
+
+    // Either the thread failed to start, or it has been stopped
+    if (timer_fd < 0) {
+        pthread_mutex_unlock(&timer_lock);
         return -1;
     }
 
+    if (timer_pending(t)) {
+        timer_remove(t);
+    } else if (timer_len == timer_cap) {
+        size_t cap = timer_cap ? timer_cap * 2 : TIMER_HEAP_INIT;
+        timeout_t **heap = realloc(timer_heap, cap * sizeof(timeout_t *));
+        if (heap == NULL) {
+            pthread_mutex_unlock(&timer_lock);
+            LOGERR("realloc");
+            return -1;
+        }
+        timer_heap = heap;
+        timer_cap = cap;
+    }
+
+    t->func = fn;
+    t->arg = arg;
+    t->timeout = (struct timespec) {sec, nsec};
+    clock_gettime(CLOCK_MONOTONIC, &t->expires);
+    timespecaddp(&t->expires, sec, nsec);
+
+    timer_heap_put(timer_len++, t);
+    timer_sift_up(timer_len - 1);
+
+    // Only a new earliest deadline needs the timerfd changing
+    if (t->index == 1 && (timer_idle(&timer_armed) ||
+            timer_before(&t->expires, &timer_armed)))
+        timer_program(&t->expires);
+
+    pthread_mutex_unlock(&timer_lock);
+
     LOG(LDBUG, "Set for %lus, %luns", sec, nsec);
 
     return 0;
 }
 
-inline void timeout_clear(timeout_t *t) {
-    if (t->timer) {
-        timer_delete(t->timer);
-        t->timer = NULL;
-    }
+void timeout_clear(timeout_t *t) {
+    // timer_fd is left as it is; the timer thread re-arms it when it fires
+    pthread_mutex_lock(&timer_lock);
+    if (timer_pending(t))
+        timer_remove(t);
+    pthread_mutex_unlock(&timer_lock);
 }
 
 int timeout_restart(timeout_t *t, time_t sec, time_t nsec) {
     if (!t)
         return -EINVAL;
 
-    timeout_clear(t);
-    sec  = (sec  == -1 ? sec  : t->timeout.tv_sec);
-    nsec = (nsec == -1 ? nsec : t->timeout.tv_nsec);
+    sec  = (sec  == -1 ? t->timeout.tv_sec  : sec);
+    nsec = (nsec == -1 ? t->timeout.tv_nsec : nsec);
     return timeout_set(t, t->func, t->arg, sec, nsec);
 }
-
-static void netstack_timer_handler(int sig, siginfo_t *si, void *uc) {
-    LOG(LDBUG, "Caught signal: %s", strsignal(sig));
-
-    if (sig == TIMER_SIGNAL) {
-        timeout_t *t = si->si_value.sival_ptr;
-        LOG(LDBUG, "Timer expired. Calling handler");
-
-        // Call passed function with provided argument
-        t->func(t->arg);
-    }
-}
@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <string.h>
+
+#define NETSTACK_LOG_UNIT "WHEEL"
+#include <netstack/log.h>
+#include <netstack/time/wheel.h>
+#include <netstack/time/util.h>
+
+// Furthest a timer can be placed from the current tick
+#define WHEEL_MAX_DELTA ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+// Ticks elapsed since the wheel was started
+static uint64_t wheel_clock(struct wheel *wheel) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timespecsub(&now, &wheel->start);
+    return tstons(&now, uint64_t) / WHEEL_TICK_NS;
+}
+
+static void wheel_unlink(struct wheel_timer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void wheel_link(struct wheel_timer **head, struct wheel_timer *timer) {
+    timer->next = *head;
+    timer->pprev = head;
+    if (*head != NULL)
+        (*head)->pprev = &timer->next;
+    *head = timer;
+}
+
+/*
+ * Links a timer into the slot for its expiry tick in the lowest level that
+ * reaches that far. wheel->lock must be held
+ */
+static void wheel_insert(struct wheel *wheel, struct wheel_timer *timer) {
+    uint64_t at = timer->expires;
+    int level = 0;
+
+    if (at < wheel->now)
+        at = wheel->now;
+    else if (at - wheel->now > WHEEL_MAX_DELTA)
+        // Park it as far out as possible; it is placed again when cascaded
+        at = wheel->now + WHEEL_MAX_DELTA;
+
+    while (level < WHEEL_LEVELS - 1 &&
+           at - wheel->now >= 1ULL << (WHEEL_BITS * (level + 1)))
+        level++;
+
+    wheel_link(&wheel->slots[level][(at >> (WHEEL_BITS * level)) & WHEEL_MASK],
+               timer);
+}
+
+// Moves every timer in a slot into the levels below it
+static void wheel_cascade(struct wheel *wheel, int level, unsigned int slot) {
+    struct wheel_timer *timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+
+    while (timer != NULL) {
+        struct wheel_timer *next = timer->next;
+        wheel_insert(wheel, timer);
+        timer = next;
+    }
+}
+
+/*
+ * Runs the timers due in tick wheel->now and advances it.
+ * wheel->lock must be held, but is released around each callback
+ */
+static void wheel_run_tick(struct wheel *wheel) {
+    unsigned int slot = wheel->now & WHEEL_MASK;
+
+    // Level 0 has wrapped around, so refill it from the levels above
+    if (slot == 0) {
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            unsigned int upper = (wheel->now >> (WHEEL_BITS * level)) &
+                                 WHEEL_MASK;
+            wheel_cascade(wheel, level, upper);
+            if (upper != 0)
+                break;
+        }
+    }
+
+    // Detach the due timers so that re-arming one cannot put it back in them
+    struct wheel_timer *due = wheel->slots[0][slot];
+    wheel->slots[0][slot] = NULL;
+    wheel->expired = due;
+    if (due != NULL)
+        due->pprev = &wheel->expired;
+    wheel->now++;
+
+    struct wheel_timer *timer;
+    while ((timer = wheel->expired) != NULL) {
+        void (*fn)(void *) = timer->fn;
+        void *arg = timer->arg;
+
+        wheel_unlink(timer);
+        wheel->pending--;
+
+        pthread_mutex_unlock(&wheel->lock);
+        fn(arg);
+        pthread_mutex_lock(&wheel->lock);
+    }
+}
+
+/*
+ * Finds the next tick that needs running: either one with timers due, or the
+ * one that cascades the next level down. wheel->lock must be held
+ */
+static uint64_t wheel_next(struct wheel *wheel) {
+    uint64_t tick = wheel->now;
+    while (wheel->slots[0][tick & WHEEL_MASK] == NULL) {
+        if ((++tick & WHEEL_MASK) == 0)
+            break;
+    }
+    return tick;
+}
+
+static void *wheel_run(void *arg) {
+    struct wheel *wheel = arg;
+
+#ifdef _GNU_SOURCE
+    char thread_name[64];
+    pthread_getname_np(pthread_self(), thread_name, 64);
+    strncat(thread_name, "/wheel", 63);
+    pthread_setname_np(pthread_self(), thread_name);
+#endif
+
+    pthread_mutex_lock(&wheel->lock);
+    while (wheel->running) {
+        uint64_t tick = wheel_clock(wheel);
+
+        // An empty wheel can skip ahead, there is nothing to cascade
+        if (wheel->pending == 0)
+            wheel->now = tick;
+
+        while (wheel->running && wheel->now < tick)
+            wheel_run_tick(wheel);
+
+        if (!wheel->running)
+            break;
+
+        int ret;
+        if (wheel->pending == 0) {
+            LOG(LVERB, "no timers left. Waiting for one");
+            wheel->wake = UINT64_MAX;
+            ret = pthread_cond_wait(&wheel->wait, &wheel->lock);
+        } else {
+            // Tick n is run once it has passed, at the start of tick n + 1
+            struct timespec abs;
+            wheel->wake = wheel_next(wheel);
+            timespecns(&abs, tstons(&wheel->start, uint64_t) +
+                             (wheel->wake + 1) * WHEEL_TICK_NS);
+            ret = pthread_cond_timedwait(&wheel->wait, &wheel->lock, &abs);
+        }
+
+        if (ret != 0 && ret != ETIMEDOUT && ret != EINTR) {
+            LOGSE(LERR, "pthread_cond_wait", ret);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&wheel->lock);
+
+    return NULL;
+}
+
+int wheel_init(struct wheel *wheel) {
+    pthread_condattr_t attr;
+    int ret;
+
+    memset(wheel, 0, sizeof(struct wheel));
+    clock_gettime(CLOCK_MONOTONIC, &wheel->start);
+    wheel->wake = UINT64_MAX;
+    wheel->running = true;
+
+    pthread_mutex_init(&wheel->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wheel->wait, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // Without a thread the wheel stays usable, but its timers never expire
+    if ((ret = pthread_create(&wheel->thread, NULL, wheel_run, wheel)) != 0) {
+        LOGSE(LERR, "pthread_create", ret);
+        wheel->running = false;
+        return -ret;
+    }
+
+    return 0;
+}
+
+void wheel_stop(struct wheel *wheel) {
+    pthread_mutex_lock(&wheel->lock);
+    bool running = wheel->running;
+    wheel->running = false;
+    pthread_cond_signal(&wheel->wait);
+    pthread_mutex_unlock(&wheel->lock);
+
+    // The thread may never have started, or already been stopped
+    if (running)
+        pthread_join(wheel->thread, NULL);
+
+    pthread_mutex_lock(&wheel->lock);
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (unsigned int slot = 0; slot < WHEEL_SLOTS; slot++) {
+            struct wheel_timer *timer;
+            while ((timer = wheel->slots[level][slot]) != NULL)
+                wheel_unlink(timer);
+        }
+    }
+    wheel->pending = 0;
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+bool wheel_arm(struct wheel *wheel, struct wheel_timer *timer, uint64_t ns) {
+    pthread_mutex_lock(&wheel->lock);
+
+    uint64_t tick = wheel_clock(wheel);
+
+    // An empty wheel has not kept time whilst asleep. Bring it up to date so
+    // the wheel thread doesn't run every tick it missed when woken
+    if (wheel->pending == 0)
+        wheel->now = tick;
+
+    bool pending = timer->pprev != NULL;
+    if (pending)
+        wheel_unlink(timer);
+    else
+        wheel->pending++;
+
+    // Rounding up means the timer cannot run early, see wheel_run()
+    timer->expires = tick + (ns + WHEEL_TICK_NS - 1) / WHEEL_TICK_NS;
+    wheel_insert(wheel, timer);
+
+    // Wake the wheel thread if it is asleep past the new expiry
+    if (timer->expires < wheel->wake)
+        pthread_cond_signal(&wheel->wait);
+
+    pthread_mutex_unlock(&wheel->lock);
+    return pending;
+}
+
+bool wheel_cancel(struct wheel *wheel, struct wheel_timer *timer) {
+    pthread_mutex_lock(&wheel->lock);
+
+    bool pending = timer->pprev != NULL;
+    if (pending) {
+        wheel_unlink(timer);
+        wheel->pending--;
+    }
+
+    pthread_mutex_unlock(&wheel->lock);
+    return pending;
+}
@@ -0,0 +1,76 @@
+#include <check.h>
+#include <stdlib.h>
+
+#include <netstack/col/alist.h>
+
+ARRAYLIST_DEFINE(intlist, int);
+
+START_TEST (alist_grow)
+    {
+        intlist_t list = {0};
+        int *elem;
+        ck_assert_int_eq(alist_init(&list, 2), 0);
+
+        for (int i = 0; i < 9; i++) {
+            ck_assert_int_eq(alist_add(&list, (void **) &elem), i);
+            *elem = i;
+        }
+        ck_assert_uint_eq(list.count, 9);
+        ck_assert_uint_eq(list.len, 16);
+        for (int i = 0; i < 9; i++)
+            ck_assert_int_eq(list.arr[i], i);
+
+        alist_free(&list);
+    }
+END_TEST
+
+START_TEST (alist_fixed)
+    {
+        intlist_t list = {0};
+        int storage[4];
+        int *elem;
+        ck_assert_int_eq(alist_init_fixed(&list, storage, 4), 0);
+
+        for (int i = 0; i < 4; i++) {
+            ck_assert_int_eq(alist_add(&list, (void **) &elem), i);
+            *elem = i;
+        }
+        ck_assert_ptr_eq(list.arr, storage);
+
+        // Overflowing moves the list onto the heap
+        ck_assert_int_eq(alist_add(&list, (void **) &elem), 4);
+        *elem = 4;
+        ck_assert_ptr_ne(list.arr, storage);
+        ck_assert_uint_eq(list.len, 8);
+        for (int i = 0; i < 5; i++)
+            ck_assert_int_eq(list.arr[i], i);
+
+        alist_free(&list);
+    }
+END_TEST
+
+Suite *alist_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("ArrayList");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, alist_grow);
+    tcase_add_test(tc_core, alist_fixed);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(alist_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,170 @@
+#include <check.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <netstack/checksum.h>
+
+#define CSUM_TEST_LEN   9018
+
+typedef uint16_t (*csum_fn)(const void *, size_t, uint64_t);
+typedef uint16_t (*csum_copy_fn)(void *, const void *, size_t, uint64_t);
+
+/* Example from RFC 1071 section 3, summed in network byte order */
+START_TEST (csum_rfc1071)
+    {
+        const uint8_t data[] = { 0x00, 0x01, 0xf2, 0x03,
+                                 0xf4, 0xf5, 0xf6, 0xf7 };
+        uint16_t sum = (uint16_t) ~in_csum(data, sizeof(data), 0);
+        const uint8_t *bytes = (const uint8_t *) &sum;
+        ck_assert_uint_eq(bytes[0], 0xdd);
+        ck_assert_uint_eq(bytes[1], 0xf2);
+    }
+END_TEST
+
+/* Every implementation must match the reference for every length/alignment */
+static void csum_compare(csum_fn fn) {
+    uint8_t *buf = malloc(CSUM_TEST_LEN + 8);
+    srand(1071);
+    for (size_t i = 0; i < CSUM_TEST_LEN + 8; i++)
+        buf[i] = (uint8_t) rand();
+
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t len = 0; len <= 300; len++)
+            ck_assert_uint_eq(fn(buf + off, len, 0),
+                              in_csum_ref(buf + off, len, 0));
+        ck_assert_uint_eq(fn(buf + off, CSUM_TEST_LEN, 0x12345678),
+                          in_csum_ref(buf + off, CSUM_TEST_LEN, 0x12345678));
+    }
+
+    // All 0xFF octets maximise the carries
+    memset(buf, 0xff, CSUM_TEST_LEN);
+    ck_assert_uint_eq(fn(buf, CSUM_TEST_LEN, UINT64_MAX),
+                      in_csum_ref(buf, CSUM_TEST_LEN, UINT64_MAX));
+    free(buf);
+}
+
+/* Copies must be exact and sum the same as the reference */
+static void csum_copy_compare(csum_copy_fn fn) {
+    uint8_t *src = malloc(CSUM_TEST_LEN + 8);
+    uint8_t *dest = malloc(CSUM_TEST_LEN + 8);
+    srand(793);
+    for (size_t i = 0; i < CSUM_TEST_LEN + 8; i++)
+        src[i] = (uint8_t) rand();
+
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t len = 0; len <= 300; len += (len < 80 ? 1 : 7)) {
+            memset(dest, 0, CSUM_TEST_LEN + 8);
+            ck_assert_uint_eq(fn(dest + (7 - off), src + off, len, 0),
+                              in_csum_ref(src + off, len, 0));
+            ck_assert_mem_eq(dest + (7 - off), src + off, len);
+            // Nothing is written past the end
+            ck_assert_uint_eq(dest[7 - off + len], 0);
+        }
+        ck_assert_uint_eq(fn(dest, src + off, CSUM_TEST_LEN, 0xabcdef),
+                          in_csum_ref(src + off, CSUM_TEST_LEN, 0xabcdef));
+        ck_assert_mem_eq(dest, src + off, CSUM_TEST_LEN);
+    }
+    free(src);
+    free(dest);
+}
+
+/* Partial sums combine into the sum of the whole, at any split */
+START_TEST (csum_partial)
+    {
+        uint8_t buf[301];
+        srand(1624);
+        for (size_t i = 0; i < sizeof(buf); i++)
+            buf[i] = (uint8_t) rand();
+
+        uint16_t whole = ~in_csum(buf, sizeof(buf), 0);
+        for (size_t split = 0; split <= sizeof(buf); split++) {
+            uint16_t a = ~in_csum(buf, split, 0);
+            uint16_t b = ~in_csum(buf + split, sizeof(buf) - split, 0);
+            if (split & 1)
+                b = in_csum_swap(b);
+            // 0x0000 and 0xFFFF are both zero in one's complement
+            ck_assert_uint_eq(in_csum_add(a, b) % 0xffff, whole % 0xffff);
+        }
+    }
+END_TEST
+
+/* Incremental updates match summing the modified data again */
+START_TEST (csum_update)
+    {
+        uint16_t buf[30];
+        srand(1624);
+        for (int i = 0; i < 1000; i++) {
+            for (size_t j = 0; j < 30; j++)
+                buf[j] = (uint16_t) rand();
+            uint16_t csum = in_csum(buf, sizeof(buf), 0);
+
+            size_t idx = (size_t) rand() % 29;
+            uint16_t old16 = buf[idx];
+            buf[idx] = (uint16_t) (i == 0 ? 0 : rand());
+            csum = in_csum_update16(csum, old16, buf[idx]);
+            ck_assert_uint_eq(csum % 0xffff,
+                              in_csum(buf, sizeof(buf), 0) % 0xffff);
+
+            uint32_t old32, new32 = (uint32_t) rand();
+            memcpy(&old32, &buf[idx], sizeof(old32));
+            memcpy(&buf[idx], &new32, sizeof(new32));
+            csum = in_csum_update32(csum, old32, new32);
+            ck_assert_uint_eq(csum % 0xffff,
+                              in_csum(buf, sizeof(buf), 0) % 0xffff);
+        }
+    }
+END_TEST
+
+START_TEST (csum_dispatch)
+    {
+        csum_compare(in_csum);
+        csum_copy_compare(in_csum_copy);
+    }
+END_TEST
+
+START_TEST (csum_simd)
+    {
+        csum_copy_compare(in_csum_copy_ref);
+#if defined(__x86_64__)
+        csum_compare(in_csum_sse2);
+        csum_copy_compare(in_csum_copy_sse2);
+        if (__builtin_cpu_supports("avx2")) {
+            csum_compare(in_csum_avx2);
+            csum_copy_compare(in_csum_copy_avx2);
+        }
+#elif defined(__aarch64__)
+        csum_compare(in_csum_neon);
+        csum_copy_compare(in_csum_copy_neon);
+#endif
+    }
+END_TEST
+
+Suite *checksum_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Checksum");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, csum_rfc1071);
+    tcase_add_test(tc_core, csum_partial);
+    tcase_add_test(tc_core, csum_update);
+    tcase_add_test(tc_core, csum_dispatch);
+    tcase_add_test(tc_core, csum_simd);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(checksum_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,106 @@
+#include <check.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <netstack/lock/epoch.h>
+
+static void epoch_set(void *arg) {
+    *(bool *) arg = true;
+}
+
+static pthread_mutex_t reader_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reader_cond = PTHREAD_COND_INITIALIZER;
+static int reader_state;
+
+// Stays in a read-side section until told to leave
+static void *epoch_reader(void *arg) {
+    epoch_enter();
+    pthread_mutex_lock(&reader_lock);
+    reader_state = 1;
+    pthread_cond_broadcast(&reader_cond);
+    while (reader_state != 2)
+        pthread_cond_wait(&reader_cond, &reader_lock);
+    pthread_mutex_unlock(&reader_lock);
+    epoch_exit();
+    return NULL;
+}
+
+START_TEST (epoch_no_readers)
+    {
+        bool done = false;
+        epoch_defer(epoch_set, &done);
+        ck_assert(done);
+    }
+END_TEST
+
+START_TEST (epoch_nested)
+    {
+        bool done = false;
+        epoch_enter();
+        epoch_enter();
+        epoch_defer(epoch_set, &done);
+        epoch_exit();
+        ck_assert(!done);
+        epoch_exit();
+
+        epoch_barrier();
+        ck_assert(done);
+    }
+END_TEST
+
+START_TEST (epoch_waits_for_reader)
+    {
+        bool done = false;
+        pthread_t reader;
+        reader_state = 0;
+        pthread_create(&reader, NULL, epoch_reader, NULL);
+
+        pthread_mutex_lock(&reader_lock);
+        while (reader_state != 1)
+            pthread_cond_wait(&reader_cond, &reader_lock);
+        pthread_mutex_unlock(&reader_lock);
+
+        // The reader may have found the object, so it must not be released
+        epoch_defer(epoch_set, &done);
+        for (int i = 0; i < 10; i++)
+            epoch_defer(free, malloc(1));
+        ck_assert(!done);
+
+        pthread_mutex_lock(&reader_lock);
+        reader_state = 2;
+        pthread_cond_broadcast(&reader_cond);
+        pthread_mutex_unlock(&reader_lock);
+        pthread_join(reader, NULL);
+
+        epoch_barrier();
+        ck_assert(done);
+    }
+END_TEST
+
+Suite *epoch_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Epoch");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, epoch_no_readers);
+    tcase_add_test(tc_core, epoch_nested);
+    tcase_add_test(tc_core, epoch_waits_for_reader);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(epoch_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
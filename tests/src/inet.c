@@ -0,0 +1,223 @@
+#include <check.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <netstack/inet.h>
+#include <netstack/lock/epoch.h>
+
+#define INET_TEST_SOCKS 5000
+
+#define ipv4(a) ((addr_t) {.proto = PROTO_IPV4, .ipv4 = (a)})
+
+static struct inet_sock *inet_sock_new(ip4_addr_t remaddr, ip4_addr_t locaddr,
+                                       uint16_t remport, uint16_t locport) {
+    struct inet_sock *sock = calloc(1, sizeof(struct inet_sock));
+    sock->remaddr = ipv4(remaddr);
+    sock->locaddr = ipv4(locaddr);
+    sock->remport = remport;
+    sock->locport = locport;
+    return sock;
+}
+
+START_TEST (socktbl_exact_and_listen)
+    {
+        struct inet_socktbl tbl = INET_SOCKTBL_INITIALISER;
+        addr_t rem = ipv4(0x0a000001), loc = ipv4(0x0a000002);
+        addr_t other = ipv4(0x0a000003);
+
+        ck_assert_ptr_null(inet_sock_lookup(&tbl, &rem, &loc, 1000, 80));
+
+        struct inet_sock *wild = inet_sock_new(0, 0, 0, 80);
+        struct inet_sock *bound = inet_sock_new(0, 0x0a000002, 0, 80);
+        struct inet_sock *conn = inet_sock_new(0x0a000001, 0x0a000002, 1000, 80);
+        ck_assert_int_eq(inet_sock_hash(&tbl, wild), 0);
+        ck_assert_int_eq(wild->hashed, INET_HASH_LISTEN);
+
+        // Only the wildcard listener matches so far
+        ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &loc, 1000, 80), wild);
+        ck_assert_ptr_null(inet_sock_lookup(&tbl, &rem, &loc, 1000, 81));
+
+        // A listener on the local address is preferred to the wildcard
+        ck_assert_int_eq(inet_sock_hash(&tbl, bound), 0);
+        ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &loc, 1000, 80), bound);
+        ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &other, 1000, 80), wild);
+
+        // And an exact match to both
+        ck_assert_int_eq(inet_sock_hash(&tbl, conn), 0);
+        ck_assert_int_eq(conn->hashed, INET_HASH_ESTAB);
+        ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &loc, 1000, 80), conn);
+        ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &loc, 1001, 80), bound);
+
+        inet_sock_unhash(&tbl, conn);
+        ck_assert_int_eq(conn->hashed, INET_HASH_NONE);
+        ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &loc, 1000, 80), bound);
+        inet_sock_unhash(&tbl, bound);
+        ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &loc, 1000, 80), wild);
+        inet_sock_unhash(&tbl, wild);
+        ck_assert_ptr_null(inet_sock_lookup(&tbl, &rem, &loc, 1000, 80));
+
+        inet_socktbl_free(&tbl);
+        epoch_barrier();
+        free(wild);
+        free(bound);
+        free(conn);
+    }
+END_TEST
+
+START_TEST (socktbl_rehash)
+    {
+        struct inet_socktbl tbl = INET_SOCKTBL_INITIALISER;
+        addr_t rem = ipv4(0x0a000001), loc = ipv4(0x0a000002);
+
+        struct inet_sock *a = inet_sock_new(0x0a000001, 0x0a000002, 1000, 80);
+        struct inet_sock *b = inet_sock_new(0x0a000001, 0x0a000002, 1000, 80);
+        ck_assert_int_eq(inet_sock_hash(&tbl, a), 0);
+        ck_assert_int_eq(inet_sock_hash(&tbl, b), -EADDRINUSE);
+        ck_assert_int_eq(b->hashed, INET_HASH_NONE);
+
+        // Hashing again moves a socket to its new key
+        a->remport = 1001;
+        ck_assert_int_eq(inet_sock_hash(&tbl, a), 0);
+        ck_assert_ptr_null(inet_sock_lookup(&tbl, &rem, &loc, 1000, 80));
+        ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &loc, 1001, 80), a);
+        ck_assert_int_eq(inet_sock_hash(&tbl, b), 0);
+        ck_assert_uint_eq(tbl.estab.count, 2);
+
+        inet_socktbl_free(&tbl);
+        epoch_barrier();
+        free(a);
+        free(b);
+    }
+END_TEST
+
+START_TEST (socktbl_resize)
+    {
+        struct inet_socktbl tbl = INET_SOCKTBL_INITIALISER;
+        struct inet_sock **socks = calloc(INET_TEST_SOCKS, sizeof(*socks));
+        addr_t loc = ipv4(0x0a000002);
+
+        for (int i = 0; i < INET_TEST_SOCKS; i++) {
+            socks[i] = inet_sock_new(0x0a000100 + i % 7, 0x0a000002,
+                                     (uint16_t) (1024 + i), 80);
+            ck_assert_int_eq(inet_sock_hash(&tbl, socks[i]), 0);
+        }
+        ck_assert_uint_eq(tbl.estab.count, INET_TEST_SOCKS);
+        ck_assert_uint_ge(tbl.estab.buckets->size, INET_TEST_SOCKS);
+
+        for (int i = 0; i < INET_TEST_SOCKS; i++) {
+            addr_t rem = ipv4(0x0a000100 + i % 7);
+            ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &loc,
+                                              (uint16_t) (1024 + i), 80),
+                             socks[i]);
+        }
+
+        // Removing most sockets shrinks the table again
+        for (int i = 0; i < INET_TEST_SOCKS - 1; i++)
+            inet_sock_unhash(&tbl, socks[i]);
+        ck_assert_uint_eq(tbl.estab.count, 1);
+        ck_assert_uint_eq(tbl.estab.buckets->size, INET_SOCKTBL_MIN);
+
+        addr_t rem = ipv4(0x0a000100 + (INET_TEST_SOCKS - 1) % 7);
+        ck_assert_ptr_eq(inet_sock_lookup(&tbl, &rem, &loc,
+                                          1024 + INET_TEST_SOCKS - 1, 80),
+                         socks[INET_TEST_SOCKS - 1]);
+
+        inet_socktbl_free(&tbl);
+        epoch_barrier();
+        for (int i = 0; i < INET_TEST_SOCKS; i++)
+            free(socks[i]);
+        free(socks);
+    }
+END_TEST
+
+struct socktbl_race {
+    struct inet_socktbl tbl;
+    struct inet_sock *fixed;
+    atomic_bool stop;
+    atomic_long misses;
+};
+
+// Looks up a socket that never leaves the table whilst others churn around it
+static void *socktbl_reader(struct socktbl_race *race) {
+    addr_t rem = race->fixed->remaddr, loc = race->fixed->locaddr;
+    while (!atomic_load(&race->stop)) {
+        epoch_enter();
+        if (inet_sock_lookup(&race->tbl, &rem, &loc, race->fixed->remport,
+                             race->fixed->locport) != race->fixed)
+            atomic_fetch_add(&race->misses, 1);
+        epoch_exit();
+    }
+    return NULL;
+}
+
+START_TEST (socktbl_concurrent)
+    {
+        struct socktbl_race race = {
+                .tbl = INET_SOCKTBL_INITIALISER,
+                .fixed = inet_sock_new(0x0a000001, 0x0a000002, 999, 80)
+        };
+        pthread_t threads[2];
+        ck_assert_int_eq(inet_sock_hash(&race.tbl, race.fixed), 0);
+
+        for (int i = 0; i < 2; i++)
+            pthread_create(&threads[i], NULL,
+                           (void *(*)(void *)) socktbl_reader, &race);
+
+        // Grow and shrink the table, moving sockets between buckets
+        for (int round = 0; round < 200; round++) {
+            struct inet_sock *socks[500];
+            for (int i = 0; i < 500; i++) {
+                socks[i] = inet_sock_new(0x0a000001, 0x0a000002,
+                                         (uint16_t) (1000 + i), 80);
+                ck_assert_int_eq(inet_sock_hash(&race.tbl, socks[i]), 0);
+            }
+            for (int i = 0; i < 500; i++) {
+                socks[i]->remport += 1000;
+                ck_assert_int_eq(inet_sock_hash(&race.tbl, socks[i]), 0);
+            }
+            for (int i = 0; i < 500; i++) {
+                inet_sock_unhash(&race.tbl, socks[i]);
+                epoch_defer(free, socks[i]);
+            }
+        }
+
+        atomic_store(&race.stop, true);
+        for (int i = 0; i < 2; i++)
+            pthread_join(threads[i], NULL);
+        ck_assert_int_eq(race.misses, 0);
+
+        inet_socktbl_free(&race.tbl);
+        epoch_barrier();
+        free(race.fixed);
+    }
+END_TEST
+
+Suite *inet_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Inet");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, socktbl_exact_and_listen);
+    tcase_add_test(tc_core, socktbl_rehash);
+    tcase_add_test(tc_core, socktbl_resize);
+    tcase_add_test(tc_core, socktbl_concurrent);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(inet_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
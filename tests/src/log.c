@@ -0,0 +1,94 @@
+#include <check.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <netstack/log.h>
+
+START_TEST (log_enabled_levels)
+    {
+        ck_assert(!log_enabled(LINFO));
+
+        ck_assert_int_eq(log_add_stream(&logconf, stdout, LDBUG, LINFO), 0);
+        ck_assert(log_enabled(LDBUG));
+        ck_assert(log_enabled(LINFO));
+        ck_assert(!log_enabled(LVERB));
+        ck_assert(!log_enabled(LINFO + 1));
+
+        ck_assert_int_eq(log_add_stream(&logconf, stderr, LCRIT,
+                                        loglvl_max - 1), 0);
+        ck_assert(log_enabled(LCRIT));
+        ck_assert(log_enabled(loglvl_max - 1));
+
+        // Removing all streams disables every level
+        llist_iter(&logconf.streams, free);
+        llist_clear(&logconf.streams);
+        log_update(&logconf);
+        ck_assert(!log_enabled(LDBUG));
+        ck_assert(!log_enabled(LCRIT));
+    }
+END_TEST
+
+#define LOG_TEST_THREADS 4
+#define LOG_TEST_ENTRIES 100
+
+static void *log_thread(void *arg) {
+    for (int i = 0; i < LOG_TEST_ENTRIES; i++)
+        LOG(LINFO, "entry %d", i);
+    return NULL;
+}
+
+START_TEST (log_async)
+    {
+        FILE *file = tmpfile();
+        ck_assert_ptr_nonnull(file);
+        ck_assert_int_eq(log_add_stream(&logconf, file, LINFO, LINFO), 0);
+        ck_assert_int_eq(log_async_start(&logconf), 0);
+
+        pthread_t threads[LOG_TEST_THREADS];
+        for (int i = 0; i < LOG_TEST_THREADS; i++)
+            pthread_create(&threads[i], NULL, log_thread, NULL);
+        for (int i = 0; i < LOG_TEST_THREADS; i++)
+            pthread_join(threads[i], NULL);
+
+        // Stopping writes out every buffered entry
+        log_async_stop(&logconf);
+
+        int lines = 0;
+        char buf[LOG_MAX];
+        rewind(file);
+        while (fgets(buf, LOG_MAX, file) != NULL)
+            lines++;
+        ck_assert_int_eq(lines, LOG_TEST_THREADS * LOG_TEST_ENTRIES);
+
+        llist_iter(&logconf.streams, free);
+        llist_clear(&logconf.streams);
+        log_update(&logconf);
+        fclose(file);
+    }
+END_TEST
+
+Suite *log_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Log");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, log_enabled_levels);
+    tcase_add_test(tc_core, log_async);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(log_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,191 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netstack/tcp/tcp.h>
+#include <netstack/tcp/option.h>
+
+#define OPT_TEST_MAX    40
+
+// A TCP header followed by the options given, padded to a whole word
+static struct tcp_hdr *opt_test_hdr(uint8_t *buf, const uint8_t *opts,
+                                    size_t len) {
+    size_t padded = (len + 3) & ~(size_t) 3;
+    memset(buf, 0, sizeof(struct tcp_hdr) + OPT_TEST_MAX);
+    memcpy(buf + sizeof(struct tcp_hdr), opts, len);
+
+    struct tcp_hdr *hdr = (struct tcp_hdr *) buf;
+    hdr->hlen = (sizeof(struct tcp_hdr) + padded) >> 2;
+    return hdr;
+}
+
+START_TEST (opt_syn)
+    {
+        uint8_t buf[sizeof(struct tcp_hdr) + OPT_TEST_MAX];
+        const uint8_t syn[] = {
+                TCP_OPT_MSS, TCP_OPT_MSS_LEN, 0x05, 0xb4,
+                TCP_OPT_NOP, TCP_OPT_NOP,
+                TCP_OPT_SACK_PERM, TCP_OPT_SACK_PERM_LEN,
+                TCP_OPT_NOP, TCP_OPT_WSCALE, TCP_OPT_WSCALE_LEN, 7,
+                TCP_OPT_NOP, TCP_OPT_NOP, TCP_OPT_TS, TCP_OPT_TS_LEN,
+                0x12, 0x34, 0x56, 0x78, 0x00, 0x00, 0x00, 0x00
+        };
+        struct tcp_opts opts;
+
+        tcp_parse_opts(opt_test_hdr(buf, syn, sizeof(syn)), &opts);
+        ck_assert_uint_eq(opts.mss, 1460);
+        ck_assert(opts.sack_ok);
+        ck_assert(opts.wscale_ok);
+        ck_assert_uint_eq(opts.wscale, 7);
+        ck_assert(opts.ts_ok);
+        ck_assert_uint_eq(opts.tsval, 0x12345678);
+        ck_assert_uint_eq(opts.tsecr, 0);
+        ck_assert_uint_eq(opts.sacks, 0);
+        ck_assert_uint_eq(tcp_syn_mss(&opts, NULL), 1460);
+
+        // Without an MSS option, the default is used
+        tcp_parse_opts(opt_test_hdr(buf, syn + 4, sizeof(syn) - 4), &opts);
+        ck_assert_uint_eq(opts.mss, 0);
+        ck_assert(opts.sack_ok);
+        ck_assert_uint_eq(tcp_syn_mss(&opts, NULL), TCP_DEF_MSS);
+    }
+END_TEST
+
+START_TEST (opt_wscale)
+    {
+        uint8_t buf[sizeof(struct tcp_hdr) + OPT_TEST_MAX];
+        uint8_t ws[] = {TCP_OPT_NOP, TCP_OPT_WSCALE, TCP_OPT_WSCALE_LEN, 0};
+        struct tcp_opts opts;
+
+        tcp_parse_opts(opt_test_hdr(buf, ws, sizeof(ws)), &opts);
+        ck_assert(opts.wscale_ok);
+        ck_assert_uint_eq(opts.wscale, 0);
+
+        // Shifts past the largest allowed are taken as it
+        ws[3] = 15;
+        tcp_parse_opts(opt_test_hdr(buf, ws, sizeof(ws)), &opts);
+        ck_assert(opts.wscale_ok);
+        ck_assert_uint_eq(opts.wscale, TCP_MAX_WSCALE);
+
+        // The receive buffer decides the shift we send
+        ck_assert_uint_eq(tcp_rcvbuf_wscale(UINT16_MAX), 0);
+        ck_assert_uint_eq(tcp_rcvbuf_wscale(UINT16_MAX + 1), 1);
+        ck_assert_uint_eq(tcp_rcvbuf_wscale(TCP_DEF_RCVBUF), 3);
+        ck_assert_uint_eq(tcp_rcvbuf_wscale(TCP_MAX_RCVBUF), TCP_MAX_WSCALE);
+        ck_assert_uint_eq(tcp_rcvbuf_wscale(SIZE_MAX), TCP_MAX_WSCALE);
+    }
+END_TEST
+
+START_TEST (opt_ts)
+    {
+        uint8_t buf[sizeof(struct tcp_hdr) + OPT_TEST_MAX];
+        uint8_t ts[] = {
+                TCP_OPT_NOP, TCP_OPT_NOP, TCP_OPT_TS, TCP_OPT_TS_LEN,
+                0xff, 0xff, 0xff, 0xfe, 0x00, 0x00, 0x01, 0x00
+        };
+        struct tcp_opts opts;
+
+        tcp_parse_opts(opt_test_hdr(buf, ts, sizeof(ts)), &opts);
+        ck_assert(opts.ts_ok);
+        ck_assert_uint_eq(opts.tsval, 0xfffffffe);
+        ck_assert_uint_eq(opts.tsecr, 0x100);
+
+        // Timestamps of the wrong length are ignored
+        ts[3] = TCP_OPT_TS_LEN - 2;
+        tcp_parse_opts(opt_test_hdr(buf, ts, sizeof(ts)), &opts);
+        ck_assert(!opts.ts_ok);
+    }
+END_TEST
+
+START_TEST (opt_sack)
+    {
+        uint8_t buf[sizeof(struct tcp_hdr) + OPT_TEST_MAX];
+        uint8_t sack[] = {
+                TCP_OPT_NOP, TCP_OPT_NOP, TCP_OPT_SACK, TCP_OPT_SACK_LEN(2),
+                0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00,
+                0xff, 0xff, 0xff, 0xf0, 0x00, 0x00, 0x00, 0x10
+        };
+        struct tcp_opts opts;
+
+        tcp_parse_opts(opt_test_hdr(buf, sack, sizeof(sack)), &opts);
+        ck_assert_uint_eq(opts.sacks, 2);
+        ck_assert_uint_eq(opts.sack[0].start, 0x100);
+        ck_assert_uint_eq(opts.sack[0].end, 0x200);
+        ck_assert_uint_eq(opts.sack[1].start, 0xfffffff0);
+        ck_assert_uint_eq(opts.sack[1].end, 0x10);
+        ck_assert(!opts.sack_ok);
+        ck_assert(!opts.ts_ok);
+
+        // A length that isn't a whole number of blocks is ignored
+        sack[3] = TCP_OPT_SACK_LEN(1) + 4;
+        tcp_parse_opts(opt_test_hdr(buf, sack, sizeof(sack)), &opts);
+        ck_assert_uint_eq(opts.sacks, 0);
+    }
+END_TEST
+
+START_TEST (opt_malformed)
+    {
+        uint8_t buf[sizeof(struct tcp_hdr) + OPT_TEST_MAX];
+        struct tcp_opts opts;
+
+        // Options after one whose length runs past the header are not read
+        const uint8_t overrun[] = {
+                TCP_OPT_SACK_PERM, TCP_OPT_SACK_PERM_LEN,
+                TCP_OPT_MSS, 0x20, 0x05, 0xb4
+        };
+        tcp_parse_opts(opt_test_hdr(buf, overrun, sizeof(overrun)), &opts);
+        ck_assert(opts.sack_ok);
+        ck_assert_uint_eq(opts.mss, 0);
+
+        // A zero length would otherwise never advance
+        const uint8_t zero[] = {0x1e, 0x00, TCP_OPT_MSS, TCP_OPT_MSS_LEN};
+        tcp_parse_opts(opt_test_hdr(buf, zero, sizeof(zero)), &opts);
+        ck_assert_uint_eq(opts.mss, 0);
+
+        // Nothing is read past the end of the option list
+        const uint8_t eol[] = {
+                TCP_OPT_EOL, 0x00, 0x00, 0x00,
+                TCP_OPT_MSS, TCP_OPT_MSS_LEN, 0x05, 0xb4
+        };
+        tcp_parse_opts(opt_test_hdr(buf, eol, sizeof(eol)), &opts);
+        ck_assert_uint_eq(opts.mss, 0);
+
+        // An MSS option with the wrong length is skipped over
+        const uint8_t badmss[] = {
+                TCP_OPT_MSS, 0x03, 0x05,
+                TCP_OPT_SACK_PERM, TCP_OPT_SACK_PERM_LEN
+        };
+        tcp_parse_opts(opt_test_hdr(buf, badmss, sizeof(badmss)), &opts);
+        ck_assert_uint_eq(opts.mss, 0);
+        ck_assert(opts.sack_ok);
+    }
+END_TEST
+
+Suite *option_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("TCP options");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, opt_syn);
+    tcase_add_test(tc_core, opt_wscale);
+    tcase_add_test(tc_core, opt_ts);
+    tcase_add_test(tc_core, opt_sack);
+    tcase_add_test(tc_core, opt_malformed);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(option_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
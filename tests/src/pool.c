@@ -0,0 +1,165 @@
+#include <check.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <netstack/col/pool.h>
+
+#define POOL_TEST_COUNT 64
+#define POOL_TEST_SIZE  100
+
+START_TEST (pool_get_put)
+    {
+        struct pool pool;
+        ck_assert_int_eq(pool_init(&pool, POOL_TEST_SIZE, POOL_TEST_COUNT), 0);
+        ck_assert_uint_eq(pool.obj_sz % POOL_ALIGN, 0);
+
+        void *obj = pool_get(&pool, POOL_TEST_SIZE);
+        ck_assert_ptr_nonnull(obj);
+        ck_assert(pool_contains(&pool, obj));
+        ck_assert_uint_eq((uintptr_t) obj % POOL_ALIGN, 0);
+
+        pool_put(&pool, obj);
+        ck_assert_ptr_eq(pool_get(&pool, POOL_TEST_SIZE), obj);
+        pool_put(&pool, obj);
+
+        struct pool_stats stats;
+        pool_get_stats(&pool, &stats);
+        ck_assert_uint_eq(stats.used, 0);
+        ck_assert_uint_eq(stats.high_water, 1);
+        ck_assert_uint_eq(stats.misses, 0);
+        pool_free(&pool);
+    }
+END_TEST
+
+START_TEST (pool_exhaust)
+    {
+        struct pool pool;
+        void *objs[POOL_TEST_COUNT];
+        ck_assert_int_eq(pool_init(&pool, POOL_TEST_SIZE, POOL_TEST_COUNT), 0);
+
+        // Every object should be handed out exactly once
+        for (int i = 0; i < POOL_TEST_COUNT; i++) {
+            objs[i] = pool_get(&pool, POOL_TEST_SIZE);
+            ck_assert(pool_contains(&pool, objs[i]));
+            for (int j = 0; j < i; j++)
+                ck_assert_ptr_ne(objs[i], objs[j]);
+        }
+
+        // Then fall back to malloc
+        void *extra = pool_get(&pool, POOL_TEST_SIZE);
+        ck_assert_ptr_nonnull(extra);
+        ck_assert(!pool_contains(&pool, extra));
+        pool_put(&pool, extra);
+
+        for (int i = 0; i < POOL_TEST_COUNT; i++)
+            pool_put(&pool, objs[i]);
+
+        struct pool_stats stats;
+        pool_get_stats(&pool, &stats);
+        ck_assert_uint_eq(stats.used, 0);
+        ck_assert_uint_eq(stats.high_water, POOL_TEST_COUNT);
+        ck_assert_uint_eq(stats.misses, 1);
+        pool_free(&pool);
+    }
+END_TEST
+
+START_TEST (pool_oversize)
+    {
+        struct pool pool;
+        ck_assert_int_eq(pool_init(&pool, POOL_TEST_SIZE, POOL_TEST_COUNT), 0);
+
+        void *obj = pool_get(&pool, pool.obj_sz + 1);
+        ck_assert_ptr_nonnull(obj);
+        ck_assert(!pool_contains(&pool, obj));
+        pool_put(&pool, obj);
+        pool_free(&pool);
+    }
+END_TEST
+
+START_TEST (pool_free_resets)
+    {
+        struct pool pool;
+        ck_assert_int_eq(pool_init(&pool, POOL_TEST_SIZE, POOL_TEST_COUNT), 0);
+        pool_free(&pool);
+
+        ck_assert_ptr_null(pool.mem);
+        ck_assert_uint_eq(pool.obj_sz, 0);
+        ck_assert_uint_eq(pool.count, 0);
+
+        // A freed pool only hands out malloc(3) memory
+        void *obj = pool_get(&pool, POOL_TEST_SIZE);
+        ck_assert_ptr_nonnull(obj);
+        ck_assert(!pool_contains(&pool, obj));
+        pool_put(&pool, obj);
+        pool_free(&pool);
+    }
+END_TEST
+
+static void *pool_thread(struct pool *pool) {
+    void *objs[8];
+    for (int i = 0; i < 10000; i++) {
+        for (int j = 0; j < 8; j++)
+            objs[j] = pool_get(pool, POOL_TEST_SIZE);
+        for (int j = 0; j < 8; j++)
+            pool_put(pool, objs[j]);
+    }
+    return NULL;
+}
+
+START_TEST (pool_threads)
+    {
+        struct pool pool;
+        pthread_t threads[4];
+        ck_assert_int_eq(pool_init(&pool, POOL_TEST_SIZE, POOL_TEST_COUNT), 0);
+
+        for (int i = 0; i < 4; i++)
+            pthread_create(&threads[i], NULL,
+                           (void *(*)(void *)) pool_thread, &pool);
+        for (int i = 0; i < 4; i++)
+            pthread_join(threads[i], NULL);
+
+        // Exited threads return their caches, so the whole pool is available
+        void *objs[POOL_TEST_COUNT];
+        for (int i = 0; i < POOL_TEST_COUNT; i++) {
+            objs[i] = pool_get(&pool, POOL_TEST_SIZE);
+            ck_assert(pool_contains(&pool, objs[i]));
+        }
+        for (int i = 0; i < POOL_TEST_COUNT; i++)
+            pool_put(&pool, objs[i]);
+
+        struct pool_stats stats;
+        pool_get_stats(&pool, &stats);
+        ck_assert_uint_eq(stats.used, 0);
+        pool_free(&pool);
+    }
+END_TEST
+
+Suite *pool_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Pool");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, pool_get_put);
+    tcase_add_test(tc_core, pool_exhaust);
+    tcase_add_test(tc_core, pool_oversize);
+    tcase_add_test(tc_core, pool_free_resets);
+    tcase_add_test(tc_core, pool_threads);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(pool_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,205 @@
+#include <check.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <netstack/tcp/reassembly.h>
+
+#define REASS_TEST_SPACE    4096
+#define REASS_TEST_COUNT    2000
+
+// Segment frames have no buffer, the queue only holds references to them
+static int reass_test_insert(struct tcp_reass *q, uint32_t seq, uint16_t len) {
+    struct frame *frame = frame_init(NULL, NULL, 0);
+    int ret = tcp_reass_insert(q, frame, seq, len);
+    if (ret != 0)
+        frame_decref(frame);
+    return ret;
+}
+
+// Pops a run, checking it covers seq up to end without gaps
+static void reass_test_pop(struct tcp_reass *q, uint32_t nxt, uint32_t seq,
+                           uint32_t end) {
+    struct tcp_reass_seg *seg = tcp_reass_pop(q, nxt);
+    ck_assert_ptr_nonnull(seg);
+    ck_assert_uint_eq(seg->seq, seq);
+
+    uint32_t reached = seq;
+    while (seg != NULL) {
+        struct tcp_reass_seg *next = seg->next;
+        ck_assert_uint_le(seg->seq - seq, reached - seq);
+        ck_assert_uint_ge(seg->seq + seg->len - seq, reached - seq);
+        reached = seg->seq + seg->len;
+        frame_decref(seg->frame);
+        free(seg);
+        seg = next;
+    }
+    ck_assert_uint_eq(reached, end);
+}
+
+START_TEST (reass_merge)
+    {
+        struct tcp_reass q;
+        tcp_reass_init(&q);
+
+        // Three separate runs, the last two then joined by a segment between
+        ck_assert_int_eq(reass_test_insert(&q, 100, 10), 0);
+        ck_assert_int_eq(reass_test_insert(&q, 300, 10), 0);
+        ck_assert_int_eq(reass_test_insert(&q, 200, 10), 0);
+        ck_assert_uint_eq(q.runs, 3);
+        ck_assert_int_eq(reass_test_insert(&q, 205, 100), 0);
+        ck_assert_uint_eq(q.runs, 2);
+        ck_assert_uint_eq(q.held, 130);
+
+        // Adjoining the first run extends it
+        ck_assert_int_eq(reass_test_insert(&q, 110, 10), 0);
+        ck_assert_uint_eq(q.runs, 2);
+
+        // Nothing is handed over until nxt reaches the first run
+        ck_assert_ptr_null(tcp_reass_pop(&q, 99));
+        reass_test_pop(&q, 100, 100, 120);
+        reass_test_pop(&q, 250, 200, 310);
+        ck_assert_ptr_null(tcp_reass_pop(&q, 1000));
+        ck_assert_uint_eq(q.runs, 0);
+        ck_assert_uint_eq(q.held, 0);
+        tcp_reass_free(&q);
+    }
+END_TEST
+
+START_TEST (reass_duplicates)
+    {
+        struct tcp_reass q;
+        tcp_reass_init(&q);
+
+        ck_assert_int_eq(reass_test_insert(&q, 100, 50), 0);
+        ck_assert_int_eq(reass_test_insert(&q, 100, 50), 0);
+        ck_assert_int_eq(reass_test_insert(&q, 110, 20), 0);
+        ck_assert_int_eq(reass_test_insert(&q, 100, 10), 0);
+        ck_assert_uint_eq(q.runs, 1);
+        ck_assert_uint_eq(q.held, 50);
+
+        // A segment covering queued ones replaces them
+        ck_assert_int_eq(reass_test_insert(&q, 200, 10), 0);
+        ck_assert_int_eq(reass_test_insert(&q, 220, 10), 0);
+        ck_assert_int_eq(reass_test_insert(&q, 150, 100), 0);
+        ck_assert_uint_eq(q.runs, 1);
+        ck_assert_uint_eq(q.held, 150);
+
+        reass_test_pop(&q, 100, 100, 250);
+        tcp_reass_free(&q);
+    }
+END_TEST
+
+START_TEST (reass_wrap)
+    {
+        struct tcp_reass q;
+        tcp_reass_init(&q);
+
+        // Runs either side of the sequence number wrapping around
+        ck_assert_int_eq(reass_test_insert(&q, 10, 10), 0);
+        ck_assert_int_eq(reass_test_insert(&q, UINT32_MAX - 9, 10), 0);
+        ck_assert_uint_eq(q.runs, 2);
+        ck_assert_int_eq(reass_test_insert(&q, 0, 10), 0);
+        ck_assert_uint_eq(q.runs, 1);
+
+        reass_test_pop(&q, UINT32_MAX - 9, UINT32_MAX - 9, 20);
+        tcp_reass_free(&q);
+    }
+END_TEST
+
+START_TEST (reass_random)
+    {
+        struct tcp_reass q;
+        bool have[REASS_TEST_SPACE] = {0};
+        tcp_reass_init(&q);
+        srand(1);
+
+        for (int i = 0; i < REASS_TEST_COUNT; i++) {
+            uint32_t seq = (uint32_t) (rand() % (REASS_TEST_SPACE - 64));
+            uint16_t len = (uint16_t) (rand() % 32 + 1);
+            ck_assert_int_eq(reass_test_insert(&q, seq, len), 0);
+            for (uint32_t s = seq; s < seq + len; s++)
+                have[s] = true;
+        }
+
+        // Every run should be a maximal range of the octets inserted
+        uint32_t runs = 0;
+        for (uint32_t s = 0; s < REASS_TEST_SPACE; s++) {
+            if (!have[s] || (s > 0 && have[s - 1]))
+                continue;
+            uint32_t end = s;
+            while (end < REASS_TEST_SPACE && have[end])
+                end++;
+            reass_test_pop(&q, s, s, end);
+            runs++;
+        }
+        ck_assert_uint_ge(runs, 1);
+        ck_assert_uint_eq(q.runs, 0);
+        ck_assert_uint_eq(q.held, 0);
+        tcp_reass_free(&q);
+    }
+END_TEST
+
+START_TEST (reass_sack)
+    {
+        struct tcp_reass q;
+        struct tcp_sack_block blocks[TCP_SACK_MAX_BLOCKS];
+        tcp_reass_init(&q);
+
+        ck_assert_uint_eq(tcp_reass_sack(&q, 0, blocks, 4), 0);
+
+        for (uint32_t seq = 100; seq < 600; seq += 100)
+            ck_assert_int_eq(reass_test_insert(&q, seq, 10), 0);
+        ck_assert_int_eq(reass_test_insert(&q, 310, 10), 0);
+
+        // The run with the latest segment is first, then the rest in order
+        ck_assert_uint_eq(tcp_reass_sack(&q, 310, blocks, 4), 4);
+        ck_assert_uint_eq(blocks[0].start, 300);
+        ck_assert_uint_eq(blocks[0].end, 320);
+        ck_assert_uint_eq(blocks[1].start, 100);
+        ck_assert_uint_eq(blocks[2].start, 200);
+        ck_assert_uint_eq(blocks[3].start, 400);
+        ck_assert_uint_eq(blocks[3].end, 410);
+
+        // Which are cut short by the space given
+        ck_assert_uint_eq(tcp_reass_sack(&q, 500, blocks, 2), 2);
+        ck_assert_uint_eq(blocks[0].start, 500);
+        ck_assert_uint_eq(blocks[1].start, 100);
+
+        // A recent segment since handed over is left out
+        reass_test_pop(&q, 100, 100, 110);
+        ck_assert_uint_eq(tcp_reass_sack(&q, 100, blocks, 4), 4);
+        ck_assert_uint_eq(blocks[0].start, 200);
+        ck_assert_uint_eq(blocks[3].start, 500);
+        tcp_reass_free(&q);
+    }
+END_TEST
+
+Suite *reassembly_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Reassembly");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, reass_merge);
+    tcase_add_test(tc_core, reass_duplicates);
+    tcase_add_test(tc_core, reass_wrap);
+    tcase_add_test(tc_core, reass_random);
+    tcase_add_test(tc_core, reass_sack);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(reassembly_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,130 @@
+#include <check.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <netstack/checksum.h>
+#include <netstack/col/ringbuf.h>
+
+#define RINGBUF_TEST_SIZE   1000
+
+START_TEST (ringbuf_fill)
+    {
+        uint8_t testdata[RINGBUF_TEST_SIZE + 100], outdata[RINGBUF_TEST_SIZE];
+        for (size_t i = 0; i < sizeof(testdata); i++)
+            testdata[i] = (uint8_t) (i * 7);
+
+        ringbuf_t rb;
+        ck_assert_int_eq(ringbuf_init(&rb, RINGBUF_TEST_SIZE), 0);
+        ck_assert_uint_eq(ringbuf_space(&rb), RINGBUF_TEST_SIZE);
+
+        // Writes stop when the ring is full
+        ck_assert_int_eq(ringbuf_write(&rb, testdata, 600), 600);
+        ck_assert_int_eq(ringbuf_write(&rb, testdata + 600, 500), 400);
+        ck_assert_uint_eq(ringbuf_space(&rb), 0);
+        ck_assert_int_eq(ringbuf_write(&rb, testdata, 1), 0);
+
+        // Reads stop when the ring is empty
+        ck_assert_int_eq(ringbuf_read(&rb, outdata, 300), 300);
+        ck_assert_mem_eq(outdata, testdata, 300);
+        ck_assert_int_eq(ringbuf_read(&rb, outdata, RINGBUF_TEST_SIZE), 700);
+        ck_assert_mem_eq(outdata, testdata + 300, 700);
+        ck_assert_int_eq(ringbuf_read(&rb, outdata, 1), 0);
+
+        ringbuf_free(&rb);
+    }
+END_TEST
+
+START_TEST (ringbuf_wrap)
+    {
+        uint8_t testdata[RINGBUF_TEST_SIZE], outdata[RINGBUF_TEST_SIZE];
+        ringbuf_t rb;
+        ck_assert_int_eq(ringbuf_init(&rb, RINGBUF_TEST_SIZE), 0);
+
+        // Stream through the ring in uneven chunks so reads and writes wrap
+        // at every offset, checking the data comes out in the order it went in
+        uint8_t in = 0, out = 0;
+        for (int i = 0; i < 5000; i++) {
+            size_t len = (size_t) (i * 37) % RINGBUF_TEST_SIZE;
+            for (size_t j = 0; j < len; j++)
+                testdata[j] = (uint8_t) (in + j);
+
+            long written = ringbuf_write(&rb, testdata, len);
+            ck_assert_uint_le(rb.count, RINGBUF_TEST_SIZE);
+            in += (uint8_t) written;
+
+            long read = ringbuf_read(&rb, outdata, (size_t) (i * 53) %
+                                                   RINGBUF_TEST_SIZE);
+            for (long j = 0; j < read; j++)
+                ck_assert_uint_eq(outdata[j], (uint8_t) (out + j));
+            out += (uint8_t) read;
+        }
+
+        ringbuf_free(&rb);
+    }
+END_TEST
+
+START_TEST (ringbuf_stage)
+    {
+        uint8_t testdata[RINGBUF_TEST_SIZE], outdata[RINGBUF_TEST_SIZE];
+        for (size_t i = 0; i < sizeof(testdata); i++)
+            testdata[i] = (uint8_t) (i * 13 + 1);
+
+        ringbuf_t rb;
+        ck_assert_int_eq(ringbuf_init(&rb, RINGBUF_TEST_SIZE), 0);
+
+        // Wrap the staged text at both odd and even offsets into it
+        for (size_t at = 0; at < 8; at++) {
+            size_t len = 301 + at;
+            // Leave a byte in the ring, as an empty one starts from 0 again
+            ringbuf_write(&rb, testdata, RINGBUF_TEST_SIZE - 150 - at);
+            ringbuf_read(&rb, outdata, RINGBUF_TEST_SIZE - 151 - at);
+
+            uint16_t sum;
+            ck_assert_int_eq(ringbuf_stage_csum(&rb, testdata, len, &sum),
+                             len);
+            ck_assert_uint_eq(sum, (uint16_t) ~in_csum(testdata, len, 0));
+
+            // Staged text isn't in the ring until it is committed
+            ck_assert_uint_eq(rb.count, 1);
+            ringbuf_commit(&rb, len);
+            ck_assert_int_eq(ringbuf_read(&rb, outdata, 1), 1);
+            ck_assert_int_eq(ringbuf_read(&rb, outdata, len), len);
+            ck_assert_mem_eq(outdata, testdata, len);
+        }
+
+        // Only as much as there is space for is staged
+        uint16_t sum;
+        ringbuf_write(&rb, testdata, RINGBUF_TEST_SIZE - 10);
+        ck_assert_int_eq(ringbuf_stage_csum(&rb, testdata, 20, &sum), 10);
+        ck_assert_uint_eq(sum, (uint16_t) ~in_csum(testdata, 10, 0));
+
+        ringbuf_free(&rb);
+    }
+END_TEST
+
+Suite *ringbuf_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Ring Buffer");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, ringbuf_fill);
+    tcase_add_test(tc_core, ringbuf_wrap);
+    tcase_add_test(tc_core, ringbuf_stage);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(ringbuf_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
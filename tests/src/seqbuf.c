@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <netstack/col/seqbuf.h>
 
@@ -16,7 +17,7 @@ START_TEST (read_write)
         size_t start = (size_t) random() % UINT16_MAX;
 
         seqbuf_t buf;
-        ck_assert_int_eq(seqbuf_init(&buf, random() % 87, start), 0);
+        ck_assert_int_eq(seqbuf_init(&buf, start, ((size_t) 1) << 32U), 0);
 
         ck_assert_int_eq(seqbuf_write(&buf, testdata + 000, 100), 100);
         ck_assert_int_eq(buf.count, 100);
@@ -39,11 +40,62 @@ START_TEST (read_write)
 
         size_t consume_amt = 100;
         size_t newstart = start + consume_amt;
-        seqbuf_consume(&buf, consume_amt);
+        ck_assert_int_eq(seqbuf_consume(&buf, start, consume_amt), 0);
         ck_assert_int_eq(seqbuf_available(&buf, newstart), testlen - consume_amt);
 
-        seqbuf_consume(&buf, (size_t) seqbuf_available(&buf, newstart));
+        ck_assert_int_eq(seqbuf_consume(&buf, newstart,
+                     (size_t) seqbuf_available(&buf, newstart)), 0);
         ck_assert_int_eq(seqbuf_available(&buf, newstart + (testlen - consume_amt)), 0);
+        seqbuf_free(&buf);
+    }
+END_TEST
+
+START_TEST (wrap_and_grow)
+    {
+        size_t chunk = SEQBUF_MIN_SIZE / 3 + 1;
+        uint8_t *testdata = malloc(4 * chunk), *outdata = malloc(4 * chunk);
+        for (size_t i = 0; i < 4 * chunk; i++)
+            testdata[i] = (uint8_t) (i * 7);
+
+        // Start just before the sequence space wraps
+        size_t limit = ((size_t) 1) << 32U, start = limit - 1000;
+        seqbuf_t buf;
+        ck_assert_int_eq(seqbuf_init(&buf, start, limit), 0);
+
+        // Fill most of the ring, then consume the front so the next write
+        // wraps around the end of the ring
+        ck_assert_int_eq(seqbuf_write(&buf, testdata, 2 * chunk), 2 * chunk);
+        ck_assert_int_eq(seqbuf_consume_to(&buf, (start + chunk) % limit), 0);
+        ck_assert_int_eq(seqbuf_write(&buf, testdata + 2 * chunk, chunk),
+                         chunk);
+        ck_assert_uint_eq(buf.size, SEQBUF_MIN_SIZE);
+
+        // A read across the wrap is still one contiguous run
+        size_t from = (start + chunk) % limit;
+        ck_assert_int_eq(seqbuf_read(&buf, from, outdata, 2 * chunk),
+                         2 * chunk);
+        ck_assert_mem_eq(outdata, testdata + chunk, 2 * chunk);
+
+        uint16_t sum;
+        ck_assert_int_eq(seqbuf_read_csum(&buf, from + 1, outdata, 2 * chunk,
+                                          &sum), 2 * chunk - 1);
+        ck_assert_mem_eq(outdata, testdata + chunk + 1, 2 * chunk - 1);
+
+        // Writing past the size of the ring grows it, keeping the data
+        ck_assert_int_eq(seqbuf_write(&buf, testdata + 3 * chunk, chunk),
+                         chunk);
+        ck_assert_uint_gt(buf.size, SEQBUF_MIN_SIZE);
+        ck_assert_int_eq(seqbuf_available(&buf, from), 3 * chunk);
+        ck_assert_int_eq(seqbuf_read(&buf, from, outdata, 3 * chunk),
+                         3 * chunk);
+        ck_assert_mem_eq(outdata, testdata + chunk, 3 * chunk);
+
+        // Nothing can be read from before the start
+        ck_assert_int_lt(seqbuf_read(&buf, start, outdata, 1), 0);
+
+        seqbuf_free(&buf);
+        free(testdata);
+        free(outdata);
     }
 END_TEST
 
@@ -57,6 +109,7 @@ Suite *llist_suite(void) {
     tc_core = tcase_create("Core");
 
     tcase_add_test(tc_core, read_write);
+    tcase_add_test(tc_core, wrap_and_grow);
     suite_add_tcase(s, tc_core);
 
     return s;
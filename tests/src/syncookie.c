@@ -0,0 +1,86 @@
+#include <check.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <netstack/tcp/syncookie.h>
+
+static struct inet_sock syncookie_test_sock(void) {
+    return (struct inet_sock) {
+            .locaddr = {.proto = PROTO_IPV4, .ipv4 = 0x0a000001},
+            .remaddr = {.proto = PROTO_IPV4, .ipv4 = 0x0a000002},
+            .locport = 80,
+            .remport = 40000
+    };
+}
+
+START_TEST (syncookie_roundtrip)
+    {
+        struct inet_sock inet = syncookie_test_sock();
+        uint32_t seq = 0xfffffff0;
+
+        // The MSS is rounded down to one the cookie can hold
+        uint16_t mss[][2] = {
+                {1460, 1460}, {9000, 1460}, {1400, 1380}, {536, 536},
+                {600, 536}, {100, 216}
+        };
+        for (size_t i = 0; i < sizeof(mss) / sizeof(mss[0]); i++) {
+            uint32_t cookie = tcp_syncookie_make(&inet, seq, mss[i][0]);
+            ck_assert_int_eq(tcp_syncookie_check(&inet, seq, cookie),
+                             mss[i][1]);
+        }
+    }
+END_TEST
+
+START_TEST (syncookie_tampered)
+    {
+        struct inet_sock inet = syncookie_test_sock();
+        uint32_t seq = 123456789;
+        uint32_t cookie = tcp_syncookie_make(&inet, seq, 1460);
+
+        // Any change to the hash or the MSS is caught
+        for (int bit = 0; bit < 27; bit++)
+            ck_assert_int_eq(tcp_syncookie_check(&inet, seq,
+                                                 cookie ^ (1U << bit)), -EINVAL);
+
+        // As is a cookie that is too old
+        uint32_t old = cookie - (TCP_COOKIE_MAXAGE << 27);
+        ck_assert_int_eq(tcp_syncookie_check(&inet, seq, old), -EINVAL);
+
+        // Or one returned for another connection
+        ck_assert_int_eq(tcp_syncookie_check(&inet, seq + 1, cookie), -EINVAL);
+        inet.remport++;
+        ck_assert_int_eq(tcp_syncookie_check(&inet, seq, cookie), -EINVAL);
+        inet.remport--;
+        inet.remaddr.ipv4++;
+        ck_assert_int_eq(tcp_syncookie_check(&inet, seq, cookie), -EINVAL);
+        inet.remaddr.ipv4--;
+
+        ck_assert_int_eq(tcp_syncookie_check(&inet, seq, cookie), 1460);
+    }
+END_TEST
+
+Suite *syncookie_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("SYN cookies");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, syncookie_roundtrip);
+    tcase_add_test(tc_core, syncookie_tampered);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(syncookie_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,123 @@
+#include <check.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <netstack/tcp/tcp.h>
+
+static struct tcp_sock *tcp_test_sock(uint16_t port) {
+    struct tcp_sock *sock = tcp_sock_init(calloc(1, sizeof(struct tcp_sock)));
+    sock->inet.locaddr = (addr_t) {.proto = PROTO_IPV4, .ipv4 = 0x0a000001};
+    sock->inet.locport = port;
+    sock->inet.type = SOCK_STREAM;
+    return sock;
+}
+
+START_TEST (tcp_close_listener)
+    {
+        struct tcp_sock *sock = tcp_test_sock(8000);
+
+        ck_assert_int_eq(tcp_user_listen(sock, 4), 0);
+        ck_assert_int_eq(sock->state, TCP_LISTEN);
+
+        // A listener has no send buffer for close() to look at
+        ck_assert_int_eq(tcp_user_close(sock), 0);
+    }
+END_TEST
+
+START_TEST (tcp_close_unconnected)
+    {
+        struct tcp_sock *sock = tcp_test_sock(8001);
+
+        ck_assert_int_eq(tcp_user_close(sock), -ENOTCONN);
+        ck_assert_int_eq(sock->state, TCP_CLOSED);
+        tcp_sock_destroy(sock);
+
+        // Neither does a connection that is still opening
+        sock = tcp_test_sock(8002);
+        tcp_setstate(sock, TCP_SYN_SENT);
+        ck_assert_int_eq(tcp_user_close(sock), 0);
+    }
+END_TEST
+
+static void *tcp_test_accept(void *arg) {
+    struct tcp_sock *client;
+    return (void *) (intptr_t) tcp_user_accept(arg, &client);
+}
+
+START_TEST (tcp_close_wakes_accept)
+    {
+        struct tcp_sock *sock = tcp_test_sock(8003);
+        ck_assert_int_eq(tcp_user_listen(sock, 4), 0);
+
+        // A non-blocking accept() leaves the listener's references as it was
+        struct tcp_sock *client;
+        sock->inet.flags |= O_NONBLOCK;
+        ck_assert_int_eq(tcp_user_accept(sock, &client), -EWOULDBLOCK);
+        ck_assert_int_eq(atomic_load(&sock->refcount), 1);
+        sock->inet.flags &= ~O_NONBLOCK;
+
+        // A blocked accept() keeps the listener until it has woken up
+        pthread_t thread;
+        void *ret;
+        ck_assert_int_eq(pthread_create(&thread, NULL, tcp_test_accept,
+                                        sock), 0);
+        usleep(50000);
+        ck_assert_int_eq(tcp_user_close(sock), 0);
+        pthread_join(thread, &ret);
+        ck_assert_int_eq((intptr_t) ret, -EINVAL);
+    }
+END_TEST
+
+START_TEST (tcp_timewait_refcount)
+    {
+        struct tcp_sock *sock = tcp_test_sock(8004);
+        tcp_setstate(sock, TCP_TIME_WAIT);
+
+        // The armed timer holds one reference, however often it is restarted
+        tcp_timewait_start(sock);
+        tcp_timewait_restart(sock);
+        ck_assert_int_eq(atomic_load(&sock->refcount), 2);
+        tcp_timewait_cancel(sock);
+        ck_assert_int_eq(atomic_load(&sock->refcount), 1);
+
+        // Expiry closes the connection and drops both references. Hold one
+        // more to look at the socket, and fire the timer as the wheel would
+        tcp_timewait_start(sock);
+        tcp_sock_incref(sock);
+        wheel_cancel(&tcp_wheel, &sock->timewait);
+        tcp_timewait_expire(sock);
+        ck_assert_int_eq(sock->state, TCP_CLOSED);
+        ck_assert_int_eq(atomic_load(&sock->refcount), 1);
+        tcp_sock_decref(sock);
+    }
+END_TEST
+
+Suite *tcp_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("TCP");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, tcp_close_listener);
+    tcase_add_test(tc_core, tcp_close_unconnected);
+    tcase_add_test(tc_core, tcp_close_wakes_accept);
+    tcase_add_test(tc_core, tcp_timewait_refcount);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(tcp_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
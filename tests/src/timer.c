@@ -0,0 +1,133 @@
+#include <check.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include <netstack/time/timer.h>
+
+#define TIMER_TEST_COUNT 1000
+
+static atomic_int fired;
+static atomic_int order[3];
+static atomic_int next;
+
+static void timer_test_count(void *arg) {
+    atomic_fetch_add(&fired, 1);
+}
+
+static void timer_test_order(void *arg) {
+    order[atomic_fetch_add(&next, 1)] = (int) (intptr_t) arg;
+}
+
+START_TEST (timer_fires_in_order)
+    {
+        timeout_t t[3] = { TIMEOUT_INITIALISER, TIMEOUT_INITIALISER,
+                           TIMEOUT_INITIALISER };
+        atomic_store(&next, 0);
+
+        ck_assert_int_eq(timeout_set(&t[0], timer_test_order, (void *) 2,
+                                     0, 30000000), 0);
+        ck_assert_int_eq(timeout_set(&t[1], timer_test_order, (void *) 0,
+                                     0, 10000000), 0);
+        ck_assert_int_eq(timeout_set(&t[2], timer_test_order, (void *) 1,
+                                     0, 20000000), 0);
+
+        usleep(70000);
+        ck_assert_int_eq(next, 3);
+        for (int i = 0; i < 3; i++)
+            ck_assert_int_eq(order[i], i);
+    }
+END_TEST
+
+START_TEST (timer_clear_and_restart)
+    {
+        timeout_t cleared = TIMEOUT_INITIALISER, restarted = TIMEOUT_INITIALISER;
+        atomic_store(&fired, 0);
+
+        // Clearing a timeout that was never set does nothing
+        timeout_clear(&cleared);
+
+        ck_assert_int_eq(timeout_set(&cleared, timer_test_count, NULL,
+                                     0, 20000000), 0);
+        ck_assert_int_eq(timeout_set(&restarted, timer_test_count, NULL,
+                                     0, 20000000), 0);
+        timeout_clear(&cleared);
+
+        // Restarting with the original timeout pushes the expiry back
+        usleep(10000);
+        ck_assert_int_eq(timeout_restart(&restarted, -1, -1), 0);
+        usleep(15000);
+        ck_assert_int_eq(fired, 0);
+
+        usleep(40000);
+        ck_assert_int_eq(fired, 1);
+    }
+END_TEST
+
+START_TEST (timer_many)
+    {
+        timeout_t *t = calloc(TIMER_TEST_COUNT, sizeof(timeout_t));
+        atomic_store(&fired, 0);
+
+        // Set them all, then clear every other one before any expire
+        for (int i = 0; i < TIMER_TEST_COUNT; i++)
+            ck_assert_int_eq(timeout_set(&t[i], timer_test_count, NULL, 0,
+                                         20000000 + (i % 17) * 1000000), 0);
+        for (int i = 0; i < TIMER_TEST_COUNT; i += 2)
+            timeout_clear(&t[i]);
+
+        usleep(100000);
+        ck_assert_int_eq(fired, TIMER_TEST_COUNT / 2);
+        free(t);
+    }
+END_TEST
+
+// Run last, as the timer thread can't be started again once stopped
+START_TEST (timer_stop_drops)
+    {
+        timeout_t t = TIMEOUT_INITIALISER;
+        atomic_store(&fired, 0);
+
+        ck_assert_int_eq(timeout_set(&t, timer_test_count, NULL,
+                                     0, 10000000), 0);
+        timer_stop();
+        usleep(30000);
+        ck_assert_int_eq(fired, 0);
+
+        // Neither a second stop nor a new timeout may do anything
+        timer_stop();
+        timeout_clear(&t);
+        ck_assert_int_eq(timeout_set(&t, timer_test_count, NULL, 0, 1), -1);
+        usleep(10000);
+        ck_assert_int_eq(fired, 0);
+    }
+END_TEST
+
+Suite *timer_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Timer");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, timer_fires_in_order);
+    tcase_add_test(tc_core, timer_clear_and_restart);
+    tcase_add_test(tc_core, timer_many);
+    tcase_add_test(tc_core, timer_stop_drops);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(timer_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,152 @@
+#include <check.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include <netstack/time/wheel.h>
+#include <netstack/time/util.h>
+
+struct wheel_test {
+    struct wheel *wheel;
+    struct wheel_timer timer;
+    struct timespec armed, fired;
+    atomic_int count;
+    int rearm;                  // Times the callback re-arms the timer
+};
+
+static void wheel_test_fire(void *arg) {
+    struct wheel_test *test = arg;
+    clock_gettime(CLOCK_MONOTONIC, &test->fired);
+    if (atomic_fetch_add(&test->count, 1) < test->rearm)
+        wheel_arm(test->wheel, &test->timer, mstons(2));
+}
+
+static void wheel_test_arm(struct wheel *wheel, struct wheel_test *test,
+                           uint64_t ns) {
+    test->wheel = wheel;
+    wheel_timer_init(&test->timer, wheel_test_fire, test);
+    clock_gettime(CLOCK_MONOTONIC, &test->armed);
+    ck_assert(!wheel_arm(wheel, &test->timer, ns));
+}
+
+// Milliseconds between arming a timer and it firing
+static uint64_t wheel_test_elapsed(struct wheel_test *test) {
+    struct timespec diff = test->fired;
+    timespecsub(&diff, &test->armed);
+    return nstoms(tstons(&diff, uint64_t));
+}
+
+START_TEST (wheel_fires_in_order)
+    {
+        struct wheel wheel;
+        struct wheel_test tests[3] = {0};
+        ck_assert_int_eq(wheel_init(&wheel), 0);
+
+        // Beyond the first level, so the last is cascaded before it fires
+        wheel_test_arm(&wheel, &tests[0], mstons(30));
+        wheel_test_arm(&wheel, &tests[1], mstons(5));
+        wheel_test_arm(&wheel, &tests[2], mstons(150));
+
+        usleep(250000);
+        for (int i = 0; i < 3; i++) {
+            ck_assert_int_eq(tests[i].count, 1);
+            ck_assert(!wheel_pending(&tests[i].timer));
+        }
+        ck_assert_uint_ge(wheel_test_elapsed(&tests[1]), 5);
+        ck_assert_uint_ge(wheel_test_elapsed(&tests[0]), 30);
+        ck_assert_uint_ge(wheel_test_elapsed(&tests[2]), 150);
+        ck_assert_uint_le(wheel_test_elapsed(&tests[2]), 240);
+
+        wheel_stop(&wheel);
+    }
+END_TEST
+
+START_TEST (wheel_cancel_and_rearm)
+    {
+        struct wheel wheel;
+        struct wheel_test cancelled = {0}, moved = {0};
+        ck_assert_int_eq(wheel_init(&wheel), 0);
+
+        wheel_test_arm(&wheel, &cancelled, mstons(20));
+        wheel_test_arm(&wheel, &moved, mstons(20));
+        ck_assert(wheel_cancel(&wheel, &cancelled.timer));
+        ck_assert(!wheel_cancel(&wheel, &cancelled.timer));
+
+        // Re-arming pushes the expiry back rather than adding another
+        ck_assert(wheel_arm(&wheel, &moved.timer, mstons(80)));
+
+        usleep(50000);
+        ck_assert_int_eq(cancelled.count, 0);
+        ck_assert_int_eq(moved.count, 0);
+
+        usleep(80000);
+        ck_assert_int_eq(cancelled.count, 0);
+        ck_assert_int_eq(moved.count, 1);
+        ck_assert_uint_ge(wheel_test_elapsed(&moved), 80);
+        ck_assert(!wheel_cancel(&wheel, &moved.timer));
+
+        wheel_stop(&wheel);
+    }
+END_TEST
+
+START_TEST (wheel_rearm_from_callback)
+    {
+        struct wheel wheel;
+        struct wheel_test test = {.rearm = 4};
+        ck_assert_int_eq(wheel_init(&wheel), 0);
+
+        wheel_test_arm(&wheel, &test, mstons(1));
+        usleep(100000);
+        ck_assert_int_eq(test.count, 5);
+        ck_assert(!wheel_pending(&test.timer));
+
+        wheel_stop(&wheel);
+    }
+END_TEST
+
+START_TEST (wheel_stop_disarms)
+    {
+        struct wheel wheel;
+        struct wheel_test test = {0};
+        ck_assert_int_eq(wheel_init(&wheel), 0);
+
+        wheel_test_arm(&wheel, &test, sectons((uint64_t) 3600));
+        wheel_stop(&wheel);
+        ck_assert(!wheel_pending(&test.timer));
+        ck_assert_int_eq(test.count, 0);
+
+        // A stopped wheel still takes timers, it just never runs them
+        wheel_test_arm(&wheel, &test, 0);
+        ck_assert(wheel_cancel(&wheel, &test.timer));
+        wheel_stop(&wheel);
+        ck_assert_int_eq(test.count, 0);
+    }
+END_TEST
+
+Suite *wheel_suite(void) {
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Wheel");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, wheel_fires_in_order);
+    tcase_add_test(tc_core, wheel_cancel_and_rearm);
+    tcase_add_test(tc_core, wheel_rearm_from_callback);
+    tcase_add_test(tc_core, wheel_stop_disarms);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int fails;
+    SRunner *sr = srunner_create(wheel_suite());
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (fails == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
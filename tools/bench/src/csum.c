@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <netstack/checksum.h>
+
+/*
+ * Measures in_csum() and in_csum_copy() throughput for each implementation
+ * over lengths from a bare IPv4 header up to a jumbo frame, with the buffers
+ * in cache. memcpy+sum is the separate copy and checksum passes that
+ * in_csum_copy() replaces
+ */
+
+#define BENCH_BYTES     (1L << 28)  /* Octets summed per length, per round */
+#define BENCH_ROUNDS    5
+
+typedef uint16_t (*csum_fn)(const void *, size_t, uint64_t);
+typedef uint16_t (*csum_copy_fn)(void *, const void *, size_t, uint64_t);
+
+static uint8_t *dest;
+static csum_copy_fn copy_fn;
+
+static const size_t lengths[] = { 20, 40, 64, 128, 576, 1460, 1500, 4096, 9000 };
+
+static double elapsed_ns(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 +
+           (end->tv_nsec - start->tv_nsec);
+}
+
+// Best time for one checksum of len octets
+static double bench_run(csum_fn fn, const uint8_t *buf, size_t len) {
+    long iters = BENCH_BYTES / len;
+    volatile uint16_t sink;
+    double best = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (long i = 0; i < iters; i++)
+            sink = fn(buf, len, (uint64_t) i);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double ns = elapsed_ns(&start, &end) / iters;
+        if (round == 0 || ns < best)
+            best = ns;
+    }
+    (void) sink;
+    return best;
+}
+
+static uint16_t bench_copy(const void *buf, size_t len, uint64_t initial) {
+    return copy_fn(dest, buf, len, initial);
+}
+
+static uint16_t bench_memcpy(const void *buf, size_t len, uint64_t initial) {
+    memcpy(dest, buf, len);
+    return in_csum(dest, len, initial);
+}
+
+static void bench_impl(const char *name, csum_fn fn, const uint8_t *buf) {
+    printf("  %-10s", name);
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(*lengths); i++) {
+        double ns = bench_run(fn, buf, lengths[i]);
+        printf(" %5.1f", lengths[i] / ns);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    uint8_t *buf = malloc(9000);
+    for (size_t i = 0; i < 9000; i++)
+        buf[i] = (uint8_t) rand();
+
+    printf("in_csum: GB/s, best of %d rounds\n  %-10s", BENCH_ROUNDS, "length");
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(*lengths); i++)
+        printf(" %5zu", lengths[i]);
+    printf("\n");
+
+    bench_impl("ref", in_csum_ref, buf);
+#if defined(__x86_64__)
+    bench_impl("sse2", in_csum_sse2, buf);
+    if (__builtin_cpu_supports("avx2"))
+        bench_impl("avx2", in_csum_avx2, buf);
+#elif defined(__aarch64__)
+    bench_impl("neon", in_csum_neon, buf);
+#endif
+    bench_impl("in_csum", in_csum, buf);
+
+    dest = malloc(9000);
+    printf("in_csum_copy\n");
+    bench_impl("memcpy+sum", bench_memcpy, buf);
+    copy_fn = in_csum_copy_ref;
+    bench_impl("ref", bench_copy, buf);
+#if defined(__x86_64__)
+    copy_fn = in_csum_copy_sse2;
+    bench_impl("sse2", bench_copy, buf);
+    if (__builtin_cpu_supports("avx2")) {
+        copy_fn = in_csum_copy_avx2;
+        bench_impl("avx2", bench_copy, buf);
+    }
+#elif defined(__aarch64__)
+    copy_fn = in_csum_copy_neon;
+    bench_impl("neon", bench_copy, buf);
+#endif
+
+    free(dest);
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <netstack.h>
+#include <netstack/frame.h>
+#include <netstack/intf/intf.h>
+
+/*
+ * Measures the per-packet cost of frame locking along the receive path:
+ *
+ *   frame_init()               take ownership for writing
+ *   frame_unlock/frame_lock    downgrade to reading for *_recv()
+ *   frame_clone()              packet log clone, read
+ *   frame_decref_unlock() x2   release the clone, then the frame
+ *
+ * The same sequence is run with a pthread_rwlock_t per frame, as every frame
+ * carried before the single-owner model, and with frame_lock() as it is now
+ * compiled (a no-op, or an ownership assertion with NETSTACK_DEBUG_FRAME).
+ */
+
+#define BENCH_PACKETS   2000000
+#define BENCH_ROUNDS    5
+
+static struct intf intf = {
+        .name = "bench",
+        .new_buffer = intf_malloc_buffer,
+        .free_buffer = intf_free_buffer
+};
+
+static double elapsed_ns(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 +
+           (end->tv_nsec - start->tv_nsec);
+}
+
+// Per-packet lock operations with a pthread_rwlock_t per frame
+static void bench_rwlock(void) {
+    for (long i = 0; i < BENCH_PACKETS; i++) {
+        pthread_rwlock_t lock, clone_lock;
+        struct frame *frame = frame_init(&intf, NULL, 0);
+        pthread_rwlock_init(&lock, NULL);
+        pthread_rwlock_wrlock(&lock);
+
+        struct frame *clone = frame_clone(frame, SHARED_RD);
+        pthread_rwlock_init(&clone_lock, NULL);
+        pthread_rwlock_rdlock(&clone_lock);
+
+        pthread_rwlock_unlock(&lock);
+        pthread_rwlock_rdlock(&lock);
+
+        pthread_rwlock_unlock(&clone_lock);
+        frame_decref_unlock(clone);
+        pthread_rwlock_unlock(&lock);
+        frame_decref_unlock(frame);
+
+        pthread_rwlock_destroy(&clone_lock);
+        pthread_rwlock_destroy(&lock);
+    }
+}
+
+// The same sequence with the single-owner model
+static void bench_owner(void) {
+    for (long i = 0; i < BENCH_PACKETS; i++) {
+        struct frame *frame = frame_init(&intf, NULL, 0);
+        struct frame *clone = frame_clone(frame, SHARED_RD);
+
+        frame_unlock(frame);
+        frame_lock(frame, SHARED_RD);
+
+        frame_decref_unlock(clone);
+        frame_decref_unlock(frame);
+    }
+}
+
+static double bench_run(void (*fn)(void)) {
+    double best = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        fn();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double ns = elapsed_ns(&start, &end) / BENCH_PACKETS;
+        if (round == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    if (frame_pool_init() < 0) {
+        fprintf(stderr, "Failed to create the frame pool\n");
+        return EXIT_FAILURE;
+    }
+
+    double rwlock = bench_run(bench_rwlock);
+    double owner = bench_run(bench_owner);
+
+    printf("frame_lock: %d packets, best of %d rounds\n",
+           BENCH_PACKETS, BENCH_ROUNDS);
+    printf("  per-frame rwlock   %7.1f ns/packet\n", rwlock);
+#ifdef NETSTACK_DEBUG_FRAME
+    printf("  owner (debug)      %7.1f ns/packet\n", owner);
+#else
+    printf("  owner              %7.1f ns/packet\n", owner);
+#endif
+    printf("  saving             %7.1f ns/packet (%.0f%%)\n",
+           rwlock - owner, 100 * (rwlock - owner) / rwlock);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <netstack/inet.h>
+#include <netstack/lock/epoch.h>
+
+/*
+ * Measures socket lookup throughput as the number of receive threads grows,
+ * whilst another thread keeps adding and removing sockets as socket() and
+ * close() would. Each lookup is either an epoch read-side section, as
+ * tcp_ipv4_recv() does it now, or serialised on a single mutex, as every
+ * lookup was when sockets were kept in the tcp_sockets list.
+ *
+ * Usage: sock_lookup [max threads]
+ */
+
+#define BENCH_SOCKS     4096
+#define BENCH_LOOKUPS   2000000     /* Per thread */
+#define BENCH_ROUNDS    3
+
+static struct inet_socktbl tbl = INET_SOCKTBL_INITIALISER;
+static struct inet_sock socks[BENCH_SOCKS];
+static pthread_mutex_t lookup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start;
+static atomic_bool stop;
+static bool locked;
+
+static double elapsed_ns(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 +
+           (end->tv_nsec - start->tv_nsec);
+}
+
+static void bench_sock(struct inet_sock *sock, int i) {
+    sock->remaddr = (addr_t) {.proto = PROTO_IPV4, .ipv4 = 0x0a000100 + i % 251};
+    sock->locaddr = (addr_t) {.proto = PROTO_IPV4, .ipv4 = 0x0a000001};
+    sock->remport = (uint16_t) (1024 + i);
+    sock->locport = 80;
+}
+
+static void *bench_reader(void *arg) {
+    unsigned int seed = (unsigned int) (uintptr_t) arg;
+    long found = 0;
+
+    pthread_barrier_wait(&start);
+    for (long n = 0; n < BENCH_LOOKUPS; n++) {
+        struct inet_sock *want = &socks[rand_r(&seed) % BENCH_SOCKS];
+        if (locked) {
+            pthread_mutex_lock(&lookup_lock);
+            found += inet_sock_lookup(&tbl, &want->remaddr, &want->locaddr,
+                                      want->remport, want->locport) != NULL;
+            pthread_mutex_unlock(&lookup_lock);
+        } else {
+            epoch_enter();
+            found += inet_sock_lookup(&tbl, &want->remaddr, &want->locaddr,
+                                      want->remport, want->locport) != NULL;
+            epoch_exit();
+        }
+    }
+
+    if (found != BENCH_LOOKUPS)
+        fprintf(stderr, "Only %ld of %d lookups succeeded\n",
+                found, BENCH_LOOKUPS);
+    return NULL;
+}
+
+// Opens and closes connections next to the ones being looked up
+static void *bench_writer(void *arg) {
+    int i = 0;
+    while (!atomic_load(&stop)) {
+        struct inet_sock *sock = calloc(1, sizeof(struct inet_sock));
+        bench_sock(sock, BENCH_SOCKS + i++ % 1024);
+        sock->locport = 8080;
+        if (locked)
+            pthread_mutex_lock(&lookup_lock);
+        inet_sock_hash(&tbl, sock);
+        inet_sock_unhash(&tbl, sock);
+        if (locked)
+            pthread_mutex_unlock(&lookup_lock);
+        epoch_defer(free, sock);
+    }
+    return NULL;
+}
+
+// Best aggregate lookup rate with count reader threads, in millions/sec
+static double bench_run(int count) {
+    double best = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        pthread_t readers[count], writer;
+        struct timespec t0, t1;
+
+        pthread_barrier_init(&start, NULL, count + 1);
+        atomic_store(&stop, false);
+        pthread_create(&writer, NULL, bench_writer, NULL);
+        for (int i = 0; i < count; i++)
+            pthread_create(&readers[i], NULL, bench_reader,
+                           (void *) (uintptr_t) (i + 1));
+
+        pthread_barrier_wait(&start);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < count; i++)
+            pthread_join(readers[i], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        atomic_store(&stop, true);
+        pthread_join(writer, NULL);
+        pthread_barrier_destroy(&start);
+
+        double rate = (double) count * BENCH_LOOKUPS * 1e3 /
+                      elapsed_ns(&t0, &t1);
+        if (rate > best)
+            best = rate;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    long max = argc > 1 ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (max < 1)
+        max = 1;
+
+    for (int i = 0; i < BENCH_SOCKS; i++) {
+        bench_sock(&socks[i], i);
+        inet_sock_hash(&tbl, &socks[i]);
+    }
+
+    printf("sock_lookup: %d sockets, %d lookups per thread, best of %d "
+           "rounds\n", BENCH_SOCKS, BENCH_LOOKUPS, BENCH_ROUNDS);
+    printf("  threads        mutex      epoch   (Mlookups/s)\n");
+    for (int count = 1; count <= max; count++) {
+        locked = true;
+        double mutex = bench_run(count);
+        locked = false;
+        double epoch = bench_run(count);
+        printf("  %7d   %10.2f %10.2f\n", count, mutex, epoch);
+    }
+
+    inet_socktbl_free(&tbl);
+    epoch_barrier();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+
+#include <netstack/time/timer.h>
+
+/*
+ * Measures how fast timeouts can be set and cleared with the timerfd backend
+ * behind timeout_set(), against a POSIX timer per timeout delivering a signal,
+ * which is what timeout_set() used to create. Timeouts are set far enough in
+ * the future that none expire, as with ARP timeouts cleared by a reply.
+ *
+ * Usage: timeout [timeouts]
+ */
+
+#define BENCH_TIMEOUTS  10000
+#define BENCH_ROUNDS    5
+
+static double elapsed_ns(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 +
+           (end->tv_nsec - start->tv_nsec);
+}
+
+static void bench_expire(void *arg) {
+    fprintf(stderr, "Timeout expired during the benchmark\n");
+}
+
+static void bench_signal(int sig, siginfo_t *si, void *uc) {
+    bench_expire(NULL);
+}
+
+// Sets and then clears count timeouts, returning the best ns per set + clear
+static double bench_timeout(timeout_t *t, long count) {
+    double best = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        // Latest first, so each timeout becomes the earliest one
+        for (long i = 0; i < count; i++)
+            timeout_set(&t[i], bench_expire, NULL, 60 + count - i, 0);
+        for (long i = 0; i < count; i++)
+            timeout_clear(&t[i]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double ns = elapsed_ns(&start, &end) / count;
+        if (round == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+static double bench_posix(timer_t *timers, long count) {
+    double best = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (long i = 0; i < count; i++) {
+            struct sigaction sa = { .sa_flags = SA_SIGINFO,
+                                    .sa_sigaction = bench_signal };
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGUSR1, &sa, NULL);
+
+            struct sigevent te = { .sigev_notify = SIGEV_SIGNAL,
+                                   .sigev_signo = SIGUSR1 };
+            struct itimerspec its = { .it_value.tv_sec = 60 + count - i };
+            timer_create(CLOCK_MONOTONIC, &te, &timers[i]);
+            timer_settime(timers[i], 0, &its, NULL);
+        }
+        for (long i = 0; i < count; i++)
+            timer_delete(timers[i]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double ns = elapsed_ns(&start, &end) / count;
+        if (round == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    long count = argc > 1 ? atol(argv[1]) : BENCH_TIMEOUTS;
+    if (count < 1)
+        count = 1;
+
+    timeout_t *t = calloc((size_t) count, sizeof(timeout_t));
+    timer_t *timers = calloc((size_t) count, sizeof(timer_t));
+
+    printf("timeout: %ld timeouts set then cleared, best of %d rounds\n",
+           count, BENCH_ROUNDS);
+    double fd = bench_timeout(t, count);
+    double posix = bench_posix(timers, count);
+    printf("  %-16s %10.1f ns %10.2f Mops/s\n", "timerfd heap", fd, 1e3 / fd);
+    printf("  %-16s %10.1f ns %10.2f Mops/s\n", "posix signal", posix,
+           1e3 / posix);
+
+    free(t);
+    free(timers);
+    return EXIT_SUCCESS;
+}
@@ -4,6 +4,7 @@
 #include <netdb.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #include <sys/wait.h>
 
@@ -13,6 +14,8 @@
 #include <netstack/inet/route.h>
 #include <netstack/tcp/tcp.h>
 #include <netstack/intf/rawsock.h>
+#include <netstack/intf/tpacket.h>
+#include <netstack/intf/xdp.h>
 
 // TODO: Add many configurable interfaces
 // TODO: Add loopback interface
@@ -22,19 +25,43 @@ static struct netstack instance;
 int main(int argc, char **argv) {
 
     // Initialise config & netstack internals
-    netstack_init(&instance);
+    if (netstack_init(&instance) < 0)
+        exit(EXIT_FAILURE);
 
     // Check for effective CAP_NET_RAW,CAP_NET_ADMIN capabilities
     if (netstack_checkcap(argv[0]))
         exit(EXIT_FAILURE);
 
     // TODO: Take interface etc. configuration from config file
+    int (*intf_new)(struct intf *) = rawsock_new;
+    char *intf_type = "rawsock";
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+            case 't':
+                intf_type = optarg;
+                if (!strcmp(optarg, "rawsock"))
+                    intf_new = rawsock_new;
+                else if (!strcmp(optarg, "tpacket"))
+                    intf_new = tpacket_new;
+                else if (!strcmp(optarg, "xdp"))
+                    intf_new = xdp_new;
+                else {
+                    LOG(LCRIT, "Unknown interface type %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t rawsock|tpacket|xdp]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
 
-    // Create a INTF_RAWSOCK interface for sending/recv'ing data
+    // Create an interface for sending/recv'ing data
     int err;
     struct intf *intf = calloc(sizeof(struct intf), 1);
-    if (rawsock_new(intf) != 0) {
-        LOG(LCRIT, "Could not create INTF_RAWSOCK");
+    if (intf_new(intf) != 0) {
+        LOG(LCRIT, "Could not create %s interface", intf_type);
         exit(EXIT_FAILURE);
     }
     llist_append(&instance.interfaces, intf);
@@ -24,7 +24,8 @@ void premain(int argc, char *argv[]) {
     // TODO: Parse config based on argv/configuration file
 
     // Initialise the netstack instance
-    netstack_init(&instance);
+    if (netstack_init(&instance) < 0)
+        LOG(LCRIT, "netstack failed to initialise");
 
     LOG(LINFO, "netstack v%s loaded, via libnshook", NETSTACK_VERSION);
 }